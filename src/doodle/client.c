@@ -0,0 +1,232 @@
+/*
+     This file is part of doodle.
+     (C) 2026 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/client.c
+ * @brief messages exchanged between doodle and doodle-server
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include "client.h"
+#include "helper2.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+static int writeAll(int sock,
+		    const void * buf,
+		    size_t len) {
+  size_t pos;
+  ssize_t ret;
+
+  pos = 0;
+  while (pos < len) {
+    ret = write(sock,
+		&((const char*) buf)[pos],
+		len - pos);
+    if (ret == -1) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    pos += ret;
+  }
+  return 0;
+}
+
+static int readAll(int sock,
+		   void * buf,
+		   size_t len) {
+  size_t pos;
+  ssize_t ret;
+
+  pos = 0;
+  while (pos < len) {
+    ret = read(sock,
+	       &((char*) buf)[pos],
+	       len - pos);
+    if (ret == -1) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    if (ret == 0)
+      return -1; /* connection closed */
+    pos += ret;
+  }
+  return 0;
+}
+
+int sendMessage(int sock,
+		unsigned int type,
+		const void * payload,
+		unsigned int size) {
+  unsigned int hdr[2];
+
+  if (size > DOODLE_MAX_MESSAGE)
+    return -1;
+  hdr[0] = htonl(size);
+  hdr[1] = htonl(type);
+  if (-1 == writeAll(sock,
+		     hdr,
+		     sizeof(hdr)))
+    return -1;
+  if (size == 0)
+    return 0;
+  return writeAll(sock,
+		  payload,
+		  size);
+}
+
+char * receiveMessage(int sock,
+		      unsigned int * type,
+		      unsigned int * size) {
+  unsigned int hdr[2];
+  char * ret;
+
+  if (-1 == readAll(sock,
+		    hdr,
+		    sizeof(hdr)))
+    return NULL;
+  *size = ntohl(hdr[0]);
+  *type = ntohl(hdr[1]);
+  if (*size > DOODLE_MAX_MESSAGE)
+    return NULL;
+  ret = MALLOC(*size + 1);
+  if (-1 == readAll(sock,
+		    ret,
+		    *size)) {
+    free(ret);
+    return NULL;
+  }
+  ret[*size] = '\0';
+  return ret;
+}
+
+int connectToServer() {
+  struct sockaddr_un addr;
+  const char * name;
+  char * ename;
+  int sock;
+
+  name = getenv("DOODLE_SOCKET");
+  if (name == NULL)
+    name = DOODLE_SOCKET_NAME;
+  ename = expandFileName(name);
+  if (ename == NULL)
+    return -1;
+  if (strlen(ename) >= sizeof(addr.sun_path)) {
+    free(ename);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, ename);
+  free(ename);
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1)
+    return -1;
+  if (0 != connect(sock,
+		   (struct sockaddr*) &addr,
+		   sizeof(addr))) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+int searchServer(int sock,
+		 const char * database,
+		 const char * query,
+		 unsigned int approx,
+		 int ignore_case,
+		 DOODLE_ResultCallback callback,
+		 void * arg) {
+  DOODLE_FileInfo fi;
+  unsigned int dlen;
+  unsigned int qlen;
+  unsigned int size;
+  unsigned int type;
+  unsigned int val;
+  char * msg;
+  int ret;
+
+  dlen = strlen(database) + 1;
+  qlen = strlen(query) + 1;
+  if (2 * sizeof(unsigned int) + dlen + qlen > DOODLE_MAX_MESSAGE)
+    return -1;
+  msg = MALLOC(2 * sizeof(unsigned int) + dlen + qlen);
+  val = htonl(approx);
+  memcpy(msg, &val, sizeof(unsigned int));
+  val = htonl(ignore_case ? 1 : 0);
+  memcpy(&msg[sizeof(unsigned int)], &val, sizeof(unsigned int));
+  memcpy(&msg[2 * sizeof(unsigned int)], database, dlen);
+  memcpy(&msg[2 * sizeof(unsigned int) + dlen], query, qlen);
+  ret = sendMessage(sock,
+		    DOODLE_MSG_SEARCH,
+		    msg,
+		    2 * sizeof(unsigned int) + dlen + qlen);
+  free(msg);
+  if (ret == -1)
+    return -1;
+  while (1) {
+    msg = receiveMessage(sock,
+			 &type,
+			 &size);
+    if (msg == NULL)
+      return -1;
+    switch (type) {
+    case DOODLE_MSG_RESULT:
+      if (size <= sizeof(unsigned int)) {
+	free(msg);
+	return -1;
+      }
+      memcpy(&val, msg, sizeof(unsigned int));
+      fi.mod_time = ntohl(val);
+      fi.filename = &msg[sizeof(unsigned int)];
+      if (callback != NULL)
+	callback(&fi, arg);
+      break;
+    case DOODLE_MSG_DONE:
+      if (size != sizeof(unsigned int)) {
+	free(msg);
+	return -1;
+      }
+      memcpy(&val, msg, sizeof(unsigned int));
+      free(msg);
+      return (int) ntohl(val);
+    case DOODLE_MSG_UNKNOWN_DB:
+      free(msg);
+      return -2;
+    default:
+      free(msg);
+      return -1;
+    }
+    free(msg);
+  }
+}
+
+/* end of client.c */
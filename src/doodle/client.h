@@ -0,0 +1,125 @@
+/*
+     This file is part of doodle.
+     (C) 2026 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/client.h
+ * @brief protocol between doodle and doodle-server
+ * @author Christian Grothoff
+ *
+ * All messages start with the size of the payload and the
+ * type of the message (both 32 bit, network byte order).  A
+ * client sends SEARCH messages; the server answers each with
+ * a RESULT message per matching file followed by DONE (or
+ * with UNKNOWN_DB or ERROR).
+ */
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "doodle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default name of the socket of doodle-server (can be
+ * overridden with the environment variable DOODLE_SOCKET).
+ */
+#define DOODLE_SOCKET_NAME "~/.doodle-socket"
+
+/**
+ * Maximum size of the payload of a message.
+ */
+#define DOODLE_MAX_MESSAGE 65536
+
+/**
+ * Search request: approx (32 bit), ignore_case (32 bit), the
+ * (expanded) filename of the database and the search string
+ * (both 0-terminated).
+ */
+#define DOODLE_MSG_SEARCH 1
+
+/**
+ * Matching file: modification time (32 bit), filename (0-terminated).
+ */
+#define DOODLE_MSG_RESULT 2
+
+/**
+ * End of the results of a search: number of results (32 bit).
+ */
+#define DOODLE_MSG_DONE 3
+
+/**
+ * The server does not serve the requested database (no payload).
+ */
+#define DOODLE_MSG_UNKNOWN_DB 4
+
+/**
+ * The search failed (no payload).
+ */
+#define DOODLE_MSG_ERROR 5
+
+/**
+ * Send a message.
+ * @return 0 on success, -1 on error
+ */
+int sendMessage(int sock,
+		unsigned int type,
+		const void * payload,
+		unsigned int size);
+
+/**
+ * Receive a message.
+ * @param type set to the type of the message
+ * @param size set to the size of the payload
+ * @return the payload (caller must free, 0-terminated for
+ *   convenience), NULL on error
+ */
+char * receiveMessage(int sock,
+		      unsigned int * type,
+		      unsigned int * size);
+
+/**
+ * Connect to doodle-server.
+ * @return the socket, -1 if the server is not running
+ */
+int connectToServer();
+
+/**
+ * Search with the help of doodle-server.
+ *
+ * @param database expanded filename of the database
+ * @return -1 on error (connection problem), -2 if the server
+ *   does not serve that database, otherwise the number of results
+ */
+int searchServer(int sock,
+		 const char * database,
+		 const char * query,
+		 unsigned int approx,
+		 int ignore_case,
+		 DOODLE_ResultCallback callback,
+		 void * arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,762 @@
+/*
+     This file is part of doodle.
+     (C) 2026 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/doodle-server.c
+ * @brief search server that keeps doodle databases open
+ * @author Christian Grothoff
+ *
+ * doodle-server opens the databases once (read-only) and answers
+ * the searches of doodle over a Unix domain socket (see client.h
+ * for the protocol).  This way, doodle does not have to open the
+ * database (and load the filenames and the top of the tree) for
+ * every search.  If a database is replaced (i.e. by doodle -b),
+ * the server re-opens it before the next search.  Each client is
+ * served by its own thread; searches in the same database are
+ * serialized and the results are sent after the database was
+ * released, so a slow client does not hold up the others.
+ */
+
+#include "config.h"
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <locale.h>
+#include "doodle.h"
+#include "gettext.h"
+#include "getopt.h"
+#include "helper2.h"
+#include "client.h"
+#include "semaphore.h"
+#include "shutdown.h"
+
+/**
+ * How long do we wait for a client to send its next
+ * request (in seconds) before we close the connection?
+ */
+#define CLIENT_TIMEOUT 5
+
+/**
+ * How many clients do we serve at the same time?  Further
+ * connections wait in the listen queue.
+ */
+#define MAX_CLIENTS 32
+
+static int verbose = 0;
+static int very_verbose = 0;
+static int do_debug = 0;
+
+/**
+ * Print the doodle-server-specific text for --help.
+ */
+static void printHelp () {
+  static Help help[] = {
+    { 'd', "database", "FILENAME",
+      gettext_noop("serve the database(s) FILENAME (colon-separated list)") },
+    { 'D', "debug", NULL,
+      gettext_noop("run in debug mode, do not daemonize") },
+    { 'h', "help", NULL,
+      gettext_noop("print this help page") },
+    { 'j', "threads", "COUNT",
+      gettext_noop("use COUNT threads for approximate searches and searches with many results") },
+    { 'L', "log", "FILENAME",
+      gettext_noop("log activity to a file named FILENAME") },
+    { 'm', "memory", "SIZE",
+      gettext_noop("set the memory limit to SIZE MB (for each tree).") },
+    { 's', "socket", "FILENAME",
+      gettext_noop("listen on the Unix domain socket FILENAME") },
+    { 'v', "version", NULL,
+      gettext_noop("print the version number") },
+    { 'V', "verbose", NULL,
+      gettext_noop("be verbose") },
+    { 0, NULL, NULL, NULL },
+  };
+  formatHelp(_("doodle-server [OPTIONS]"),
+	     _("Keep doodle databases open and answer searches."),
+	     help);
+}
+
+/**
+ * Print log-messages to the logfile.
+ */
+static void my_log(void * ctx,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  FILE * logfile = ctx;
+  va_list args;
+  if (logfile == NULL) {
+    if (do_debug)
+      logfile = stderr;
+    else
+      return; /* no logfile? no logging! */
+  }
+  if ( (level == 0) ||
+       (verbose && (level == 1)) ||
+       (very_verbose && (level == 2) ) ) {
+    va_start(args, msg);
+    vfprintf(logfile, msg, args);
+    va_end(args);
+    fflush(logfile);
+  }
+}
+
+/**
+ * @brief a database served by doodle-server
+ */
+typedef struct {
+  /* expanded filename */
+  char * ename;
+  /* the tree, NULL if the database could not be opened */
+  struct DOODLE_SuffixTree * tree;
+  /* identity of the file when we opened it */
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  /* serializes the searches (and re-opening) */
+  Mutex lock;
+} ServedDB;
+
+/**
+ * @brief closure for addResult: the result messages
+ *  of one search (modification time and filename each),
+ *  sent once the database was released
+ */
+typedef struct {
+  char * buf;
+  unsigned int size;
+  unsigned int pos;
+} ResultContext;
+
+/**
+ * @brief argument of clientMain
+ */
+typedef struct {
+  int sock;
+  ServedDB * dbs;
+  unsigned int dbCount;
+} ClientContext;
+
+static FILE * logfile;
+
+static size_t mem_limit;
+
+/* free slots for client threads */
+static Semaphore * clientSlots;
+
+/* number of threads per search */
+static unsigned int threads = 1;
+
+/**
+ * Make sure that the tree for the given database is open
+ * and up-to-date (re-open it if the file was replaced).
+ * @return 0 on success, -1 on error
+ */
+static int refreshDB(ServedDB * db) {
+  struct stat buf;
+
+  if (0 != stat(db->ename, &buf)) {
+    my_log(logfile,
+	   DOODLE_LOG_CRITICAL,
+	   _("Call to '%s' for file '%s' failed: %s.\n"),
+	   "stat",
+	   db->ename,
+	   strerror(errno));
+    return -1;
+  }
+  if ( (db->tree != NULL) &&
+       (db->dev == buf.st_dev) &&
+       (db->ino == buf.st_ino) &&
+       (db->mtime == buf.st_mtime) )
+    return 0;
+  if (db->tree != NULL) {
+    my_log(logfile,
+	   DOODLE_LOG_VERBOSE,
+	   _("Database '%s' changed, re-opening it.\n"),
+	   db->ename);
+    DOODLE_tree_destroy(db->tree);
+  }
+  db->tree = DOODLE_tree_open_RDONLY(&my_log,
+				     logfile,
+				     db->ename);
+  if (db->tree == NULL)
+    return -1;
+  /* do not block updates of the database */
+  DOODLE_tree_release_lock(db->tree);
+  if (mem_limit != 0)
+    DOODLE_tree_set_memory_limit(db->tree,
+				 mem_limit);
+  if ( (threads > 1) &&
+       (0 != DOODLE_tree_set_threads(db->tree,
+				     threads)) )
+    my_log(logfile,
+	   DOODLE_LOG_VERBOSE,
+	   _("Searching database '%s' with a single thread.\n"),
+	   db->ename);
+  db->dev = buf.st_dev;
+  db->ino = buf.st_ino;
+  db->mtime = buf.st_mtime;
+  return 0;
+}
+
+static void addResult(const DOODLE_FileInfo * fileinfo,
+		      ResultContext * rc) {
+  unsigned int len;
+  unsigned int val;
+
+  len = strlen(fileinfo->filename) + 1;
+  if (len + sizeof(unsigned int) > DOODLE_MAX_MESSAGE)
+    return;
+  if (rc->pos + len + sizeof(unsigned int) > rc->size)
+    GROW(rc->buf,
+	 rc->size,
+	 rc->size * 2 + len + sizeof(unsigned int));
+  val = htonl(fileinfo->mod_time);
+  memcpy(&rc->buf[rc->pos], &val, sizeof(unsigned int));
+  memcpy(&rc->buf[rc->pos + sizeof(unsigned int)], fileinfo->filename, len);
+  rc->pos += len + sizeof(unsigned int);
+}
+
+/**
+ * Send the results collected by addResult to the client.
+ * @return 0 on success, -1 on error (client gone)
+ */
+static int sendResults(int sock,
+		       const ResultContext * rc) {
+  unsigned int pos;
+  unsigned int len;
+
+  pos = 0;
+  while (pos < rc->pos) {
+    len = strlen(&rc->buf[pos + sizeof(unsigned int)]) + 1 + sizeof(unsigned int);
+    if (-1 == sendMessage(sock,
+			  DOODLE_MSG_RESULT,
+			  &rc->buf[pos],
+			  len))
+      return -1;
+    pos += len;
+  }
+  return 0;
+}
+
+/**
+ * Process the requests of a client until it closes
+ * the connection.
+ */
+static void handleClient(int sock,
+			 ServedDB * dbs,
+			 unsigned int dbCount) {
+  ResultContext rc;
+  unsigned int size;
+  unsigned int type;
+  unsigned int approx;
+  unsigned int ignore_case;
+  unsigned int val;
+  unsigned int i;
+  const char * database;
+  const char * query;
+  char * msg;
+  int ret;
+
+  memset(&rc, 0, sizeof(ResultContext));
+  while (NULL != (msg = receiveMessage(sock,
+				       &type,
+				       &size))) {
+    if ( (type != DOODLE_MSG_SEARCH) ||
+	 (size < 2 * sizeof(unsigned int) + 2) ||
+	 (msg[size-1] != '\0') ||
+	 (strlen(&msg[2 * sizeof(unsigned int)]) + 2 * sizeof(unsigned int) + 1 >= size) ) {
+      my_log(logfile,
+	     DOODLE_LOG_CRITICAL,
+	     _("Received malformed request from client.\n"));
+      sendMessage(sock, DOODLE_MSG_ERROR, NULL, 0);
+      free(msg);
+      break;
+    }
+    memcpy(&val, msg, sizeof(unsigned int));
+    approx = ntohl(val);
+    memcpy(&val, &msg[sizeof(unsigned int)], sizeof(unsigned int));
+    ignore_case = ntohl(val);
+    database = &msg[2 * sizeof(unsigned int)];
+    query = &database[strlen(database) + 1];
+    for (i=0;i<dbCount;i++)
+      if (0 == strcmp(database,
+		      dbs[i].ename))
+	break;
+    if (i < dbCount)
+      MUTEX_LOCK(&dbs[i].lock);
+    if ( (i == dbCount) ||
+	 (-1 == refreshDB(&dbs[i])) ) {
+      if (i < dbCount)
+	MUTEX_UNLOCK(&dbs[i].lock);
+      free(msg);
+      if (-1 == sendMessage(sock, DOODLE_MSG_UNKNOWN_DB, NULL, 0))
+	break;
+      continue;
+    }
+    my_log(logfile,
+	   DOODLE_LOG_VERY_VERBOSE,
+	   _("Searching for '%s' in '%s'.\n"),
+	   query,
+	   database);
+    rc.pos = 0;
+    if ( (approx == 0) &&
+	 (ignore_case == 0) )
+      ret = DOODLE_tree_search(dbs[i].tree,
+			       query,
+			       (DOODLE_ResultCallback) &addResult,
+			       &rc);
+    else
+      ret = DOODLE_tree_search_approx(dbs[i].tree,
+				      approx,
+				      ignore_case != 0,
+				      query,
+				      (DOODLE_ResultCallback) &addResult,
+				      &rc);
+    MUTEX_UNLOCK(&dbs[i].lock);
+    free(msg);
+    if (-1 == sendResults(sock,
+			  &rc))
+      break;
+    if (ret == -1) {
+      if (-1 == sendMessage(sock, DOODLE_MSG_ERROR, NULL, 0))
+	break;
+      continue;
+    }
+    val = htonl(ret);
+    if (-1 == sendMessage(sock,
+			  DOODLE_MSG_DONE,
+			  &val,
+			  sizeof(unsigned int)))
+      break;
+  }
+  if (rc.buf != NULL)
+    free(rc.buf);
+}
+
+/**
+ * Main method of the thread serving one client.
+ */
+static void * clientMain(ClientContext * cc) {
+  handleClient(cc->sock,
+	       cc->dbs,
+	       cc->dbCount);
+  close(cc->sock);
+  free(cc);
+  SEMAPHORE_UP(clientSlots);
+  return NULL;
+}
+
+/**
+ * Remove the socket left behind by a previous doodle-server that
+ * did not shut down properly.  Files that are not sockets and the
+ * socket of a server that is still running are left alone.
+ *
+ * @return 0 if the name can be used now, -1 if not (errno is set)
+ */
+static int removeStaleSocket(const struct sockaddr_un * addr) {
+  struct stat sbuf;
+  int sock;
+  int ret;
+
+  if (0 != lstat(addr->sun_path, &sbuf))
+    return (errno == ENOENT) ? 0 : -1;
+  if (! S_ISSOCK(sbuf.st_mode)) {
+    errno = EEXIST;
+    return -1;
+  }
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1)
+    return -1;
+  ret = connect(sock,
+		(const struct sockaddr*) addr,
+		sizeof(struct sockaddr_un));
+  close(sock);
+  if (ret == 0) {
+    errno = EADDRINUSE; /* another server is listening */
+    return -1;
+  }
+  if (errno != ECONNREFUSED)
+    return -1;
+  return unlink(addr->sun_path);
+}
+
+/**
+ * Accept connections and answer searches until we are
+ * asked to shut down.
+ */
+static int serve(const char * socketName,
+		 ServedDB * dbs,
+		 unsigned int dbCount) {
+  struct sockaddr_un addr;
+  struct timeval tv;
+  fd_set rs;
+  ClientContext * cc;
+  PTHREAD_T thread;
+  mode_t mask;
+  int lsock;
+  int sock;
+  int ret;
+  int i;
+
+  if (strlen(socketName) >= sizeof(addr.sun_path)) {
+    my_log(logfile,
+	   DOODLE_LOG_CRITICAL,
+	   _("Socket name '%s' is too long.\n"),
+	   socketName);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketName);
+  lsock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lsock == -1) {
+    my_log(logfile,
+	   DOODLE_LOG_CRITICAL,
+	   _("Call to '%s' failed: %s\n"),
+	   "socket",
+	   strerror(errno));
+    return -1;
+  }
+  ret = removeStaleSocket(&addr);
+  if (ret == 0) {
+    /* the socket must never be accessible for other users,
+       not even between bind and chmod */
+    mask = umask(S_IRWXG | S_IRWXO);
+    ret = bind(lsock,
+	       (struct sockaddr*) &addr,
+	       sizeof(addr));
+    umask(mask);
+  }
+  if ( (0 != ret) ||
+       (0 != chmod(socketName,
+		   S_IRUSR | S_IWUSR)) ||
+       (0 != listen(lsock, 16)) ) {
+    my_log(logfile,
+	   DOODLE_LOG_CRITICAL,
+	   _("Could not listen on '%s': %s\n"),
+	   socketName,
+	   strerror(errno));
+    close(lsock);
+    return -1;
+  }
+  my_log(logfile,
+	 DOODLE_LOG_VERBOSE,
+	 _("doodle-server listening on '%s'.\n"),
+	 socketName);
+  while (0 == testShutdown()) {
+    FD_ZERO(&rs);
+    FD_SET(lsock, &rs);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if (0 >= select(lsock + 1, &rs, NULL, NULL, &tv))
+      continue; /* timeout or signal, check for shutdown */
+    sock = accept(lsock, NULL, NULL);
+    if (sock == -1)
+      continue;
+    /* do not let an idle client hold a thread forever */
+    tv.tv_sec = CLIENT_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(sock,
+	       SOL_SOCKET,
+	       SO_RCVTIMEO,
+	       &tv,
+	       sizeof(tv));
+    setsockopt(sock,
+	       SOL_SOCKET,
+	       SO_SNDTIMEO,
+	       &tv,
+	       sizeof(tv));
+    SEMAPHORE_DOWN(clientSlots);
+    cc = MALLOC(sizeof(ClientContext));
+    cc->sock = sock;
+    cc->dbs = dbs;
+    cc->dbCount = dbCount;
+    i = PTHREAD_CREATE(&thread,
+		       (PThreadMain) &clientMain,
+		       cc,
+		       256 * 1024);
+    if (i != 0) {
+      my_log(logfile,
+	     DOODLE_LOG_CRITICAL,
+	     _("Call to '%s' failed: %s\n"),
+	     "pthread_create",
+	     strerror(i));
+      /* serve this client ourselves */
+      clientMain(cc);
+      continue;
+    }
+    PTHREAD_DETACH(&thread);
+  }
+  close(lsock);
+  /* wait for the clients that are still being served */
+  for (i=0;i<MAX_CLIENTS;i++)
+    SEMAPHORE_DOWN(clientSlots);
+  for (i=0;i<MAX_CLIENTS;i++)
+    SEMAPHORE_UP(clientSlots);
+  unlink(socketName);
+  return 0;
+}
+
+/**
+ * Fork and start a new session to go into the background
+ * in the way a good deamon should.  Code from gnunetd.
+ *
+ * @param filedes pointer to an array of 2 file descriptors
+ *        to complete the detachment protocol (handshake)
+ */
+static void detachFromTerminal(int * filedes) {
+  pid_t pid;
+  int nullfd;
+
+  /* Don't hold the wrong FS mounted */
+  if (chdir("/") < 0) {
+    perror("chdir");
+    exit(1);
+  }
+  if (0 != pipe(filedes)) {
+    perror("pipe");
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid) {  /* Parent */
+    int ok;
+    char c;
+
+    close(filedes[1]); /* we only read */
+    ok = -1;
+    while (0 < read(filedes[0], &c, sizeof(char))) {
+      if (c == '.')
+	ok = 0;
+    }
+    fflush(stdout);
+    if (ok == 0)
+      exit(0);
+    else
+      exit(1); /* child reported error */
+  }
+  close(filedes[0]); /* we only write */
+  nullfd = open("/dev/null",
+		O_CREAT | O_RDWR | O_APPEND, S_IWUSR | S_IRUSR);
+  if (nullfd < 0) {
+    perror("/dev/null");
+    exit(1);
+  }
+  if (dup2(nullfd,0) < 0 ||
+      dup2(nullfd,1) < 0 ||
+      dup2(nullfd,2) < 0) {
+    perror("dup2"); /* Should never happen */
+    exit(1);
+  }
+  setsid(); /* Detach from controlling terminal */
+}
+
+static void detachFromTerminalComplete(int * filedes) {
+  char c = '.';
+
+  if (1 != write(filedes[1], &c, sizeof(char))) /* signal success */
+    perror("write");
+  close(filedes[1]);
+}
+
+int main(int argc,
+	 char * argv[]) {
+  int c;
+  int option_index;
+  char * dbName;
+  char * socketName;
+  char * esocketName;
+  char * name;
+  char * log = NULL;
+  ServedDB * dbs;
+  unsigned int dbCount;
+  unsigned int i;
+  int j;
+  int ret;
+  int filedes[2]; /* pipe between client and parent */
+
+  setlocale (LC_ALL, "");
+  bindtextdomain (PACKAGE, LOCALEDIR);
+  textdomain (PACKAGE);
+
+  dbName = getenv("DOODLE_PATH");
+  if (NULL == dbName)
+    dbName = "~/.doodle";
+  socketName = getenv("DOODLE_SOCKET");
+  if (NULL == socketName)
+    socketName = DOODLE_SOCKET_NAME;
+
+  while (1) {
+    static struct option long_options[] = {
+      {"database", 1, 0, 'd'},
+      {"debug", 0, 0, 'D'},
+      {"help", 0, 0, 'h'},
+      {"threads", 1, 0, 'j'},
+      {"log", 1, 0, 'L'},
+      {"memory", 1, 0, 'm'},
+      {"socket", 1, 0, 's'},
+      {"version", 0, 0, 'v'},
+      {"verbose", 0, 0, 'V'},
+      {NULL, 0, 0, 0}
+    };
+    option_index = 0;
+    c = getopt_long(argc,
+		    argv, "d:Dhj:L:m:s:vV",
+		    long_options,
+		    &option_index);
+
+    if (c == -1)
+      break; /* No more flags to process */
+    switch (c) {
+    case 'd':
+      dbName = optarg;
+      break;
+    case 'D':
+      do_debug = 1;
+      break;
+    case 'h':
+      printHelp();
+      return 0;
+    case 'j':
+      if ( (1 != sscanf(optarg, "%u", &threads)) ||
+	   (threads == 0) ) {
+	printf(_("You must pass a number to the '%s' option.\n"),
+	       "-j");
+	return -1;
+      }
+      break;
+    case 'L':
+      log = optarg;
+      break;
+    case 'm':
+      if (1 != sscanf(optarg, "%u", &i)) {
+	printf(_("You must pass a number to the '%s' option.\n"),
+	       "-m");
+	return -1;
+      }
+      if (i > 0xFFFFFFFF / 1024 / 1024) {
+	printf(_("Specified memory limit is too high.\n"));
+	return -1;
+      }
+      mem_limit = i * 1024 * 1024;
+      break;
+    case 's':
+      socketName = optarg;
+      break;
+    case 'V':
+      if (verbose == 1)
+	very_verbose = 1;
+      verbose = 1;
+      break;
+    case 'v':
+      printf(_("Version %s\n"),
+	     PACKAGE_VERSION);
+      return 0;
+    default:
+      fprintf(stderr,
+	      _("Use '--help' to get a list of options.\n"));
+      return -1;
+    }  /* end of parsing commandline */
+  } /* while (1) */
+
+  if (argc != optind) {
+    fprintf(stderr,
+	    _("Invalid arguments (use '%s' to specify databases).\n"),
+	    "-d");
+    return -1;
+  }
+
+  logfile = NULL;
+  if (log != NULL) {
+    logfile = fopen(log, "a");
+    if (logfile == NULL)
+      fprintf(stderr,
+	      _("Could not open '%s' for logging: %s.\n"),
+	      log,
+	      strerror(errno));
+  }
+
+  /* open all databases */
+  dbs = NULL;
+  dbCount = 0;
+  name = STRDUP(dbName);
+  for (j=strlen(name);j>=0;j--) {
+    if ( (j == 0) ||
+	 (name[j-1] == ':') ) {
+      if (name[j] != '\0') {
+	GROW(dbs,
+	     dbCount,
+	     dbCount + 1);
+	dbs[dbCount-1].ename = expandFileName(&name[j]);
+	dbs[dbCount-1].tree = NULL;
+	MUTEX_CREATE(&dbs[dbCount-1].lock);
+	if (-1 == refreshDB(&dbs[dbCount-1]))
+	  my_log(logfile,
+		 DOODLE_LOG_CRITICAL,
+		 _("Could not open database '%s', will try again later.\n"),
+		 dbs[dbCount-1].ename);
+      }
+      if (j > 0)
+	name[j-1] = '\0';
+    }
+  }
+  free(name);
+
+  esocketName = expandFileName(socketName);
+  if (do_debug == 0)
+    detachFromTerminal(filedes);
+  initializeShutdownHandlers();
+  signal(SIGPIPE, SIG_IGN);
+  if (do_debug == 0)
+    detachFromTerminalComplete(filedes);
+  clientSlots = SEMAPHORE_NEW(MAX_CLIENTS);
+  ret = serve(esocketName,
+	      dbs,
+	      dbCount);
+  SEMAPHORE_FREE(clientSlots);
+  doneShutdownHandlers();
+  free(esocketName);
+  for (i=0;i<dbCount;i++) {
+    if (dbs[i].tree != NULL)
+      DOODLE_tree_destroy(dbs[i].tree);
+    MUTEX_DESTROY(&dbs[i].lock);
+    free(dbs[i].ename);
+  }
+  GROW(dbs,
+       dbCount,
+       0);
+  if (logfile != NULL)
+    fclose(logfile);
+  return ret;
+}
+
+/* end of doodle-server.c */
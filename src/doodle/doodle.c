@@ -53,6 +53,7 @@
 #include "getopt.h"
 #include "helper2.h"
 #include "convert.h"
+#include "client.h"
 
 
 static int verbose = 0;
@@ -67,16 +68,28 @@ static void printHelp () {
       gettext_noop("consider strings to match if DISTANCE letters are different") },
     { 'b', "build", NULL,
       gettext_noop("build database (default is to search)") },
+    { 'C', "cache", "FILENAME",
+      gettext_noop("when building, keep the extracted keywords in FILENAME and reuse them for unchanged files") },
+    { 'c', "extractors", "NUMBER",
+      gettext_noop("when building, run NUMBER libextractor processes in parallel (default: one for each processor)") },
     { 'd', "database", "FILENAME",
       gettext_noop("use location FILENAME to store doodle database") },
     { 'e', "extract", NULL,
       gettext_noop("for each matching file, print the extracted keywords") },
+    { 'E', "regex", NULL,
+      gettext_noop("treat the query terms as (POSIX extended) regular expressions") },
     { 'f', "filenames", NULL,
       gettext_noop("add the filename to the list of keywords (use when building database)") },
+    { 'F', "flat", NULL,
+      gettext_noop("when building, add an index for fast searches with very short strings") },
+    { 'g', "glob", NULL,
+      gettext_noop("treat the query terms as glob patterns (matching the end of keywords)") },
     { 'h', "help", NULL,
       gettext_noop("print this help page") },
     { 'i', "ignore-case", NULL,
-      gettext_noop("be case-insensitive (use when searching)") },
+      gettext_noop("be case-insensitive (when building, add an index for fast case-insensitive searches)") },
+    { 'j', "threads", "NUMBER",
+      gettext_noop("when building a new database, insert the keywords with NUMBER threads") },
     { 'l', "library", "LIBRARY",
       gettext_noop("load an extractor plugin named LIBRARY") },
     { 'L', "log", "FILENAME",
@@ -87,12 +100,26 @@ static void printHelp () {
       gettext_noop("set the memory limit to SIZE MB (for the tree).") },
     { 'p', "print", NULL,
       gettext_noop("print suffix tree (for debugging)") },
+    { 'R', "rules", "FILENAME",
+      gettext_noop("when building, decide with the rules in FILENAME which files are extracted, only indexed by name or skipped") },
+    { 'r', "max-results", "NUMBER",
+      gettext_noop("stop each search after NUMBER results") },
     { 'P', "prunepaths", NULL,
       gettext_noop("exclude given paths from building or searching") },
+    { 's', "stdin", NULL,
+      gettext_noop("read the query terms from standard input (one per line) and search for all of them at once") },
+    { 't', "timeout", "MILLISECONDS",
+      gettext_noop("stop each search after MILLISECONDS (the results are incomplete)") },
     { 'v', "version", NULL,
       gettext_noop("print the version number") },
     { 'V', "verbose", NULL,
       gettext_noop("be verbose") },
+    { 'W', "words", NULL,
+      gettext_noop("when building, only index whole words (searches then match the beginning of words)") },
+    { 'x', "fm-index", "FILENAME",
+      gettext_noop("write a compressed index of the database to FILENAME (for exact searches only)") },
+    { 'z', "freeze", "FILENAME",
+      gettext_noop("write a compact, read-only copy of the database to FILENAME (for searching only)") },
     { 0, NULL, NULL, NULL },
   };
   formatHelp(_("doodle [OPTIONS] ([FILENAMES]*|[KEYWORDS]*)"),
@@ -105,7 +132,16 @@ static int do_default = 1;
 static int do_print   = 0;
 static int do_filenames = 0;
 static int ignore_case = 0;
+static int do_flat = 0;
+static int do_words = 0;
+static unsigned int build_threads = 1;
+static unsigned int extractors = 0;
+static char * cacheName = NULL;
+static char * rulesName = NULL;
 static unsigned int do_approx = 0;
+static int do_pattern = -1;
+static int do_batch = 0;
+static DOODLE_SearchLimits limits;
 static char * prunepaths = "/tmp /usr/tmp /var/tmp /dev /proc /sys";
 
 /* *************** helper functions **************** */
@@ -167,20 +203,12 @@ typedef struct {
 static int do_index(const char * filename,
 		    void * cls) {
   DIC * dic = cls;
-  int i;
-  int j;
   struct stat sbuf;
 
   if (isPruned(filename, NULL))
     return 0;
-  j = -1;
-  for (i=DOODLE_getFileCount(dic->tree)-1;i>=0;i--)
-    if (0 == strcmp(filename,
-		    DOODLE_getFileAt(dic->tree,i)->filename)) {
-      j = i;
-      break;
-    }
-  if (j != -1)
+  if (-1 != DOODLE_tree_lookup_file(dic->tree,
+				    filename))
     return 0; /* already processed */
   if (0 != stat(filename,
 		&sbuf)) {
@@ -197,12 +225,44 @@ static int do_index(const char * filename,
     return buildIndex(dic->elist,
 		      dic->logFile,
 		      filename,
+		      &sbuf,
 		      dic->tree,
 		      do_filenames);
   } else
     return 0;
 }
 
+/**
+ * Remove all files from the database.
+ *
+ * @return the NULL-terminated list of the removed files (so that
+ *         they can be indexed again), caller must free
+ */
+static char ** clear(struct DOODLE_SuffixTree * tree) {
+  char ** names;
+  unsigned int count;
+  unsigned int i;
+
+  count = DOODLE_getFileCount(tree);
+  names = MALLOC(sizeof(char*) * (count + 1));
+  for (i=0;i<count;i++)
+    names[i] = STRDUP(DOODLE_getFileAt(tree, i)->filename);
+  names[count] = NULL;
+  DOODLE_tree_truncate_multiple(tree,
+				(const char **) names);
+  return names;
+}
+
+static void freeNames(char ** names) {
+  unsigned int i;
+
+  if (names == NULL)
+    return;
+  for (i=0;names[i] != NULL;i++)
+    free(names[i]);
+  free(names);
+}
+
 static int build(const char * libraries,
 		 const char * dbName,
 		 size_t mem_limit,
@@ -213,6 +273,7 @@ static int build(const char * libraries,
   int ret;
   DIC cls;
   char * ename;
+  char ** reindex;
 
   if (dbName == NULL) {
     printf(_("No database specified.  Aborting.\n"));
@@ -226,28 +287,111 @@ static int build(const char * libraries,
       return -1;
     }
   }
+
+  /* set up the extractor first: if that fails, the database
+     must not be touched */
+  if (extractors == 0) {
+    /* keep all processors busy with extracting */
+    i = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    extractors = (i > 0) ? i : 1;
+  }
+  cls.elist = forkExtractor(do_default,
+			    libraries,
+			    extractors,
+			    &my_log,
+			    NULL);
+  if (cacheName != NULL) {
+    ename = expandFileName(cacheName);
+    if ( (ename == NULL) ||
+	 (0 != setExtractorCache(cls.elist,
+				 ename)) )
+      printf(_("Could not use '%s' as extraction cache, extracting all files.\n"),
+	     cacheName);
+    free(ename);
+  }
+  if (rulesName != NULL) {
+    ename = expandFileName(rulesName);
+    if ( (ename == NULL) ||
+	 (0 != setExtractorPolicy(cls.elist,
+				  ename)) ) {
+      free(ename);
+      joinExtractor(cls.elist);
+      return -1;
+    }
+    free(ename);
+  }
+
   ename = expandFileName(dbName);
-  if (ename == NULL)
+  if (ename == NULL) {
+    joinExtractor(cls.elist);
     return -1;
+  }
   /* unlink(ename); */
   cls.tree = DOODLE_tree_create(&my_log,
 				NULL,
 				ename);
   free(ename);
-  if (cls.tree == NULL)
+  if (cls.tree == NULL) {
+    joinExtractor(cls.elist);
     return -1;
+  }
   if (mem_limit != 0)
     DOODLE_tree_set_memory_limit(cls.tree,
 				 mem_limit);
 
+  /* the case-folded index, the flat keyword index and the
+     word index can only be added to an empty database, so
+     we remove all files and index them again below (but
+     only after checking that nothing else stands in the way) */
+  if ( ( (do_words == 1) &&
+	 (DOODLE_tree_get_flat_index(cls.tree) != 0) ) ||
+       ( (do_flat == 1) &&
+	 (DOODLE_tree_get_word_index(cls.tree) != 0) ) ) {
+    printf(_("Database '%s' already has a %s; it can not be combined with option '%s'.\n"),
+	   dbName,
+	   (do_words == 1) ? _("flat keyword index") : _("word index"),
+	   (do_words == 1) ? "-W" : "-F");
+    joinExtractor(cls.elist);
+    DOODLE_tree_destroy(cls.tree);
+    return -1;
+  }
+  reindex = NULL;
+  if ( (ignore_case == 1) &&
+       (0 != DOODLE_tree_set_case_folding(cls.tree, 1)) ) {
+    if (verbose)
+      printf(_("Re-indexing all files to build the case-insensitive index.\n"));
+    reindex = clear(cls.tree);
+    if (0 != DOODLE_tree_set_case_folding(cls.tree, 1))
+      goto FAIL;
+  }
+  if ( (do_flat == 1) &&
+       (0 != DOODLE_tree_set_flat_index(cls.tree, 1)) ) {
+    if (verbose)
+      printf(_("Re-indexing all files to build the flat keyword index.\n"));
+    if (reindex == NULL)
+      reindex = clear(cls.tree);
+    if (0 != DOODLE_tree_set_flat_index(cls.tree, 1))
+      goto FAIL;
+  }
+  if ( (do_words == 1) &&
+       (0 != DOODLE_tree_set_word_index(cls.tree, 1)) ) {
+    if (verbose)
+      printf(_("Re-indexing all files to build the word index.\n"));
+    if (reindex == NULL)
+      reindex = clear(cls.tree);
+    if (0 != DOODLE_tree_set_word_index(cls.tree, 1))
+      goto FAIL;
+  }
   DOODLE_tree_truncate_modified(cls.tree,
 			       &my_log,
 			       NULL);
+  /* the initial indexing of a database is much faster
+     if the keywords are inserted in sorted order */
+  if ( (DOODLE_getFileCount(cls.tree) == 0) &&
+       ( (0 != DOODLE_tree_set_build_threads(cls.tree, build_threads)) ||
+	 (0 != DOODLE_tree_bulk_open(cls.tree)) ) )
+    goto FAIL;
 
-  cls.elist = forkExtractor(do_default,
-			    libraries,
-			    &my_log,
-			    NULL);
   cls.logFile = NULL;
   if (log != NULL) {
     cls.logFile = fopen(log, "w+");
@@ -258,7 +402,18 @@ static int build(const char * libraries,
   }
 
   ret = 0;
-  for (i=0;i<argc;i++) {
+  /* the files removed above (files that no longer exist are
+     simply dropped, as by DOODLE_tree_truncate_modified) */
+  for (i=0;(reindex != NULL) && (reindex[i] != NULL);i++) {
+    if (0 != access(reindex[i], F_OK))
+      continue;
+    if (-1 == do_index(reindex[i],
+		       &cls)) {
+      ret = -1;
+      break;
+    }
+  }
+  for (i=0;(ret == 0) && (i<argc);i++) {
     char * exp;
 
     if (verbose)
@@ -278,11 +433,21 @@ static int build(const char * libraries,
     }
     free(exp);
   }
+  if (0 == finishIndex(cls.elist))
+    ret = -1;
   joinExtractor(cls.elist);  
+  if (0 != DOODLE_tree_bulk_close(cls.tree))
+    ret = -1;
   DOODLE_tree_destroy(cls.tree);
   if (cls.logFile != NULL)
     fclose(cls.logFile);
+  freeNames(reindex);
   return ret;
+ FAIL:
+  joinExtractor(cls.elist);
+  DOODLE_tree_destroy(cls.tree);
+  freeNames(reindex);
+  return -1;
 }
 
 /**
@@ -333,6 +498,192 @@ static void printIt(const DOODLE_FileInfo * fileinfo,
   }
 }
 
+static int printLimited(const DOODLE_FileInfo * fileinfo,
+			PrintItArgs * args) {
+  printIt(fileinfo, args);
+  return 0;
+}
+
+typedef struct {
+  PrintItArgs * args;
+  char ** queries;
+  int last;
+} PrintBatchArgs;
+
+static void printBatch(unsigned int query,
+		       const DOODLE_FileInfo * fileinfo,
+		       PrintBatchArgs * bargs) {
+  if (bargs->last != (int) query) {
+    printf(_("Searching for '%s':\n"),
+	   bargs->queries[query]);
+    bargs->last = query;
+  }
+  printIt(fileinfo, bargs->args);
+}
+
+/**
+ * Search for all queries with a single traversal of the tree.
+ * @return number of queries that were not found, -1 on error
+ */
+static int searchBatch(struct DOODLE_SuffixTree * tree,
+		       int argc,
+		       char * argv[],
+		       PrintItArgs * args) {
+  PrintBatchArgs bargs;
+  unsigned int * results;
+  char ** utf;
+  int ret;
+  int i;
+
+  utf = MALLOC(sizeof(char*) * argc);
+  results = MALLOC(sizeof(unsigned int) * argc);
+  for (i=0;i<argc;i++)
+    utf[i] = convertToUtf8(argv[i],
+			   strlen(argv[i]),
+			   nl_langinfo(CODESET));
+  bargs.args = args;
+  bargs.queries = argv;
+  bargs.last = -1;
+  ret = 0;
+  if (-1 == DOODLE_tree_search_batch(tree,
+				     (const char**) utf,
+				     argc,
+				     (DOODLE_BatchCallback) &printBatch,
+				     &bargs,
+				     results))
+    ret = -1;
+  for (i=0;i<argc;i++) {
+    if ( (ret != -1) &&
+	 (results[i] == 0) ) {
+      printf(_("Searching for '%s':\n"),
+	     argv[i]);
+      printf(_("\tNot found!\n"));
+      ret++;
+    }
+    free(utf[i]);
+  }
+  free(results);
+  free(utf);
+  return ret;
+}
+
+/**
+ * Read the query terms from stdin (one per line).
+ * @return number of queries
+ */
+static int readQueries(char *** queries) {
+  char line[MAX_LENGTH * 4];
+  unsigned int size;
+  int count;
+  int len;
+
+  size = 0;
+  count = 0;
+  *queries = NULL;
+  while (NULL != fgets(line, sizeof(line), stdin)) {
+    len = strlen(line);
+    while ( (len > 0) &&
+	    ( (line[len-1] == '\n') ||
+	      (line[len-1] == '\r') ) )
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+    if (count == size)
+      GROW(*queries,
+	   size,
+	   size * 2 + 64);
+    (*queries)[count++] = STRDUP(line);
+  }
+  return count;
+}
+
+typedef struct {
+  PrintItArgs * args;
+  const char * query;
+  int printed;
+} PrintServerArgs;
+
+static void printServer(const DOODLE_FileInfo * fileinfo,
+			PrintServerArgs * sargs) {
+  if (! sargs->printed) {
+    printf(_("Searching for '%s':\n"),
+	   sargs->query);
+    sargs->printed = 1;
+  }
+  printIt(fileinfo, sargs->args);
+}
+
+/**
+ * Search with the help of doodle-server (if it is running
+ * and has the database open).
+ *
+ * @param ename expanded filename of the database
+ * @param done set to the number of queries that were processed
+ *   (the remaining ones must be searched without the server)
+ * @return number of queries that were not found
+ */
+static int searchWithServer(const char * ename,
+			    int argc,
+			    char * argv[],
+			    PrintItArgs * args,
+			    int * done) {
+  PrintServerArgs sargs;
+  char * utf;
+  int sock;
+  int ret;
+  int ret2;
+  int i;
+
+  *done = 0;
+  /* the server only does simple, approximate and
+     case-insensitive searches */
+  if ( (do_pattern != -1) ||
+       (do_batch != 0) ||
+       (limits.max_time != 0) ||
+       (limits.max_results != 0) )
+    return 0;
+  for (i=0;i<argc;i++)
+    if (strlen(argv[i]) > MAX_LENGTH/2)
+      return 0;
+  sock = connectToServer();
+  if (sock == -1)
+    return 0;
+  ret = 0;
+  for (i=0;i<argc;i++) {
+    utf = convertToUtf8(argv[i],
+			strlen(argv[i]),
+			nl_langinfo(CODESET));
+    sargs.args = args;
+    sargs.query = argv[i];
+    sargs.printed = 0;
+    ret2 = searchServer(sock,
+			ename,
+			utf,
+			do_approx,
+			ignore_case,
+			(DOODLE_ResultCallback) &printServer,
+			&sargs);
+    free(utf);
+    if (ret2 < 0) {
+      if (sargs.printed) {
+	printf(_("\tLost connection to doodle-server, results are incomplete.\n"));
+	ret++;
+	*done = i + 1;
+      }
+      break;
+    }
+    if (ret2 == 0) {
+      printf(_("Searching for '%s':\n"),
+	     argv[i]);
+      printf(_("\tNot found!\n"));
+      ret++;
+    }
+    *done = i + 1;
+  }
+  close(sock);
+  return ret;
+}
+
 static int print(const char * dbName) {
   struct DOODLE_SuffixTree * tree;
   char * ename;
@@ -364,12 +715,56 @@ static int print(const char * dbName) {
   return ret;
 }
 
+/**
+ * Write a frozen copy or an FM index of the database.
+ *
+ * @param fm write an FM index instead of a frozen copy
+ */
+static int freeze(const char * dbName,
+		  const char * frozenName,
+		  int fm) {
+  struct DOODLE_SuffixTree * tree;
+  char * ename;
+  char * fname;
+  struct stat buf;
+  int ret;
+
+  ename = expandFileName(dbName);
+  if (0 != stat(ename, &buf)) {
+    printf(_("Call to '%s' for file '%s' failed: %s.\n"),
+	   "stat",
+	   dbName,
+	   strerror(errno));
+    free(ename);
+    return -1;
+  }
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 ename);
+  free(ename);
+  if (tree == NULL)
+    return -1;
+  fname = expandFileName(frozenName);
+  if (fm)
+    ret = DOODLE_tree_build_fm_index(tree,
+				     fname);
+  else
+    ret = DOODLE_tree_freeze(tree,
+			     fname);
+  free(fname);
+  DOODLE_tree_destroy(tree);
+  return ret;
+}
+
 static int search(const char * libraries,
 		  const char * dbName,
 		  size_t mem_limit,
 		  int argc,
 		  char * argv[]) {
   int ret;
+  int ret2;
+  int done;
+  int truncated;
   struct stat buf;
   char * ename;
   struct DOODLE_SuffixTree * tree;
@@ -391,16 +786,6 @@ static int search(const char * libraries,
     free(ename);
     return -1;
   }
-  tree = DOODLE_tree_open_RDONLY(&my_log,
-				 NULL,
-				 ename);
-  if (mem_limit != 0)
-    DOODLE_tree_set_memory_limit(tree,
-				 mem_limit);
-
-  free(ename);
-  if (tree == NULL)
-    return -1;
   if (do_extract) {
     if (do_default)
       extractors = EXTRACTOR_plugin_add_defaults(EXTRACTOR_OPTION_DEFAULT_POLICY);
@@ -413,13 +798,42 @@ static int search(const char * libraries,
   } else
     extractors = NULL;
 
-  ret = 0;
   args.list = extractors;
   args.filenames_seen = NULL;
   args.seen_size = 0;
   args.seen_count = 0;
 
-  for (i=0;i<argc;i++) {
+  ret = searchWithServer(ename,
+			 argc,
+			 argv,
+			 &args,
+			 &done);
+  tree = NULL;
+  if (done < argc) {
+    tree = DOODLE_tree_open_RDONLY(&my_log,
+				   NULL,
+				   ename);
+    if ( (tree != NULL) &&
+	 (mem_limit != 0) )
+      DOODLE_tree_set_memory_limit(tree,
+				   mem_limit);
+  }
+  free(ename);
+  if ( (tree == NULL) &&
+       (done < argc) ) {
+    ret = -1;
+    argc = 0;
+  }
+
+  if ( (do_batch) &&
+       (argc > 0) ) {
+    ret = searchBatch(tree,
+		      argc,
+		      argv,
+		      &args);
+    argc = 0;
+  }
+  for (i=done;i<argc;i++) {
     printf(_("Searching for '%s':\n"),
 	   argv[i]);
     if (strlen(argv[i]) > MAX_LENGTH) {
@@ -434,8 +848,36 @@ static int search(const char * libraries,
     utf = convertToUtf8(argv[i],
 			strlen(argv[i]),
 			nl_langinfo(CODESET));
-    if ( (do_approx == 0) &&
-	 (ignore_case == 0) ) {
+    if (do_pattern != -1) {
+      ret2 = DOODLE_tree_search_pattern(tree,
+					utf,
+					do_pattern | (ignore_case ? DOODLE_PATTERN_IGNORE_CASE : 0),
+					(DOODLE_ResultCallback) &printIt,
+					&args);
+      if (ret2 == -1) {
+	ret++;
+      } else if (ret2 == 0) {
+	printf(_("\tNot found!\n"));
+	ret++;
+      }
+    } else if ( (limits.max_time != 0) ||
+		(limits.max_results != 0) ) {
+      ret2 = DOODLE_tree_search_limited(tree,
+					utf,
+					do_approx,
+					ignore_case,
+					&limits,
+					(DOODLE_LimitedResultCallback) &printLimited,
+					&args,
+					&truncated);
+      if (ret2 == 0) {
+	printf(_("\tNot found!\n"));
+	ret++;
+      }
+      if (truncated)
+	printf(_("\tSearch stopped early, results are incomplete.\n"));
+    } else if ( (do_approx == 0) &&
+		(ignore_case == 0) ) {
       if (0 == DOODLE_tree_search(tree,
 				  utf,
 				  (DOODLE_ResultCallback) &printIt,
@@ -456,7 +898,8 @@ static int search(const char * libraries,
     }
     free(utf);
   }
-  DOODLE_tree_destroy(tree);
+  if (tree != NULL)
+    DOODLE_tree_destroy(tree);
   EXTRACTOR_plugin_remove_all(extractors);
 
   for (i=0;i<args.seen_count;i++)
@@ -477,6 +920,8 @@ int main(int argc,
   char * dbName;
   char * tmp;
   char * log = NULL;
+  char * frozenName = NULL;
+  char * fmName = NULL;
   int ret;
 
   setlocale (LC_ALL, "");
@@ -494,24 +939,37 @@ int main(int argc,
     static struct option long_options[] = {
       {"approximate", 1, 0, 'a'},
       {"build", 0, 0, 'b'},
+      {"cache", 1, 0, 'C'},
+      {"extractors", 1, 0, 'c'},
       {"database", 1, 0, 'd'},
       {"extract", 0, 0, 'e'},
+      {"regex", 0, 0, 'E'},
       {"filenames", 0, 0, 'f'} ,
+      {"flat", 0, 0, 'F'},
+      {"glob", 0, 0, 'g'},
       {"help", 0, 0, 'h'},
       {"ignore-case", 0, 0, 'i'},
+      {"threads", 1, 0, 'j'},
       {"library", 1, 0, 'l'},
       {"log", 1, 0, 'L'},
       {"memory", 1, 0, 'm'},
+      {"max-results", 1, 0, 'r'},
+      {"rules", 1, 0, 'R'},
       {"nodefault", 1, 0, 'n'},
       {"prunepaths", 1, 0, 'P' },
       {"print", 0, 0, 'p'},
+      {"stdin", 0, 0, 's'},
+      {"timeout", 1, 0, 't'},
       {"verbose", 0, 0, 'V'},
       {"version", 0, 0, 'v'},
+      {"words", 0, 0, 'W'},
+      {"fm-index", 1, 0, 'x'},
+      {"freeze", 1, 0, 'z'},
       {NULL, 0, 0, 0}
     };
     option_index = 0;
     c = getopt_long(argc,
-		    argv, "a:bd:efhil:L:m:nP:pVv",
+		    argv, "a:bC:c:d:eEfFghij:l:L:m:nP:pr:R:st:VvWx:z:",
 		    long_options,
 		    &option_index);
 
@@ -542,9 +1000,15 @@ int main(int argc,
 	       "-b", "-p");
 	return -1;
       }	
-      if (ignore_case == 1) {
-	printf(_("The options '%s' and '%s' cannot be used together!\n"),
-	       "-b", "-i");
+      break;
+    case 'C':
+      cacheName = optarg;
+      break;
+    case 'c':
+      if ( (1 != sscanf(optarg, "%u", &extractors)) ||
+	   (extractors == 0) ) {
+	printf(_("You must pass a number to the '%s' option.\n"),
+	       "-c");
 	return -1;
       }
       break;
@@ -554,17 +1018,29 @@ int main(int argc,
     case 'e':
       do_extract = 1;
       break;
+    case 'E':
+      do_pattern = DOODLE_PATTERN_REGEX;
+      break;
     case 'f':
       do_filenames = 1;
       break;
+    case 'F':
+      do_flat = 1;
+      break;
+    case 'g':
+      do_pattern = DOODLE_PATTERN_GLOB;
+      break;
     case 'h':
       printHelp();
       return 0;
     case 'i':
       ignore_case = 1;
-      if (do_build == 1) {
-	printf(_("The options '%s' and '%s' cannot be used together!\n"),
-	       "-b", "-i");
+      break;
+    case 'j':
+      if ( (1 != sscanf(optarg, "%u", &build_threads)) ||
+	   (build_threads == 0) ) {
+	printf(_("You must pass a number to the '%s' option.\n"),
+	       "-j");
 	return -1;
       }
       break;
@@ -600,6 +1076,26 @@ int main(int argc,
     case 'P':
       prunepaths = optarg;
       break;
+    case 'r':
+      if (1 != sscanf(optarg, "%u", &limits.max_results)) {
+	printf(_("You must pass a number to the '%s' option.\n"),
+	       "-r");
+	return -1;
+      }
+      break;
+    case 'R':
+      rulesName = optarg;
+      break;
+    case 's':
+      do_batch = 1;
+      break;
+    case 't':
+      if (1 != sscanf(optarg, "%u", &limits.max_time)) {
+	printf(_("You must pass a number to the '%s' option.\n"),
+	       "-t");
+	return -1;
+      }
+      break;
     case 'V':
       if (verbose == 1)
 	very_verbose = 1;
@@ -609,6 +1105,15 @@ int main(int argc,
       printf(_("Version %s\n"),
 	     PACKAGE_VERSION);
       return 0;
+    case 'W':
+      do_words = 1;
+      break;
+    case 'x':
+      fmName = optarg;
+      break;
+    case 'z':
+      frozenName = optarg;
+      break;
     default:
       fprintf(stderr,
 	      _("Use '--help' to get a list of options.\n"));
@@ -616,6 +1121,79 @@ int main(int argc,
     }  /* end of parsing commandline */
   } /* while (1) */
 
+  if ( (do_pattern != -1) &&
+       ( (do_build == 1) ||
+	 (do_approx != 0) ) ) {
+    printf(_("The options '%s' and '%s' cannot be used together!\n"),
+	   (do_pattern == DOODLE_PATTERN_GLOB) ? "-g" : "-E",
+	   (do_build == 1) ? "-b" : "-a");
+    return -1;
+  }
+
+  if ( ( (limits.max_time != 0) ||
+	 (limits.max_results != 0) ) &&
+       ( (do_build == 1) ||
+	 (do_batch == 1) ||
+	 (do_pattern != -1) ) ) {
+    printf(_("The options '%s' and '%s' can only be used for simple or approximate searches!\n"),
+	   "-r", "-t");
+    return -1;
+  }
+
+  if ( (do_words == 1) &&
+       (do_flat == 1) ) {
+    printf(_("The options '%s' and '%s' cannot be used together!\n"),
+	   "-W",
+	   "-F");
+    return -1;
+  }
+
+  if ( (do_batch == 1) &&
+       ( (do_build == 1) ||
+	 (do_approx != 0) ||
+	 (ignore_case == 1) ||
+	 (do_pattern != -1) ) ) {
+    printf(_("The option '%s' can only be used for exact searches!\n"),
+	   "-s");
+    return -1;
+  }
+
+  if ( (do_batch == 1) &&
+       (argc - optind > 0) ) {
+    printf(_("With option '%s' the query terms are read from standard input, not from the command line!\n"),
+	   "-s");
+    return -1;
+  }
+
+  if (do_batch == 1) {
+    argc = readQueries(&argv);
+    optind = 0;
+  }
+
+  if ( ( (frozenName != NULL) ||
+	 (fmName != NULL) ) &&
+       (do_print == 1) ) {
+    printf(_("The options '%s' and '%s' cannot be used together!\n"),
+	   (frozenName != NULL) ? "-z" : "-x",
+	   "-p");
+    return -1;
+  }
+  if ( (do_build == 0) &&
+       ( (frozenName != NULL) ||
+	 (fmName != NULL) ) ) {
+    ret = 0;
+    if (frozenName != NULL)
+      ret = freeze(dbName,
+		   frozenName,
+		   0);
+    if ( (ret == 0) &&
+	 (fmName != NULL) )
+      ret = freeze(dbName,
+		   fmName,
+		   1);
+    return ret;
+  }
+
   if ( (do_print == 0) &&
        (argc - optind < 1) ) {
     fprintf(stderr,
@@ -636,6 +1214,17 @@ int main(int argc,
 		&argv[optind]);
     if (libraries != NULL)
       free(libraries);
+    /* convert the fresh database */
+    if ( (ret == 0) &&
+	 (frozenName != NULL) )
+      ret = freeze(dbName,
+		   frozenName,
+		   0);
+    if ( (ret == 0) &&
+	 (fmName != NULL) )
+      ret = freeze(dbName,
+		   fmName,
+		   1);
     return ret;
   } else if (do_print) {
     int i;
@@ -678,6 +1267,11 @@ int main(int argc,
     free(name);
     if (libraries != NULL)
       free(libraries);
+    if (do_batch == 1) {
+      for (i=0;i<argc;i++)
+	free(argv[i]);
+      free(argv);
+    }
     return ret;
   }
 }
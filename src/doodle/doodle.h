@@ -80,6 +80,16 @@ unsigned int DOODLE_getFileCount(const struct DOODLE_SuffixTree * tree);
 const DOODLE_FileInfo * DOODLE_getFileAt(const struct DOODLE_SuffixTree * tree,
 					 unsigned int index);
 
+/**
+ * Find a file in the doodle DB (using a hash table of the
+ * filenames, so this is fast even for many files).
+ *
+ * @return the index of the file (for DOODLE_getFileAt),
+ *   -1 if the file is not in the DB
+ */
+int DOODLE_tree_lookup_file(struct DOODLE_SuffixTree * tree,
+			    const char * filename);
+
 /**
  * Create a suffix-tree (and store in file
  * named database).  Also used to re-open an existing
@@ -111,6 +121,69 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
 		       const char * searchString,
 		       const char * fileName);
 
+/**
+ * Add each word of a keyword (each maximal run of letters,
+ * digits and non-ASCII characters) with DOODLE_tree_expand,
+ * but not the suffixes of the words.  Used to build a word
+ * index (see DOODLE_tree_set_word_index).
+ * @return 0 on success, 1 on error
+ */
+int DOODLE_tree_expand_words(struct DOODLE_SuffixTree * tree,
+			     const char * keyword,
+			     const char * fileName);
+
+/**
+ * Add all keywords of a file: each keyword together with all
+ * of its suffixes (as doodle does) or, for a word index, each
+ * word of the keyword.  Much faster than calling
+ * DOODLE_tree_expand for every suffix: the file is not stat'ed
+ * (mod_time is recorded if the file is new) and identical
+ * keywords and suffixes are only inserted once.
+ * @param keywords array of keywords, NULL terminated!
+ * @return 0 on success, 1 on error
+ */
+int DOODLE_tree_expand_file(struct DOODLE_SuffixTree * tree,
+			    const char * fileName,
+			    unsigned int mod_time,
+			    const char * keywords[]);
+
+/**
+ * Start a bulk build for the initial indexing of a (new or
+ * empty) database.  Keywords added with DOODLE_tree_expand,
+ * DOODLE_tree_expand_words and DOODLE_tree_expand_file are
+ * buffered (and written to sorted temporary runs next to the
+ * database if the buffer exceeds the memory limit) and only
+ * inserted into the tree, in sorted order, by
+ * DOODLE_tree_bulk_close.  Searches do not find the buffered
+ * keywords until then.
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_bulk_open(struct DOODLE_SuffixTree * tree);
+
+/**
+ * Insert the keywords buffered since DOODLE_tree_bulk_open
+ * into the tree and end the bulk build.  DOODLE_tree_destroy
+ * and DOODLE_tree_truncate_multiple do this implicitly.
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_bulk_close(struct DOODLE_SuffixTree * tree);
+
+/**
+ * Change the number of threads that insert the keywords of a
+ * bulk build into a tree that is still empty.  The keywords are
+ * split by their first byte into one range for each thread
+ * (with about the same number of keywords); each thread builds
+ * the subtrees for its range with its share of the memory
+ * limit, and the subtrees are joined below the root when the
+ * bulk build ends.
+ *
+ * @param threads number of threads, 1 to insert the keywords
+ *   in the calling thread only
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_build_threads(struct DOODLE_SuffixTree * tree,
+				  unsigned int threads);
+
 /**
  * Remove all entries for the given filename.
  */
@@ -164,6 +237,85 @@ int DOODLE_tree_search(struct DOODLE_SuffixTree * tree,
 		       DOODLE_ResultCallback callback,
 		       void * arg);
 
+typedef void (*DOODLE_BatchCallback)(unsigned int query,
+				     const DOODLE_FileInfo * fileinfo,
+				     void * arg);
+
+/**
+ * Search the suffix tree for many strings at once.  The
+ * queries are sorted so that queries with a common prefix
+ * share the traversal of the tree; the upper levels of the
+ * tree are kept in memory for the duration of the batch.
+ *
+ * @param queries the strings to search for
+ * @param count number of strings in queries
+ * @param callback function to call for each matching file,
+ *   with the index of the query in queries; the results are
+ *   grouped by query (in sorted order of the queries)
+ * @param arg extra argument to callback
+ * @param results set to the number of results for each
+ *   query (array of count entries, may be NULL)
+ * @return -1 on error, otherwise the total number of results
+ */
+int DOODLE_tree_search_batch(struct DOODLE_SuffixTree * tree,
+			     const char ** queries,
+			     unsigned int count,
+			     DOODLE_BatchCallback callback,
+			     void * arg,
+			     unsigned int * results);
+
+/**
+ * Count the number of distinct files matching the given
+ * string.  For a database that was not modified since it
+ * was opened, this does not need to look at the individual
+ * matches (the counts are stored in the database).
+ *
+ * @param substring the string to search for
+ * @return -1 on error, otherwise the number of files
+ */
+int DOODLE_tree_count(struct DOODLE_SuffixTree * tree,
+		      const char * substring);
+
+struct DOODLE_SearchCursor;
+
+/**
+ * Start a paginated search of the suffix tree.  Unlike
+ * DOODLE_tree_search, the results are produced in batches
+ * (see DOODLE_tree_search_next) and each file is reported
+ * at most once.
+ *
+ * @param substring the string to search for
+ * @param offset number of (distinct) matching files to skip
+ * @return NULL on error
+ */
+struct DOODLE_SearchCursor *
+DOODLE_tree_search_open(struct DOODLE_SuffixTree * tree,
+			const char * substring,
+			unsigned int offset);
+
+/**
+ * Obtain the next batch of results of a paginated search.
+ * The traversal of the tree stops as soon as limit files
+ * have been found and resumes there on the next call.
+ * The cursor must not be used after the tree has been
+ * modified (DOODLE_tree_expand, DOODLE_tree_truncate).
+ *
+ * @param limit maximum number of files to report in this batch
+ * @param callback function to call for each matching file
+ * @param arg extra argument to callback
+ * @return -1 on error, otherwise the number of files
+ *   reported (0 if there are no more results)
+ */
+int DOODLE_tree_search_next(struct DOODLE_SearchCursor * cursor,
+			    unsigned int limit,
+			    DOODLE_ResultCallback callback,
+			    void * arg);
+
+/**
+ * Release a paginated search.
+ */
+void DOODLE_tree_search_close(struct DOODLE_SearchCursor * cursor);
+
 /**
  * Search the suffix tree for matching strings.
  * The resulting nodes returned in result
@@ -183,6 +335,74 @@ int DOODLE_tree_search_approx(struct DOODLE_SuffixTree * tree,
 			      DOODLE_ResultCallback callback,
 			      void * arg);
 
+/**
+ * Type of the callback for DOODLE_tree_search_limited.
+ * @return 0 to continue the search, non-zero to stop it
+ */
+typedef int (*DOODLE_LimitedResultCallback)(const DOODLE_FileInfo * fileinfo,
+					    void * arg);
+
+/**
+ * Limits for a search; 0 means "no limit" for all fields.
+ */
+typedef struct {
+  /* maximum time (wall-clock) for the search in milliseconds */
+  unsigned int max_time;
+  /* maximum number of nodes of the tree to visit */
+  unsigned long long max_nodes;
+  /* maximum number of results to report */
+  unsigned int max_results;
+} DOODLE_SearchLimits;
+
+/**
+ * Search the suffix tree for matching strings (exact if approx
+ * is 0 and ignore_case is 0, otherwise like
+ * DOODLE_tree_search_approx), but stop once one of the limits
+ * is exceeded or the callback returns non-zero.
+ *
+ * @param limits limits for the search, NULL for none
+ * @param callback function to call for each matching file
+ * @param arg extra argument to callback
+ * @param truncated set to 1 if the search was stopped before
+ *   all results were reported, 0 otherwise (may be NULL)
+ * @return -1 on error, otherwise the number of results reported
+ */
+int DOODLE_tree_search_limited(struct DOODLE_SuffixTree * tree,
+			       const char * substring,
+			       unsigned int approx,
+			       int ignore_case,
+			       const DOODLE_SearchLimits * limits,
+			       DOODLE_LimitedResultCallback callback,
+			       void * arg,
+			       int * truncated);
+
+/* flags for DOODLE_tree_search_pattern */
+#define DOODLE_PATTERN_REGEX 0
+#define DOODLE_PATTERN_GLOB 1
+#define DOODLE_PATTERN_IGNORE_CASE 2
+
+/**
+ * Search the suffix tree for keywords matching a pattern.
+ * Regular expressions (POSIX extended syntax, without
+ * back-references) match anywhere in a keyword unless they
+ * end with '$'; '^' is not supported.  Globs ('*', '?' and
+ * '[...]') must match up to the end of a keyword but may
+ * start anywhere.
+ *
+ * @param pattern the glob or regular expression
+ * @param flags DOODLE_PATTERN_REGEX or DOODLE_PATTERN_GLOB,
+ *   optionally or'ed with DOODLE_PATTERN_IGNORE_CASE
+ * @param callback function to call for each matching file
+ * @param arg extra argument to callback
+ * @return -1 on error (i.e. invalid pattern), otherwise the
+ *   number of results
+ */
+int DOODLE_tree_search_pattern(struct DOODLE_SuffixTree * tree,
+			       const char * pattern,
+			       int flags,
+			       DOODLE_ResultCallback callback,
+			       void * arg);
+
 /**
  * Change the memory limit (how much memory the
  * tree may use).  Note that the limit only refers
@@ -195,6 +415,142 @@ int DOODLE_tree_search_approx(struct DOODLE_SuffixTree * tree,
 void DOODLE_tree_set_memory_limit(struct DOODLE_SuffixTree * tree,
 				  size_t limit);
 
+/**
+ * Change the number of searches for which the results are
+ * cached.  DOODLE_tree_search and DOODLE_tree_search_approx
+ * answer a repeated search from the cache unless the tree was
+ * modified in the meantime.  The default is 32.
+ *
+ * @param entries new size of the cache, 0 to disable caching
+ */
+void DOODLE_tree_set_cache_size(struct DOODLE_SuffixTree * tree,
+				unsigned int entries);
+
+/**
+ * Change the number of threads used for approximate searches
+ * and exact searches with many results.  Each additional
+ * thread loads the nodes it needs into its own handle of the
+ * database; the handles share the filenames and keywords with
+ * the tree and together use at most the memory limit for the
+ * nodes.  Only possible for trees opened with
+ * DOODLE_tree_open_RDONLY.
+ *
+ * @param threads number of threads, 1 to search in the
+ *   calling thread only
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_threads(struct DOODLE_SuffixTree * tree,
+			    unsigned int threads);
+
+/**
+ * Enable or disable the case-folded index.  With the index,
+ * case-insensitive searches (DOODLE_tree_search_approx with
+ * approx 0) are as fast as case-sensitive searches, at the
+ * expense of a larger database.  The index can only be
+ * enabled for an empty database; the setting is stored in
+ * the database.
+ *
+ * @param enable 1 to enable, 0 to disable
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_case_folding(struct DOODLE_SuffixTree * tree,
+				 int enable);
+
+/**
+ * Enable or disable the flat keyword index.  The index stores
+ * the keywords of each file once more, packed one after the
+ * other; exact searches for very short (or very common) strings
+ * then scan these keywords instead of visiting a large part of
+ * the tree (with the same results as the tree).  It
+ * requires that each keyword is added together with all of its
+ * suffixes (and is removed again if this is not the case).  The
+ * index can only be enabled for an empty database; the setting
+ * is stored in the database.
+ *
+ * @param enable 1 to enable, 0 to disable
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_flat_index(struct DOODLE_SuffixTree * tree,
+			       int enable);
+
+/**
+ * @return 1 if the database has a flat keyword index (see
+ *  DOODLE_tree_set_flat_index), 0 if not
+ */
+int DOODLE_tree_get_flat_index(struct DOODLE_SuffixTree * tree);
+
+/**
+ * Make the database a word index.  Instead of all suffixes of
+ * each keyword, a word index only contains the words of the
+ * keywords (added with DOODLE_tree_expand_words), so it is much
+ * smaller and faster to build, but a search string only matches
+ * at the beginning of a word: DOODLE_tree_search finds the files
+ * with a word that starts with the search string.  The setting
+ * can only be changed for an empty database and is stored in the
+ * database; it can not be combined with the flat keyword index.
+ *
+ * @param enable 1 for a word index, 0 for a suffix index
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_word_index(struct DOODLE_SuffixTree * tree,
+			       int enable);
+
+/**
+ * @return 1 if the database is a word index (see
+ *  DOODLE_tree_set_word_index), 0 if not
+ */
+int DOODLE_tree_get_word_index(struct DOODLE_SuffixTree * tree);
+
+/**
+ * Release the lock on a database opened with
+ * DOODLE_tree_open_RDONLY so that it can be updated while the
+ * tree remains open (for long-running searchers).  The tree
+ * continues to show the database as it was when it was opened;
+ * reopen it when the database file has been replaced.
+ *
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_release_lock(struct DOODLE_SuffixTree * tree);
+
+/**
+ * Write a frozen copy of the database to the given file.  A
+ * frozen database is a compact, read-only representation of the
+ * tree (a succinct trie with packed labels and compressed lists
+ * of matches) that is searched directly from a mapping of the
+ * file instead of being loaded into memory node by node.  Open
+ * it with DOODLE_tree_open_RDONLY; exact, approximate,
+ * case-insensitive, limited and batch searches and
+ * DOODLE_tree_count work as usual (the order of the results may
+ * differ), while paginated and pattern searches and all changes
+ * are refused.  Only unmodified trees opened with
+ * DOODLE_tree_open_RDONLY can be frozen.
+ *
+ * @param filename name of the frozen database
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_freeze(struct DOODLE_SuffixTree * tree,
+		       const char * filename);
+
+/**
+ * Write an FM index of the database to the given file.  The
+ * index is another kind of frozen database (see
+ * DOODLE_tree_freeze) that keeps only the Burrows-Wheeler
+ * transform of the keywords of each file with a few sampled
+ * positions, which needs little more space than the keywords
+ * themselves.  Open it with DOODLE_tree_open_RDONLY; exact,
+ * limited and batch searches and DOODLE_tree_count work as
+ * usual, but every file is reported only once and approximate or
+ * case-insensitive searches are refused as well.  Only possible
+ * for unmodified trees opened with DOODLE_tree_open_RDONLY to
+ * which every keyword was added together with all of its
+ * suffixes (as doodle does).
+ *
+ * @param filename name of the FM index
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_build_fm_index(struct DOODLE_SuffixTree * tree,
+			       const char * filename);
+
 
 #ifdef __cplusplus
 }
@@ -57,6 +57,8 @@ static int very_verbose = 0;
  */
 static void printHelp () {
   static Help help[] = {
+    { 'C', "cache", "FILENAME",
+      gettext_noop("keep the extracted keywords in FILENAME and reuse them for unchanged files") },
     { 'd', "database", "FILENAME",
       gettext_noop("use location FILENAME to store doodle database") },
     { 'D', "debug", NULL,
@@ -73,6 +75,8 @@ static void printHelp () {
       gettext_noop("do not load default set of extractor plugins") },
     { 'm', "memory", "SIZE",
       gettext_noop("set the memory limit to SIZE MB (for the tree).") },
+    { 'R', "rules", "FILENAME",
+      gettext_noop("decide with the rules in FILENAME which files are extracted, only indexed by name or skipped") },
     { 'P', "prunepaths", NULL,
       gettext_noop("exclude given paths from building or searching") },
     { 'v', "version", NULL,
@@ -89,6 +93,8 @@ static void printHelp () {
 static int do_debug = 0;
 static int do_default = 1;
 static int do_filenames = 0;
+static char * cacheName = NULL;
+static char * rulesName = NULL;
 static char * prunepaths = "/tmp /usr/tmp /var/tmp /dev /proc /sys";
 
 /* *************** helper functions **************** */
@@ -303,14 +309,8 @@ static int do_index(const char * filename,
     }
   }
 
-  j = -1;
-  for (i=DOODLE_getFileCount(dic->tree)-1;i>=0;i--) {
-    if (0 == strcmp(filename,
-		    DOODLE_getFileAt(dic->tree,i)->filename)) {
-      j = i;
-      break;
-    }
-  }
+  j = DOODLE_tree_lookup_file(dic->tree,
+			      filename);
 
   k = -1;
   for (i=0;i<dic->frPos;i++) {
@@ -425,11 +425,14 @@ static int do_index(const char * filename,
 	     DOODLE_LOG_VERY_VERBOSE,
 	     _("Processing file '%s'.\n"),
 	     filename);
-    return buildIndex(dic->elist,
-		      NULL, 
-		      filename,
-		      dic->tree,
-		      do_filenames);
+    if (0 == buildIndex(dic->elist,
+			NULL, 
+			filename,
+			&sbuf,
+			dic->tree,
+			do_filenames))
+      return 0;
+    return finishIndex(dic->elist);
   }
 
   return 0;
@@ -568,6 +571,7 @@ static int build(const char * libraries,
   unsigned int ret;
   DIC cls;
   char * ename;
+  char * cname;
   FILE * logfile;
   PTHREAD_T workerThread;
   void * unused;
@@ -619,14 +623,41 @@ static int build(const char * libraries,
   if (mem_limit != 0)
     DOODLE_tree_set_memory_limit(cls.tree,
 				 mem_limit);
+  /* files are indexed one at a time as the events arrive */
   cls.elist = forkExtractor(do_default,
 			    libraries,
+			    1,
 			    &my_log,
 			    logfile);
   if (cls.elist == NULL) {
     DOODLE_tree_destroy(cls.tree);
     return -1;
   }
+  if (cacheName != NULL) {
+    cname = expandFileName(cacheName);
+    if ( (cname == NULL) ||
+	 (0 != setExtractorCache(cls.elist,
+				 cname)) )
+      my_log(logfile,
+	     DOODLE_LOG_CRITICAL,
+	     _("Could not use '%s' as extraction cache, extracting all files.\n"),
+	     cacheName);
+    if (cname != NULL)
+      free(cname);
+  }
+  if (rulesName != NULL) {
+    cname = expandFileName(rulesName);
+    if ( (cname == NULL) ||
+	 (0 != setExtractorPolicy(cls.elist,
+				  cname)) ) {
+      if (cname != NULL)
+	free(cname);
+      joinExtractor(cls.elist);
+      DOODLE_tree_destroy(cls.tree);
+      return -1;
+    }
+    free(cname);
+  }
   if (0 != FAMOpen2(&cls.fc, "doodled")) {
     my_log(logfile,
 	   DOODLE_LOG_CRITICAL,
@@ -807,6 +838,7 @@ int main(int argc,
 
   while (1) {
     static struct option long_options[] = {
+      {"cache", 1, 0, 'C'},
       {"database", 1, 0, 'd'},
       {"debug", 0, 0, 'D'},
       {"filenames", 0, 0, 'f'} ,
@@ -816,19 +848,23 @@ int main(int argc,
       {"memory", 1, 0, 'm'},
       {"nodefault", 0, 0, 'n'},
       {"prunepaths", 1, 0, 'P' },
+      {"rules", 1, 0, 'R'},
       {"version", 0, 0, 'v'},
       {"verbose", 0, 0, 'V'},
       {NULL, 0, 0, 0}
     };
     option_index = 0;
     c = getopt_long(argc,
-		    argv, "d:Dfhl:L:m:nP:vV",
+		    argv, "C:d:Dfhl:L:m:nP:R:vV",
 		    long_options,
 		    &option_index);
 
     if (c == -1)
       break; /* No more flags to process */
     switch (c) {
+    case 'C':
+      cacheName = optarg;
+      break;
     case 'd':
       dbName = optarg;
       break;
@@ -865,6 +901,9 @@ int main(int argc,
     case 'P':
       prunepaths = optarg;
       break;
+    case 'R':
+      rulesName = optarg;
+      break;
     case 'V':
       if (verbose == 1)
 	very_verbose = 1;
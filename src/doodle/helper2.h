@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <extractor.h>
 #include "helper1.h"
 #include "doodle.h"
@@ -98,25 +99,67 @@ int scanDirectory(char * dirName,
 
 struct EXTRACT_Process;
 
+/**
+ * Prepare a pool of libextractor processes (started
+ * when they are needed).
+ *
+ * @param workers number of files to process in parallel
+ */
 struct EXTRACT_Process * forkExtractor(int do_default,
 				       const char * libraries,
+				       unsigned int workers,
 				       DOODLE_Logger logger,
 				       void * log_ctx);
 
 void joinExtractor(struct EXTRACT_Process * proc);
 
+/**
+ * Use the given file as a persistent cache of the extracted
+ * keywords: files whose device, inode, size and modification
+ * time did not change are not extracted again.
+ *
+ * @return 0 on success, -1 on error
+ */
+int setExtractorCache(struct EXTRACT_Process * proc,
+		      const char * filename);
 
 /**
- * Find keywords in the given file and append
- * the string describing these keywords to the
- * long string (for the suffix tree).
+ * Read the rules that decide which files are extracted,
+ * which are only indexed by their name and which are
+ * skipped (see index.c for the syntax).  The number of
+ * files that matched each rule is logged (verbose) when
+ * the extractor is joined.
+ *
+ * @return 0 on success, -1 on error
+ */
+int setExtractorPolicy(struct EXTRACT_Process * proc,
+		       const char * filename);
+
+
+/**
+ * Find keywords in the given file and add the file with
+ * these keywords to the tree.  With several extractor
+ * processes, the file may only be added by a later call
+ * or by finishIndex.
+ *
+ * @param sbuf the result of stat for the file (NULL to
+ *        call stat in buildIndex)
  */
 int buildIndex(struct EXTRACT_Process * elist,
 	       FILE * logFile,
 	       const char * filename,
+	       const struct stat * sbuf,
 	       struct DOODLE_SuffixTree * tree,
 	       int do_filenames);
 
+/**
+ * Add all files that are still being processed to
+ * their trees.
+ *
+ * @return 1 on success, 0 on error
+ */
+int finishIndex(struct EXTRACT_Process * elist);
+
 
 /**
  * Maximum search-string length.  If a search-string is more than
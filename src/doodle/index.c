@@ -34,55 +34,841 @@
 #include "gettext.h"
 #include "doodle.h"
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <ctype.h>
+#include <fnmatch.h>
 
 #define DEBUG_IPC 0
 
-typedef struct EXTRACT_Process {
-  char * libs;
-  void * log_ctx;
+/**
+ * Size of the buffer that each extractor process shares with
+ * doodle for passing the keywords of a file.  Keywords that do
+ * not fit are sent through the pipe.
+ */
+#define SHM_SIZE 256 * 1024
+
+/**
+ * @brief one libextractor process
+ */
+typedef struct {
   int send_pipe;
   int read_pipe;
   pid_t pid;
+  /* is the process working on a file? */
+  int busy;
+  /* buffer shared with the process (SHM_SIZE bytes) */
+  char * shm;
+  /* buffer for keywords that did not fit into shm */
+  char * spill;
+  size_t spillSize;
+} EXTRACT_Worker;
+
+/**
+ * @brief the contents of a file as far as the extraction cache
+ *  is concerned (also the header of the records of the cache)
+ */
+typedef struct {
+  unsigned long long dev;
+  unsigned long long ino;
+  unsigned long long size;
+  unsigned long long mtime;
+  /* size of the frame that follows the record */
+  unsigned long long frameSize;
+} CacheRecord;
+
+/**
+ * @brief what to do with a file (see setExtractorPolicy)
+ */
+typedef enum {
+  POLICY_EXTRACT,
+  /* add the file with its name as the only keyword */
+  POLICY_FILENAME,
+  /* do not add the file */
+  POLICY_SKIP
+} PolicyAction;
+
+/**
+ * @brief a rule of the extraction policy
+ */
+typedef struct {
+  PolicyAction action;
+  /* "path", "size", "magic" or "mime" */
+  char test;
+  /* glob for paths and MIME types */
+  char * pattern;
+  /* bytes at the start of the file */
+  unsigned char * magic;
+  unsigned int magicLen;
+  /* size limit, larger files match if above is set */
+  unsigned long long size;
+  int above;
+  /* the rule as given (for reporting) */
+  char * text;
+  /* number of files that matched the rule */
+  unsigned int matches;
+} PolicyRule;
+
+/**
+ * @brief a file that was sent to an extractor process but
+ *  whose keywords have not yet been added to the tree
+ */
+typedef struct {
+  char * filename;
+  unsigned int mod_time;
+  CacheRecord key;
+  /* the keywords if they were found in the cache (the file
+     is then not sent to an extractor process) */
+  char * cached;
+  EXTRACT_Worker * worker;
+  FILE * logFile;
+  struct DOODLE_SuffixTree * tree;
+  int do_filenames;
+} EXTRACT_Job;
+
+typedef struct EXTRACT_Process {
+  char * libs;
+  void * log_ctx;
   int do_default;
   DOODLE_Logger my_log;
+  EXTRACT_Worker * workers;
+  unsigned int workerCount;
+  /* ring of the files being processed (oldest first, at
+     most one for each worker) */
+  EXTRACT_Job * jobs;
+  unsigned int jobStart;
+  unsigned int jobCount;
+  /* the keywords of the file that is added to the tree
+     (mostly pointing into the buffer of the process) */
+  const char ** keywords;
+  unsigned int keywordsSize;
+  /* the extraction cache (see setExtractorCache), cacheFd
+     is -1 if there is none */
+  char * cacheName;
+  int cacheFd;
+  /* size of the header and of the cache file */
+  unsigned long long cacheStart;
+  unsigned long long cacheEnd;
+  /* the newest record for each file (by device and inode) */
+  CacheRecord * cache;
+  unsigned long long * cacheOff;
+  unsigned int cacheCount;
+  /* number of records in the file that were replaced */
+  unsigned int cacheDead;
+  /* hash table of the indices into cache (CACHE_HASH_EMPTY
+     for unused slots, at most half full) */
+  unsigned int * cacheHash;
+  unsigned int cacheHashSize;
+  /* the extraction policy (first matching rule wins) */
+  PolicyRule * rules;
+  unsigned int ruleCount;
+  /* number of files that matched no rule */
+  unsigned int ruleMisses;
 } EXTRACT_Process;
 
 struct EXTRACT_Process * forkExtractor(int do_default,
 				       const char * libraries,
+				       unsigned int workers,
 				       DOODLE_Logger logger,
 				       void * log_ct) {
   EXTRACT_Process * ret;
+  unsigned int i;
+
+  if (workers == 0)
+    workers = 1;
   ret = malloc(sizeof(EXTRACT_Process));
   if (libraries != NULL)
     ret->libs = strdup(libraries);
   else
     ret->libs = NULL;
   ret->do_default = do_default;
-  ret->pid = -1;
-  ret->send_pipe = -1;
-  ret->read_pipe = -1;
+  ret->workers = malloc(sizeof(EXTRACT_Worker) * workers);
+  ret->workerCount = workers;
+  for (i=0;i<workers;i++) {
+    ret->workers[i].pid = -1;
+    ret->workers[i].send_pipe = -1;
+    ret->workers[i].read_pipe = -1;
+    ret->workers[i].busy = 0;
+    ret->workers[i].shm = NULL;
+    ret->workers[i].spill = NULL;
+    ret->workers[i].spillSize = 0;
+  }
+  ret->jobs = malloc(sizeof(EXTRACT_Job) * workers);
+  ret->jobStart = 0;
+  ret->jobCount = 0;
+  ret->keywords = NULL;
+  ret->keywordsSize = 0;
+  ret->cacheName = NULL;
+  ret->cacheFd = -1;
+  ret->cache = NULL;
+  ret->cacheOff = NULL;
+  ret->cacheCount = 0;
+  ret->cacheDead = 0;
+  ret->cacheHash = NULL;
+  ret->cacheHashSize = 0;
+  ret->rules = NULL;
+  ret->ruleCount = 0;
+  ret->ruleMisses = 0;
   ret->my_log = logger;
   ret->log_ctx = log_ct;
   return ret;
 }
 
-void joinExtractor(struct EXTRACT_Process * proc) {
+/**
+ * Stop the given extractor process (it is started again
+ * when it is needed).
+ */
+static void killWorker(EXTRACT_Worker * w) {
   int status;
 
+  if (w->send_pipe != -1)
+    close(w->send_pipe);
+  w->send_pipe = -1;
+  if (w->read_pipe != -1)
+    close(w->read_pipe);
+  w->read_pipe = -1;
+  if (w->pid != -1) {
+    kill(w->pid, SIGTERM);
+    waitpid(w->pid, &status, 0);
+  }
+  w->pid = -1;
+  w->busy = 0;
+  if (w->shm != NULL)
+    munmap(w->shm, SHM_SIZE);
+  w->shm = NULL;
+}
+
+/**
+ * Marker for the unused slots of the cache hash table.
+ */
+#define CACHE_HASH_EMPTY 0xFFFFFFFF
+
+/**
+ * First line of the cache file, followed by the extractor
+ * configuration (a cache of another configuration is dropped).
+ */
+#define CACHE_MAGIC "doodle extraction cache 1\n"
+
+static unsigned int hashFile(const CacheRecord * key) {
+  unsigned long long h;
+
+  h = key->ino * 0x9E3779B97F4A7C15ULL + key->dev;
+  return (unsigned int) (h ^ (h >> 32));
+}
+
+/**
+ * Find the slot of the cache hash table for the file
+ * (device and inode) of the given record.
+ */
+static unsigned int cacheSlot(struct EXTRACT_Process * proc,
+			      const CacheRecord * key) {
+  unsigned int slot;
+  unsigned int index;
+
+  slot = hashFile(key) & (proc->cacheHashSize - 1);
+  while (CACHE_HASH_EMPTY != (index = proc->cacheHash[slot])) {
+    if ( (proc->cache[index].dev == key->dev) &&
+	 (proc->cache[index].ino == key->ino) )
+      break;
+    slot = (slot + 1) & (proc->cacheHashSize - 1);
+  }
+  return slot;
+}
+
+/**
+ * Remember the record at the given offset of the cache file
+ * (replacing the older record of the same file).
+ */
+static void cacheAdd(struct EXTRACT_Process * proc,
+		     const CacheRecord * rec,
+		     unsigned long long off) {
+  unsigned int slot;
+  unsigned int i;
+
+  if (proc->cacheHashSize / 2 <= proc->cacheCount) {
+    free(proc->cacheHash);
+    proc->cacheHashSize = (proc->cacheHashSize == 0) ? 64 : 2 * proc->cacheHashSize;
+    proc->cacheHash = malloc(sizeof(unsigned int) * (size_t) proc->cacheHashSize);
+    memset(proc->cacheHash,
+	   0xFF,
+	   sizeof(unsigned int) * (size_t) proc->cacheHashSize);
+    for (i=0;i<proc->cacheCount;i++)
+      proc->cacheHash[cacheSlot(proc, &proc->cache[i])] = i;
+    proc->cache = realloc(proc->cache,
+			  sizeof(CacheRecord) * (size_t) proc->cacheHashSize / 2);
+    proc->cacheOff = realloc(proc->cacheOff,
+			     sizeof(unsigned long long) * (size_t) proc->cacheHashSize / 2);
+  }
+  slot = cacheSlot(proc, rec);
+  i = proc->cacheHash[slot];
+  if (i == CACHE_HASH_EMPTY) {
+    i = proc->cacheCount++;
+    proc->cacheHash[slot] = i;
+  } else {
+    proc->cacheDead++;
+  }
+  proc->cache[i] = *rec;
+  proc->cacheOff[i] = off;
+}
+
+/**
+ * Stop using the extraction cache.  If most of the records in
+ * the cache file were replaced, the remaining records are
+ * copied into a new file.
+ */
+static void cacheClose(struct EXTRACT_Process * proc) {
+  char * tmpName;
+  char * frame;
+  int fd;
+  unsigned int i;
+  unsigned long long end;
+  size_t hlen;
+
+  if ( (proc->cacheFd != -1) &&
+       (proc->cacheDead > proc->cacheCount) ) {
+    tmpName = malloc(strlen(proc->cacheName) + 2);
+    strcpy(tmpName, proc->cacheName);
+    strcat(tmpName, "~");
+    fd = open(tmpName,
+	      O_CREAT | O_TRUNC | O_WRONLY,
+	      S_IRUSR | S_IWUSR);
+    frame = NULL;
+    if (fd != -1) {
+      /* the header (magic and configuration) */
+      hlen = (size_t) proc->cacheStart;
+      frame = malloc(hlen);
+      end = hlen;
+      if ( ((ssize_t) hlen != pread(proc->cacheFd, frame, hlen, 0)) ||
+	   ((ssize_t) hlen != write(fd, frame, hlen)) )
+	end = 0;
+      for (i=0;(i<proc->cacheCount) && (end != 0);i++) {
+	hlen = sizeof(CacheRecord) + (size_t) proc->cache[i].frameSize;
+	frame = realloc(frame, hlen);
+	if ( ((ssize_t) hlen != pread(proc->cacheFd, frame, hlen, proc->cacheOff[i])) ||
+	     ((ssize_t) hlen != write(fd, frame, hlen)) )
+	  end = 0;
+	end += hlen;
+      }
+      close(fd);
+      if ( (end == 0) ||
+	   (0 != rename(tmpName, proc->cacheName)) )
+	unlink(tmpName);
+    }
+    free(frame);
+    free(tmpName);
+  }
+  if (proc->cacheFd != -1)
+    close(proc->cacheFd);
+  proc->cacheFd = -1;
+  free(proc->cacheName);
+  proc->cacheName = NULL;
+  free(proc->cache);
+  proc->cache = NULL;
+  free(proc->cacheOff);
+  proc->cacheOff = NULL;
+  free(proc->cacheHash);
+  proc->cacheHash = NULL;
+  proc->cacheHashSize = 0;
+  proc->cacheCount = 0;
+  proc->cacheDead = 0;
+}
+
+/**
+ * Use the given file as a cache of the keywords extracted from
+ * files.  Files whose device, inode, size and modification time
+ * are in the cache are not extracted again (so renaming a file
+ * or building a database again is cheap), and the keywords of
+ * all other files are added to the cache.
+ *
+ * @return 0 on success, -1 on error
+ */
+int setExtractorCache(struct EXTRACT_Process * proc,
+		      const char * filename) {
+  CacheRecord rec;
+  char * header;
+  char * buf;
+  size_t hlen;
+  unsigned long long off;
+  struct stat sbuf;
+
+  cacheClose(proc);
+  proc->cacheFd = open(filename,
+		       O_CREAT | O_RDWR,
+		       S_IRUSR | S_IWUSR);
+  if (proc->cacheFd == -1) {
+    proc->my_log(proc->log_ctx,
+		 DOODLE_LOG_CRITICAL,
+		 _("Call to '%s' for file '%s' failed: %s\n"),
+		 "open",
+		 filename,
+		 strerror(errno));
+    return -1;
+  }
+  proc->cacheName = strdup(filename);
+  hlen = strlen(CACHE_MAGIC) + 2 + ((proc->libs == NULL) ? 0 : strlen(proc->libs)) + 2;
+  header = malloc(hlen);
+  sprintf(header,
+	  "%s%d:%s\n",
+	  CACHE_MAGIC,
+	  proc->do_default,
+	  (proc->libs == NULL) ? "" : proc->libs);
+  hlen = strlen(header);
+  buf = malloc(hlen);
+  if ( (0 != fstat(proc->cacheFd, &sbuf)) ||
+       ((ssize_t) hlen != pread(proc->cacheFd, buf, hlen, 0)) ||
+       (0 != memcmp(buf, header, hlen)) ) {
+    /* new file (or another configuration), start over */
+    if ( (0 != ftruncate(proc->cacheFd, 0)) ||
+	 ((ssize_t) hlen != pwrite(proc->cacheFd, header, hlen, 0)) ) {
+      proc->my_log(proc->log_ctx,
+		   DOODLE_LOG_CRITICAL,
+		   _("Call to '%s' for file '%s' failed: %s\n"),
+		   "write",
+		   filename,
+		   strerror(errno));
+      free(buf);
+      free(header);
+      cacheClose(proc);
+      return -1;
+    }
+    sbuf.st_size = hlen;
+  }
+  free(buf);
+  free(header);
+  off = hlen;
+  /* (written so that a corrupt frameSize can not overflow) */
+  while ( (off + sizeof(CacheRecord) <= (unsigned long long) sbuf.st_size) &&
+	  (sizeof(CacheRecord) == pread(proc->cacheFd, &rec, sizeof(CacheRecord), off)) &&
+	  (rec.frameSize <= (unsigned long long) sbuf.st_size - off - sizeof(CacheRecord)) ) {
+    cacheAdd(proc, &rec, off);
+    off += sizeof(CacheRecord) + rec.frameSize;
+  }
+  /* drop an incomplete last record (doodle was interrupted) or
+     everything from a corrupt record on */
+  if ( (off != (unsigned long long) sbuf.st_size) &&
+       (0 != ftruncate(proc->cacheFd, off)) ) {
+    proc->my_log(proc->log_ctx,
+		 DOODLE_LOG_CRITICAL,
+		 _("Call to '%s' for file '%s' failed: %s\n"),
+		 "ftruncate",
+		 filename,
+		 strerror(errno));
+    cacheClose(proc);
+    return -1;
+  }
+  proc->cacheStart = hlen;
+  proc->cacheEnd = off;
+  return 0;
+}
+
+/**
+ * Find the keywords of the file with the given key in the cache.
+ *
+ * @param key the file, the size of the frame is stored in
+ *        key->frameSize
+ * @return the frame with the keywords (to be freed by the
+ *         caller), NULL if the file is not in the cache
+ */
+static char * cacheGet(struct EXTRACT_Process * proc,
+		       CacheRecord * key) {
+  CacheRecord * rec;
+  unsigned int index;
+  char * frame;
+
+  if ( (proc->cacheFd == -1) ||
+       (proc->cacheCount == 0) )
+    return NULL;
+  index = proc->cacheHash[cacheSlot(proc, key)];
+  if (index == CACHE_HASH_EMPTY)
+    return NULL;
+  rec = &proc->cache[index];
+  if ( (rec->size != key->size) ||
+       (rec->mtime != key->mtime) )
+    return NULL; /* the file was changed */
+  frame = malloc((size_t) rec->frameSize);
+  if ((ssize_t) rec->frameSize != pread(proc->cacheFd,
+					frame,
+					(size_t) rec->frameSize,
+					proc->cacheOff[index] + sizeof(CacheRecord))) {
+    free(frame);
+    return NULL;
+  }
+  key->frameSize = rec->frameSize;
+  return frame;
+}
+
+/**
+ * Add the keywords (frame) extracted from the file with the
+ * given key to the cache.
+ */
+static void cachePut(struct EXTRACT_Process * proc,
+		     const CacheRecord * key,
+		     const char * frame,
+		     size_t size) {
+  CacheRecord rec;
+
+  if (proc->cacheFd == -1)
+    return;
+  rec = *key;
+  rec.frameSize = size;
+  if ( (sizeof(CacheRecord) != pwrite(proc->cacheFd,
+				      &rec,
+				      sizeof(CacheRecord),
+				      proc->cacheEnd)) ||
+       ((ssize_t) size != pwrite(proc->cacheFd,
+				 frame,
+				 size,
+				 proc->cacheEnd + sizeof(CacheRecord))) ) {
+    proc->my_log(proc->log_ctx,
+		 DOODLE_LOG_CRITICAL,
+		 _("Call to '%s' for file '%s' failed: %s\n"),
+		 "write",
+		 proc->cacheName,
+		 strerror(errno));
+    cacheClose(proc);
+    return;
+  }
+  cacheAdd(proc, &rec, proc->cacheEnd);
+  proc->cacheEnd += sizeof(CacheRecord) + size;
+}
+
+/**
+ * Number of bytes at the start of a file that are read for
+ * magic and mime rules.
+ */
+#define MAGIC_SIZE 128
+
+/**
+ * @brief a file type that can be recognized by its first bytes
+ */
+typedef struct {
+  const char * mime;
+  unsigned int offset;
+  const char * magic;
+  unsigned int magicLen;
+} MagicType;
+
+/**
+ * Types for "mime" rules (the files that typically take long
+ * to extract without yielding keywords, and some common
+ * documents and media).
+ */
+static MagicType magicTypes[] = {
+  { "application/x-executable", 0, "\177ELF", 4 },
+  { "application/x-archive", 0, "!<arch>\n", 8 },
+  { "application/x-ms-dos-executable", 0, "MZ", 2 },
+  { "application/x-qemu-disk", 0, "QFI\373", 4 },
+  { "application/x-vmdk", 0, "KDMV", 4 },
+  { "application/x-virtualbox-vdi", 64, "\177\020\332\276", 4 },
+  { "application/x-sqlite3", 0, "SQLite format 3", 16 },
+  { "application/x-java-applet", 0, "\312\376\272\276", 4 },
+  { "application/gzip", 0, "\037\213", 2 },
+  { "application/x-bzip2", 0, "BZh", 3 },
+  { "application/x-xz", 0, "\3757zXZ\0", 6 },
+  { "application/zip", 0, "PK\003\004", 4 },
+  { "application/pdf", 0, "%PDF-", 5 },
+  { "image/png", 0, "\211PNG", 4 },
+  { "image/jpeg", 0, "\377\330\377", 3 },
+  { "image/gif", 0, "GIF8", 4 },
+  { "audio/mpeg", 0, "ID3", 3 },
+  { "audio/x-flac", 0, "fLaC", 4 },
+  { "application/ogg", 0, "OggS", 4 },
+  { NULL, 0, NULL, 0 },
+};
+
+/**
+ * Guess the MIME type of a file from its first bytes.
+ *
+ * @return NULL if the type is not known
+ */
+static const char * sniffMime(const unsigned char * head,
+			      unsigned int len) {
+  unsigned int i;
+
+  for (i=0;magicTypes[i].mime != NULL;i++)
+    if ( (magicTypes[i].offset + magicTypes[i].magicLen <= len) &&
+	 (0 == memcmp(&head[magicTypes[i].offset],
+		      magicTypes[i].magic,
+		      magicTypes[i].magicLen)) )
+      return magicTypes[i].mime;
+  return NULL;
+}
+
+static void policyFree(struct EXTRACT_Process * proc) {
+  unsigned int i;
+
+  for (i=0;i<proc->ruleCount;i++) {
+    free(proc->rules[i].pattern);
+    free(proc->rules[i].magic);
+    free(proc->rules[i].text);
+  }
+  free(proc->rules);
+  proc->rules = NULL;
+  proc->ruleCount = 0;
+  proc->ruleMisses = 0;
+}
+
+/**
+ * Parse one line of a policy file.
+ *
+ * @return 0 on success (also for empty lines and comments),
+ *         -1 on syntax errors
+ */
+static int policyParse(struct EXTRACT_Process * proc,
+		       char * line) {
+  PolicyRule rule;
+  char action[16];
+  char test[16];
+  char arg[4096];
+  const char * unit;
+  unsigned int byte;
+  unsigned int i;
+  int n;
+
+  line[strcspn(line, "\r\n")] = '\0';
+  while (isspace((unsigned char) line[0]))
+    line++;
+  if ( (line[0] == '\0') ||
+       (line[0] == '#') )
+    return 0;
+  n = 0;
+  if ( (3 != sscanf(line, "%15s %15s %4095s %n", action, test, arg, &n)) ||
+       (n == 0) ||
+       (line[n] != '\0') )
+    return -1; /* missing or additional fields */
+  memset(&rule, 0, sizeof(PolicyRule));
+  if (0 == strcmp(action, "extract"))
+    rule.action = POLICY_EXTRACT;
+  else if (0 == strcmp(action, "filename"))
+    rule.action = POLICY_FILENAME;
+  else if (0 == strcmp(action, "skip"))
+    rule.action = POLICY_SKIP;
+  else
+    return -1;
+  if ( (0 == strcmp(test, "path")) ||
+       (0 == strcmp(test, "mime")) ) {
+    rule.test = test[0];
+    rule.pattern = strdup(arg);
+  } else if (0 == strcmp(test, "size")) {
+    /* ">100M" or "<1K" */
+    rule.test = 's';
+    if ( (arg[0] != '<') &&
+	 (arg[0] != '>') )
+      return -1;
+    rule.above = (arg[0] == '>');
+    if ( (! isdigit((unsigned char) arg[1])) ||
+	 (1 != sscanf(&arg[1], "%llu%n", &rule.size, &n)) )
+      return -1;
+    unit = &arg[1 + n];
+    if ( (unit[0] != '\0') &&
+	 (unit[1] != '\0') )
+      return -1; /* more than one unit character */
+    switch (unit[0]) {
+    case '\0': break;
+    case 'G': rule.size *= 1024; /* fall through */
+    case 'M': rule.size *= 1024; /* fall through */
+    case 'K': rule.size *= 1024; break;
+    default: return -1;
+    }
+  } else if (0 == strcmp(test, "magic")) {
+    /* hex bytes at the start of the file */
+    rule.test = 'g';
+    n = strlen(arg);
+    if ( (n == 0) ||
+	 (n % 2 != 0) ||
+	 (n / 2 > MAGIC_SIZE) )
+      return -1;
+    rule.magicLen = n / 2;
+    rule.magic = malloc(rule.magicLen);
+    for (i=0;i<rule.magicLen;i++) {
+      if ( (! isxdigit((unsigned char) arg[2*i])) ||
+	   (! isxdigit((unsigned char) arg[2*i+1])) ||
+	   (1 != sscanf(&arg[2*i], "%2x", &byte)) ) {
+	free(rule.magic);
+	return -1;
+      }
+      rule.magic[i] = (unsigned char) byte;
+    }
+  } else
+    return -1;
+  rule.text = strdup(line);
+  proc->rules = realloc(proc->rules,
+			sizeof(PolicyRule) * (proc->ruleCount + 1));
+  proc->rules[proc->ruleCount++] = rule;
+  return 0;
+}
+
+/**
+ * Use the rules in the given file to decide which files are
+ * passed to libextractor.  Each line has the form
+ * "ACTION TEST ARGUMENT" where ACTION is "extract", "filename"
+ * (add the file with its name as the only keyword) or "skip"
+ * (do not add the file) and TEST is one of
+ * "path GLOB", "size >SIZE", "size <SIZE" (with an optional
+ * K, M or G), "magic HEXBYTES" (the first bytes of the file)
+ * or "mime GLOB" (the type guessed from the first bytes).
+ * The first matching rule wins; files that match no rule are
+ * extracted.
+ *
+ * @return 0 on success, -1 on error
+ */
+int setExtractorPolicy(struct EXTRACT_Process * proc,
+		       const char * filename) {
+  FILE * f;
+  char line[FILENAME_MAX + 64];
+  unsigned int lineNo;
+
+  policyFree(proc);
+  f = fopen(filename, "r");
+  if (f == NULL) {
+    proc->my_log(proc->log_ctx,
+		 DOODLE_LOG_CRITICAL,
+		 _("Call to '%s' for file '%s' failed: %s\n"),
+		 "fopen",
+		 filename,
+		 strerror(errno));
+    return -1;
+  }
+  lineNo = 0;
+  while (NULL != fgets(line, sizeof(line), f)) {
+    lineNo++;
+    if ( (NULL == strchr(line, '\n')) &&
+	 (! feof(f)) ) {
+      proc->my_log(proc->log_ctx,
+		   DOODLE_LOG_CRITICAL,
+		   _("Line %u of file '%s' is too long.\n"),
+		   lineNo,
+		   filename);
+      fclose(f);
+      policyFree(proc);
+      return -1;
+    }
+    if (0 != policyParse(proc,
+			 line)) {
+      proc->my_log(proc->log_ctx,
+		   DOODLE_LOG_CRITICAL,
+		   _("Syntax error in line %u of file '%s'.\n"),
+		   lineNo,
+		   filename);
+      fclose(f);
+      policyFree(proc);
+      return -1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+/**
+ * Decide what to do with the given file.
+ */
+static PolicyAction policyCheck(struct EXTRACT_Process * proc,
+				const char * filename,
+				const struct stat * sbuf) {
+  PolicyRule * rule;
+  unsigned char head[MAGIC_SIZE];
+  const char * mime;
+  ssize_t len;
+  unsigned int i;
+  int fd;
+  int match;
+
+  len = -1; /* not yet read */
+  mime = NULL;
+  for (i=0;i<proc->ruleCount;i++) {
+    rule = &proc->rules[i];
+    if ( ( (rule->test == 'g') ||
+	   (rule->test == 'm') ) &&
+	 (len == -1) ) {
+      /* read the first bytes (only once, and only if needed) */
+      len = 0;
+      fd = open(filename, O_RDONLY);
+      if (fd != -1) {
+	len = read(fd, head, sizeof(head));
+	if (len < 0)
+	  len = 0;
+	close(fd);
+      }
+      mime = sniffMime(head,
+		       (unsigned int) len);
+    }
+    switch (rule->test) {
+    case 'p':
+      match = (0 == fnmatch(rule->pattern, filename, 0));
+      break;
+    case 's':
+      if (rule->above)
+	match = ((unsigned long long) sbuf->st_size > rule->size);
+      else
+	match = ((unsigned long long) sbuf->st_size < rule->size);
+      break;
+    case 'g':
+      match = ( (rule->magicLen <= (unsigned int) len) &&
+		(0 == memcmp(head, rule->magic, rule->magicLen)) );
+      break;
+    case 'm':
+      match = ( (mime != NULL) &&
+		(0 == fnmatch(rule->pattern, mime, 0)) );
+      break;
+    default:
+      match = 0;
+    }
+    if (match) {
+      rule->matches++;
+      return rule->action;
+    }
+  }
+  proc->ruleMisses++;
+  return POLICY_EXTRACT;
+}
+
+/**
+ * Report how many files matched each rule of the policy.
+ */
+static void policyReport(struct EXTRACT_Process * proc) {
+  unsigned int i;
+
+  if (proc->ruleCount == 0)
+    return;
+  for (i=0;i<proc->ruleCount;i++)
+    proc->my_log(proc->log_ctx,
+		 DOODLE_LOG_VERBOSE,
+		 _("Extraction policy: %u files matched '%s'.\n"),
+		 proc->rules[i].matches,
+		 proc->rules[i].text);
+  proc->my_log(proc->log_ctx,
+	       DOODLE_LOG_VERBOSE,
+	       _("Extraction policy: %u files matched no rule.\n"),
+	       proc->ruleMisses);
+}
+
+void joinExtractor(struct EXTRACT_Process * proc) {
+  unsigned int i;
+
 #if DEBUG_IPC
   fprintf(stderr, "Joining!\n");
 #endif
-  if (proc->send_pipe != -1)
-    close(proc->send_pipe);
-  if (proc->read_pipe != -1)
-    close(proc->read_pipe);
-  if (proc->pid != -1) {
-    kill(proc->pid, SIGTERM);
-    waitpid(proc->pid, &status, 0);
+  /* files that were not finished are dropped */
+  while (proc->jobCount > 0) {
+    free(proc->jobs[proc->jobStart].filename);
+    free(proc->jobs[proc->jobStart].cached);
+    proc->jobStart = (proc->jobStart + 1) % proc->workerCount;
+    proc->jobCount--;
+  }
+  for (i=0;i<proc->workerCount;i++) {
+    killWorker(&proc->workers[i]);
+    free(proc->workers[i].spill);
   }
+  cacheClose(proc);
+  policyReport(proc);
+  policyFree(proc);
+  free(proc->keywords);
+  free(proc->jobs);
+  free(proc->workers);
   if (proc->libs != NULL)
     free(proc->libs);
   free(proc);
@@ -110,19 +896,37 @@ static int do_read(int fd,
 }
 
 #if DEBUG_IPC
-#define DO_WRITE(fd,data, len) if (len != write(fd,data,len)) { fprintf(stderr, "Write error!\n"); goto ERROR;}
+#define DO_WRITE(fd,data, len) if ((ssize_t) (len) != write(fd,data,len)) { fprintf(stderr, "Write error!\n"); goto ERROR;}
 #else
-#define DO_WRITE(fd,data, len) if (len != write(fd,data,len)) goto ERROR;
+#define DO_WRITE(fd,data, len) if ((ssize_t) (len) != write(fd,data,len)) goto ERROR;
 #endif
 #define DO_READ(fd,data,len) if (do_read(fd,data,len)) goto ERROR;
 #define MAX_SLEN 16 * 1024 * 1024
 
+/**
+ * The keywords of a file are passed from the extractor process
+ * to doodle in one frame: the size of the frame and the number
+ * of keywords followed by the type, the length and the bytes
+ * (and a 0-terminator) of each keyword.  The frame is copied to
+ * the shared buffer of the process and only its size is sent
+ * through the pipe (frames that do not fit into the buffer are
+ * sent through the pipe with a single write).
+ */
+#define FRAME_HEADER (sizeof(size_t) + sizeof(unsigned int))
+
+/**
+ * Keyword count of the frame of a file that the extractor process
+ * could not read (such frames are not cached).
+ */
+#define FRAME_FAILED ((unsigned int) -1)
+
 struct AccuCtx
 {
   unsigned int count;
-  unsigned int size;
-  enum EXTRACTOR_MetaType *types;
-  char ** keywords;
+  /* the frame */
+  char * buf;
+  size_t size;
+  size_t pos;
 };
 
 
@@ -136,27 +940,96 @@ accumulator(void *cls,
 	    size_t data_len)
 {
   struct AccuCtx * ac = cls;
-  unsigned int nsize;
+  size_t slen;
+  size_t need;
+
   if ( (format != EXTRACTOR_METAFORMAT_UTF8) &&
        (format != EXTRACTOR_METAFORMAT_C_STRING) )
     return 0;
-  if (ac->size == ac->count)
+  slen = strlen(data);
+  if (slen == 0)
+    return 0;
+  if (slen > MAX_SLEN)
+    slen = MAX_SLEN; /* cut off -- far too large! */
+  need = ac->pos + sizeof(enum EXTRACTOR_MetaType) + sizeof(size_t) + slen + 1;
+  if (need > ac->size)
     {
-      nsize = 4 + 2 * ac->size;
-      ac->types = realloc (ac->types, nsize * sizeof(enum EXTRACTOR_MetaType));
-      ac->keywords = realloc (ac->keywords, nsize * sizeof(char *));
-      ac->size = nsize;
+      ac->size = need + ac->size;
+      ac->buf = realloc (ac->buf, ac->size);
     }
-  ac->types[ac->count] = type;
-  ac->keywords[ac->count++] = strdup (data);
+  memcpy(&ac->buf[ac->pos], &type, sizeof(enum EXTRACTOR_MetaType));
+  ac->pos += sizeof(enum EXTRACTOR_MetaType);
+  memcpy(&ac->buf[ac->pos], &slen, sizeof(size_t));
+  ac->pos += sizeof(size_t);
+  memcpy(&ac->buf[ac->pos], data, slen);
+  ac->pos += slen;
+  ac->buf[ac->pos++] = '\0';
+  ac->count++;
+  return 0;
+}
+
+
+/**
+ * Run libextractor on the given file.  The file is opened and
+ * mapped once and all plugins work on the mapping (instead of
+ * each plugin opening and reading the file).
+ *
+ * @return 0 on success, -1 if the file could not be read
+ */
+static int extractFile(struct EXTRACTOR_PluginList * list,
+			const char * filename,
+			struct AccuCtx * ac) {
+  struct stat sbuf;
+  void * data;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  if (0 != fstat(fd, &sbuf)) {
+    close(fd);
+    return -1;
+  }
+  if ( (sbuf.st_size == 0) ||
+       ((off_t) (size_t) sbuf.st_size != sbuf.st_size) ) {
+    close(fd);
+    return 0;
+  }
+  data = mmap(NULL,
+	      (size_t) sbuf.st_size,
+	      PROT_READ,
+	      MAP_PRIVATE,
+	      fd,
+	      0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    /* let the plugins read the file themselves */
+    EXTRACTOR_extract(list,
+		      filename,
+		      NULL, 0,
+		      &accumulator,
+		      ac);
+    return 0;
+  }
+  EXTRACTOR_extract(list,
+		    NULL,
+		    data,
+		    (size_t) sbuf.st_size,
+		    &accumulator,
+		    ac);
+  munmap(data,
+	 (size_t) sbuf.st_size);
   return 0;
 }
 
 
 /**
+ * Start the given extractor process.
+ *
  * @return 0 on success, 1 on error.
  */
-static int do_fork(struct EXTRACT_Process * proc) {
+static int do_fork(struct EXTRACT_Process * proc,
+		   EXTRACT_Worker * w) {
   int filedes1[2];
   int filedes2[2];
   char buffer[FILENAME_MAX+2];
@@ -166,6 +1039,7 @@ static int do_fork(struct EXTRACT_Process * proc) {
   struct EXTRACTOR_PluginList * list;
   char * filename;
   struct AccuCtx acc_ctx;
+  unsigned int i;
 
 #if DEBUG_IPC
   fprintf(stderr, "Forking!\n");
@@ -200,29 +1074,63 @@ static int do_fork(struct EXTRACT_Process * proc) {
 		 _("Loading libextractor plugins: '%s'\n"),
 		 proc->libs);  
 
-  proc->pid = fork();
-  if (proc->pid == -1) {
+  w->shm = mmap(NULL,
+		SHM_SIZE,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS,
+		-1,
+		0);
+  if (w->shm == MAP_FAILED) {
+    proc->my_log(proc->log_ctx,
+		 DOODLE_LOG_CRITICAL,
+		 _("Call to '%s' failed: %s\n"),
+		 "mmap",
+		 strerror(errno));
+    w->shm = NULL;
+    close(filedes1[0]);
+    close(filedes1[1]);
+    close(filedes2[0]);
+    close(filedes2[1]);
+    return 1;
+  }
+  w->pid = fork();
+  if (w->pid == -1) {
     proc->my_log(proc->log_ctx,
 		 DOODLE_LOG_CRITICAL,
 		 _("Call to '%s' failed: %s\n"),
 		 "fork",
 		 strerror(errno));
+    munmap(w->shm, SHM_SIZE);
+    w->shm = NULL;
     close(filedes1[0]);
     close(filedes1[1]);
     close(filedes2[0]);
     close(filedes2[1]);
     return 1;
   }
-  if (proc->pid != 0) {
+  if (w->pid != 0) {
     close(filedes1[1]);
     close(filedes2[0]);
-    proc->send_pipe = filedes2[1];
-    proc->read_pipe = filedes1[0];
+    w->send_pipe = filedes2[1];
+    w->read_pipe = filedes1[0];
     return 0;
   }
   /* we're now in the forked process! */
   close(filedes1[0]);
   close(filedes2[1]);
+  /* the other processes must see the end of their input
+     when we are stopped, not when we exit */
+  for (i=0;i<proc->workerCount;i++) {
+    if (proc->workers[i].send_pipe != -1)
+      close(proc->workers[i].send_pipe);
+    if (proc->workers[i].read_pipe != -1)
+      close(proc->workers[i].read_pipe);
+    if ( (proc->workers[i].shm != NULL) &&
+	 (&proc->workers[i] != w) )
+      munmap(proc->workers[i].shm, SHM_SIZE);
+  }
+  if (proc->cacheFd != -1)
+    close(proc->cacheFd);
   list = NULL;
 
   if (proc->do_default)
@@ -232,6 +1140,8 @@ static int do_fork(struct EXTRACT_Process * proc) {
 				       proc->libs,
 				       EXTRACTOR_OPTION_DEFAULT_POLICY);  
   
+  acc_ctx.size = SHM_SIZE;
+  acc_ctx.buf = malloc(acc_ctx.size);
   pos = 0;
   buffer[FILENAME_MAX + 1] = '\0';
   ret = read(filedes2[0], &buffer[pos], FILENAME_MAX + 1 - pos);
@@ -246,209 +1156,343 @@ static int do_fork(struct EXTRACT_Process * proc) {
 	      pos - slen);
       pos = pos - slen;
       acc_ctx.count = 0;
-      acc_ctx.size = 0;
-      acc_ctx.keywords = NULL;
-      acc_ctx.types = NULL;
-      EXTRACTOR_extract(list,
-			filename,
-			NULL, 0,
-			&accumulator,
-			&acc_ctx);
-      DO_WRITE(filedes1[1], &acc_ctx.count, sizeof(unsigned int));
-      while (0 != acc_ctx.count--) {
-	DO_WRITE(filedes1[1], 
-		 &acc_ctx.types[acc_ctx.count],
-		 sizeof(enum EXTRACTOR_MetaType));
-	slen = strlen(acc_ctx.keywords[acc_ctx.count]);
-	if (slen > MAX_SLEN)
-	  slen = MAX_SLEN; /* cut off -- far too large! */
-	DO_WRITE(filedes1[1], &slen, sizeof(size_t));
-	DO_WRITE(filedes1[1], acc_ctx.keywords[acc_ctx.count], slen);
-	free(acc_ctx.keywords[acc_ctx.count]);
+      acc_ctx.pos = FRAME_HEADER;
+      if (-1 == extractFile(list,
+			    filename,
+			    &acc_ctx))
+	acc_ctx.count = FRAME_FAILED;
+      free(filename);
+      memcpy(acc_ctx.buf, &acc_ctx.pos, sizeof(size_t));
+      memcpy(&acc_ctx.buf[sizeof(size_t)], &acc_ctx.count, sizeof(unsigned int));
+      if (acc_ctx.pos <= SHM_SIZE) {
+	memcpy(w->shm, acc_ctx.buf, acc_ctx.pos);
+	DO_WRITE(filedes1[1], acc_ctx.buf, sizeof(size_t));
+      } else {
+	DO_WRITE(filedes1[1], acc_ctx.buf, acc_ctx.pos);
       }
-      free (acc_ctx.keywords);
-      free (acc_ctx.types);
-      acc_ctx.keywords = NULL;
-      acc_ctx.types = NULL;
-      acc_ctx.size = 0;
     }
     ret = read(filedes2[0], &buffer[pos], FILENAME_MAX + 1 - pos);
   }
   /* exit / cleanup */
  ERROR:
-  free (acc_ctx.keywords);
-  free (acc_ctx.types);
+  free (acc_ctx.buf);
   EXTRACTOR_plugin_remove_all (list);
   close(filedes2[0]);
   close(filedes1[1]);
-  /* never return - we were forked! */
-  exit(0);
+  /* never return - we were forked!  (_exit: the stdio
+     buffers copied from doodle, for example of the keyword
+     log, must not be flushed a second time) */
+  _exit(0);
   return 1; /* eh, dead */
 }
 
 
-struct KeywordList {
-  /* the keyword that was found */
-  char * keyword;
-  /* the type of the keyword (classification) */
-  enum EXTRACTOR_MetaType keywordType;
-  /* the next entry in the list */
-  struct KeywordList * next;
-};
+/**
+ * Send the given file to an extractor process (that is
+ * started if needed).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int
+sendFile(struct EXTRACT_Process * eproc,
+	 EXTRACT_Worker * w,
+	 const char * filename) {
+  if (w->pid == -1)
+    if (0 != do_fork(eproc, w))
+      return 1;
+  if (w->pid == -1)
+    return 1;
+  fprintf(stderr, "Processing file %s\n", filename);
+  DO_WRITE(w->send_pipe, filename, strlen(filename)+1);
+  w->busy = 1;
+  return 0;
+ ERROR:
+#if DEBUG_IPC
+  fprintf(stderr, "WRITE ERROR!\n");
+#endif
+  killWorker(w);
+  return 1;
+}
 
+/**
+ * Read the frame with the keywords of the file that was sent
+ * to the given extractor process.  If the process fails (for
+ * example because libextractor crashed on the file), it is
+ * stopped and the file has no keywords.
+ *
+ * @param size set to the size of the frame (0 on error)
+ * @return the frame (in the buffer shared with the process or
+ *         in the spill buffer), NULL on error
+ */
+static const char *
+getFrame(EXTRACT_Worker * w,
+	 size_t * size) {
+  const char * frame;
 
-static void 
-freeKeywords (struct KeywordList * keywords)
-{
-  struct KeywordList *prev;
-  while (keywords != NULL)
-    {
-      prev = keywords;
-      keywords = keywords->next;
-      free (prev->keyword);
-      free (prev);
+  *size = 0;
+  if (! w->busy)
+    return NULL;
+  DO_READ(w->read_pipe, size, sizeof(size_t));
+  if ( (*size < FRAME_HEADER) ||
+       (*size > 16 * MAX_SLEN) )
+    goto ERROR; /* far too large! something must have gone wrong! */
+  if (*size <= SHM_SIZE) {
+    frame = w->shm;
+  } else {
+    if (w->spillSize < *size) {
+      free(w->spill);
+      w->spill = malloc(*size);
+      w->spillSize = *size;
     }
+    memcpy(w->spill, size, sizeof(size_t));
+    DO_READ(w->read_pipe,
+	    &w->spill[sizeof(size_t)],
+	    *size - sizeof(size_t));
+    frame = w->spill;
+  }
+  w->busy = 0;
+  return frame;
+ ERROR:
+#if DEBUG_IPC
+  fprintf(stderr, "READ ERROR!\n");
+#endif
+  *size = 0;
+  killWorker(w);
+  return NULL;  
 }
 
 
-
-static struct KeywordList * 
-getKeywords(struct EXTRACT_Process * eproc,
-	    const char * filename) {
-  struct KeywordList * pos;
-  struct KeywordList * next;
-  struct KeywordList * head;
+/**
+ * Add the file of the given job with the keywords in the
+ * given frame to the tree.  The keywords are used in place
+ * (only long keywords are copied in sections).
+ *
+ * @return 1 on success, 0 on error
+ */
+static int addKeywords(struct EXTRACT_Process * eproc,
+		       EXTRACT_Job * job,
+		       const char * frame,
+		       size_t size) {
+  char ** sections;
+  unsigned int sectionCount;
   unsigned int count;
+  unsigned int n;
+  size_t pos;
   size_t slen;
-  int status;
+  size_t j;
+  int words;
+  int ret;
 
-  if (eproc->pid == -1)
-    if (0 != do_fork(eproc))
-      return NULL;
-  if (eproc->pid == -1)
-    return NULL;
-  fprintf(stderr, "Processing file %s\n", filename);
-  head = NULL;
-  pos = NULL;
-  next = NULL;
-  DO_WRITE(eproc->send_pipe, filename, strlen(filename)+1);
-  DO_READ(eproc->read_pipe, &count, sizeof(unsigned int));
+  words = DOODLE_tree_get_word_index(job->tree);
+  sections = NULL;
+  sectionCount = 0;
+  n = 0;
+  count = 0;
+  if (size >= FRAME_HEADER)
+    memcpy(&count, &frame[sizeof(size_t)], sizeof(unsigned int));
+  if (count == FRAME_FAILED)
+    count = 0;
+  pos = FRAME_HEADER;
   while (count-- > 0) {
-    next = malloc(sizeof(struct KeywordList));
-    DO_READ(eproc->read_pipe, &next->keywordType, sizeof(enum EXTRACTOR_MetaType));
-    DO_READ(eproc->read_pipe, &slen, sizeof(size_t));
-    if (slen == 0)
-    {
-      free(next);
-      next = NULL;
-      continue;
+    if (pos + sizeof(enum EXTRACTOR_MetaType) + sizeof(size_t) > size)
+      break; /* truncated frame */
+    memcpy(&slen,
+	   &frame[pos + sizeof(enum EXTRACTOR_MetaType)],
+	   sizeof(size_t));
+    pos += sizeof(enum EXTRACTOR_MetaType) + sizeof(size_t);
+    if ( (slen > MAX_SLEN) ||
+	 (pos + slen + 1 > size) ||
+	 (frame[pos + slen] != '\0') )
+      break; /* corrupt frame */
+    if (job->logFile != NULL)
+      fprintf(job->logFile, "%s\n", &frame[pos]);
+    /* long keywords are split into overlapping sections,
+       except for word indices */
+    if ( (! words) &&
+	 (slen > MAX_LENGTH) ) {
+      j = (slen + MAX_LENGTH/2 - 1) / (MAX_LENGTH/2);
+      sections = realloc(sections,
+			 (sectionCount + j) * sizeof(char*));
+    } else
+      j = 1;
+    if (n + j + 2 > eproc->keywordsSize) {
+      eproc->keywordsSize = 2 * eproc->keywordsSize + j + 2;
+      eproc->keywords = realloc(eproc->keywords,
+				eproc->keywordsSize * sizeof(char*));
     }
-    if (slen > MAX_SLEN) 
-      goto ERROR; /* too large! something must have gone wrong! */
-    if (pos == NULL) {
-      pos = next;
-      next = NULL;
-      head = pos;
+    if (j == 1) {
+      eproc->keywords[n++] = &frame[pos];
     } else {
-      pos->next = next;
-      next = NULL;
-      pos = pos->next;
+      for (j=0;j<slen;j+=MAX_LENGTH/2) {
+	sections[sectionCount] = malloc(MAX_LENGTH+1);
+	sections[sectionCount][MAX_LENGTH] = '\0';
+	strncpy(sections[sectionCount],
+		&frame[pos + j],
+		MAX_LENGTH);
+	eproc->keywords[n++] = sections[sectionCount++];
+      }
     }
-    pos->next = NULL;
-    pos->keyword = malloc(slen + 1);
-    pos->keyword[slen] = '\0';
-    DO_READ(eproc->read_pipe, pos->keyword, slen);
-  }  
-  return head;
- ERROR:
-#if DEBUG_IPC
-  fprintf(stderr, "READ ERROR!\n");
-#endif
-  if (next != NULL)
-    free(next);
-  freeKeywords(head);
-  if (eproc->send_pipe != -1)
-    close(eproc->send_pipe);
-  eproc->send_pipe = -1;
-  if (eproc->read_pipe != -1)
-    close(eproc->read_pipe);
-  eproc->read_pipe = -1;
-  if (eproc->pid != -1) {
-    kill(eproc->pid, SIGTERM); 
-    waitpid(eproc->pid, &status, 0);
-  }
-  eproc->pid = -1;
-  return NULL;  
+    pos += slen + 1;
+  }
+  if (n + 2 > eproc->keywordsSize) {
+    eproc->keywordsSize = n + 2;
+    eproc->keywords = realloc(eproc->keywords,
+			      eproc->keywordsSize * sizeof(char*));
+  }
+  if (job->do_filenames)
+    eproc->keywords[n++] = job->filename;
+  eproc->keywords[n] = NULL;
+  ret = DOODLE_tree_expand_file(job->tree,
+				job->filename,
+				job->mod_time,
+				eproc->keywords);
+  while (sectionCount > 0)
+    free(sections[--sectionCount]);
+  free(sections);
+  return (ret == 0) ? 1 : 0;
+}
+
+/**
+ * Wait for the oldest file that is being processed and add
+ * it to the tree.
+ *
+ * @return 1 on success, 0 on error
+ */
+static int finishJob(struct EXTRACT_Process * eproc) {
+  EXTRACT_Job * job;
+  const char * frame;
+  size_t size;
+  unsigned int count;
+  int ret;
+
+  job = &eproc->jobs[eproc->jobStart];
+  if (job->cached != NULL) {
+    frame = job->cached;
+    size = (size_t) job->key.frameSize;
+  } else if (job->worker == NULL) {
+    frame = NULL; /* not to be extracted */
+    size = 0;
+  } else {
+    frame = getFrame(job->worker,
+		     &size);
+    if ( (frame != NULL) &&
+	 (size >= FRAME_HEADER) )
+      memcpy(&count, &frame[sizeof(size_t)], sizeof(unsigned int));
+    else
+      count = FRAME_FAILED;
+    if (count != FRAME_FAILED) /* only cache files that could be read */
+      cachePut(eproc,
+	       &job->key,
+	       frame,
+	       size);
+  }
+  ret = addKeywords(eproc,
+		    job,
+		    frame,
+		    size);
+  free(job->cached);
+  free(job->filename);
+  eproc->jobStart = (eproc->jobStart + 1) % eproc->workerCount;
+  eproc->jobCount--;
+  return ret;
+}
+
+/**
+ * Wait for all files that are still being processed and
+ * add them to the tree.
+ *
+ * @return 1 on success, 0 on error
+ */
+int finishIndex(struct EXTRACT_Process * eproc) {
+  int ret;
+
+  ret = 1;
+  while (eproc->jobCount > 0)
+    if (0 == finishJob(eproc))
+      ret = 0;
+  return ret;
 }
 
 
 /**
- * Find keywords in the given file and append
- * the string describing these keywords to the
- * long string (for the suffix tree).
+ * Find keywords in the given file and add the file with
+ * these keywords to the tree.  The file is passed to an
+ * idle extractor process; the tree is only updated once
+ * all files passed before have been added (so with several
+ * extractor processes, the call may return before the file
+ * is in the tree, see finishIndex).
+ *
+ * @param sbuf the result of stat for the file (NULL to
+ *        call stat here)
+ * @return 1 on success, 0 on error
  */
 int buildIndex(struct EXTRACT_Process * eproc,
 	       FILE * logFile,
 	       const char * filename,
+	       const struct stat * sbuf,
 	       struct DOODLE_SuffixTree * tree,
 	       int do_filenames) {
-  struct KeywordList * head;
-  struct KeywordList * pos;
-
-  head = getKeywords(eproc, filename); 
-  pos  = head;
-  while (pos != NULL) {
-    char * cpos;
-    size_t slen;
-
-    cpos = pos->keyword;
-    if (logFile != NULL)
-      fprintf(logFile, "%s\n", cpos);
-    slen = strlen(cpos);
-    if (slen > MAX_LENGTH) {
-      char section[MAX_LENGTH+1];
-      char * xpos;
-      int j;
-
-      section[MAX_LENGTH] = '\0';
-      for (j=0;j<slen;j+=MAX_LENGTH/2) {
-	strncpy(section,
-		&cpos[j],
-		MAX_LENGTH);
-	xpos = &section[0];
-	while (xpos[0] != '\0') {
-	  if (0 != DOODLE_tree_expand(tree,
-				      xpos,
-				      filename)) {
-	    freeKeywords(head);
-	    return 0;
-	  }
-	  xpos++;
-	}
-      }
-    } else {
-      while (cpos[0] != '\0') {
-	if (0 != DOODLE_tree_expand(tree,
-				    cpos,
-				    filename)) {
-	  freeKeywords(head);
-	  return 0;
-	}
-	cpos++;
-      }
-    }
-    pos = pos->next;
-  }
-  freeKeywords(head);
-  if (do_filenames) {
-    const char * cpos = filename;
-    while (cpos[0] != '\0') {
-      if (0 != DOODLE_tree_expand(tree,
-				  cpos,
-				  filename))
-	return 0;
-      cpos++;
+  EXTRACT_Job * job;
+  struct stat st;
+  PolicyAction action;
+  unsigned int i;
+  int ret;
+
+  if (sbuf == NULL) {
+    if (0 != stat(filename,
+		  &st))
+      return 0;
+    sbuf = &st;
+  }
+  for (i=0;i<eproc->jobCount;i++)
+    if (0 == strcmp(filename,
+		    eproc->jobs[(eproc->jobStart + i) % eproc->workerCount].filename)) {
+      eproc->my_log(eproc->log_ctx,
+		    DOODLE_LOG_VERBOSE,
+		    _("File '%s' is already being processed, ignoring it.\n"),
+		    filename);
+      return 1;
     }
+  action = policyCheck(eproc,
+		       filename,
+		       sbuf);
+  if (action == POLICY_SKIP)
+    return 1;
+  ret = 1;
+  if (eproc->jobCount == eproc->workerCount)
+    ret = finishJob(eproc);
+  job = &eproc->jobs[(eproc->jobStart + eproc->jobCount) % eproc->workerCount];
+  job->filename = strdup(filename);
+  job->mod_time = (unsigned int) sbuf->st_mtime;
+  job->logFile = logFile;
+  job->tree = tree;
+  job->do_filenames = do_filenames;
+  job->key.dev = (unsigned long long) sbuf->st_dev;
+  job->key.ino = (unsigned long long) sbuf->st_ino;
+  job->key.size = (unsigned long long) sbuf->st_size;
+  job->key.mtime = (unsigned long long) sbuf->st_mtime;
+  job->key.frameSize = 0;
+  job->worker = NULL;
+  job->cached = NULL;
+  eproc->jobCount++;
+  if (action == POLICY_FILENAME) {
+    job->do_filenames = 1;
+    return ret;
   }
-  return 1;
+  job->cached = cacheGet(eproc,
+			 &job->key);
+  if (job->cached != NULL)
+    return ret; /* no need to extract again */
+  for (i=0;i<eproc->workerCount;i++)
+    if (! eproc->workers[i].busy)
+      job->worker = &eproc->workers[i];
+  if (0 != sendFile(eproc,
+		    job->worker,
+		    filename)) {
+    /* add the file without keywords right away
+       (once the files before it are done) */
+    if (0 == finishIndex(eproc))
+      ret = 0;
+  }
+  return ret;
 }
@@ -0,0 +1,195 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testbatch.c
+ * @brief Testcase for batched searches, compares the results
+ *  with those of individual searches
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 16
+#define QUERIES 200
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+static char * queries[QUERIES];
+
+static unsigned int single[QUERIES];
+
+static unsigned int batched[QUERIES];
+
+static int lastQuery;
+
+static int order;
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  (*(unsigned int*) arg)++;
+}
+
+static void batchCounter(unsigned int query,
+			 const DOODLE_FileInfo * fi,
+			 void * arg) {
+  /* results must be grouped by query */
+  if ( (lastQuery != -1) &&
+       (lastQuery != (int) query) &&
+       (strcmp(queries[lastQuery], queries[query]) > 0) )
+    order = 1;
+  lastQuery = query;
+  batched[query]++;
+}
+
+static int check(struct DOODLE_SuffixTree * tree) {
+  unsigned int results[QUERIES];
+  int total;
+  int ret;
+  int i;
+
+  total = 0;
+  for (i=0;i<QUERIES;i++) {
+    single[i] = 0;
+    batched[i] = 0;
+    DOODLE_tree_search(tree,
+		       queries[i],
+		       &counter,
+		       &single[i]);
+    total += single[i];
+  }
+  lastQuery = -1;
+  order = 0;
+  ret = DOODLE_tree_search_batch(tree,
+				 (const char**) queries,
+				 QUERIES,
+				 &batchCounter,
+				 NULL,
+				 results);
+  if (ret != total)
+    ABORT();
+  if (order != 0)
+    ABORT();
+  for (i=0;i<QUERIES;i++)
+    if ( (single[i] != batched[i]) ||
+	 (results[i] != single[i]) )
+      ABORT();
+  if (total == 0)
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  char key[32];
+  int i;
+  int j;
+  int k;
+  int len;
+
+  srand(42);
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    for (k=0;k<20;k++) {
+      len = 4 + rand() % 12;
+      for (j=0;j<len;j++)
+	key[j] = 'a' + rand() % 4;
+      key[len] = '\0';
+      for (j=0;j<len;j++)
+	if (0 != DOODLE_tree_expand(tree,
+				    &key[j],
+				    names[i]))
+	  ABORT();
+    }
+  }
+  for (i=0;i<QUERIES;i++) {
+    len = rand() % 8;
+    queries[i] = malloc(len + 1);
+    for (j=0;j<len;j++)
+      queries[i][j] = 'a' + rand() % 5;
+    queries[i][len] = '\0';
+  }
+  if (0 != check(tree))
+    ABORT();
+  if (0 != DOODLE_tree_search_batch(tree,
+				    (const char**) queries,
+				    0,
+				    &batchCounter,
+				    NULL,
+				    NULL))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<QUERIES;i++)
+    free(queries[i]);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
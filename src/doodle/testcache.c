@@ -0,0 +1,243 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testcache.c
+ * @brief Testcase for the result cache
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 32
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+#define MAX_RESULTS 4096
+
+typedef struct {
+  const DOODLE_FileInfo * results[MAX_RESULTS];
+  int count;
+} Collector;
+
+static void collect(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  Collector * c = arg;
+
+  if (c->count < MAX_RESULTS)
+    c->results[c->count] = fi;
+  c->count++;
+}
+
+/**
+ * Run the search with and without the cache and compare.
+ */
+static int compare(struct DOODLE_SuffixTree * tree,
+		   const char * query,
+		   unsigned int approx,
+		   int ignore_case) {
+  static Collector a;
+  static Collector b;
+  int ret;
+  int i;
+
+  a.count = 0;
+  b.count = 0;
+  if ( (approx == 0) && (ignore_case == 0) )
+    ret = DOODLE_tree_search(tree, query, &collect, &a);
+  else
+    ret = DOODLE_tree_search_approx(tree, approx, ignore_case, query,
+				    &collect, &a);
+  if (ret != a.count)
+    ABORT();
+  tree->cacheSize = 0; /* bypass the cache (but keep it) */
+  if ( (approx == 0) && (ignore_case == 0) )
+    ret = DOODLE_tree_search(tree, query, &collect, &b);
+  else
+    ret = DOODLE_tree_search_approx(tree, approx, ignore_case, query,
+				    &collect, &b);
+  tree->cacheSize = 2;
+  if ( (ret != b.count) || (a.count != b.count) )
+    ABORT();
+  for (i=0;i<a.count && i<MAX_RESULTS;i++)
+    if (a.results[i] != b.results[i])
+      ABORT();
+  return a.count;
+}
+
+static int check(struct DOODLE_SuffixTree * tree) {
+  int total;
+  int ret;
+  int i;
+
+  DOODLE_tree_set_cache_size(tree, 2);
+  for (i=0;i<3;i++) {
+    /* first round fills the cache, then hits (and evictions) */
+    total = compare(tree, "ab", 0, 0);
+    if (total < 10)
+      ABORT();
+    if (-1 == compare(tree, "ab", 1, 0))
+      ABORT();
+    if (-1 == compare(tree, "cd", 0, 1))
+      ABORT();
+    if (-1 == compare(tree, "x", 0, 0))
+      ABORT();
+  }
+  /* the same query in different case shares the entry */
+  ret = compare(tree, "AB", 0, 1);
+  if (ret != compare(tree, "ab", 0, 1))
+    ABORT();
+  if (ret < total)
+    ABORT();
+  if (tree->read_only)
+    return 0;
+  /* changes of the tree invalidate the cache */
+  if ( (0 != DOODLE_tree_expand(tree, "abx", names[0])) ||
+       (0 != DOODLE_tree_expand(tree, "x", names[0])) )
+    ABORT();
+  if (compare(tree, "ab", 0, 0) != total + 1)
+    ABORT();
+  if (compare(tree, "x", 0, 0) != 1)
+    ABORT();
+  if (0 != DOODLE_tree_truncate(tree, names[0]))
+    ABORT();
+  if (compare(tree, "x", 0, 0) != 0)
+    ABORT();
+  if (compare(tree, "ab", 0, 0) > total)
+    ABORT();
+  return 0;
+}
+
+/**
+ * With the case-folded tree, queries that only differ in the
+ * case of non-ASCII characters share the cache entry, too.
+ */
+static int checkFolded() {
+  struct DOODLE_SuffixTree * tree;
+  int used;
+  int ret;
+  int i;
+
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if ( (0 != DOODLE_tree_set_case_folding(tree, 1)) ||
+       (0 != DOODLE_tree_expand(tree, "\xc3\x89" "clair", names[0])) ||
+       (0 != DOODLE_tree_expand(tree, "\xc3\xa9" "clat", names[1])) )
+    ABORT();
+  DOODLE_tree_set_cache_size(tree, 2);
+  ret = compare(tree, "\xc3\x89" "CL", 0, 1);
+  if ( (ret != 2) ||
+       (ret != compare(tree, "\xc3\xa9" "cl", 0, 1)) )
+    ABORT();
+  used = 0;
+  for (i=0;i<tree->cacheSize;i++)
+    if (tree->cache[i].query != NULL)
+      used++;
+  if (used != 1)
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  char key[32];
+  int i;
+  int j;
+  int k;
+  int len;
+
+  srand(42);
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    for (k=0;k<10;k++) {
+      len = 4 + rand() % 12;
+      for (j=0;j<len;j++)
+	key[j] = 'a' + rand() % 4;
+      key[len] = '\0';
+      for (j=0;j<len;j++)
+	if (0 != DOODLE_tree_expand(tree,
+				    &key[j],
+				    names[i]))
+	  ABORT();
+    }
+  }
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  if (0 != checkFolded())
+    ABORT();
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testcasefold.c
+ * @brief Testcase for the case-folded index, checks that
+ *  case-insensitive searches find the right files (also for
+ *  non-ASCII characters) and that the index survives
+ *  serialization and removal of files
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 5
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * keys[FILES] = {
+  "MiXeD CaSe",
+  "mixed case",
+  "\xc3\x84rger \xc3\xbc" "ber Stra\xc3\x9f" "en", /* Ärger über Straßen */
+  "\xce\xa3\xce\x9f\xce\xa6\xce\x99\xce\x91", /* ΣΟΦΙΑ */
+  "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82", /* Привет */
+};
+
+static char * names[FILES];
+
+static int found[FILES];
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  int i;
+
+  for (i=0;i<FILES;i++)
+    if (0 == strcmp(fi->filename,
+		    names[i]))
+      found[i] = 1;
+}
+
+/**
+ * Search case-insensitively.
+ * @return bitmask of the files found, -1 on error
+ */
+static int search(struct DOODLE_SuffixTree * tree,
+		  const char * query) {
+  int ret;
+  int i;
+
+  memset(found, 0, sizeof(found));
+  if (-1 == DOODLE_tree_search_approx(tree,
+				      0,
+				      1,
+				      query,
+				      &counter,
+				      NULL))
+    return -1;
+  ret = 0;
+  for (i=0;i<FILES;i++)
+    if (found[i])
+      ret |= (1 << i);
+  return ret;
+}
+
+static int check(struct DOODLE_SuffixTree * tree,
+		 int have) {
+  if ((3 & have) != search(tree, "mixed"))
+    ABORT();
+  if ((3 & have) != search(tree, "MIXED CASE"))
+    ABORT();
+  if ((3 & have) != search(tree, "Xed c"))
+    ABORT();
+  if ((4 & have) != search(tree, "\xc3\xa4rger")) /* ärger */
+    ABORT();
+  if ((4 & have) != search(tree, "\xc3\x9c" "BER")) /* ÜBER */
+    ABORT();
+  if ((4 & have) != search(tree, "stra\xc3\x9f")) /* straß */
+    ABORT();
+  if ((8 & have) != search(tree, "\xcf\x83\xce\xbf\xcf\x86")) /* σοφ */
+    ABORT();
+  if ((8 & have) != search(tree, "\xce\xa6\xce\xb9\xce\xb1")) /* Φια */
+    ABORT();
+  if ((16 & have) != search(tree, "\xd0\xbf\xd1\x80\xd0\x98")) /* прИ */
+    ABORT();
+  if (0 != search(tree, "mixes"))
+    ABORT();
+  if (0 != search(tree, "strass"))
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  const char * kill[2];
+  int i;
+  int j;
+
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (0 != DOODLE_tree_set_case_folding(tree, 1))
+    ABORT();
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    for (j=0;keys[i][j] != '\0';j++)
+      if (0 != DOODLE_tree_expand(tree,
+				  &keys[i][j],
+				  names[i]))
+	ABORT();
+  }
+  if (0 != check(tree, 31))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree, 31))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (tree == NULL)
+    ABORT();
+  kill[0] = names[0];
+  kill[1] = NULL;
+  if (0 != DOODLE_tree_truncate_multiple(tree,
+					 kill))
+    ABORT();
+  if (0 != check(tree, 30))
+    ABORT();
+  /* the folded index cannot be added to a non-empty database */
+  if (0 != DOODLE_tree_set_case_folding(tree, 0))
+    ABORT();
+  if (-1 != DOODLE_tree_set_case_folding(tree, 1))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (tree->fold != 0)
+    ABORT();
+  if (2 != search(tree, "MIXED"))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
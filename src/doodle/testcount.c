@@ -0,0 +1,238 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testcount.c
+ * @brief Testcase for counting the files matching a query,
+ *  checks that the counts (and the paginated results) obtained
+ *  from the stored aggregates match those of a full search,
+ *  also after the database was modified
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+/* ...and store the lists of files even for small subtrees */
+#define AGGREGATE_THRESHOLD 4
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 64
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES + 1];
+
+static int counts[FILES + 1];
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  int i;
+
+  for (i=0;i<=FILES;i++)
+    if ( (names[i] != NULL) &&
+	 (0 == strcmp(fi->filename,
+		      names[i])) )
+      counts[i]++;
+}
+
+/**
+ * @return number of distinct files in counts
+ */
+static int distinct() {
+  int ret;
+  int i;
+
+  ret = 0;
+  for (i=0;i<=FILES;i++)
+    if (counts[i] > 0)
+      ret++;
+  return ret;
+}
+
+/**
+ * Check that DOODLE_tree_count and paging through the results
+ * agree with a full search for the given query.
+ * @return number of files found, -1 on error
+ */
+static int check_query(struct DOODLE_SuffixTree * tree,
+		       const char * query) {
+  struct DOODLE_SearchCursor * cursor;
+  int expect;
+  int total;
+  int ret;
+  int i;
+
+  memset(counts, 0, sizeof(counts));
+  if (-1 == DOODLE_tree_search(tree,
+			       query,
+			       &counter,
+			       NULL))
+    return -1;
+  expect = distinct();
+  if (expect != DOODLE_tree_count(tree,
+				  query))
+    return -1;
+  memset(counts, 0, sizeof(counts));
+  cursor = DOODLE_tree_search_open(tree,
+				   query,
+				   3);
+  if (cursor == NULL)
+    return -1;
+  total = 0;
+  while (0 < (ret = DOODLE_tree_search_next(cursor,
+					    5,
+					    &counter,
+					    NULL)))
+    total += ret;
+  DOODLE_tree_search_close(cursor);
+  if (ret == -1)
+    return -1;
+  for (i=0;i<=FILES;i++)
+    if (counts[i] > 1)
+      return -1;
+  if (total != ((expect > 3) ? expect - 3 : 0))
+    return -1;
+  return expect;
+}
+
+static int check(struct DOODLE_SuffixTree * tree,
+		 int extra) {
+  if (FILES + extra != check_query(tree, "a"))
+    ABORT();
+  if (FILES + extra != check_query(tree, "-"))
+    ABORT();
+  if (FILES / 2 + extra != check_query(tree, "even"))
+    ABORT();
+  if (FILES / 2 != check_query(tree, "odd"))
+    ABORT();
+  if (FILES / 16 != check_query(tree, "rare"))
+    ABORT();
+  if (1 != check_query(tree, "key-17-"))
+    ABORT();
+  if (11 + extra != check_query(tree, "key-1"))
+    ABORT();
+  if (0 != check_query(tree, "nothing"))
+    ABORT();
+  return 0;
+}
+
+/**
+ * Add file number n (as names[i]) to the tree.
+ */
+static int add(struct DOODLE_SuffixTree * tree,
+	       int i,
+	       int n) {
+  char key[64];
+  int j;
+
+  names[i] = malloc(strlen(TNAME) + 20);
+  sprintf(names[i],
+	  "%s.%d",
+	  TNAME,
+	  n);
+  fclose(fopen(names[i], "a+"));
+  sprintf(key,
+	  "key-%d-%s-%sabracadabra",
+	  n,
+	  (n % 2 == 0) ? "even" : "odd",
+	  (n % 16 == 15) ? "rare-" : "");
+  for (j=0;key[j] != '\0';j++)
+    if (0 != DOODLE_tree_expand(tree,
+				&key[j],
+				names[i]))
+      ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  int i;
+
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++)
+    if (0 != add(tree, i, i))
+      ABORT();
+  if (0 != check(tree, 0))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree, 0))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  /* add a file, the aggregates on the path must not be used */
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != add(tree, FILES, 100))
+    ABORT();
+  if (0 != check(tree, 1))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree, 1))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<=FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
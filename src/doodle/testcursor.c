@@ -0,0 +1,179 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testcursor.c
+ * @brief Testcase for paginated searches, checks that paging
+ *  through the results (with swapping between the pages)
+ *  yields each matching file exactly once
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 40
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+static int counts[FILES];
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  int i;
+
+  for (i=0;i<FILES;i++)
+    if (0 == strcmp(fi->filename,
+		    names[i]))
+      counts[i]++;
+}
+
+/**
+ * Page through the results for the given query.
+ * @return number of files found, -1 on error
+ */
+static int page(struct DOODLE_SuffixTree * tree,
+		const char * query,
+		unsigned int offset,
+		unsigned int limit) {
+  struct DOODLE_SearchCursor * cursor;
+  int total;
+  int ret;
+  int i;
+
+  memset(counts, 0, sizeof(counts));
+  cursor = DOODLE_tree_search_open(tree,
+				   query,
+				   offset);
+  if (cursor == NULL)
+    return -1;
+  total = 0;
+  while (0 < (ret = DOODLE_tree_search_next(cursor,
+					    limit,
+					    &counter,
+					    NULL))) {
+    if (ret > limit)
+      return -1;
+    total += ret;
+  }
+  DOODLE_tree_search_close(cursor);
+  if (ret == -1)
+    return -1;
+  for (i=0;i<FILES;i++)
+    if (counts[i] > 1)
+      return -1;
+  return total;
+}
+
+static int check(struct DOODLE_SuffixTree * tree) {
+  if (FILES != page(tree, "a", 0, 3))
+    ABORT();
+  if (FILES != page(tree, "a", 0, 1))
+    ABORT();
+  if (FILES - 5 != page(tree, "a", 5, 7))
+    ABORT();
+  if (0 != page(tree, "a", FILES, 7))
+    ABORT();
+  if (FILES / 2 != page(tree, "even", 0, 4))
+    ABORT();
+  if (1 != page(tree, "key-17-", 0, 4))
+    ABORT();
+  if (counts[17] != 1)
+    ABORT();
+  if (0 != page(tree, "nothing", 0, 4))
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  char key[64];
+  int i;
+  int j;
+
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    sprintf(key,
+	    "key-%d-%s-abracadabra",
+	    i,
+	    (i % 2 == 0) ? "even" : "odd");
+    for (j=0;key[j] != '\0';j++)
+      if (0 != DOODLE_tree_expand(tree,
+				  &key[j],
+				  names[i]))
+	ABORT();
+  }
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,323 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testexpandfile.c
+ * @brief Testcase for DOODLE_tree_expand_file and bulk builds
+ *        (DOODLE_tree_bulk_open, DOODLE_tree_bulk_close and
+ *        DOODLE_tree_set_build_threads)
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define SNAME "/tmp/doodle-tree-test-suffixes"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 200
+#define KEYWORDS 20
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+static void count(const DOODLE_FileInfo * fi,
+		  void * arg) {
+  (*(int*) arg)++;
+}
+
+/**
+ * @return number of results for the search string, -1 on error
+ */
+static int search(SuffixTree * tree,
+		  const char * query) {
+  int cnt;
+  int ret;
+
+  cnt = 0;
+  ret = DOODLE_tree_search(tree, query, &count, &cnt);
+  if (ret != cnt)
+    ABORT();
+  return ret;
+}
+
+/**
+ * @return number of results for the case-insensitive search,
+ *         -1 on error
+ */
+static int approx(SuffixTree * tree,
+		  const char * query) {
+  int cnt;
+  int ret;
+
+  cnt = 0;
+  ret = DOODLE_tree_search_approx(tree, 0, 1, query, &count, &cnt);
+  if (ret != cnt)
+    ABORT();
+  return ret;
+}
+
+/**
+ * Add random keywords (with many repeated keywords and suffixes)
+ * for file i, to tree with DOODLE_tree_expand_file and to single
+ * with DOODLE_tree_expand (or DOODLE_tree_expand_words).
+ */
+static int add(SuffixTree * tree,
+	       SuffixTree * single,
+	       int words,
+	       int fold,
+	       int i) {
+  char keys[KEYWORDS][64];
+  const char * list[KEYWORDS + 1];
+  int j;
+  int k;
+  int len;
+
+  for (k=0;k<KEYWORDS;k++) {
+    if ( (k > 0) &&
+	 ((rand() % 4) == 0) ) {
+      strcpy(keys[k], keys[rand() % k]);
+    } else {
+      len = rand() % 24;
+      j = 0;
+      while (j < len) {
+	if ((rand() % 5) == 0)
+	  keys[k][j++] = ' ';
+	else if ( (fold) &&
+		  ((rand() % 5) == 0) ) {
+	  /* upper case A with diaeresis */
+	  keys[k][j++] = '\xc3';
+	  keys[k][j++] = '\x84';
+	} else if ( (fold) &&
+		    ((rand() % 2) == 0) )
+	  keys[k][j++] = 'A' + rand() % 4;
+	else
+	  keys[k][j++] = 'a' + rand() % 4;
+      }
+      keys[k][j] = '\0';
+    }
+    list[k] = keys[k];
+    if (words) {
+      if (0 != DOODLE_tree_expand_words(single,
+					keys[k],
+					names[i]))
+	ABORT();
+    } else {
+      for (j=0;keys[k][j] != '\0';j++)
+	if (0 != DOODLE_tree_expand(single,
+				    &keys[k][j],
+				    names[i]))
+	  ABORT();
+    }
+  }
+  list[KEYWORDS] = NULL;
+  if (0 != DOODLE_tree_expand_file(tree,
+				   names[i],
+				   1000 + i,
+				   list))
+    ABORT();
+  return 0;
+}
+
+/**
+ * Check that both trees give the same results.
+ */
+static int compare(SuffixTree * tree,
+		   SuffixTree * single) {
+  char query[4];
+  int i;
+  int j;
+
+  if (DOODLE_getFileCount(tree) != DOODLE_getFileCount(single))
+    ABORT();
+  for (i=0;i<DOODLE_getFileCount(tree);i++)
+    if ( (0 != strcmp(DOODLE_getFileAt(tree, i)->filename,
+		      DOODLE_getFileAt(single, i)->filename)) ||
+	 (DOODLE_getFileAt(tree, i)->mod_time != 1000 + i) )
+      ABORT();
+  if (DOODLE_tree_count(tree, "a") != FILES)
+    ABORT();
+  for (i=0;i<4*4*4*4;i++) {
+    /* all strings of up to 3 characters from "abcd " */
+    j = 0;
+    if (i % 4 != 0)
+      query[j++] = 'a' + i % 4 - 1;
+    if ((i / 4) % 4 != 0)
+      query[j++] = ((i / 4) % 4 == 1) ? ' ' : 'a' + (i / 4) % 4 - 1;
+    if (i / 16 != 0)
+      query[j++] = 'a' + (i / 16) % 4;
+    query[j] = '\0';
+    if (j == 0)
+      continue;
+    if ( (search(tree, query) != search(single, query)) ||
+	 (DOODLE_tree_count(tree, query) != DOODLE_tree_count(single, query)) ||
+	 (approx(tree, query) != approx(single, query)) )
+      ABORT();
+  }
+  if ( (approx(tree, "\xc3\xa4") != approx(single, "\xc3\xa4")) ||
+       (approx(tree, "a\xc3\xa4") != approx(single, "a\xc3\xa4")) )
+    ABORT();
+  return 0;
+}
+
+/**
+ * @param threads 0 to add the files with DOODLE_tree_expand_file,
+ *        otherwise the number of threads of a bulk build
+ * @param limit memory limit for the bulk build
+ */
+static int run(int words,
+	       int fold,
+	       unsigned int threads,
+	       size_t limit) {
+  struct DOODLE_SuffixTree * tree;
+  struct DOODLE_SuffixTree * single;
+  const char * none[2];
+  const char * last[2];
+  int i;
+
+  unlink(DBNAME);
+  unlink(SNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  single = DOODLE_tree_create(&my_log,
+			      NULL,
+			      SNAME);
+  if ( (0 != DOODLE_tree_set_word_index(tree, words)) ||
+       (0 != DOODLE_tree_set_word_index(single, words)) ||
+       (0 != DOODLE_tree_set_case_folding(tree, fold)) ||
+       (0 != DOODLE_tree_set_case_folding(single, fold)) )
+    ABORT();
+  if (threads == 0) {
+    /* files without keywords are not added */
+    none[0] = "";
+    none[1] = NULL;
+    if ( (0 != DOODLE_tree_expand_file(tree, names[0], 0, none)) ||
+	 (0 != DOODLE_tree_expand_file(tree, names[0], 0, &none[1])) ||
+	 (0 != DOODLE_getFileCount(tree)) )
+      ABORT();
+  } else {
+    /* with a small limit the keywords are written to several
+       runs and the tree is swapped out while they are inserted */
+    DOODLE_tree_set_memory_limit(tree, limit);
+    if ( (0 != DOODLE_tree_set_build_threads(tree, threads)) ||
+	 (0 != DOODLE_tree_bulk_open(tree)) )
+      ABORT();
+  }
+  for (i=0;i<FILES;i++)
+    if (0 != add(tree, single, words, fold, i))
+      ABORT();
+  if (threads == 0) {
+    /* the modification time of a file is only set when it is added */
+    if (0 != add(tree, single, words, fold, 0))
+      ABORT();
+  } else {
+    /* the files are known, the keywords are not yet in the tree */
+    if ( (DOODLE_getFileCount(tree) != FILES) ||
+	 (DOODLE_tree_count(tree, "a") != 0) )
+      ABORT();
+    /* truncate inserts the buffered keywords first (with the
+       threads, the tree is still empty) */
+    last[0] = names[FILES-1];
+    last[1] = NULL;
+    if ( (0 != DOODLE_tree_truncate_multiple(tree, last)) ||
+	 (0 != DOODLE_tree_truncate_multiple(single, last)) ||
+	 (0 != add(tree, single, words, fold, FILES-1)) ||
+	 (0 != DOODLE_tree_bulk_close(tree)) )
+      ABORT();
+  }
+  if (0 != compare(tree, single))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  DOODLE_tree_destroy(single);
+
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  single = DOODLE_tree_open_RDONLY(&my_log,
+				   NULL,
+				   SNAME);
+  if ( (tree == NULL) ||
+       (single == NULL) ||
+       (0 != compare(tree, single)) )
+    ABORT();
+  /* no bulk build for read-only databases */
+  if ( (0 == DOODLE_tree_bulk_open(tree)) ||
+       (0 == DOODLE_tree_set_build_threads(tree, 2)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  DOODLE_tree_destroy(single);
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  int i;
+
+  srand(42);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+  }
+  if ( (0 != run(0, 0, 0, 0)) ||
+       (0 != run(1, 0, 0, 0)) ||
+       (0 != run(0, 1, 0, 0)) ||
+       (0 != run(0, 0, 1, 4096)) ||
+       (0 != run(1, 0, 1, 4096)) ||
+       (0 != run(0, 1, 1, 4096)) ||
+       (0 != run(0, 0, 4, 4096)) ||
+       (0 != run(0, 1, 4, 4096)) ||
+       (0 != run(0, 1, 4, 64 * 1024 * 1024)) )
+    ABORT();
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  unlink(SNAME);
+  printf("Ok.\n");
+  return 0;
+}
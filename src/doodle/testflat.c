@@ -0,0 +1,294 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testflat.c
+ * @brief Testcase for the flat keyword index
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 200
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+typedef struct {
+  SuffixTree * tree;
+  unsigned int seen[FILES];
+  int count;
+  int dups;
+} Collector;
+
+static void collect(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  Collector * c = arg;
+  unsigned int i;
+
+  i = fi - c->tree->filenames;
+  if (i >= c->tree->fnc) {
+    c->dups = -1000000; /* not one of our files! */
+    return;
+  }
+  if (c->seen[i])
+    c->dups++;
+  else
+    c->count++;
+  c->seen[i]++;
+}
+
+static void collectBatch(unsigned int query,
+			 const DOODLE_FileInfo * fi,
+			 void * arg) {
+  collect(fi, arg);
+}
+
+/**
+ * Compare the search (which may use the flat index) with the
+ * results that the tree itself reports and with the batch
+ * search: each file must be reported as often in each, and
+ * all must return the same number of results.  The number of
+ * distinct files must match DOODLE_tree_count.
+ * @return number of matching files, -1 on error
+ */
+static int compare(SuffixTree * tree,
+		   const char * query) {
+  static Collector a;
+  static Collector b;
+  static Collector c;
+  unsigned int results;
+  int ret;
+  int iret;
+
+  memset(&a, 0, sizeof(Collector));
+  memset(&b, 0, sizeof(Collector));
+  memset(&c, 0, sizeof(Collector));
+  a.tree = tree;
+  b.tree = tree;
+  c.tree = tree;
+  ret = DOODLE_tree_search(tree, query, &collect, &a);
+  if ( (a.dups < 0) || (ret != a.count + a.dups) )
+    ABORT();
+  iret = tree_iterate_internal(0,
+			       tree,
+			       tree_search_internal(tree, query),
+			       &collect,
+			       &b);
+  if ( (b.dups < 0) ||
+       (iret != ret) ||
+       (a.count != b.count) ||
+       (0 != memcmp(a.seen, b.seen, sizeof(a.seen))) )
+    ABORT();
+  iret = DOODLE_tree_search_batch(tree,
+				  &query,
+				  1,
+				  &collectBatch,
+				  &c,
+				  &results);
+  if ( (iret != ret) ||
+       (results != ret) ||
+       (0 != memcmp(a.seen, c.seen, sizeof(a.seen))) )
+    ABORT();
+  if (a.count != DOODLE_tree_count(tree, query))
+    ABORT();
+  return a.count;
+}
+
+static int check(SuffixTree * tree) {
+  char query[4];
+  int i;
+  int j;
+  int k;
+
+  DOODLE_tree_set_cache_size(tree, 0);
+  if (compare(tree, "z") != 0)
+    ABORT();
+  if (compare(tree, "a") < FILES / 2)
+    ABORT();
+  for (i=0;i<8;i++) {
+    query[0] = 'a' + i;
+    query[1] = '\0';
+    if (-1 == compare(tree, query))
+      ABORT();
+    for (j=0;j<8;j++) {
+      query[1] = 'a' + j;
+      query[2] = '\0';
+      if (-1 == compare(tree, query))
+	ABORT();
+      for (k=0;k<8;k++) {
+	query[2] = 'a' + k;
+	query[3] = '\0';
+	if (-1 == compare(tree, query))
+	  ABORT();
+      }
+    }
+  }
+  return 0;
+}
+
+static int add(SuffixTree * tree,
+	       int i) {
+  char key[32];
+  int j;
+  int k;
+  int len;
+
+  for (k=0;k<10;k++) {
+    len = 4 + rand() % 12;
+    for (j=0;j<len;j++)
+      key[j] = 'a' + rand() % 8;
+    key[len] = '\0';
+    for (j=0;j<len;j++)
+      if (0 != DOODLE_tree_expand(tree,
+				  &key[j],
+				  names[i]))
+	ABORT();
+  }
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  const char * del[FILES / 4 + 1];
+  int i;
+
+  srand(42);
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (0 != DOODLE_tree_set_flat_index(tree, 1))
+    ABORT();
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    if (0 != add(tree, i))
+      ABORT();
+  }
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  /* the index is stored in the database */
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (tree->flatIndex == 0) ||
+       (tree->flat != NULL) )
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  if (tree->flat == NULL)
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  /* removing files (and adding them again) keeps it in sync */
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if ( (tree == NULL) ||
+       (0 != DOODLE_tree_set_flat_index(tree, 1)) )
+    ABORT(); /* already enabled */
+  for (i=0;i<FILES/4;i++)
+    del[i] = names[i * 3];
+  del[FILES/4] = NULL;
+  if (0 != DOODLE_tree_truncate_multiple(tree, del))
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  for (i=0;i<FILES/8;i++)
+    if (0 != add(tree, i * 3))
+      ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (tree->flatIndex == 0) )
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  /* keywords without their suffixes remove the index */
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (0 != DOODLE_tree_set_flat_index(tree, 1))
+    ABORT();
+  if ( (0 != DOODLE_tree_expand(tree, "abc", names[0])) ||
+       (0 != DOODLE_tree_expand(tree, "xyz", names[0])) )
+    ABORT();
+  if (tree->flatIndex != 0)
+    ABORT();
+  if (0 == DOODLE_tree_set_flat_index(tree, 1))
+    ABORT(); /* no longer empty */
+  if (compare(tree, "ab") != 1)
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
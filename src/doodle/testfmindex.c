@@ -0,0 +1,353 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testfmindex.c
+ * @brief Testcase for FM indices
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* small blocks and samples to cover their boundaries */
+#define FM_OCC_BLOCK 16
+#define FM_SAMPLE_RATE 4
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define FNAME "/tmp/doodle-tree-test-fm"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 200
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+typedef struct {
+  SuffixTree * tree;
+  unsigned int hits[FILES];
+  int count;
+} Collector;
+
+static void collect(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  Collector * c = arg;
+  unsigned int i;
+
+  i = fi - c->tree->filenames;
+  if (i >= c->tree->fnc) {
+    c->count = -1000000; /* not one of our files! */
+    return;
+  }
+  c->hits[i]++;
+  c->count++;
+}
+
+/**
+ * Compare the results of a search in the original tree and in
+ * the FM index (which reports each file once).
+ * @return number of files, -1 on error
+ */
+static int compare(SuffixTree * tree,
+		   SuffixTree * fm,
+		   const char * query) {
+  static Collector a;
+  static Collector b;
+  int files;
+  int ra;
+  int rb;
+  int i;
+
+  memset(&a, 0, sizeof(Collector));
+  memset(&b, 0, sizeof(Collector));
+  a.tree = tree;
+  b.tree = fm;
+  ra = DOODLE_tree_search(tree, query, &collect, &a);
+  rb = DOODLE_tree_search(fm, query, &collect, &b);
+  if ( (ra != a.count) ||
+       (rb != b.count) )
+    ABORT();
+  files = 0;
+  for (i=0;i<FILES;i++) {
+    if (b.hits[i] > 1)
+      ABORT();
+    if ((a.hits[i] > 0) != (b.hits[i] > 0))
+      ABORT();
+    if (a.hits[i] > 0)
+      files++;
+  }
+  if ( (rb != files) ||
+       (DOODLE_tree_count(tree, query) != files) ||
+       (DOODLE_tree_count(fm, query) != files) )
+    ABORT();
+  return rb;
+}
+
+static int check(SuffixTree * tree,
+		 SuffixTree * fm) {
+  static const char * alphabet = "abcdAB";
+  char query[5];
+  int i;
+  int j;
+  int k;
+
+  if (compare(tree, fm, "zzz") != 0)
+    ABORT();
+  if (compare(tree, fm, "a") < FILES / 2)
+    ABORT();
+  for (i=0;alphabet[i] != '\0';i++) {
+    query[0] = alphabet[i];
+    query[1] = '\0';
+    if (-1 == compare(tree, fm, query))
+      ABORT();
+    for (j=0;alphabet[j] != '\0';j++) {
+      query[1] = alphabet[j];
+      query[2] = '\0';
+      if (-1 == compare(tree, fm, query))
+	ABORT();
+      for (k=0;alphabet[k] != '\0';k++) {
+	query[2] = alphabet[k];
+	query[3] = '\0';
+	if (-1 == compare(tree, fm, query))
+	  ABORT();
+	query[3] = 'a';
+	query[4] = '\0';
+	if (-1 == compare(tree, fm, query))
+	  ABORT();
+      }
+    }
+  }
+  /* whole keywords, also across the end of a keyword */
+  if ( (1 != compare(tree, fm, "keyword-0")) ||
+       (1 != compare(tree, fm, "word-0")) ||
+       (0 != compare(tree, fm, "keyword-0keyword")) )
+    ABORT();
+  return 0;
+}
+
+static int expand(SuffixTree * tree,
+		  const char * key,
+		  int i) {
+  int j;
+
+  for (j=0;key[j] != '\0';j++)
+    if (0 != DOODLE_tree_expand(tree,
+				&key[j],
+				names[i]))
+      ABORT();
+  return 0;
+}
+
+static int add(SuffixTree * tree,
+	       int i) {
+  char key[32];
+  int j;
+  int k;
+  int len;
+
+  for (k=0;k<10;k++) {
+    len = 4 + rand() % 16;
+    for (j=0;j<len;j++)
+      key[j] = ((rand() % 4) == 0) ? 'A' + rand() % 8 : 'a' + rand() % 8;
+    key[len] = '\0';
+    if (0 != expand(tree, key, i))
+      ABORT();
+    /* keywords that are part of another keyword of the file */
+    if ( ( (k == 0) &&
+	   (0 != expand(tree, &key[len / 2], i)) ) ||
+	 ( (k == 1) &&
+	   (0 != expand(tree, key, i)) ) )
+      ABORT();
+  }
+  sprintf(key,
+	  "keyword-%d",
+	  i);
+  return expand(tree, key, i);
+}
+
+static int dummy(const DOODLE_FileInfo * fi,
+		 void * arg) {
+  return 0;
+}
+
+static void batchCollect(unsigned int query,
+			 const DOODLE_FileInfo * fi,
+			 void * arg) {
+  (*(int*) arg)++;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  struct DOODLE_SuffixTree * fm;
+  DOODLE_SearchLimits limits;
+  const char * queries[3];
+  unsigned int results[3];
+  int truncated;
+  int total;
+  int i;
+
+  srand(42);
+  unlink(DBNAME);
+  unlink(FNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    if (0 != add(tree, i))
+      ABORT();
+  }
+  if (-1 != DOODLE_tree_build_fm_index(tree, FNAME))
+    ABORT(); /* not read-only */
+  DOODLE_tree_destroy(tree);
+
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != DOODLE_tree_build_fm_index(tree, FNAME)) )
+    ABORT();
+  fm = DOODLE_tree_open_RDONLY(&my_log,
+			       NULL,
+			       FNAME);
+  if ( (fm == NULL) ||
+       (fm->frozen == NULL) ||
+       (fm->frozen->fm == NULL) ||
+       (fm->fnc != tree->fnc) )
+    ABORT();
+  for (i=0;i<FILES;i++)
+    if ( (0 != strcmp(tree->filenames[i].filename,
+		      fm->filenames[i].filename)) ||
+	 (tree->filenames[i].mod_time != fm->filenames[i].mod_time) )
+      ABORT();
+  DOODLE_tree_set_cache_size(tree, 0);
+  DOODLE_tree_set_cache_size(fm, 0);
+  if (0 != check(tree, fm))
+    ABORT();
+
+  /* limits */
+  memset(&limits, 0, sizeof(DOODLE_SearchLimits));
+  limits.max_results = 5;
+  if ( (5 != DOODLE_tree_search_limited(fm, "a", 0, 0, &limits,
+					&dummy, NULL, &truncated)) ||
+       (truncated != 1) )
+    ABORT();
+
+  /* batches */
+  queries[0] = "ab";
+  queries[1] = "zzz";
+  queries[2] = "Ac";
+  total = 0;
+  if (DOODLE_tree_search_batch(fm, queries, 3, &batchCollect,
+			       &total, results) != total)
+    ABORT();
+  for (i=0;i<3;i++)
+    if (results[i] != compare(tree, fm, queries[i]))
+      ABORT();
+
+  /* only exact searches, no changes */
+  if ( (-1 != DOODLE_tree_search_approx(fm, 1, 0, "ab", &collect, NULL)) ||
+       (-1 != DOODLE_tree_search_approx(fm, 0, 1, "ab", &collect, NULL)) ||
+       (NULL != DOODLE_tree_search_open(fm, "a", 0)) ||
+       (1 != DOODLE_tree_expand(fm, "abc", names[0])) ||
+       (-1 != DOODLE_tree_freeze(fm, DBNAME)) ||
+       (-1 != DOODLE_tree_build_fm_index(fm, DBNAME)) )
+    ABORT();
+  DOODLE_tree_destroy(fm);
+  DOODLE_tree_destroy(tree);
+  if (NULL != DOODLE_tree_create(&my_log,
+				 NULL,
+				 FNAME))
+    ABORT();
+
+  /* keywords without all of their suffixes */
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (0 != DOODLE_tree_expand(tree, "abc", names[0]))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (-1 != DOODLE_tree_build_fm_index(tree, FNAME)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  /* empty database */
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != DOODLE_tree_build_fm_index(tree, FNAME)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  fm = DOODLE_tree_open_RDONLY(&my_log,
+			       NULL,
+			       FNAME);
+  if ( (fm == NULL) ||
+       (0 != DOODLE_tree_search(fm, "a", NULL, NULL)) ||
+       (0 != DOODLE_tree_count(fm, "a")) )
+    ABORT();
+  DOODLE_tree_destroy(fm);
+
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  unlink(FNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,314 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testfrozen.c
+ * @brief Testcase for frozen databases
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define FNAME "/tmp/doodle-tree-test-frozen"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 200
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+typedef struct {
+  SuffixTree * tree;
+  unsigned int hits[FILES];
+  int count;
+} Collector;
+
+static void collect(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  Collector * c = arg;
+  unsigned int i;
+
+  i = fi - c->tree->filenames;
+  if (i >= c->tree->fnc) {
+    c->count = -1000000; /* not one of our files! */
+    return;
+  }
+  c->hits[i]++;
+  c->count++;
+}
+
+/**
+ * Compare the results of a search in the original and in the
+ * frozen tree (as multisets, the order may differ).
+ * @return number of results, -1 on error
+ */
+static int compare(SuffixTree * tree,
+		   SuffixTree * frozen,
+		   const char * query,
+		   unsigned int approx,
+		   int ignore_case) {
+  static Collector a;
+  static Collector b;
+  int ra;
+  int rb;
+
+  memset(&a, 0, sizeof(Collector));
+  memset(&b, 0, sizeof(Collector));
+  a.tree = tree;
+  b.tree = frozen;
+  if ( (approx == 0) &&
+       (ignore_case == 0) ) {
+    ra = DOODLE_tree_search(tree, query, &collect, &a);
+    rb = DOODLE_tree_search(frozen, query, &collect, &b);
+    if (DOODLE_tree_count(tree, query) !=
+	DOODLE_tree_count(frozen, query))
+      ABORT();
+  } else {
+    ra = DOODLE_tree_search_approx(tree, approx, ignore_case, query, &collect, &a);
+    rb = DOODLE_tree_search_approx(frozen, approx, ignore_case, query, &collect, &b);
+  }
+  if ( (ra != a.count) ||
+       (rb != b.count) ||
+       (ra != rb) ||
+       (0 != memcmp(a.hits, b.hits, sizeof(a.hits))) )
+    ABORT();
+  return ra;
+}
+
+static int check(SuffixTree * tree,
+		 SuffixTree * frozen) {
+  static const char * alphabet = "abcdAB";
+  char query[4];
+  int i;
+  int j;
+  int k;
+
+  if (compare(tree, frozen, "zzz", 0, 0) != 0)
+    ABORT();
+  if (compare(tree, frozen, "a", 0, 0) < FILES / 2)
+    ABORT();
+  for (i=0;alphabet[i] != '\0';i++) {
+    query[0] = alphabet[i];
+    query[1] = '\0';
+    if ( (-1 == compare(tree, frozen, query, 0, 0)) ||
+	 (-1 == compare(tree, frozen, query, 0, 1)) )
+      ABORT();
+    for (j=0;alphabet[j] != '\0';j++) {
+      query[1] = alphabet[j];
+      query[2] = '\0';
+      if ( (-1 == compare(tree, frozen, query, 0, 0)) ||
+	   (-1 == compare(tree, frozen, query, 0, 1)) ||
+	   (-1 == compare(tree, frozen, query, 1, 0)) )
+	ABORT();
+      for (k=0;alphabet[k] != '\0';k++) {
+	query[2] = alphabet[k];
+	query[3] = '\0';
+	if ( (-1 == compare(tree, frozen, query, 0, 0)) ||
+	     (-1 == compare(tree, frozen, query, 0, 1)) ||
+	     (-1 == compare(tree, frozen, query, 1, 1)) ||
+	     (-1 == compare(tree, frozen, query, 2, 0)) )
+	  ABORT();
+      }
+    }
+  }
+  return 0;
+}
+
+static int add(SuffixTree * tree,
+	       int i) {
+  char key[32];
+  int j;
+  int k;
+  int len;
+
+  for (k=0;k<10;k++) {
+    len = 4 + rand() % 16;
+    for (j=0;j<len;j++)
+      key[j] = ((rand() % 4) == 0) ? 'A' + rand() % 8 : 'a' + rand() % 8;
+    key[len] = '\0';
+    for (j=0;j<len;j++)
+      if (0 != DOODLE_tree_expand(tree,
+				  &key[j],
+				  names[i]))
+	ABORT();
+  }
+  return 0;
+}
+
+static int dummy(const DOODLE_FileInfo * fi,
+		 void * arg) {
+  return 0;
+}
+
+static void batchCollect(unsigned int query,
+			 const DOODLE_FileInfo * fi,
+			 void * arg) {
+  (*(int*) arg)++;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  struct DOODLE_SuffixTree * frozen;
+  DOODLE_SearchLimits limits;
+  const char * queries[3];
+  unsigned int results[3];
+  int truncated;
+  int total;
+  int i;
+
+  srand(42);
+  unlink(DBNAME);
+  unlink(FNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (0 != DOODLE_tree_set_case_folding(tree, 1))
+    ABORT();
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    if (0 != add(tree, i))
+      ABORT();
+  }
+  if (-1 != DOODLE_tree_freeze(tree, FNAME))
+    ABORT(); /* not read-only */
+  DOODLE_tree_destroy(tree);
+
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != DOODLE_tree_freeze(tree, FNAME)) )
+    ABORT();
+  frozen = DOODLE_tree_open_RDONLY(&my_log,
+				   NULL,
+				   FNAME);
+  if ( (frozen == NULL) ||
+       (frozen->frozen == NULL) ||
+       (frozen->fold == 0) ||
+       (frozen->fnc != tree->fnc) )
+    ABORT();
+  if ( (0 == bitRank(&frozen->frozen->longLabels,
+		     frozen->frozen->nodes)) ||
+       (0 == bitRank(&frozen->frozen->hasAggregate,
+		     frozen->frozen->nodes)) )
+    ABORT(); /* labels and aggregates are not covered */
+  for (i=0;i<FILES;i++)
+    if ( (0 != strcmp(tree->filenames[i].filename,
+		      frozen->filenames[i].filename)) ||
+	 (tree->filenames[i].mod_time != frozen->filenames[i].mod_time) )
+      ABORT();
+  DOODLE_tree_set_cache_size(tree, 0);
+  DOODLE_tree_set_cache_size(frozen, 0);
+  if (0 != check(tree, frozen))
+    ABORT();
+
+  /* limits */
+  memset(&limits, 0, sizeof(DOODLE_SearchLimits));
+  limits.max_results = 5;
+  if ( (5 != DOODLE_tree_search_limited(frozen, "a", 0, 0, &limits,
+					&dummy, NULL, &truncated)) ||
+       (truncated != 1) )
+    ABORT();
+
+  /* batches */
+  queries[0] = "ab";
+  queries[1] = "zzz";
+  queries[2] = "Ac";
+  total = 0;
+  if (DOODLE_tree_search_batch(frozen, queries, 3, &batchCollect,
+			       &total, results) != total)
+    ABORT();
+  for (i=0;i<3;i++)
+    if (results[i] != compare(tree, frozen, queries[i], 0, 0))
+      ABORT();
+
+  /* frozen databases can not be changed */
+  if ( (NULL != DOODLE_tree_search_open(frozen, "a", 0)) ||
+       (1 != DOODLE_tree_expand(frozen, "abc", names[0])) ||
+       (-1 != DOODLE_tree_freeze(frozen, DBNAME)) )
+    ABORT();
+  DOODLE_tree_destroy(frozen);
+  DOODLE_tree_destroy(tree);
+  if (NULL != DOODLE_tree_create(&my_log,
+				 NULL,
+				 FNAME))
+    ABORT();
+
+  /* empty database */
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != DOODLE_tree_freeze(tree, FNAME)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  frozen = DOODLE_tree_open_RDONLY(&my_log,
+				   NULL,
+				   FNAME);
+  if ( (frozen == NULL) ||
+       (0 != DOODLE_tree_search(frozen, "a", NULL, NULL)) ||
+       (0 != DOODLE_tree_search_approx(frozen, 1, 1, "ab", NULL, NULL)) ||
+       (0 != DOODLE_tree_count(frozen, "a")) )
+    ABORT();
+  DOODLE_tree_destroy(frozen);
+
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  unlink(FNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testlimits.c
+ * @brief Testcase for searches with limits
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 32
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+static int stopAfter;
+
+static int seen;
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  (*(int*) arg)++;
+}
+
+static int limitedCounter(const DOODLE_FileInfo * fi,
+			  void * arg) {
+  seen++;
+  return (seen == stopAfter) ? 1 : 0;
+}
+
+static int check(struct DOODLE_SuffixTree * tree) {
+  DOODLE_SearchLimits limits;
+  int truncated;
+  int total;
+  int ret;
+
+  total = 0;
+  DOODLE_tree_search(tree,
+		     "b",
+		     &counter,
+		     &total);
+  if (total < 10)
+    ABORT();
+  /* no limits */
+  memset(&limits, 0, sizeof(limits));
+  seen = 0;
+  stopAfter = -1;
+  ret = DOODLE_tree_search_limited(tree, "b", 0, 0, &limits,
+				   &limitedCounter, NULL, &truncated);
+  if ( (ret != total) || (seen != total) || (truncated != 0) )
+    ABORT();
+  limits.max_time = 1000000;
+  ret = DOODLE_tree_search_limited(tree, "b", 0, 0, &limits,
+				   NULL, NULL, &truncated);
+  if ( (ret != total) || (truncated != 0) )
+    ABORT();
+  /* result limit */
+  memset(&limits, 0, sizeof(limits));
+  limits.max_results = 5;
+  seen = 0;
+  ret = DOODLE_tree_search_limited(tree, "b", 0, 0, &limits,
+				   &limitedCounter, NULL, &truncated);
+  if ( (ret != 5) || (seen != 5) || (truncated != 1) )
+    ABORT();
+  /* exactly as many results as allowed is not truncated */
+  limits.max_results = total;
+  seen = 0;
+  ret = DOODLE_tree_search_limited(tree, "b", 0, 0, &limits,
+				   &limitedCounter, NULL, &truncated);
+  if ( (ret != total) || (seen != total) || (truncated != 0) )
+    ABORT();
+  /* the callback stops the search */
+  memset(&limits, 0, sizeof(limits));
+  seen = 0;
+  stopAfter = 3;
+  ret = DOODLE_tree_search_limited(tree, "b", 0, 0, NULL,
+				   &limitedCounter, NULL, &truncated);
+  if ( (ret != 3) || (seen != 3) || (truncated != 1) )
+    ABORT();
+  /* node limit, also for approximate searches */
+  limits.max_nodes = 2;
+  seen = 0;
+  stopAfter = -1;
+  ret = DOODLE_tree_search_limited(tree, "ab", 2, 1, &limits,
+				   &limitedCounter, NULL, &truncated);
+  if ( (ret == -1) || (ret != seen) || (truncated != 1) )
+    ABORT();
+  total = 0;
+  DOODLE_tree_search_approx(tree, 2, 1, "ab", &counter, &total);
+  if (ret >= total)
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  char key[32];
+  int i;
+  int j;
+  int k;
+  int len;
+
+  srand(42);
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    for (k=0;k<10;k++) {
+      len = 4 + rand() % 12;
+      for (j=0;j<len;j++)
+	key[j] = 'a' + rand() % 4;
+      key[len] = '\0';
+      for (j=0;j<len;j++)
+	if (0 != DOODLE_tree_expand(tree,
+				    &key[j],
+				    names[i]))
+	  ABORT();
+    }
+  }
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
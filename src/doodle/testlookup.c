@@ -0,0 +1,190 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testlookup.c
+ * @brief Testcase for DOODLE_tree_lookup_file
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 1000
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+/**
+ * Check that every file is found at its index and that the
+ * files that are not in the tree are not found.
+ *
+ * @param present which of names are in the tree
+ */
+static int check(SuffixTree * tree,
+		 const int * present) {
+  unsigned int found;
+  int idx;
+  int i;
+
+  found = 0;
+  for (i=0;i<FILES;i++) {
+    idx = DOODLE_tree_lookup_file(tree, names[i]);
+    if (present[i] == 0) {
+      if (idx != -1)
+	ABORT();
+      continue;
+    }
+    if ( (idx < 0) ||
+	 (idx >= DOODLE_getFileCount(tree)) ||
+	 (0 != strcmp(names[i],
+		      DOODLE_getFileAt(tree, idx)->filename)) )
+      ABORT();
+    found++;
+  }
+  if ( (found != DOODLE_getFileCount(tree)) ||
+       (-1 != DOODLE_tree_lookup_file(tree, TNAME)) ||
+       (-1 != DOODLE_tree_lookup_file(tree, "")) )
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  static int present[FILES];
+  const char * del[4];
+  int i;
+  int j;
+  int n;
+
+  unlink(DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+  }
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (0 != check(tree, present))
+    ABORT();
+  /* the table grows while the files are added */
+  for (i=0;i<FILES;i++) {
+    if ( (0 != DOODLE_tree_expand(tree, "key", names[i])) ||
+	 (0 != DOODLE_tree_expand(tree, "word", names[i])) )
+      ABORT();
+    present[i] = 1;
+    if ( (i % 100) == 0)
+      if (0 != check(tree, present))
+	ABORT();
+  }
+  if ( (0 != check(tree, present)) ||
+       (DOODLE_getFileCount(tree) != FILES) )
+    ABORT();
+  /* adding a file again does not add an entry */
+  if ( (0 != DOODLE_tree_expand(tree, "other", names[17])) ||
+       (DOODLE_getFileCount(tree) != FILES) )
+    ABORT();
+  /* removing files moves others to new indices */
+  del[0] = names[0];
+  del[1] = names[FILES / 2];
+  del[2] = names[FILES / 2];
+  del[3] = NULL;
+  if (0 != DOODLE_tree_truncate_multiple(tree, del))
+    ABORT();
+  present[0] = 0;
+  present[FILES / 2] = 0;
+  if ( (0 != DOODLE_tree_truncate(tree, names[FILES - 1])) ||
+       (0 != DOODLE_tree_truncate(tree, TNAME)) )
+    ABORT();
+  present[FILES - 1] = 0;
+  if ( (0 != check(tree, present)) ||
+       (DOODLE_getFileCount(tree) != FILES - 3) ||
+       (DOODLE_tree_search(tree, "key", NULL, NULL) != FILES - 3) )
+    ABORT();
+  /* and a removed file is added at the end again */
+  if (0 != DOODLE_tree_expand(tree, "key", names[0]))
+    ABORT();
+  present[0] = 1;
+  if (0 != check(tree, present))
+    ABORT();
+  /* removing files updates the hash table in place */
+  srand(42);
+  for (i=0;i<200;i++) {
+    n = 0;
+    while (n < 1 + i % 3) {
+      j = rand() % FILES;
+      if (present[j] == 0)
+	continue;
+      present[j] = 0;
+      del[n++] = names[j];
+    }
+    del[n] = NULL;
+    if ( (0 != DOODLE_tree_truncate_multiple(tree, del)) ||
+	 (tree->fileHash == NULL) ||
+	 (0 != check(tree, present)) )
+      ABORT();
+  }
+  DOODLE_tree_destroy(tree);
+
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != check(tree, present)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
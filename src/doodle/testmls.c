@@ -0,0 +1,142 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testmls.c
+ * @brief Testcase for multi-link groups with gaps
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+/**
+ * First characters of the keywords, in the order in which they
+ * are added (every second letter, some with larger gaps).
+ */
+static const char * starts = "mcqaeiwgkyosu0";
+
+static int check(struct DOODLE_SuffixTree * tree) {
+  char key[3];
+  int i;
+  int ret;
+
+  key[1] = 'x';
+  key[2] = '\0';
+  for (i=1;i<128;i++) {
+    key[0] = (char) i;
+    ret = DOODLE_tree_search(tree, key, NULL, NULL);
+    if ( (NULL != strchr(starts, i)) != (ret == 1) )
+      ABORT();
+  }
+  if (1 != DOODLE_tree_search(tree, "x", NULL, NULL))
+    ABORT();
+  /* the letters end up in one group (holes for the gaps) */
+  if ( (tree->root == NULL) ||
+       (tree->root->c[0] != '0') )
+    ABORT();
+  if ( (tree->root->link == NULL) &&
+       (0 != loadLink(tree, tree->root)) )
+    ABORT();
+  if ( (tree->root->link == NULL) ||
+       (tree->root->link->c[0] != 'a') ||
+       (tree->root->link->mls_size != 'y' - 'a' + 1) )
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  size_t used;
+  char key[3];
+  int i;
+
+  unlink(DBNAME);
+  fclose(fopen(TNAME, "a+"));
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (tree == NULL)
+    ABORT();
+  DOODLE_tree_set_cache_size(tree, 0);
+  key[1] = 'x';
+  key[2] = '\0';
+  for (i=0;i<strlen(starts);i++) {
+    key[0] = starts[i];
+    if ( (0 != DOODLE_tree_expand(tree, key, TNAME)) ||
+	 (0 != DOODLE_tree_expand(tree, &key[1], TNAME)) )
+      ABORT();
+  }
+  if (0 != check(tree))
+    ABORT();
+  /* the subtrees below the entries of the group can be swapped out */
+  used = tree->used_memory;
+  DOODLE_tree_set_memory_limit(tree, 1);
+  if (tree->used_memory >= used)
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  DOODLE_tree_set_cache_size(tree, 0);
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  unlink(TNAME);
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,209 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testparallel.c
+ * @brief Testcase for multi-threaded searches
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+/* use the threads for all searches */
+#define PARALLEL_MIN_FILES 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 64
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+#define MAX_RESULTS 65536
+
+typedef struct {
+  unsigned int results[MAX_RESULTS];
+  int count;
+} Collector;
+
+static struct DOODLE_SuffixTree * current;
+
+static void collect(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  Collector * c = arg;
+
+  if (c->count < MAX_RESULTS)
+    c->results[c->count] = fi - current->filenames;
+  c->count++;
+}
+
+static int search(struct DOODLE_SuffixTree * tree,
+		  const char * query,
+		  unsigned int approx,
+		  int ignore_case,
+		  Collector * c) {
+  c->count = 0;
+  current = tree;
+  if ( (approx == 0) && (ignore_case == 0) )
+    return DOODLE_tree_search(tree, query, &collect, c);
+  return DOODLE_tree_search_approx(tree, approx, ignore_case, query,
+				   &collect, c);
+}
+
+/**
+ * Run the search with one and with several threads and compare.
+ */
+static int compare(struct DOODLE_SuffixTree * single,
+		   struct DOODLE_SuffixTree * multi,
+		   const char * query,
+		   unsigned int approx,
+		   int ignore_case) {
+  static Collector a;
+  static Collector b;
+  int ret;
+  int i;
+
+  ret = search(single, query, approx, ignore_case, &a);
+  if (ret != a.count)
+    ABORT();
+  ret = search(multi, query, approx, ignore_case, &b);
+  if ( (ret != b.count) || (a.count != b.count) )
+    ABORT();
+  for (i=0;i<a.count && i<MAX_RESULTS;i++)
+    if (a.results[i] != b.results[i])
+      ABORT();
+  return a.count;
+}
+
+static int check(struct DOODLE_SuffixTree * single,
+		 struct DOODLE_SuffixTree * multi) {
+  static const char * queries[] = {
+    "a", "b", "ab", "ba", "abc", "dcba", "aaaa", "AbC", "x", NULL,
+  };
+  unsigned int approx;
+  int i;
+
+  for (i=0;queries[i]!=NULL;i++)
+    for (approx=0;approx<3;approx++) {
+      if (-1 == compare(single, multi, queries[i], approx, 0))
+	ABORT();
+      if (-1 == compare(single, multi, queries[i], approx, 1))
+	ABORT();
+    }
+  if (compare(single, multi, "a", 0, 0) < 100)
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  struct DOODLE_SuffixTree * multi;
+  char key[32];
+  int i;
+  int j;
+  int k;
+  int len;
+
+  srand(42);
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    for (k=0;k<10;k++) {
+      len = 4 + rand() % 12;
+      for (j=0;j<len;j++)
+	key[j] = 'a' + rand() % 4;
+      key[len] = '\0';
+      for (j=0;j<len;j++)
+	if (0 != DOODLE_tree_expand(tree,
+				    &key[j],
+				    names[i]))
+	  ABORT();
+    }
+  }
+  /* only for read-only trees */
+  if (-1 != DOODLE_tree_set_threads(tree, 4))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  multi = DOODLE_tree_open_RDONLY(&my_log,
+				  NULL,
+				  DBNAME);
+  if ( (tree == NULL) || (multi == NULL) )
+    ABORT();
+  DOODLE_tree_set_cache_size(tree, 0);
+  DOODLE_tree_set_cache_size(multi, 0);
+  if ( (0 != DOODLE_tree_set_threads(multi, 4)) ||
+       (multi->workerCount != 3) )
+    ABORT();
+  if (0 != check(tree, multi))
+    ABORT();
+  /* again, with the nodes already in memory */
+  if (0 != check(tree, multi))
+    ABORT();
+  if (0 != DOODLE_tree_set_threads(multi, 1))
+    ABORT();
+  if (0 != check(tree, multi))
+    ABORT();
+  DOODLE_tree_destroy(multi);
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
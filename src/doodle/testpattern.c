@@ -0,0 +1,209 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testpattern.c
+ * @brief Testcase for glob and regular expression searches
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 5
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * keys[FILES] = {
+  "report2024.pdf",
+  "Report 2023.PDF",
+  "holiday photo.jpg",
+  "\xc3\x84rger.txt", /* Ärger.txt */
+  "photo_2023.jpeg",
+};
+
+static char * names[FILES];
+
+static int found[FILES];
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  int i;
+
+  for (i=0;i<FILES;i++)
+    if (0 == strcmp(fi->filename,
+		    names[i]))
+      found[i] = 1;
+}
+
+/**
+ * @return bitmask of the files found, -1 on error
+ */
+static int search(struct DOODLE_SuffixTree * tree,
+		  const char * pattern,
+		  int flags) {
+  int ret;
+  int i;
+
+  memset(found, 0, sizeof(found));
+  if (-1 == DOODLE_tree_search_pattern(tree,
+				       pattern,
+				       flags,
+				       &counter,
+				       NULL))
+    return -1;
+  ret = 0;
+  for (i=0;i<FILES;i++)
+    if (found[i])
+      ret |= (1 << i);
+  return ret;
+}
+
+static int check(struct DOODLE_SuffixTree * tree) {
+  /* regular expressions */
+  if (19 != search(tree, "20(23|24)", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (1 != search(tree, "rep.rt", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (3 != search(tree, "REP.RT", DOODLE_PATTERN_IGNORE_CASE))
+    ABORT();
+  if (20 != search(tree, "\\.jpe?g$", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (0 != search(tree, "jp$", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (2 != search(tree, "[0-9]{4}\\.PDF", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (3 != search(tree, "\\d{4}\\.pdf$", DOODLE_PATTERN_IGNORE_CASE))
+    ABORT();
+  if (20 != search(tree, "photo", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (31 != search(tree, "x*", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (16 != search(tree, "[[:alpha:]]_[[:digit:]]+", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (8 != search(tree, ".rger", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (0 != search(tree, "\xc3\xa4rger", DOODLE_PATTERN_REGEX)) /* ärger */
+    ABORT();
+  if (8 != search(tree, "\xc3\xa4rger", DOODLE_PATTERN_IGNORE_CASE))
+    ABORT();
+  if (8 != search(tree, "[\xc3\x84\xc3\x96]rg", DOODLE_PATTERN_REGEX))
+    ABORT();
+  /* globs */
+  if (1 != search(tree, "*.pdf", DOODLE_PATTERN_GLOB))
+    ABORT();
+  if (3 != search(tree, "*.pdf", DOODLE_PATTERN_GLOB | DOODLE_PATTERN_IGNORE_CASE))
+    ABORT();
+  if (20 != search(tree, "*.jp*g", DOODLE_PATTERN_GLOB))
+    ABORT();
+  if (20 != search(tree, "photo*", DOODLE_PATTERN_GLOB))
+    ABORT();
+  if (2 != search(tree, "*2023.???", DOODLE_PATTERN_GLOB))
+    ABORT();
+  if (8 != search(tree, "[!a-z]rger.txt", DOODLE_PATTERN_GLOB))
+    ABORT();
+  if (0 != search(tree, "report", DOODLE_PATTERN_GLOB))
+    ABORT();
+  /* invalid patterns */
+  if (-1 != search(tree, "(abc", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (-1 != search(tree, "abc)", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (-1 != search(tree, "a{2,1}", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (-1 != search(tree, "a{300}", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (-1 != search(tree, "^abc", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (-1 != search(tree, "a$b", DOODLE_PATTERN_REGEX))
+    ABORT();
+  if (-1 != search(tree, "[z-a]", DOODLE_PATTERN_GLOB))
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  int i;
+  int j;
+
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    for (j=0;keys[i][j] != '\0';j++)
+      if (0 != DOODLE_tree_expand(tree,
+				  &keys[i][j],
+				  names[i]))
+	ABORT();
+  }
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if (tree == NULL)
+    ABORT();
+  if (0 != check(tree))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,196 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testqgram.c
+ * @brief Testcase for the q-gram filter
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+/* stress test swapping... */
+#define MEMORY_LIMIT 1
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 32
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+static char keys[FILES][32];
+
+static void counter(const DOODLE_FileInfo * fi,
+		    void * arg) {
+  (*(int*) arg)++;
+}
+
+static int count(struct DOODLE_SuffixTree * tree,
+		 const char * query) {
+  int ret;
+
+  ret = 0;
+  DOODLE_tree_search(tree, query, &counter, &ret);
+  return ret;
+}
+
+/**
+ * Check that every substring of the keywords of the files
+ * first to FILES-1 is found and that strings that do not occur
+ * are rejected without loading nodes.
+ */
+static int check(struct DOODLE_SuffixTree * tree,
+		 int first) {
+  char sub[32];
+  size_t mem;
+  int i;
+  int j;
+  int k;
+
+  DOODLE_tree_set_cache_size(tree, 0);
+  for (i=first;i<FILES;i++)
+    for (j=0;keys[i][j]!='\0';j++)
+      for (k=j+1;keys[i][k-1]!='\0';k++) {
+	memcpy(sub, &keys[i][j], k - j);
+	sub[k - j] = '\0';
+	if (0 == count(tree, sub))
+	  ABORT();
+      }
+  if (tree->grams == NULL)
+    ABORT();
+  mem = tree->used_memory;
+  if ( (0 != count(tree, "axb")) ||
+       (0 != count(tree, "zz")) ||
+       (0 != count(tree, "abcabcabcx")) )
+    ABORT();
+  if (mem != tree->used_memory)
+    ABORT();
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  int i;
+  int j;
+  int len;
+
+  srand(42);
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+    len = 4 + rand() % 12;
+    for (j=0;j<len;j++)
+      keys[i][j] = 'a' + rand() % 8;
+    keys[i][len] = '\0';
+    if (i == 0)
+      strcpy(keys[i], "zebra");
+    len = strlen(keys[i]);
+    for (j=0;j<len;j++)
+      if (0 != DOODLE_tree_expand(tree,
+				  &keys[i][j],
+				  names[i]))
+	ABORT();
+  }
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != check(tree, 0)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  /* a database without the filter gets one when it is written */
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if (tree == NULL)
+    ABORT();
+  free(tree->grams);
+  tree->grams = NULL;
+  if (0 == count(tree, keys[1]))
+    ABORT();
+  if (0 != DOODLE_tree_expand(tree, "extra", names[1]))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != check(tree, 0)) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  /* removing a file rebuilds the filter */
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if ( (tree == NULL) ||
+       (0 != DOODLE_tree_truncate(tree, names[0])) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (0 != check(tree, 1)) )
+    ABORT();
+  if (0 != gramsMayMatch(tree, "zebra"))
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -0,0 +1,213 @@
+/*
+     This file is part of doodle.
+     (C) 2004 Christian Grothoff (and other contributing authors)
+
+     doodle is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     doodle is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with doodle; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file doodle/testwords.c
+ * @brief Testcase for word indices
+ * @author Christian Grothoff
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "doodle.h"
+#include "gettext.h"
+
+#include "tree.c"
+
+#define DBNAME "/tmp/doodle-tree-test"
+#define SNAME "/tmp/doodle-tree-test-suffixes"
+#define TNAME "/tmp/doodle-tree-test-files"
+#define FILES 100
+
+#define ABORT() { printf("Assertion failed at %s:%d\n", __FILE__, __LINE__); return -1; }
+
+static void my_log(void * unused,
+		   unsigned int level,
+		   const char * msg,
+		   ...) {
+  va_list args;
+  if (level == 0) {
+    va_start(args, msg);
+    vfprintf(stdout, msg, args);
+    va_end(args);
+  }
+}
+
+static char * names[FILES];
+
+static void count(const DOODLE_FileInfo * fi,
+		  void * arg) {
+  (*(int*) arg)++;
+}
+
+/**
+ * @return number of results for the search string, -1 on error
+ */
+static int search(SuffixTree * tree,
+		  const char * query) {
+  int cnt;
+  int ret;
+
+  cnt = 0;
+  ret = DOODLE_tree_search(tree, query, &count, &cnt);
+  if (ret != cnt)
+    ABORT();
+  return ret;
+}
+
+/**
+ * Add random keywords made of a few words to both databases.
+ */
+static int add(SuffixTree * words,
+	       SuffixTree * suffixes,
+	       int i) {
+  char key[64];
+  int j;
+  int k;
+  int len;
+
+  for (k=0;k<10;k++) {
+    len = 8 + rand() % 40;
+    for (j=0;j<len;j++)
+      key[j] = ((rand() % 6) == 0) ? ' ' : 'a' + rand() % 16;
+    key[len] = '\0';
+    if (0 != DOODLE_tree_expand_words(words,
+				      key,
+				      names[i]))
+      ABORT();
+    for (j=0;j<len;j++)
+      if (0 != DOODLE_tree_expand(suffixes,
+				  &key[j],
+				  names[i]))
+	ABORT();
+  }
+  return 0;
+}
+
+int main(int argc,
+	 char * argv[]) {
+  struct DOODLE_SuffixTree * tree;
+  struct DOODLE_SuffixTree * suffixes;
+  struct stat wbuf;
+  struct stat sbuf;
+  int i;
+
+  srand(42);
+  unlink(DBNAME);
+  unlink(SNAME);
+  for (i=0;i<FILES;i++) {
+    names[i] = malloc(strlen(TNAME) + 20);
+    sprintf(names[i],
+	    "%s.%d",
+	    TNAME,
+	    i);
+    fclose(fopen(names[i], "a+"));
+  }
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  if ( (0 != DOODLE_tree_get_word_index(tree)) ||
+       (0 != DOODLE_tree_set_word_index(tree, 1)) ||
+       (1 != DOODLE_tree_get_word_index(tree)) ||
+       (-1 != DOODLE_tree_set_flat_index(tree, 1)) )
+    ABORT();
+  if ( (0 != DOODLE_tree_expand_words(tree, "Hello, World!", names[0])) ||
+       (0 != DOODLE_tree_expand_words(tree, "foo-bar 2004", names[1])) ||
+       (0 != DOODLE_tree_expand_words(tree, "  ", names[1])) ||
+       (0 != DOODLE_tree_expand_words(tree, "Gr\xc3\xbc\xc3\x9f Gott", names[2])) ||
+       (0 != DOODLE_tree_expand_words(tree, "world", names[1])) )
+    ABORT();
+  /* words can only be added to an empty database */
+  if (-1 != DOODLE_tree_set_word_index(tree, 0))
+    ABORT();
+  if ( (1 != search(tree, "Hello")) ||
+       (1 != search(tree, "Wor")) ||
+       (1 != search(tree, "wor")) ||
+       (0 != search(tree, "orld")) ||
+       (0 != search(tree, "Hello,")) ||
+       (1 != search(tree, "foo")) ||
+       (1 != search(tree, "bar")) ||
+       (0 != search(tree, "foo-bar")) ||
+       (1 != search(tree, "200")) ||
+       (1 != search(tree, "Gr\xc3\xbc\xc3\x9f")) ||
+       (0 != search(tree, "ott")) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  /* the setting is stored in the database */
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  if ( (tree == NULL) ||
+       (1 != DOODLE_tree_get_word_index(tree)) ||
+       (1 != search(tree, "Wor")) ||
+       (0 != search(tree, "orld")) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+
+  /* a word index is much smaller than a suffix index */
+  unlink(DBNAME);
+  tree = DOODLE_tree_create(&my_log,
+			    NULL,
+			    DBNAME);
+  suffixes = DOODLE_tree_create(&my_log,
+				NULL,
+				SNAME);
+  if (0 != DOODLE_tree_set_word_index(tree, 1))
+    ABORT();
+  for (i=0;i<FILES;i++)
+    if (0 != add(tree, suffixes, i))
+      ABORT();
+  DOODLE_tree_destroy(tree);
+  DOODLE_tree_destroy(suffixes);
+  if ( (0 != stat(DBNAME, &wbuf)) ||
+       (0 != stat(SNAME, &sbuf)) ||
+       (wbuf.st_size * 2 > sbuf.st_size) )
+    ABORT();
+  /* the words are found at their beginning only */
+  tree = DOODLE_tree_open_RDONLY(&my_log,
+				 NULL,
+				 DBNAME);
+  suffixes = DOODLE_tree_open_RDONLY(&my_log,
+				     NULL,
+				     SNAME);
+  if ( (tree == NULL) ||
+       (suffixes == NULL) ||
+       (search(tree, "a") <= 0) ||
+       (search(tree, "a") >= search(suffixes, "a")) ||
+       (0 != search(tree, " ")) )
+    ABORT();
+  DOODLE_tree_destroy(tree);
+  DOODLE_tree_destroy(suffixes);
+
+  for (i=0;i<FILES;i++) {
+    unlink(names[i]);
+    free(names[i]);
+  }
+  unlink(DBNAME);
+  unlink(SNAME);
+  printf("Ok.\n");
+  return 0;
+}
@@ -46,9 +46,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include "helper1.h"
 #include "gettext.h"
 
@@ -110,6 +114,91 @@
 #define BUF_SIZE 4096
 #endif
 
+/**
+ * Minimum number of distinct files in a subtree for which we store
+ * the list of file indices (next to the count, which is stored for
+ * every node) in the database.  With the list, enumerating the
+ * files matching a short query does not require a walk over the
+ * (possibly huge) subtree.  Smaller values give faster searches
+ * at the expense of a bigger database.  Nodes with the same files
+ * as a node below them (chains of nodes with a single child) share
+ * the list of that node.
+ */
+#ifndef AGGREGATE_THRESHOLD
+#define AGGREGATE_THRESHOLD 128
+#endif
+
+/**
+ * Default number of searches for which the results are kept in
+ * memory (see DOODLE_tree_set_cache_size).  Repeating one of the
+ * recent searches then does not need to walk the tree at all.
+ */
+#ifndef RESULT_CACHE_SIZE
+#define RESULT_CACHE_SIZE 32
+#endif
+
+/**
+ * Minimum number of distinct files matching an exact search for
+ * which the results are collected by several threads (see
+ * DOODLE_tree_set_threads).  For fewer results the cost of
+ * starting the threads exceeds the gain.  Approximate searches
+ * always use all threads.
+ */
+#ifndef PARALLEL_MIN_FILES
+#define PARALLEL_MIN_FILES 256
+#endif
+
+/**
+ * Maximum number of empty entries that are inserted into a
+ * multi-link group (mls) to add a character that is not the
+ * successor of the last character of the group.  Siblings in
+ * one group are found with a single index operation instead of
+ * following the link chain, at the expense of the memory for
+ * the empty entries.
+ */
+#ifndef MLS_MAX_FILL
+#define MLS_MAX_FILL 2
+#endif
+
+/**
+ * Exact searches for at most this many characters are answered
+ * by scanning the flat keyword index (see
+ * DOODLE_tree_set_flat_index) unless the aggregates show that
+ * only few files match.  Such short strings occur in most of the
+ * tree, and walking all of it costs more than the scan.
+ */
+#ifndef FLAT_SCAN_MAX_LENGTH
+#define FLAT_SCAN_MAX_LENGTH 2
+#endif
+
+/**
+ * Longer search strings are also answered by the flat scan if the
+ * aggregates show that at least one in this many files matches.
+ */
+#ifndef FLAT_SCAN_SELECTIVITY
+#define FLAT_SCAN_SELECTIVITY 8
+#endif
+
+/**
+ * Number of rows of an FM index (see DOODLE_tree_build_fm_index)
+ * between two stored occurrence counts.  Counting a character up
+ * to a row reads at most this many bytes of the index; smaller
+ * values give faster searches at the expense of a bigger index.
+ */
+#ifndef FM_OCC_BLOCK
+#define FM_OCC_BLOCK 256
+#endif
+
+/**
+ * Every FM_SAMPLE_RATE-th position of the text of an FM index is
+ * stored, so that mapping a result to its file takes at most this
+ * many steps.  Smaller values give faster searches at the expense
+ * of a bigger index.
+ */
+#ifndef FM_SAMPLE_RATE
+#define FM_SAMPLE_RATE 32
+#endif
+
 /* ***************** debug options, toggle to use simpler variants
    of the code or to enable more checking *********************** */
 
@@ -175,19 +264,15 @@ static int read_buf(DOODLE_Logger log,
 		    char * buf,
 		    unsigned long long cnt) {
   int ret;
-  if (off != lseek(fd, off, SEEK_SET)) {
-    log(context,
-	DOODLE_LOG_CRITICAL,
-	_("Call to '%s' failed: %s\n"),
-	"lseek", strerror(errno));
-  }
-  ret = read(fd, buf, cnt);
+  /* pread: several handles may share the descriptor
+     (see bulkMerge) */
+  ret = pread(fd, buf, cnt, off);
   if (cnt != ret) {
     if (ret == -1) {
       log(context,
 	  DOODLE_LOG_CRITICAL,
 	  _("Call to '%s' failed: %s\n"),
-	  "read", strerror(errno));
+	  "pread", strerror(errno));
     } else {
       log(context,
 	  DOODLE_LOG_CRITICAL,
@@ -358,6 +443,8 @@ static void WRITEALL(BIO * bio,
 	      buf,
 	      len);
     bio->off += len;
+    if (bio->off > bio->fsize)
+      bio->fsize = bio->off;
     return;
   }
   if ( (bio->off < bio->bstart) ||
@@ -729,6 +816,10 @@ typedef struct DOODLE_Node {
   unsigned long long next_off;
   /* position of this STNode in the file */
   unsigned long long pos;
+  /* position of the file-id aggregate of the subtree
+     (matches of this node and everything below the
+     child) in the file, 0 for none */
+  unsigned long long aggOff;
   /* other characters on the same level */
   struct DOODLE_Node * link;
   /* subtrees for a longer suffix */
@@ -742,6 +833,10 @@ typedef struct DOODLE_Node {
   unsigned int * matches;
   /* how many files match here? */
   unsigned int matchCount;
+  /* number of distinct files matching in the subtree
+     (this node and everything below the child), 0 if
+     unknown (see markModified) */
+  unsigned int aggCount;
 #if USE_CI_CACHE
   /* cix values (cached for serialization speed!) */
   int cix;
@@ -758,6 +853,33 @@ typedef struct DOODLE_Node {
   unsigned char modified;
 } STNode;
 
+/**
+ * @brief the keywords of one file in the flat index
+ */
+typedef struct {
+  /* the keywords of the file, each terminated by '\0' */
+  char * data;
+  /* number of bytes used in data */
+  unsigned int len;
+  /* number of bytes allocated for data */
+  unsigned int size;
+  /* offset of the last keyword in data (len for none) */
+  unsigned int last;
+  /* number of suffixes of the last keyword that were added */
+  unsigned int covered;
+} FlatKeywords;
+
+/**
+ * @brief the database file shared by the threads of a
+ *  parallel bulk build (see bulkParallel)
+ */
+typedef struct {
+  /* held while nodes are appended to the file */
+  pthread_mutex_t lock;
+  /* size of the file */
+  unsigned long long end;
+} SharedFile;
+
 /**
  * @brief the suffix tree (containing the interned
  *  content like keywords and filenames and the root-node).
@@ -779,12 +901,24 @@ typedef struct DOODLE_SuffixTree {
   DOODLE_FileInfo * filenames;
   /* root of the suffix tree, maybe null! */
   STNode * root;
+  /* root of the case-folded tree, maybe null! (contains
+     the case-folded versions of the strings that are not
+     already in folded form in the main tree) */
+  STNode * froot;
   /* the keyword/character index string */
   pchar* cis;
   /* how long is cis? */
   unsigned int cisPos;
   /* how much space do we have in cis? */
   unsigned int cisLen;
+  /* where the string of the last insert into root was stored
+     (its suffixes are stored right behind it), NULL if unknown */
+  char * hint;
+  /* index of that string in cis */
+  int hintCix;
+  /* the same for froot */
+  char * fhint;
+  int fhintCix;
   /* was this suffix tree modified? 1: yes, 0: no */
   int modified;
   /* force full dump (even of unmodified nodes)? 1: yes, 0: no */
@@ -800,8 +934,95 @@ typedef struct DOODLE_SuffixTree {
   unsigned int mutationCount;
   /* is this tree read-only? */
   int read_only;
+  /* number of levels below the root that are never
+     swapped out (used while processing a batch) */
+  unsigned int pinDepth;
+  /* limits of the search in progress, NULL for none */
+  struct SearchLimit * limit;
+  /* do we maintain the case-folded tree? 1: yes, 0: no */
+  int fold;
+  /* are keywords added as whole words (without their
+     suffixes)? 1: yes, 0: no (see DOODLE_tree_set_word_index) */
+  int words;
+  /* nodes stored before this offset have no aggregates (they
+     are from a "0007" database, see MAGIC_0007); 0 for none */
+  unsigned long long aggregatesStart;
+  /* incremented whenever the set of keywords or files
+     changes (invalidates the result cache) */
+  unsigned int generation;
+  /* cache of recent search results, NULL if empty */
+  struct CacheEntry * cache;
+  /* maximum number of entries in the cache (0: disabled) */
+  unsigned int cacheSize;
+  /* number of searches answered (for the LRU order) */
+  unsigned int cacheClock;
+  /* additional read-only handles of the same database, one for
+     each extra thread of a parallel search (NULL for none) */
+  struct DOODLE_SuffixTree ** workers;
+  /* number of entries in workers */
+  unsigned int workerCount;
+  /* q-gram filter (QGRAM_BYTES), NULL if not available */
+  unsigned char * grams;
+  /* were keywords removed since the filter was built? */
+  int gramsStale;
+  /* do we maintain the flat keyword index? 1: yes, 0: no */
+  int flatIndex;
+  /* flat keyword index, one entry for each file (NULL if
+     empty or not yet loaded) */
+  FlatKeywords * flat;
+  /* size of flat array */
+  unsigned int flatSize;
+  /* offset of the flat index in the database file if it
+     still needs to be loaded, 0 if not */
+  unsigned long long flatOff;
+  /* arrays of a frozen database, NULL if the database is
+     not frozen (see DOODLE_tree_freeze) */
+  struct FrozenTree * frozen;
+  /* hash table of the indices into filenames (FILE_HASH_EMPTY
+     for unused slots), NULL if it must be built again (see
+     DOODLE_tree_lookup_file) */
+  unsigned int * fileHash;
+  /* number of slots in fileHash (a power of two) */
+  unsigned int fileHashSize;
+  /* state of the bulk build in progress, NULL for none
+     (see DOODLE_tree_bulk_open) */
+  struct BulkBuild * bulk;
+  /* number of threads that insert the keywords of a bulk
+     build (see DOODLE_tree_set_build_threads) */
+  unsigned int bulkThreads;
+  /* if not NULL, fd is one of several handles of the database
+     file and nodes may only be appended with the lock held */
+  SharedFile * shared;
 } SuffixTree;
 
+static void cacheFlush(SuffixTree * tree);
+
+static int frozenLoad(SuffixTree * tree,
+		      BIO * fd,
+		      int fm);
+
+static void frozenFree(SuffixTree * tree);
+
+static void frozenRefuse(SuffixTree * tree,
+			 const char * operation);
+
+static int fmLoad(SuffixTree * tree,
+		  size_t * off);
+
+static int fmSearch(SuffixTree * tree,
+		    const char * substring,
+		    DOODLE_ResultCallback callback,
+		    void * arg);
+
+static void closeWorkers(SuffixTree * tree);
+
+static int bulkAdd(SuffixTree * tree,
+		   const char * searchString,
+		   unsigned int sharedNameIndex,
+		   int isSuffix);
+
+static int bulkFlush(SuffixTree * tree);
+
 unsigned int DOODLE_getFileCount(const struct DOODLE_SuffixTree * tree) {
   return tree->fnc;
 }
@@ -811,6 +1032,145 @@ const DOODLE_FileInfo * DOODLE_getFileAt(const struct DOODLE_SuffixTree * tree,
   return &tree->filenames[index];
 }
 
+/**
+ * Marker for the unused slots of tree->fileHash.
+ */
+#define FILE_HASH_EMPTY 0xFFFFFFFF
+
+static unsigned int hashString(const char * s) {
+  unsigned int h;
+
+  /* FNV-1a */
+  h = 2166136261U;
+  while (s[0] != '\0') {
+    h ^= (unsigned char) s[0];
+    h *= 16777619U;
+    s++;
+  }
+  return h;
+}
+
+static void fileHashInsert(SuffixTree * tree,
+			   unsigned int index) {
+  unsigned int slot;
+
+  slot = hashString(tree->filenames[index].filename) & (tree->fileHashSize - 1);
+  while (tree->fileHash[slot] != FILE_HASH_EMPTY)
+    slot = (slot + 1) & (tree->fileHashSize - 1);
+  tree->fileHash[slot] = index;
+}
+
+static void fileHashFree(SuffixTree * tree) {
+  if (tree->fileHash != NULL)
+    free(tree->fileHash);
+  tree->fileHash = NULL;
+  tree->fileHashSize = 0;
+}
+
+/**
+ * Build the hash table of the filenames (at most half full).
+ */
+static void fileHashBuild(SuffixTree * tree) {
+  unsigned int i;
+
+  fileHashFree(tree);
+  tree->fileHashSize = 64;
+  while (tree->fileHashSize / 2 <= tree->fnc)
+    tree->fileHashSize *= 2;
+  tree->fileHash = MALLOC(sizeof(unsigned int) * (size_t) tree->fileHashSize);
+  memset(tree->fileHash,
+	 0xFF,
+	 sizeof(unsigned int) * (size_t) tree->fileHashSize);
+  for (i=0;i<tree->fnc;i++)
+    fileHashInsert(tree,
+		   i);
+}
+
+/**
+ * @return the slot of the hash table that holds the given index
+ *   (which must be in the table)
+ */
+static unsigned int fileHashFind(SuffixTree * tree,
+				 unsigned int index) {
+  unsigned int slot;
+
+  slot = hashString(tree->filenames[index].filename) & (tree->fileHashSize - 1);
+  while (tree->fileHash[slot] != index)
+    slot = (slot + 1) & (tree->fileHashSize - 1);
+  return slot;
+}
+
+/**
+ * Remove the given index from the hash table.  The entries
+ * behind it in the same run are moved up so that every entry
+ * can still be reached from its home slot (no tombstones).
+ */
+static void fileHashRemove(SuffixTree * tree,
+			   unsigned int index) {
+  unsigned int mask;
+  unsigned int hole;
+  unsigned int slot;
+  unsigned int home;
+
+  mask = tree->fileHashSize - 1;
+  hole = fileHashFind(tree,
+		      index);
+  slot = hole;
+  while (1) {
+    slot = (slot + 1) & mask;
+    if (tree->fileHash[slot] == FILE_HASH_EMPTY)
+      break;
+    home = hashString(tree->filenames[tree->fileHash[slot]].filename) & mask;
+    /* the entry must stay if its home is (cyclically) in
+       (hole, slot] */
+    if ( (hole <= slot)
+	 ? ( (hole < home) && (home <= slot) )
+	 : ( (hole < home) || (home <= slot) ) )
+      continue;
+    tree->fileHash[hole] = tree->fileHash[slot];
+    hole = slot;
+  }
+  tree->fileHash[hole] = FILE_HASH_EMPTY;
+}
+
+/**
+ * Add the last entry of tree->filenames to the hash table.
+ */
+static void fileHashAdd(SuffixTree * tree) {
+  if (tree->fileHash == NULL)
+    return; /* built when it is needed */
+  if (tree->fileHashSize / 2 <= tree->fnc)
+    fileHashBuild(tree);
+  else
+    fileHashInsert(tree,
+		   tree->fnc - 1);
+}
+
+/**
+ * Find a file in the database.
+ *
+ * @return the index of the file (for DOODLE_getFileAt),
+ *   -1 if the file is not in the database
+ */
+int DOODLE_tree_lookup_file(struct DOODLE_SuffixTree * tree,
+			    const char * filename) {
+  unsigned int slot;
+  unsigned int index;
+
+  if (tree->fnc == 0)
+    return -1;
+  if (tree->fileHash == NULL)
+    fileHashBuild(tree);
+  slot = hashString(filename) & (tree->fileHashSize - 1);
+  while (FILE_HASH_EMPTY != (index = tree->fileHash[slot])) {
+    if (0 == strcmp(filename,
+		    tree->filenames[index].filename))
+      return (int) index;
+    slot = (slot + 1) & (tree->fileHashSize - 1);
+  }
+  return -1;
+}
+
 static char CIS[] = {
   0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
   10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
@@ -869,7 +1229,7 @@ static void checkInvariants(STNode * pos,
 /**
  * Macro to be used to check tree invariants.
  */
-#define CHECK(tree) { int i = 0; checkInvariants(tree->root, &i); if ((tree->root != NULL) && (tree->root->parent != NULL)) abort(); if (tree->used_memory != sizeof(STNode) * i) abort(); }
+#define CHECK(tree) { int i = 0; checkInvariants(tree->root, &i); checkInvariants(tree->froot, &i); if ((tree->root != NULL) && (tree->root->parent != NULL)) abort(); if (tree->used_memory != sizeof(STNode) * i) abort(); }
 #else
 #define CHECK(tree) {} while(0)
 #endif
@@ -898,24 +1258,71 @@ static void freeNode(SuffixTree * tree,
   }
 }
 
+/**
+ * Exchange the main tree and the case-folded tree.  All operations
+ * on the case-folded tree are done with the case-folded tree
+ * swapped in as tree->root since the code that swaps out nodes
+ * assumes that the nodes that are in use are in tree->root.
+ */
+static void swapRoots(SuffixTree * tree) {
+  STNode * tmp;
+  char * hint;
+  int cix;
+
+  tmp = tree->root;
+  tree->root = tree->froot;
+  tree->froot = tmp;
+  hint = tree->hint;
+  tree->hint = tree->fhint;
+  tree->fhint = hint;
+  cix = tree->hintCix;
+  tree->hintCix = tree->fhintCix;
+  tree->fhintCix = cix;
+}
+
+/**
+ * @brief sorted set of indices into tree->filenames
+ *  (used to compute the aggregates when writing the tree)
+ */
+typedef struct {
+  /* the indices, sorted, without duplicates */
+  unsigned int * ids;
+  /* number of indices in ids */
+  unsigned int count;
+  /* number of indices ids has room for */
+  unsigned int size;
+  /* largest aggregate written for a node below
+     (offset and number of files; 0 for none) */
+  unsigned long long aggOff;
+  unsigned int aggCount;
+  /* was some part of the subtree not available
+     (so that the set may be incomplete)? */
+  int incomplete;
+} FileSet;
+
 /**
  * Prototype, code see below.
  */
 static unsigned long long writeNode(BIO * fd,
 				    SuffixTree * tree,
-				    STNode * node);
+				    STNode * node,
+				    FileSet * files);
 
 /**
  * Shrink the given subtree of tree starting at node pos.
  * The ktC index into keepThese describes the next node
  * that must not be freed since it is referenced from
- * the calling context.
+ * the calling context.  Nodes less than tree->pinDepth
+ * levels below the root are never freed.
+ *
+ * @param depth level of pos in the tree (0 for the root)
  */
 static void processShrink(SuffixTree * tree,
 			  STNode ** keepThese,
 			  int ktC,
 			  int ktP,
 			  STNode * pos,
+			  unsigned int depth,
 			  unsigned int * kept) {
   int mark;
   STNode * next;
@@ -951,13 +1358,15 @@ static void processShrink(SuffixTree * tree,
       /* we are "allowed" to swap, do we want to
 	 swap this particular node? */
       if ( (pos->link->useCounter <= tree->swapLimit) &&
+	   (depth >= tree->pinDepth) &&
 	   ( (0 == tree->read_only) ||
 	     (pos->link->modified == 0) ) ) {
 	if ( (tree->force_dump != 0) ||
 	     (pos->link->modified != 0) ) {
 	  pos->link_off = writeNode(tree->fd,
 				    tree,
-				    pos->link);
+				    pos->link,
+				    NULL);
 	}
 	freeNode(tree,
 		 pos->link);
@@ -971,10 +1380,43 @@ static void processShrink(SuffixTree * tree,
 		      ktC,
 		      ktP,
 		      pos->link,
+		      depth,
 		      kept);
 	/* no continue here: need to also look
 	   at pos->child! */
       }
+    } else if ( (mark == 0) &&
+		(pos->link != NULL) &&
+		(pos->child != NULL) ) {
+      /* the link can not be swapped (it is part of an mls or
+	 leads to one), but the child can */
+      if ( (pos->child->useCounter <= tree->swapLimit) &&
+	   (depth + 1 >= tree->pinDepth) &&
+	   ( (0 == tree->read_only) ||
+	     (pos->child->modified == 0) ) ) {
+	if ( (tree->force_dump != 0) ||
+	     (pos->child->modified != 0) ) {
+	  pos->next_off = writeNode(tree->fd,
+				    tree,
+				    pos->child,
+				    NULL);
+	}
+	freeNode(tree,
+		 pos->child);
+	pos->child = NULL;
+	CHECK(tree);
+      } else {
+	pos->child->useCounter = 0;
+	processShrink(tree,
+		      keepThese,
+		      ktC,
+		      ktP,
+		      pos->child,
+		      depth + 1,
+		      kept);
+      }
+      pos = pos->link;
+      continue;
     } else {
       /* swap was not allowed... */
       ktP--;
@@ -983,6 +1425,7 @@ static void processShrink(SuffixTree * tree,
 		    ktC,
 		    ktP,
 		    pos->child,
+		    depth + 1,
 		    kept);
       pos = pos->link;
       continue;
@@ -992,13 +1435,15 @@ static void processShrink(SuffixTree * tree,
 	 (pos->child != NULL) ) {
       /* we are allowed to swap, do we want to? */
       if ( (pos->child->useCounter <= tree->swapLimit) &&
+	   (depth + 1 >= tree->pinDepth) &&
 	   ( (0 == tree->read_only) ||
 	     (pos->child->modified == 0) ) ) {
 	if ( (tree->force_dump != 0) ||
 	     (pos->child->modified != 0) ) {
 	  pos->next_off = writeNode(tree->fd,
 				    tree,
-				    pos->child);
+				    pos->child,
+				    NULL);
 	}
 	freeNode(tree,
 		 pos->child);
@@ -1010,11 +1455,13 @@ static void processShrink(SuffixTree * tree,
 	/* no, we don't want to swap this child,
 	   but continue processing with the subtree */
 	pos = pos->child;
+	depth++;
       }
     } else {
       /* swap was not allowed... */
       ktP--;
       pos = pos->child;
+      depth++;
     }
   }
   CHECK(tree);
@@ -1034,6 +1481,10 @@ static void shrinkMemoryFootprint(SuffixTree * tree,
 
   force_dump = tree->force_dump;
   tree->force_dump = 0; /* deactivate while shrinking! */
+  if (tree->shared != NULL) {
+    pthread_mutex_lock(&tree->shared->lock);
+    tree->fd->fsize = tree->shared->end;
+  }
   CHECK(tree);
   /* tree->swapLimit = tree->mutationCount / 2;
      RATIONALE: if we were able to perform very few mutations,
@@ -1068,7 +1519,10 @@ static void shrinkMemoryFootprint(SuffixTree * tree,
   }
 #endif
   kept = 0;
-  processShrink(tree, keepThese, ktC, ktC-2, tree->root, &kept);
+  processShrink(tree, keepThese, ktC, ktC-2, tree->root, 0, &kept);
+  /* nothing needs to be kept in the other tree */
+  if (tree->froot != NULL)
+    processShrink(tree, NULL, 0, -1, tree->froot, 0, &kept);
   CHECK(tree);
 #if ASSERTS
   if (kept * sizeof(STNode) != tree->used_memory) {
@@ -1084,6 +1538,11 @@ static void shrinkMemoryFootprint(SuffixTree * tree,
 	    _("Reduced memory consumption for suffix tree to %u bytes.\n"),
 	    tree->used_memory);
   CHECK(tree);
+  if (tree->shared != NULL) {
+    flush_buffer(tree->fd);
+    tree->shared->end = tree->fd->fsize;
+    pthread_mutex_unlock(&tree->shared->lock);
+  }
   tree->force_dump = force_dump;
 }
 
@@ -1097,6 +1556,8 @@ static STNode * lazyReadNode(SuffixTree * tree,
   int i;
   unsigned long long off_link;
   unsigned long long off_child;
+  unsigned long long agg_count;
+  unsigned long long agg_rel;
   unsigned char c_length;
   unsigned char mls_size;
   int mls;
@@ -1260,6 +1721,24 @@ static STNode * lazyReadNode(SuffixTree * tree,
 	ret[mls].matches[ret[mls].matchCount-1] = idx;
       }
     }
+    /* aggregate (distinct file count, relative offset of
+       the list of file indices); see writeNode */
+    if (off < tree->aggregatesStart) {
+      agg_count = 0; /* not known, computed when needed */
+      agg_rel = 0;
+    } else if (-1 == READULONGPAIR(tree->fd, &agg_count, &agg_rel))
+      goto ERROR_ABORT;
+    if ( (agg_count > tree->fnc) ||
+	 (agg_rel > off) ) {
+      tree->log(tree->context,
+		DOODLE_LOG_CRITICAL,
+		_("Assertion failed at %s:%d.\nDatabase format error!\n"),
+		__FILE__, __LINE__);
+      goto ERROR_ABORT;
+    }
+    ret[mls].aggCount = (unsigned int) agg_count;
+    if (agg_rel != 0)
+      ret[mls].aggOff = off - agg_rel;
   } /* end for mls */
 #if DEBUG > 1
   printf("%llu: Read  %u-Node (%c, %u, %u, %u) L:%llu, C:%llu until %llu\n",
@@ -1331,15 +1810,232 @@ static int loadLink(SuffixTree * tree,
   return 0;
 }
 
+static int compareFileIndex(const void * a,
+			    const void * b) {
+  unsigned int x;
+  unsigned int y;
+
+  x = *(const unsigned int*) a;
+  y = *(const unsigned int*) b;
+  if (x < y)
+    return -1;
+  if (x > y)
+    return 1;
+  return 0;
+}
+
+/**
+ * Add the given (sorted, duplicate-free) indices to the set.
+ * The set is merged in place (from the back), so that the
+ * buffer of the set is reused and only grows.
+ */
+static void fileSetMerge(FileSet * set,
+			 const unsigned int * ids,
+			 unsigned int count) {
+  unsigned int i;
+  unsigned int j;
+  unsigned int n;
+
+  if (count == 0)
+    return;
+  /* size of the union */
+  i = 0;
+  j = 0;
+  n = set->count + count;
+  while ( (i < set->count) && (j < count) ) {
+    if (set->ids[i] < ids[j]) {
+      i++;
+    } else if (set->ids[i] > ids[j]) {
+      j++;
+    } else {
+      i++;
+      j++;
+      n--;
+    }
+  }
+  if (n > set->size)
+    GROW(set->ids,
+	 set->size,
+	 (set->size * 2 > n) ? set->size * 2 : n);
+  i = set->count;
+  j = count;
+  set->count = n;
+  while (j > 0) {
+    if ( (i > 0) &&
+	 (set->ids[i-1] > ids[j-1]) ) {
+      set->ids[--n] = set->ids[--i];
+    } else {
+      if ( (i > 0) &&
+	   (set->ids[i-1] == ids[j-1]) )
+	i--;
+      set->ids[--n] = ids[--j];
+    }
+  }
+}
+
+/**
+ * Add the matches of the given node to the set.
+ */
+static void fileSetAddMatches(FileSet * set,
+			      const STNode * node) {
+  unsigned int * ids;
+  unsigned int i;
+  unsigned int n;
+
+  if (node->matchCount == 0)
+    return;
+  ids = MALLOC(sizeof(unsigned int) * node->matchCount);
+  memcpy(ids,
+	 node->matches,
+	 sizeof(unsigned int) * node->matchCount);
+  qsort(ids,
+	node->matchCount,
+	sizeof(unsigned int),
+	&compareFileIndex);
+  n = 1;
+  for (i=1;i<node->matchCount;i++)
+    if (ids[i] != ids[n-1])
+      ids[n++] = ids[i];
+  fileSetMerge(set, ids, n);
+  free(ids);
+}
+
+/**
+ * Write the list of file indices of an aggregate.  The list
+ * is stored either as a bitmap (type 1, for dense lists) or as
+ * the sequence of differences between the indices (type 0).
+ *
+ * @param ids sorted list of indices, must not be empty
+ * @return offset at which the list is written
+ */
+static unsigned long long writeAggregate(BIO * fd,
+					 const unsigned int * ids,
+					 unsigned int count) {
+  unsigned long long ret;
+  unsigned char * bitmap;
+  unsigned char type;
+  unsigned int bytes;
+  unsigned int i;
+
+  ret = LSEEK(fd, 0, SEEK_END);
+  bytes = ids[count-1] / 8 + 1;
+  /* the differences take about 1.5 bytes per index */
+  if (bytes <= count + count / 2) {
+    type = 1;
+    WRITEALL(fd, &type, sizeof(unsigned char));
+    bitmap = MALLOC(bytes);
+    for (i=0;i<count;i++)
+      bitmap[ids[i] / 8] |= (1 << (ids[i] % 8));
+    WRITEUINT(fd, bytes);
+    WRITEALL(fd, bitmap, bytes);
+    free(bitmap);
+  } else {
+    type = 0;
+    WRITEALL(fd, &type, sizeof(unsigned char));
+    for (i=0;i+1<count;i+=2)
+      WRITEUINTPAIR(fd,
+		    (i == 0) ? ids[0] : ids[i] - ids[i-1],
+		    ids[i+1] - ids[i]);
+    if (1 == (count & 1) )
+      WRITEUINT(fd,
+		(count == 1) ? ids[0] : ids[count-1] - ids[count-2]);
+  }
+  return ret;
+}
+
+/**
+ * Read the list of file indices of the aggregate of the given
+ * node (which must have one, see writeAggregate).
+ *
+ * @param ids set to the sorted list of indices (to be freed
+ *   by the caller)
+ * @return number of indices, -1 on error
+ */
+static int readAggregate(SuffixTree * tree,
+			 const STNode * node,
+			 unsigned int ** ids) {
+  unsigned char * bitmap;
+  unsigned char type;
+  unsigned int bytes;
+  unsigned int gap1;
+  unsigned int gap2;
+  unsigned int last;
+  unsigned int i;
+  unsigned int n;
+
+  LSEEK(tree->fd, node->aggOff, SEEK_SET);
+  if (-1 == READALL(tree->fd, &type, sizeof(unsigned char)))
+    return -1;
+  *ids = MALLOC(sizeof(unsigned int) * node->aggCount);
+  n = 0;
+  if (type == 1) {
+    if ( (-1 == READUINT(tree->fd, &bytes)) ||
+	 (bytes == 0) ||
+	 (bytes > (tree->fnc + 7) / 8) )
+      goto FORMAT_ERROR;
+    bitmap = MALLOC(bytes);
+    if (-1 == READALL(tree->fd, bitmap, bytes)) {
+      free(bitmap);
+      goto FORMAT_ERROR;
+    }
+    for (i=0;i<bytes * 8;i++) {
+      if ((bitmap[i / 8] & (1 << (i % 8))) == 0)
+	continue;
+      if (n == node->aggCount)
+	break;
+      (*ids)[n++] = i;
+    }
+    free(bitmap);
+  } else if (type == 0) {
+    last = 0;
+    for (i=0;i+1<node->aggCount;i+=2) {
+      if (-1 == READUINTPAIR(tree->fd, &gap1, &gap2))
+	goto FORMAT_ERROR;
+      (*ids)[n++] = last + gap1;
+      last = (*ids)[n-1] + gap2;
+      (*ids)[n++] = last;
+    }
+    if (1 == (node->aggCount & 1) ) {
+      if (-1 == READUINT(tree->fd, &gap1))
+	goto FORMAT_ERROR;
+      (*ids)[n++] = last + gap1;
+    }
+  }
+  if ( (n != node->aggCount) ||
+       ( (*ids)[n-1] >= tree->fnc) )
+    goto FORMAT_ERROR;
+  return n;
+ FORMAT_ERROR:
+  tree->log(tree->context,
+	    DOODLE_LOG_CRITICAL,
+	    _("Assertion failed at %s:%d.\nDatabase format error!\n"),
+	    __FILE__, __LINE__);
+  free(*ids);
+  *ids = NULL;
+  return -1;
+}
+
 /**
+ * Write the given node (and everything that was modified
+ * below it) to the file.  If files is not NULL (final dump
+ * of the database), the aggregates of all nodes are computed
+ * and written as well; the indices of all files matching in
+ * node, its subtrees and the nodes linked from it are then
+ * added to files.
+ *
  * @return offset at which node is written!
  */
 static unsigned long long writeNode(BIO * fd,
 				    SuffixTree * tree,
-				    STNode * node) {
+				    STNode * node,
+				    FileSet * files) {
   unsigned long long ret;
   unsigned long long linkRel;
   unsigned long long nextRel;
+  unsigned long long aggRel;
+  unsigned int * aggCount;
+  unsigned long long * aggOff;
+  FileSet set;
   int i;
   int mls;
 
@@ -1348,32 +2044,78 @@ static unsigned long long writeNode(BIO * fd,
   if (tree->read_only)
     abort();
 
+  if (files != NULL) {
+    aggCount = MALLOC(sizeof(unsigned int) * node->mls_size);
+    aggOff = MALLOC(sizeof(unsigned long long) * node->mls_size);
+  } else {
+    aggCount = NULL;
+    aggOff = NULL;
+  }
   node->modified = 0;
   for (mls=0;mls<node->mls_size;mls++) {
     if ( (node[mls].child == NULL) &&
 	 (node[mls].next_off != 0) &&
 	 (tree->force_dump != 0) )
       loadChild(tree, &node[mls]);
+    memset(&set, 0, sizeof(FileSet));
+    if (files != NULL) {
+      fileSetAddMatches(&set, &node[mls]);
+      if ( (node[mls].child == NULL) &&
+	   (node[mls].next_off != 0) )
+	set.incomplete = 1;
+    }
     if ( (node[mls].child != NULL) &&
 	 ( (node[mls].child->modified != 0) ||
 	   (tree->force_dump != 0) ) )
       node[mls].next_off
 	= writeNode(fd,
 		    tree,
-		    node[mls].child);
+		    node[mls].child,
+		    (files != NULL) ? &set : NULL);
+    if (files != NULL) {
+      if (set.incomplete) {
+	aggCount[mls] = 0;
+	files->incomplete = 1;
+      } else {
+	aggCount[mls] = set.count;
+      }
+      if ( (aggCount[mls] != 0) &&
+	   (aggCount[mls] >= AGGREGATE_THRESHOLD) ) {
+	/* the files below are a subset of ours; if a node
+	   below has as many, the list is the same (this is
+	   the case along chains of nodes with one child) and
+	   we only point to it */
+	if (set.aggCount == aggCount[mls])
+	  aggOff[mls] = set.aggOff;
+	else
+	  aggOff[mls] = writeAggregate(fd, set.ids, set.count);
+	if (aggCount[mls] > files->aggCount) {
+	  files->aggCount = aggCount[mls];
+	  files->aggOff = aggOff[mls];
+	}
+      }
+      fileSetMerge(files, set.ids, set.count);
+      if (set.ids != NULL)
+	free(set.ids);
+    }
   }
   if ( (node[node->mls_size-1].link == NULL) &&
        (node[node->mls_size-1].link_off != 0) &&
        (tree->force_dump != 0) ) {
     loadLink(tree, &node[node->mls_size-1]);
   }
+  if ( (files != NULL) &&
+       (node[node->mls_size-1].link == NULL) &&
+       (node[node->mls_size-1].link_off != 0) )
+    files->incomplete = 1;
   if ( (node[node->mls_size-1].link != NULL) &&
        ( (node[node->mls_size-1].link->modified != 0) ||
 	 (tree->force_dump != 0) ) ) {
     node[node->mls_size-1].link_off
       = writeNode(fd,
 		  tree,
-		  node[node->mls_size-1].link);
+		  node[node->mls_size-1].link,
+		  files);
   }
   ret = LSEEK(fd, 0, SEEK_END);
 #if ASSERTS
@@ -1494,7 +2236,29 @@ static unsigned long long writeNode(BIO * fd,
       WRITEUINT(fd,
 		idx);
     }
+    /* aggregate; when swapping we keep what we have
+       (aggCount is 0 unless the subtree is unmodified,
+       in which case aggOff still refers to this file) */
+    if (files != NULL) {
+      if (aggOff[mls] != 0)
+	aggRel = ret - aggOff[mls];
+      else
+	aggRel = 0;
+      WRITEULONGPAIR(fd, aggCount[mls], aggRel);
+    } else if (node[mls].aggCount != 0) {
+      if (node[mls].aggOff != 0)
+	aggRel = ret - node[mls].aggOff;
+      else
+	aggRel = 0;
+      WRITEULONGPAIR(fd, node[mls].aggCount, aggRel);
+    } else {
+      WRITEULONGPAIR(fd, 0, 0);
+    }
   } /* for mls */
+  if (files != NULL) {
+    free(aggCount);
+    free(aggOff);
+  }
 #if DEBUG > 1
   printf("%llu: Wrote %u-node (%c, %u, %u, %u) L:%llu, C:%llu until %llu\n",
 	 ret,
@@ -1521,57 +2285,571 @@ static unsigned long long writeNode(BIO * fd,
 }
 
 
+/* ******************** q-gram filter ********************** */
+
 /**
- * Magic string is DOO for doodle followed by a '\0' to indicate a
- * binary file.  The next 4 digits describe the format version,
- * currently always "0002" to indicate compatibility with doodle
- * 0.2.0. ("0000" used SHA-1 instead of timestamps and is no longer
- * supported; "0001" was never used (see TRAGIC)).
- *
- * Doodle 0.5.0 is incompatible with 0.2.0 to 0.4.0, hence a new
- * version number.  The major differences are support for 64-bit
- * offsets (which would allow reading an 0.4.0 db per-se), but
- * also relative file offsets (which reduces the DB size and
- * breaks compatibility even for DB-sizes smaller than 2^31).
- *
- * Doodle 0.6.0 is again incompatible with 0.5.0, this
- * time introducing the 'mls' node groups (which has the potential
- * to significantly improve performance).
+ * The q-gram filter records which 2-grams (exactly, one bit for
+ * each pair of bytes) and 3-grams (hashed) occur in the keywords
+ * of the tree.  A search string that contains a 2- or 3-gram that
+ * is not in the filter can not match, and we can answer the
+ * search without loading any nodes.  Removing keywords does not
+ * update the filter (it is rebuilt when the database is written).
  */
-static char * MAGIC = "DOO\0000007";
+#define QGRAM_BIGRAM_BYTES (256 * 256 / 8)
+#define QGRAM_TRIGRAM_BITS 19
+#define QGRAM_BYTES (QGRAM_BIGRAM_BYTES + (1 << QGRAM_TRIGRAM_BITS) / 8)
+
+static unsigned int gramsTrigram(unsigned char a,
+				 unsigned char b,
+				 unsigned char c) {
+  unsigned int h;
+
+  h = (a << 16) | (b << 8) | c;
+  h *= 2654435761U;
+  return QGRAM_BIGRAM_BYTES * 8 + (h >> (32 - QGRAM_TRIGRAM_BITS));
+}
 
 /**
- * Magic string to indicate an temporary doodle database that
- * could not be completely created (the indexing/building process
- * was aborted).
+ * Add the grams ending at the given character.
+ * @param prev previous two characters (prev[1] is the last one)
+ * @param plen number of valid characters in prev (0 to 2)
  */
-static char * TRAGIC = "XOO\0000001";
+static void gramsAddChar(unsigned char * grams,
+			 const unsigned char * prev,
+			 unsigned int plen,
+			 unsigned char c) {
+  unsigned int bit;
+
+  if (plen >= 1) {
+    bit = (prev[1] << 8) | c;
+    grams[bit / 8] |= (1 << (bit % 8));
+  }
+  if (plen >= 2) {
+    bit = gramsTrigram(prev[0], prev[1], c);
+    grams[bit / 8] |= (1 << (bit % 8));
+  }
+}
 
 /**
- * Create a suffix-tree (and store in file named database).
+ * Add the grams of a keyword to the filter.
  */
-SuffixTree * DOODLE_tree_create_internal(DOODLE_Logger log,
-					 void * context,
-					 const char * database,
-					 int flags) {
-  int ifd;
-  BIO * fd;
-  SuffixTree * ret;
-  struct stat buf;
-  int i;
-  unsigned long long off;
-  pchar* pathTab;
-  unsigned int ptc;
-  signed char magic[8];
+static void gramsAdd(SuffixTree * tree,
+		     const char * keyword) {
+  const unsigned char * k = (const unsigned char *) keyword;
+  unsigned char ctx[2];
+  unsigned int clen;
+  unsigned int i;
+
+  if (tree->grams == NULL)
+    return;
+  ctx[0] = 0;
+  ctx[1] = 0;
+  clen = 0;
+  for (i=0;k[i]!='\0';i++) {
+    gramsAddChar(tree->grams,
+		 ctx,
+		 clen,
+		 k[i]);
+    ctx[0] = ctx[1];
+    ctx[1] = k[i];
+    if (clen < 2)
+      clen++;
+  }
+}
 
-  ret = MALLOC(sizeof(SuffixTree));
-  ret->log = log;
-  ret->context = context;
-  ret->database = STRDUP(database);
-  ret->modified = 0;
-  ret->used_memory = 0;
-  ret->memory_limit = MEMORY_LIMIT;
+/**
+ * Check if the given string may occur in the tree.
+ * @return 0 if it certainly does not occur, 1 if it may
+ */
+static int gramsMayMatch(SuffixTree * tree,
+			 const char * substring) {
+  const unsigned char * s = (const unsigned char *) substring;
+  unsigned int bit;
+  unsigned int i;
+
+  if (tree->grams == NULL)
+    return 1;
+  for (i=0;s[i]!='\0';i++) {
+    if (i >= 1) {
+      bit = (s[i-1] << 8) | s[i];
+      if ((tree->grams[bit / 8] & (1 << (bit % 8))) == 0)
+	return 0;
+    }
+    if (i >= 2) {
+      bit = gramsTrigram(s[i-2], s[i-1], s[i]);
+      if ((tree->grams[bit / 8] & (1 << (bit % 8))) == 0)
+	return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Add the grams of all keywords below node (and the nodes
+ * linked from it) to the filter.
+ *
+ * @param prev last two characters of the path to node
+ * @param plen number of valid characters in prev (0 to 2)
+ * @return -1 on error, 0 on success
+ */
+static int gramsWalk(SuffixTree * tree,
+		     STNode * node,
+		     const unsigned char * prev,
+		     unsigned int plen) {
+  unsigned char ctx[2];
+  unsigned int clen;
+  unsigned int i;
+
+  while (node != NULL) {
+    ctx[0] = prev[0];
+    ctx[1] = prev[1];
+    clen = plen;
+    /* empty (mls) entries are not part of any keyword */
+    if ( (node->matchCount != 0) ||
+	 (node->child != NULL) ||
+	 (node->next_off != 0) ) {
+      for (i=0;i<node->clength;i++) {
+	gramsAddChar(tree->grams,
+		     ctx,
+		     clen,
+		     (unsigned char) node->c[i]);
+	ctx[0] = ctx[1];
+	ctx[1] = (unsigned char) node->c[i];
+	if (clen < 2)
+	  clen++;
+      }
+    }
+    if ( (node->child == NULL) &&
+	 (node->next_off != 0) )
+      if (-1 == loadChild(tree,
+			  node))
+	return -1;
+    if (-1 == gramsWalk(tree,
+			node->child,
+			ctx,
+			clen))
+      return -1;
+    if ( (node->link == NULL) &&
+	 (node->link_off != 0) )
+      if (-1 == loadLink(tree,
+			 node))
+	return -1;
+    node = node->link;
+  }
+  return 0;
+}
+
+/**
+ * Rebuild the filter from the keywords in the tree.
+ */
+static void gramsRebuild(SuffixTree * tree) {
+  unsigned char prev[2];
+  int ret;
+
+  if (tree->grams == NULL)
+    tree->grams = MALLOC(QGRAM_BYTES);
+  else
+    memset(tree->grams, 0, QGRAM_BYTES);
+  prev[0] = 0;
+  prev[1] = 0;
+  ret = gramsWalk(tree,
+		  tree->root,
+		  prev,
+		  0);
+  if ( (ret == 0) &&
+       (tree->froot != NULL) ) {
+    swapRoots(tree);
+    ret = gramsWalk(tree,
+		    tree->root,
+		    prev,
+		    0);
+    swapRoots(tree);
+  }
+  if (ret == -1) {
+    /* incomplete filter would reject valid searches */
+    free(tree->grams);
+    tree->grams = NULL;
+  }
+  tree->gramsStale = 0;
+}
+
+
+/* ******************** flat keyword index ********************** */
+
+/**
+ * The flat index keeps the keywords of each file as one packed
+ * block of '\0'-terminated strings.  A string occurs in the tree
+ * iff it is a substring of one of the keywords (as long as every
+ * keyword was added together with all of its suffixes, which is
+ * what index.c and logreplay do), so short search strings that
+ * would visit most of the tree can instead be answered by one
+ * linear scan over all keywords.  Only the keywords themselves
+ * are stored; the suffixes that follow them are just counted.
+ * If a string is added that does not fit this pattern, the flat
+ * index is dropped (we would otherwise report wrong results).
+ */
+
+/**
+ * Release the flat index (without disabling it).
+ */
+static void flatFree(SuffixTree * tree) {
+  unsigned int i;
+
+  for (i=0;i<tree->flatSize;i++)
+    if (tree->flat[i].data != NULL)
+      free(tree->flat[i].data);
+  GROW(tree->flat,
+       tree->flatSize,
+       0);
+  tree->flatOff = 0;
+}
+
+/**
+ * Drop the flat index since the tree contains strings that we
+ * can not represent.
+ */
+static void flatDisable(SuffixTree * tree,
+			const char * fileName) {
+  tree->log(tree->context,
+	    DOODLE_LOG_VERBOSE,
+	    _("Keywords of file '%s' were not added with all of their suffixes, removing the flat keyword index.\n"),
+	    fileName);
+  flatFree(tree);
+  tree->flatIndex = 0;
+  tree->modified = 1;
+}
+
+/**
+ * Load the flat index from the database (if this has not
+ * happened yet).
+ * @return 0 on success, -1 on error (index removed)
+ */
+static int flatLoad(SuffixTree * tree) {
+  FlatKeywords * fk;
+  unsigned int i;
+
+  if (tree->flatOff == 0)
+    return 0;
+  GROW(tree->flat,
+       tree->flatSize,
+       tree->fns);
+  LSEEK(tree->fd, tree->flatOff, SEEK_SET);
+  tree->flatOff = 0;
+  for (i=0;i<tree->fnc;i++) {
+    fk = &tree->flat[i];
+    if (-1 == READUINT(tree->fd,
+		       &fk->len))
+      break;
+    fk->size = fk->len;
+    fk->last = fk->len;
+    if (fk->len == 0)
+      continue;
+    fk->data = MALLOC(fk->len);
+    if (-1 == READALL(tree->fd,
+		      fk->data,
+		      fk->len))
+      break;
+  }
+  if (i < tree->fnc) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Error reading database '%s' at %s.%d.\n"),
+	      tree->database,
+	      __FILE__, __LINE__);
+    flatFree(tree);
+    tree->flatIndex = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Is the last keyword of the given file complete (were all of
+ * its suffixes added)?
+ */
+static int flatComplete(const FlatKeywords * fk) {
+  return (fk->last == fk->len) ||
+    (fk->covered == fk->len - fk->last - 1);
+}
+
+/**
+ * Record that the given string was added to the tree for the
+ * file with the given index.
+ */
+static void flatAdd(SuffixTree * tree,
+		    const char * searchString,
+		    unsigned int fileIndex) {
+  FlatKeywords * fk;
+  unsigned int slen;
+  unsigned int i;
+
+  if (0 != flatLoad(tree))
+    return;
+  if (fileIndex >= tree->flatSize) {
+    i = tree->flatSize;
+    GROW(tree->flat,
+	 tree->flatSize,
+	 tree->fns);
+    memset(&tree->flat[i],
+	   0,
+	   sizeof(FlatKeywords) * (tree->flatSize - i));
+  }
+  fk = &tree->flat[fileIndex];
+  slen = strlen(searchString);
+  if (! flatComplete(fk)) {
+    if ( (slen == fk->len - fk->last - 1 - fk->covered) &&
+	 (0 == memcmp(&fk->data[fk->last + fk->covered],
+		      searchString,
+		      slen)) ) {
+      fk->covered++;
+      return;
+    }
+    flatDisable(tree,
+		tree->filenames[fileIndex].filename);
+    return;
+  }
+  if (fk->len + slen + 1 > fk->size)
+    GROW(fk->data,
+	 fk->size,
+	 fk->size * 2 + slen + 1);
+  memcpy(&fk->data[fk->len],
+	 searchString,
+	 slen + 1);
+  fk->last = fk->len;
+  fk->len += slen + 1;
+  fk->covered = 1;
+}
+
+/**
+ * Is the flat index ready to answer searches?
+ * @return 1 if yes, 0 if not
+ */
+static int flatReady(SuffixTree * tree) {
+  unsigned int i;
+
+  if ( (tree->flatIndex == 0) ||
+       (0 != flatLoad(tree)) )
+    return 0;
+  for (i=0;i<tree->fnc;i++)
+    if ( (i < tree->flatSize) &&
+	 (! flatComplete(&tree->flat[i])) )
+      return 0; /* in the middle of adding a keyword */
+  return 1;
+}
+
+/**
+ * Find needle (of length nlen > 0) in the given data.  memchr
+ * finds the candidates (the C library scans with wide words),
+ * memcmp checks them.  (memmem is not used: it is only declared
+ * if _GNU_SOURCE is defined before the first system header,
+ * which the tests that include this file do not do.)
+ *
+ * @return NULL if the needle does not occur
+ */
+static const char * flatFind(const char * data,
+			     unsigned int len,
+			     const char * needle,
+			     unsigned int nlen) {
+  const char * pos;
+  const char * end;
+
+  if (nlen == 1)
+    return memchr(data, needle[0], len);
+  if (nlen > len)
+    return NULL;
+  pos = data;
+  end = &data[len - nlen + 1];
+  while (pos < end) {
+    pos = memchr(pos, needle[0], end - pos);
+    if (pos == NULL)
+      return NULL;
+    if (0 == memcmp(pos, needle, nlen))
+      return pos;
+    pos++;
+  }
+  return NULL;
+}
+
+static int compareSuffix(const void * a,
+			 const void * b) {
+  return strcmp(*(const char * const *) a,
+		*(const char * const *) b);
+}
+
+/**
+ * Report the files that have a keyword containing the given
+ * string.  As in the search in the tree, a file is reported once
+ * for every distinct suffix of its keywords that starts with the
+ * string (each of those is a node of the tree that lists the
+ * file), so the number of results is the same.
+ * @return number of results
+ */
+static int flatScan(SuffixTree * tree,
+		    const char * substring,
+		    DOODLE_ResultCallback callback,
+		    void * arg) {
+  FlatKeywords * fk;
+  const char * pos;
+  const char ** suffixes;
+  unsigned int suffixSize;
+  unsigned int count;
+  unsigned int slen;
+  unsigned int i;
+  unsigned int j;
+  unsigned int n;
+  int ret;
+
+  slen = strlen(substring);
+  suffixes = NULL;
+  suffixSize = 0;
+  ret = 0;
+  for (i=0;(i<tree->fnc) && (i<tree->flatSize);i++) {
+    fk = &tree->flat[i];
+    if (fk->len == 0)
+      continue;
+    count = 0;
+    pos = fk->data;
+    while (NULL != (pos = flatFind(pos,
+				   &fk->data[fk->len] - pos,
+				   substring,
+				   slen))) {
+      if (count == suffixSize)
+	GROW(suffixes,
+	     suffixSize,
+	     suffixSize * 2 + 16);
+      suffixes[count++] = pos;
+      pos++;
+    }
+    if (count > 1) {
+      qsort(suffixes,
+	    count,
+	    sizeof(const char *),
+	    &compareSuffix);
+      n = 1;
+      for (j=1;j<count;j++)
+	if (0 != strcmp(suffixes[j],
+			suffixes[n-1]))
+	  suffixes[n++] = suffixes[j];
+      count = n;
+    }
+    for (j=0;j<count;j++)
+      if (callback != NULL)
+	callback(&tree->filenames[i],
+		 arg);
+    ret += count;
+  }
+  GROW(suffixes,
+       suffixSize,
+       0);
+  return ret;
+}
+
+
+/**
+ * Magic string is DOO for doodle followed by a '\0' to indicate a
+ * binary file.  The next 4 digits describe the format version,
+ * currently always "0002" to indicate compatibility with doodle
+ * 0.2.0. ("0000" used SHA-1 instead of timestamps and is no longer
+ * supported; "0001" was never used (see TRAGIC)).
+ *
+ * Doodle 0.5.0 is incompatible with 0.2.0 to 0.4.0, hence a new
+ * version number.  The major differences are support for 64-bit
+ * offsets (which would allow reading an 0.4.0 db per-se), but
+ * also relative file offsets (which reduces the DB size and
+ * breaks compatibility even for DB-sizes smaller than 2^31).
+ *
+ * Doodle 0.6.0 is again incompatible with 0.5.0, this
+ * time introducing the 'mls' node groups (which has the potential
+ * to significantly improve performance).
+ *
+ * "0009" adds the per-node aggregates (number of distinct files
+ * in the subtree and, for large subtrees, the list of files),
+ * the database flags and the case-folded tree ("0007" databases
+ * of doodle 0.7.0 are still read, see MAGIC_0007).
+ * Later additions that older readers can safely ignore are
+ * indicated by database flags (DB_FLAG_QGRAMS, DB_FLAG_FLAT,
+ * DB_FLAG_WORDS).
+ */
+static char * MAGIC = "DOO\0000009";
+
+/**
+ * Magic string of the format of doodle 0.7.0, which lacks the
+ * database flags, the offset of the case-folded tree and the
+ * aggregates of the nodes.  Such a database is searched without
+ * the aggregates and written in the current format when it is
+ * modified (nodes that are swapped out before that are appended
+ * in the current format, see aggregatesStart).
+ */
+static char * MAGIC_0007 = "DOO\0000007";
+
+/**
+ * Database flag: the database contains the case-folded tree.
+ */
+#define DB_FLAG_CASE_FOLDED 1
+
+/**
+ * Database flag: the q-gram filter follows the offsets of the
+ * roots.
+ */
+#define DB_FLAG_QGRAMS 2
+
+/**
+ * Database flag: the flat keyword index follows the q-gram
+ * filter.
+ */
+#define DB_FLAG_FLAT 4
+
+/**
+ * Database flag: the database is a word index (keywords were
+ * added as words, see DOODLE_tree_set_word_index).
+ */
+#define DB_FLAG_WORDS 8
+
+/**
+ * Magic string to indicate an temporary doodle database that
+ * could not be completely created (the indexing/building process
+ * was aborted).
+ */
+static char * TRAGIC = "XOO\0000001";
+
+/**
+ * Magic string of a frozen database (see DOODLE_tree_freeze).
+ */
+static char * FROZEN_MAGIC = "DOF\0000001";
+
+/**
+ * Magic string of an FM index (see DOODLE_tree_build_fm_index).
+ */
+static char * FM_MAGIC = "DFM\0000001";
+
+/**
+ * Create a suffix-tree (and store in file named database).
+ */
+SuffixTree * DOODLE_tree_create_internal(DOODLE_Logger log,
+					 void * context,
+					 const char * database,
+					 int flags) {
+  int ifd;
+  BIO * fd;
+  SuffixTree * ret;
+  struct stat buf;
+  int i;
+  unsigned long long off;
+  unsigned long long foff;
+  unsigned int dbflags;
+  pchar* pathTab;
+  unsigned int ptc;
+  signed char magic[8];
+
+  ret = MALLOC(sizeof(SuffixTree));
+  ret->log = log;
+  ret->context = context;
+  ret->database = STRDUP(database);
+  ret->modified = 0;
+  ret->used_memory = 0;
+  ret->memory_limit = MEMORY_LIMIT;
   ret->swapLimit = 65536; /* start very high */
+  ret->cacheSize = RESULT_CACHE_SIZE;
   ret->mutationCount = 0;
   ret->force_dump = 0;
   ret->read_only = (flags == O_RDONLY);
@@ -1616,9 +2894,37 @@ SuffixTree * DOODLE_tree_create_internal(DOODLE_Logger log,
 	     "garbage!",
 	     8);
     }
-    if (0 != memcmp(magic,
-		    MAGIC,
-		    8)) {
+    if ( (0 == memcmp(magic,
+		      FROZEN_MAGIC,
+		      8)) ||
+	 (0 == memcmp(magic,
+		      FM_MAGIC,
+		      8)) ) {
+      if ( (flags != O_RDONLY) ||
+	   (-1 == frozenLoad(ret,
+			     fd,
+			     0 == memcmp(magic,
+					 FM_MAGIC,
+					 8))) ) {
+	if (flags != O_RDONLY)
+	  log(context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Database '%s' is frozen and can not be modified.\n"),
+	      database);
+	IO_FREE(fd);
+	free(ret->database);
+	free(ret);
+	return NULL;
+      }
+      ret->fd = fd;
+      return ret;
+    }
+    if ( (0 != memcmp(magic,
+		      MAGIC,
+		      8)) &&
+	 (0 != memcmp(magic,
+		      MAGIC_0007,
+		      8)) ) {
       if (0 == memcmp(magic,
 		      TRAGIC,
 		      8)) {
@@ -1761,7 +3067,17 @@ SuffixTree * DOODLE_tree_create_internal(DOODLE_Logger log,
   	return NULL;
       }
     }
-    if (-1 == READULONGFULL(fd, &off)) {
+    dbflags = 0;
+    foff = 0;
+    if ( ( (0 == memcmp(magic,
+			MAGIC,
+			8)) &&
+	   (-1 == READUINT(fd, &dbflags)) ) ||
+	 (-1 == READULONGFULL(fd, &off)) ||
+	 ( (0 == memcmp(magic,
+			MAGIC,
+			8)) &&
+	   (-1 == READULONGFULL(fd, &foff)) ) ) {
       for (i=ret->cisPos-1;i>=0;i--)
 	free(ret->cis[++i]);
       free(ret->cis);
@@ -1773,9 +3089,32 @@ SuffixTree * DOODLE_tree_create_internal(DOODLE_Logger log,
       IO_FREE(fd);
       return NULL;
     }
+    if (0 == memcmp(magic,
+		    MAGIC_0007,
+		    8))
+      ret->aggregatesStart = buf.st_size;
+    ret->fold = ((dbflags & DB_FLAG_CASE_FOLDED) != 0) ? 1 : 0;
+    ret->words = ((dbflags & DB_FLAG_WORDS) != 0) ? 1 : 0;
+    if ((dbflags & DB_FLAG_QGRAMS) != 0) {
+      ret->grams = MALLOC(QGRAM_BYTES);
+      if (-1 == READALL(fd,
+			ret->grams,
+			QGRAM_BYTES)) {
+	/* search without the filter */
+	free(ret->grams);
+	ret->grams = NULL;
+      }
+    }
+    if ((dbflags & DB_FLAG_FLAT) != 0) {
+      /* loaded when it is first needed */
+      ret->flatIndex = 1;
+      ret->flatOff = LSEEK(fd, 0, SEEK_CUR);
+    }
     ret->fd = fd;
     ret->root = lazyReadNode(ret,
 			     off);
+    ret->froot = lazyReadNode(ret,
+			      foff);
   } else {
   FRESH_START:
     if (flags == O_RDONLY) {
@@ -1825,6 +3164,7 @@ SuffixTree * DOODLE_tree_create_internal(DOODLE_Logger log,
     ret->cis = NULL;
     ret->cisLen = 0;
     ret->cisPos = 0;
+    ret->grams = MALLOC(QGRAM_BYTES);
     /* write anti-marker: this is at best a
        temporary-DB, but never the final one; hence
        "tragic" -- if we start with this one,
@@ -1881,63 +3221,233 @@ SuffixTree * DOODLE_tree_open_RDONLY(DOODLE_Logger log,
  */
 void DOODLE_tree_set_memory_limit(SuffixTree * tree,
 				  size_t limit) {
+  unsigned int i;
+
+  for (i=0;i<tree->workerCount;i++)
+    DOODLE_tree_set_memory_limit(tree->workers[i],
+				 limit / (tree->workerCount + 1));
   tree->memory_limit = limit;
   if (tree->used_memory > tree->memory_limit)
     shrinkMemoryFootprint(tree, tree->root);
 }
 
 /**
- * Destroy (and sync) suffix tree.
+ * Enable or disable the case-folded index.  The index can
+ * only be enabled for an empty database (since we do not
+ * know which strings were added for the existing files).
+ *
+ * @param enable 1 to enable, 0 to disable
+ * @return 0 on success, -1 on error
  */
-void DOODLE_tree_destroy(SuffixTree * tree) {
-  BIO * fd;
-  int i;
-  int j;
-  unsigned long long off;
-  off_t wpos;
-  pchar * pathTab;
-  unsigned int ptc;
+int DOODLE_tree_set_case_folding(SuffixTree * tree,
+				 int enable) {
   STNode * tmp;
 
-  CHECK(tree);
-  if ( (0 == tree->read_only) &&
-       ( (tree->modified != 0) ||
-	 ( (tree->root != NULL) &&
-	   (tree->root->modified != 0) ) ) ) {
-    int fdt;
-    char * tdatabase;
-
-    tree->force_dump = 1; /* force re-dump everything! */
-    tdatabase = MALLOC(strlen(tree->database) + 2);
-    strcpy(tdatabase,
-	   tree->database);
-    strcat(tdatabase,
-	   "~");
-#ifdef O_LARGEFILE
-    fdt = open(tdatabase,
-	       O_CREAT | O_TRUNC | O_RDWR | O_LARGEFILE,
-	       S_IRUSR | S_IWUSR | S_IRGRP);
-#else
-    fdt = open(tdatabase,
-	       O_CREAT | O_TRUNC | O_RDWR,
-	       S_IRUSR | S_IWUSR | S_IRGRP);
-#endif
-    if (fdt == -1) {
+  if (tree->read_only)
+    return -1;
+  if (enable != 0) {
+    if (tree->fold != 0)
+      return 0;
+    if (tree->fnc != 0) {
       tree->log(tree->context,
-		DOODLE_LOG_CRITICAL,
-		_("Could not open temporary file '%s': %s\n"),
-		tdatabase,
-		strerror(errno));
-      free(tdatabase);
-      goto CLEANUP;
+		DOODLE_LOG_VERBOSE,
+		_("Case-folded index can only be enabled for an empty database.\n"));
+      return -1;
     }
-    fd = IO_WRAP(tree->log,
-		 tree->context,
-		 fdt);
-    WRITEALL(fd,
-	     MAGIC,
-	     8);
-    tree->log(tree->context,
+    tree->fold = 1;
+  } else {
+    if (tree->fold == 0)
+      return 0;
+    tree->fold = 0;
+    tmp = tree->froot;
+    tree->froot = NULL;
+    freeNode(tree, tmp);
+  }
+  tree->modified = 1;
+  tree->generation++;
+  return 0;
+}
+
+/**
+ * Enable or disable the flat keyword index.  Like the
+ * case-folded index, it can only be enabled for an empty
+ * database.
+ *
+ * @param enable 1 to enable, 0 to disable
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_flat_index(SuffixTree * tree,
+			       int enable) {
+  if (tree->read_only)
+    return -1;
+  if (enable != 0) {
+    if (tree->flatIndex != 0)
+      return 0;
+    if (tree->fnc != 0) {
+      tree->log(tree->context,
+		DOODLE_LOG_VERBOSE,
+		_("Flat keyword index can only be enabled for an empty database.\n"));
+      return -1;
+    }
+    if (tree->words != 0) {
+      tree->log(tree->context,
+		DOODLE_LOG_VERBOSE,
+		_("Flat keyword index can not be used with a word index.\n"));
+      return -1;
+    }
+    tree->flatIndex = 1;
+  } else {
+    if (tree->flatIndex == 0)
+      return 0;
+    tree->flatIndex = 0;
+    flatFree(tree);
+  }
+  tree->modified = 1;
+  tree->generation++;
+  return 0;
+}
+
+/**
+ * @return 1 if the database has a flat keyword index, 0 if not
+ */
+int DOODLE_tree_get_flat_index(SuffixTree * tree) {
+  return tree->flatIndex;
+}
+
+/**
+ * Make the database a word index (or a suffix index again).
+ * Like the case-folded index, this is only possible for an
+ * empty database.
+ *
+ * @param enable 1 for a word index, 0 for a suffix index
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_word_index(SuffixTree * tree,
+			       int enable) {
+  if (tree->read_only)
+    return -1;
+  if ((enable != 0) == (tree->words != 0))
+    return 0;
+  if (tree->fnc != 0) {
+    tree->log(tree->context,
+	      DOODLE_LOG_VERBOSE,
+	      _("Word index can only be enabled or disabled for an empty database.\n"));
+    return -1;
+  }
+  if ( (enable != 0) &&
+       (tree->flatIndex != 0) ) {
+    tree->log(tree->context,
+	      DOODLE_LOG_VERBOSE,
+	      _("Word index can not be used with a flat keyword index.\n"));
+    return -1;
+  }
+  tree->words = (enable != 0) ? 1 : 0;
+  tree->modified = 1;
+  tree->generation++;
+  return 0;
+}
+
+/**
+ * @return 1 if the database is a word index, 0 if not
+ */
+int DOODLE_tree_get_word_index(SuffixTree * tree) {
+  return tree->words;
+}
+
+/**
+ * Release the (shared) lock on a read-only database.  Writers
+ * only append to the database file while they run and replace
+ * it with a new file when they are done, so the tree remains
+ * usable; it simply continues to show the state of the database
+ * at the time it was opened.
+ *
+ * @return 0 on success, -1 on error (i.e. tree not read-only)
+ */
+int DOODLE_tree_release_lock(SuffixTree * tree) {
+  if ( (tree->read_only == 0) ||
+       (tree->fd == NULL) )
+    return -1;
+  if (0 != flock(tree->fd->fd, LOCK_UN)) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Could not unlock database '%s': %s\n"),
+	      tree->database,
+	      strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Destroy (and sync) suffix tree.
+ */
+void DOODLE_tree_destroy(SuffixTree * tree) {
+  BIO * fd;
+  int i;
+  int j;
+  unsigned long long off;
+  unsigned long long foff;
+  off_t wpos;
+  pchar * pathTab;
+  unsigned int ptc;
+  STNode * tmp;
+  FileSet files;
+
+  CHECK(tree);
+  if (tree->bulk != NULL)
+    DOODLE_tree_bulk_close(tree);
+  if ( (0 == tree->read_only) &&
+       ( (tree->modified != 0) ||
+	 ( (tree->root != NULL) &&
+	   (tree->root->modified != 0) ) ||
+	 ( (tree->froot != NULL) &&
+	   (tree->froot->modified != 0) ) ) ) {
+    int fdt;
+    char * tdatabase;
+
+    tree->force_dump = 1; /* force re-dump everything! */
+    if ( (tree->grams == NULL) ||
+	 (tree->gramsStale != 0) )
+      gramsRebuild(tree);
+    if (tree->flatIndex != 0) {
+      flatLoad(tree);
+      for (i=0;i<tree->flatSize;i++)
+	if (! flatComplete(&tree->flat[i])) {
+	  flatDisable(tree,
+		      tree->filenames[i].filename);
+	  break;
+	}
+    }
+    tdatabase = MALLOC(strlen(tree->database) + 2);
+    strcpy(tdatabase,
+	   tree->database);
+    strcat(tdatabase,
+	   "~");
+#ifdef O_LARGEFILE
+    fdt = open(tdatabase,
+	       O_CREAT | O_TRUNC | O_RDWR | O_LARGEFILE,
+	       S_IRUSR | S_IWUSR | S_IRGRP);
+#else
+    fdt = open(tdatabase,
+	       O_CREAT | O_TRUNC | O_RDWR,
+	       S_IRUSR | S_IWUSR | S_IRGRP);
+#endif
+    if (fdt == -1) {
+      tree->log(tree->context,
+		DOODLE_LOG_CRITICAL,
+		_("Could not open temporary file '%s': %s\n"),
+		tdatabase,
+		strerror(errno));
+      free(tdatabase);
+      goto CLEANUP;
+    }
+    fd = IO_WRAP(tree->log,
+		 tree->context,
+		 fdt);
+    WRITEALL(fd,
+	     MAGIC,
+	     8);
+    tree->log(tree->context,
 	      DOODLE_LOG_VERY_VERBOSE,
 	      _("Writing doodle database to temporary file '%s'.\n"),
 	      tdatabase);
@@ -1999,15 +3509,53 @@ void DOODLE_tree_destroy(SuffixTree * tree) {
     for (i=tree->cisPos-1;i>=0;i--)
       writeZT(fd,
 	      tree->cis[i]);
+    WRITEUINT(fd,
+	      ((tree->fold != 0) ? DB_FLAG_CASE_FOLDED : 0) |
+	      ((tree->grams != NULL) ? DB_FLAG_QGRAMS : 0) |
+	      ((tree->flatIndex != 0) ? DB_FLAG_FLAT : 0) |
+	      ((tree->words != 0) ? DB_FLAG_WORDS : 0));
     wpos = LSEEK(fd, 0, SEEK_CUR);
     off = 0;
     WRITEULONGFULL(fd, off);
+    WRITEULONGFULL(fd, off);
+    if (tree->grams != NULL)
+      WRITEALL(fd,
+	       tree->grams,
+	       QGRAM_BYTES);
+    if (tree->flatIndex != 0) {
+      for (i=0;i<tree->fnc;i++) {
+	if (i >= tree->flatSize) {
+	  WRITEUINT(fd, 0);
+	  continue;
+	}
+	WRITEUINT(fd,
+		  tree->flat[i].len);
+	if (tree->flat[i].len > 0)
+	  WRITEALL(fd,
+		   tree->flat[i].data,
+		   tree->flat[i].len);
+      }
+    }
 
+    memset(&files, 0, sizeof(FileSet));
     off = writeNode(fd,
 		    tree,
-		    tree->root);
+		    tree->root,
+		    &files);
+    if (files.ids != NULL)
+      free(files.ids);
+    swapRoots(tree);
+    memset(&files, 0, sizeof(FileSet));
+    foff = writeNode(fd,
+		     tree,
+		     tree->root,
+		     &files);
+    if (files.ids != NULL)
+      free(files.ids);
+    swapRoots(tree);
     LSEEK(fd, wpos, SEEK_SET);
     WRITEULONGFULL(fd, off);
+    WRITEULONGFULL(fd, foff);
     IO_FREE(tree->fd);
     tree->fd = NULL;
     IO_FREE(fd);
@@ -2047,19 +3595,122 @@ void DOODLE_tree_destroy(SuffixTree * tree) {
   tmp = tree->root;
   tree->root = NULL;
   freeNode(tree, tmp);
+  tmp = tree->froot;
+  tree->froot = NULL;
+  freeNode(tree, tmp);
+  cacheFlush(tree);
+  closeWorkers(tree);
+  if (tree->grams != NULL)
+    free(tree->grams);
+  flatFree(tree);
+  frozenFree(tree);
+  fileHashFree(tree);
   free(tree->database);
   free(tree);
 }
 
+/**
+ * Mark the node and the path to the root as modified.  This also
+ * invalidates the aggregates of the nodes that have the modified
+ * node in their subtree (but not of the nodes that merely link to
+ * it).  Nodes that are already marked were handled when they were
+ * marked for the first time.
+ */
 static void markModified(STNode * pos) {
+  STNode * prev;
+
+  prev = NULL;
   while (pos != NULL) {
+    if ( (prev == NULL) ||
+	 (pos->child == prev) )
+      pos->aggCount = 0;
     if (pos->modified == 1)
       break; /* already marked */
     pos->modified = 1;
+    prev = pos;
     pos = pos->parent;
   }
 }
 
+/**
+ * Case-fold a unicode character from the range that is
+ * encoded with two bytes in UTF-8.  Only characters whose
+ * folded version is in the same range are folded.
+ */
+static unsigned int foldCodePoint(unsigned int cp) {
+  if (cp == 0xB5)
+    return 0x3BC; /* micro sign */
+  if ( (cp >= 0xC0) && (cp <= 0xDE) && (cp != 0xD7) )
+    return cp + 0x20; /* Latin-1 */
+  if ( (cp >= 0x100) && (cp <= 0x137) && (cp != 0x130) && ((cp & 1) == 0) )
+    return cp + 1; /* Latin Extended-A */
+  if ( (cp >= 0x139) && (cp <= 0x148) && ((cp & 1) == 1) )
+    return cp + 1;
+  if ( (cp >= 0x14A) && (cp <= 0x177) && ((cp & 1) == 0) )
+    return cp + 1;
+  if (cp == 0x178)
+    return 0xFF;
+  if ( (cp >= 0x179) && (cp <= 0x17E) && ((cp & 1) == 1) )
+    return cp + 1;
+  if (cp == 0x386)
+    return 0x3AC; /* Greek */
+  if ( (cp >= 0x388) && (cp <= 0x38A) )
+    return cp + 0x25;
+  if (cp == 0x38C)
+    return 0x3CC;
+  if ( (cp == 0x38E) || (cp == 0x38F) )
+    return cp + 0x3F;
+  if ( (cp >= 0x391) && (cp <= 0x3AB) && (cp != 0x3A2) )
+    return cp + 0x20;
+  if (cp == 0x3C2)
+    return 0x3C3; /* final sigma */
+  if ( (cp >= 0x400) && (cp <= 0x40F) )
+    return cp + 0x50; /* Cyrillic */
+  if ( (cp >= 0x410) && (cp <= 0x42F) )
+    return cp + 0x20;
+  if ( ( ( (cp >= 0x460) && (cp <= 0x481) ) ||
+	 ( (cp >= 0x48A) && (cp <= 0x4BF) ) ||
+	 ( (cp >= 0x4D0) && (cp <= 0x52F) ) ) &&
+       ((cp & 1) == 0) )
+    return cp + 1;
+  if ( (cp >= 0x4C1) && (cp <= 0x4CE) && ((cp & 1) == 1) )
+    return cp + 1;
+  return cp;
+}
+
+/**
+ * Case-fold a UTF-8 string.  Characters whose folded version
+ * has a different length in UTF-8 are not folded, so the length
+ * of the string never changes.  Invalid UTF-8 sequences are
+ * copied unchanged.
+ *
+ * @return the folded string, to be freed by the caller
+ */
+static char * foldCase(const char * str) {
+  unsigned char * ret;
+  unsigned int cp;
+  size_t i;
+
+  ret = (unsigned char*) STRDUP(str);
+  i = 0;
+  while (ret[i] != '\0') {
+    if ( (ret[i] >= 'A') &&
+	 (ret[i] <= 'Z') ) {
+      ret[i] += 'a' - 'A';
+      i++;
+    } else if ( ((ret[i] & 0xE0) == 0xC0) &&
+		((ret[i+1] & 0xC0) == 0x80) ) {
+      cp = foldCodePoint(((ret[i] & 0x1F) << 6) | (ret[i+1] & 0x3F));
+      ret[i] = (unsigned char) (0xC0 | (cp >> 6));
+      ret[i+1] = (unsigned char) (0x80 | (cp & 0x3F));
+      i += 2;
+    } else {
+      i++;
+    }
+  }
+  return (char*) ret;
+}
+
 /**
  * Expand a node with clength>1 to a subtree of nodes of clength == 1.
  * This transformation is semantically equivalent and increases memory
@@ -2177,6 +3828,163 @@ static void tree_split(SuffixTree * tree,
   markModified(insert);
 }
 
+/**
+ * How many characters are strictly between lo and hi (lo < hi)?
+ * @return the number of characters, -1 if '\0' is one of them
+ *   (an mls can not contain it)
+ */
+static int mlsGap(char lo,
+		  char hi) {
+  if ( (lo < 0) &&
+       (hi > 0) )
+    return -1;
+  return hi - lo - 1;
+}
+
+/**
+ * Grow the mls starting at mlsroot by fill entries for the
+ * characters that follow its last entry.  If join is set, the
+ * mls that the last entry links to is appended after these
+ * entries (its first character must then follow them).  The
+ * new entries are empty (except when the caller adds to them).
+ *
+ * @return the new (reallocated) mls
+ */
+static STNode * mlsJoin(SuffixTree * tree,
+			STNode * mlsroot,
+			int fill,
+			int join) {
+  STNode * last;
+  STNode * next;
+  STNode * mlsnew;
+  unsigned int size;
+  unsigned int mls;
+
+  last = &mlsroot[mlsroot->mls_size-1];
+  next = (join != 0) ? last->link : NULL;
+  size = mlsroot->mls_size + fill;
+  if (next != NULL)
+    size += next->mls_size;
+  mlsnew = MALLOC(sizeof(STNode) * size);
+  memcpy(mlsnew,
+	 mlsroot,
+	 sizeof(STNode) * mlsroot->mls_size);
+  for (mls=mlsroot->mls_size;mls<mlsroot->mls_size+fill;mls++) {
+    mlsnew[mls].clength = 1;
+    mlsnew[mls].c = 1 + &CIS[(unsigned char) mlsnew[mls-1].c[0]];
+  }
+  if (next != NULL)
+    memcpy(&mlsnew[mlsroot->mls_size+fill],
+	   next,
+	   sizeof(STNode) * next->mls_size);
+
+  /* adjust data in copy */
+  mlsnew[0].mls_size = size;
+  for (mls=1;mls<size;mls++) {
+    mlsnew[mls].mls_size = size - mls;
+    mlsnew[mls].parent = &mlsnew[mls-1];
+    mlsnew[mls-1].link = &mlsnew[mls];
+    mlsnew[mls-1].link_off = 0;
+  }
+  for (mls=0;mls<size;mls++)
+    if (mlsnew[mls].child != NULL)
+      mlsnew[mls].child->parent = &mlsnew[mls];
+
+  /* update link to next entry */
+  if (next != NULL)
+    last = &next[next->mls_size-1];
+  mlsnew[size-1].link = last->link;
+  mlsnew[size-1].link_off = last->link_off;
+  if (last->link != NULL)
+    last->link->parent = &mlsnew[size-1];
+
+  /* update link from parent */
+  mlsnew[0].parent = mlsroot->parent;
+  if (mlsroot->parent == NULL)
+    tree->root = mlsnew;
+  else if (mlsroot->parent->link == mlsroot)
+    mlsroot->parent->link = mlsnew;
+  else
+    mlsroot->parent->child = mlsnew;
+  free(mlsroot);
+  if (next != NULL)
+    free(next);
+  tree->used_memory += sizeof(STNode) * fill;
+  tree->modified = 1;
+  for (mls=0;mls<size;mls++)
+    markModified(&mlsnew[mls]);
+  return mlsnew;
+}
+
+/**
+ * Join the mls starting at mlsroot with the entries that follow
+ * it as long as there are at most MLS_MAX_FILL characters between
+ * them (and they are in memory).
+ *
+ * @return the new mls
+ */
+static STNode * mlsJoinFollowing(SuffixTree * tree,
+				 STNode * mlsroot) {
+  STNode * last;
+  int gap;
+
+  while (1) {
+    last = &mlsroot[mlsroot->mls_size-1];
+    if (last->link == NULL)
+      return mlsroot;
+    gap = mlsGap(last->c[0],
+		 last->link->c[0]);
+    if ( (gap < 0) ||
+	 (gap > MLS_MAX_FILL) )
+      return mlsroot;
+    if (last->link->clength != 1) {
+      /* need to split tree first to make mls possible */
+      tree_split(tree,
+		 last->link,
+		 1);
+    }
+    mlsroot = mlsJoin(tree,
+		      mlsroot,
+		      gap,
+		      1);
+  }
+}
+
+/**
+ * Add an entry for the character that follows the last entry
+ * pos of an mls after fill empty entries, and join the result
+ * with the entries that follow if they are close.
+ *
+ * @return the new entry
+ */
+static STNode * mlsExtend(SuffixTree * tree,
+			  STNode * pos,
+			  int fill) {
+  STNode * mlsroot;
+  unsigned int idx;
+
+  if (pos->clength != 1) {
+    /* need to split tree first to make mls possible */
+    tree_split(tree,
+	       pos,
+	       1);
+  }
+  /* find mls 'root' */
+  mlsroot = pos;
+  while ( (mlsroot->parent != NULL) &&
+	  (mlsroot->parent->link == mlsroot) &&
+	  (mlsroot->parent->mls_size > 1) )
+    mlsroot = mlsroot->parent;
+  idx = (pos - mlsroot) + fill + 1;
+  mlsroot = mlsJoin(tree,
+		    mlsroot,
+		    fill + 1,
+		    0);
+  mlsroot = mlsJoinFollowing(tree,
+			     mlsroot);
+  return &mlsroot[idx];
+}
+
 static STNode * tree_search_internal(SuffixTree * tree,
 				     const char * substring) {
   STNode * pos;
@@ -2184,6 +3992,9 @@ static STNode * tree_search_internal(SuffixTree * tree,
   int i;
 
   CHECK(tree);
+  if (0 == gramsMayMatch(tree,
+			 substring))
+    return NULL;
   ss = substring;
   pos = tree->root;
   while (ss[0] != '\0') {
@@ -2237,6 +4048,8 @@ static STNode * tree_search_internal(SuffixTree * tree,
 	}
 #endif
       } else {
+	if (pos->mls_size > 1)
+	  pos = &pos[pos->mls_size-1]; /* skip to the end of the mls */
 	if (pos->link == NULL) {
 	  if (pos->link_off != 0) {
 	    if (-1 == loadLink(tree,
@@ -2254,73 +4067,37 @@ static STNode * tree_search_internal(SuffixTree * tree,
 }
 
 /**
- * Add keyword to suffix tree.
+ * Add the given string (for the file with the given index
+ * into tree->filenames) to the tree starting at tree->root.
  *
+ * @param stored where the string is already stored in tree->cis
+ *        (its grams must then be in the filter already), NULL
+ *        to find or add it
+ * @param storedCix index of that string in tree->cis
  * @return 0 on success, 1 on error
  */
-int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
-		       const char * searchString,
-		       const char * fileName) {
+static int tree_insert_internal(SuffixTree * tree,
+				const char * searchString,
+				unsigned int sharedNameIndex,
+				char * stored,
+				int storedCix) {
   STNode * pos;
   STNode * spos;
   char * cisp;
+  char * start;
   const char * cisp0;
-  char * sharedName;
   int i;
   int cix;
-  struct stat sbuf;
-  unsigned int sharedNameIndex;
-
-  if ( (searchString == NULL) ||
-       (strlen(searchString) == 0) )
-    return 1; /* not legal! */
-
-  CHECK(tree);
-  if (0 != stat(fileName,
-		&sbuf)) {
-    tree->log(tree->context,
-	      DOODLE_LOG_CRITICAL,
-	      _("Call to '%s' for file '%s' failed: %s\n"),
-	      "stat",
-	      fileName,
-	      strerror(errno));
-    return 1;
-  }
-  tree->mutationCount++;
-  tree->log(tree->context,
-	    DOODLE_LOG_INSANELY_VERBOSE,
-	    _("Adding keyword '%s' for file '%s'.\n"),
-	    searchString, fileName);
+  int fill;
+  int gap;
 
-  if ( (tree->fnc > 0) &&
-       (0 == strcmp(fileName,
-		    tree->filenames[tree->fnc-1].filename))) {
-    sharedName = tree->filenames[tree->fnc-1].filename;
-    sharedNameIndex = tree->fnc-1;
-  } else {
-    sharedNameIndex = -1;
-    for (i=tree->fnc-2;i>=0;i--) {
-      if (0 == strcmp(fileName,
-		      tree->filenames[i].filename)) {
-	sharedName = tree->filenames[i].filename;
-	sharedNameIndex = i;
-	break;
-      }
-    }
-    if (sharedNameIndex == -1) {
-      tree->modified = 1;
-      if (tree->fnc == tree->fns) {
-	GROW(tree->filenames,
-	     tree->fns,
-	     tree->fns * 2 + 1);
-      }
-      sharedName = STRDUP(fileName);
-      tree->filenames[tree->fnc].mod_time = (unsigned int) sbuf.st_mtime;
-      tree->filenames[tree->fnc].filename = sharedName;
-      sharedNameIndex = tree->fnc;
-      tree->fnc++;
-    }
+  if (stored != NULL) {
+    cisp = stored;
+    cix = storedCix;
+    goto DESCEND;
   }
+  gramsAdd(tree,
+	   searchString);
   cisp = "";
   if (tree->cisPos > 0) {
     cisp = tree->cis[tree->cisPos-1];
@@ -2378,6 +4155,7 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
     cix = tree->cisPos-1;
   }
 
+ DESCEND:
   if (strlen(cisp) == 0) {
     /* search string empty!? */
     tree->log(tree->context,
@@ -2386,6 +4164,7 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
 	      __FILE__, __LINE__);
     return 1;
   }
+  start = cisp;
   cisp0 = searchString;
   pos = tree->root;
   if (pos == NULL) {
@@ -2434,12 +4213,22 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
       pos = insert;
       CHECK(tree);
       markModified(insert);
+      gap = mlsGap(cisp0[0],
+		   pos->link->c[0]);
+      if ( (gap >= 0) &&
+	   (gap <= MLS_MAX_FILL) ) {
+	/* join with the entries that follow */
+	pos = mlsJoinFollowing(tree,
+			       pos);
+	CHECK(tree);
+	continue;
+      }
       break;
     } else {
       if (pos->c[0] == cisp0[0]) {
 	i = 1;
 	while ( (i < pos->clength) &&
-		(i < strlen(cisp0)) &&
+		(cisp0[i] != '\0') &&
 		(pos->c[i] == cisp0[i]) )
 	  i++;
 	
@@ -2490,12 +4279,27 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
 	}
 	pos = pos->child;	
       } else {
+	if ( (pos->clength == 1) &&
+	     (pos->mls_size > 1) &&
+	     (pos->mls_size <= cisp0[0] - pos->c[0]) )
+	  pos = &pos[pos->mls_size - 1]; /* skip to the end of the mls */
 	if (pos->link == NULL) {
 	  if (pos->link_off != 0) {
 	    if (-1 == loadLink(tree,
 			       pos))
 	      return 1;
 	  } else {
+	    fill = mlsGap(pos->c[0],
+			  cisp0[0]);
+	    if ( (fill >= 0) &&
+		 (fill <= MLS_MAX_FILL) ) {
+	      /* extend the mls to the new character */
+	      pos = mlsExtend(tree,
+			      pos,
+			      fill);
+	      CHECK(tree);
+	      continue;
+	    }
 	    /* append entry to linked list */
 	    tree->modified = 1;
 	    pos->link = MALLOC(sizeof(STNode));
@@ -2548,196 +4352,17 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
 	}
 #endif
 	if (pos->link->c[0] > cisp0[0]) {
-	  if (pos->mls_size == cisp0[0] - pos->c[0]) { /* expand mls range! */
-	    STNode * mlsroot;
-	    STNode * mlsnew;
-	    int mls;
-	
-	    /* use mls! */
-	    if (pos->clength != 1) {
-	      /* need to split tree first to make mls possible */
-	      tree_split(tree,
-			 pos,
-			 1);
-	    }
-	    /* find mls 'root' */
-	    mlsroot = pos;
-	    while ( (mlsroot->parent != NULL) &&
-		    (mlsroot->parent->link == mlsroot) &&
-		    (mlsroot->parent->mls_size > 1) )
-	      mlsroot = mlsroot->parent;
-	
-	    if (pos->link->c[0] == cisp0[0] + 1) {
-	      /* JOIN two mls segments (the new character fills the gap)! */
-	      if (pos->link->clength != 1) {
-		/* need to split tree first to make mls possible */
-		tree_split(tree,
-			   pos->link,
-			   1);
-	      }
-#if ASSERTS
-	      if ( (pos->mls_size != 1) ||
-		   (pos->link->parent != pos) ) {
-		tree->log(tree->context,
-			  DOODLE_LOG_CRITICAL,
-			  _("Assertion failed at %s:%d!\n"),
-			  __FILE__, __LINE__);
-		return 1;
-	      }
-#endif
-	      mlsnew = MALLOC(sizeof(STNode) * (mlsroot->mls_size + pos->link->mls_size + 1));
-	
-	      memcpy(mlsnew,
-		     mlsroot,
-		     sizeof(STNode) * (mlsroot->mls_size));
-	      mlsnew[mlsroot->mls_size].clength = 1;
-	      memcpy(&mlsnew[mlsroot->mls_size+1],
-		     pos->link,
-		     sizeof(STNode) * (pos->link->mls_size));
-	
-	      /* adjust data in copy */
-	      mlsnew[0].mls_size = mlsroot->mls_size + pos->link->mls_size + 1;
-	      for (mls=1;mls<mlsnew->mls_size;mls++) {
-		mlsnew[mls].mls_size = mlsnew->mls_size - mls;
-		mlsnew[mls].parent = &mlsnew[mls-1];
-		mlsnew[mls-1].link = &mlsnew[mls];
-	      }
-	      for (mls=0;mls<mlsnew->mls_size;mls++)
-		if (mlsnew[mls].child != NULL)
-		  mlsnew[mls].child->parent = &mlsnew[mls];	
-	
-	      /* update link to next entry */
-	      mlsnew[mlsnew->mls_size-1].link = pos->link[pos->link->mls_size-1].link;
-	      mlsnew[mlsnew->mls_size-1].link_off = pos->link[pos->link->mls_size-1].link_off;
-	      if (pos->link[pos->link->mls_size-1].link != NULL)
-		pos->link[pos->link->mls_size-1].link->parent = &mlsnew[mlsnew->mls_size-1];
-	
-	      /* update data in new entry */
-	      mlsnew[mlsroot->mls_size].c = 1 + &CIS[(unsigned char) mlsnew[mlsroot->mls_size-1].c[0]];
-	
-	      /* update link from parent */
-	      if (mlsroot->parent != NULL) {
-		mlsnew[0].parent = mlsroot->parent;
-		if (mlsroot->parent->link == mlsroot) {
-		  mlsroot->parent->link = mlsnew;
-		} else {
-#if ASSERTS
-		  if (mlsroot->parent->child != mlsroot) {
-		    tree->log(tree->context,
-			      DOODLE_LOG_CRITICAL,
-			      _("Assertion failed at %s:%d!\n"),
-			      __FILE__, __LINE__);
-		    free(mlsnew);
-		    return 1;
-		  }
-#endif
-		  mlsroot->parent->child = mlsnew;
-		}
-	      } else {
-#if ASSERTS
-		if (tree->root != mlsroot) {
-		  tree->log(tree->context,
-			    DOODLE_LOG_CRITICAL,
-			    _("Assertion failed at %s:%d!\n"),
-			    __FILE__, __LINE__);
-		  free(mlsnew);
-		  return 1;
-		}
-#endif
-		tree->root = mlsnew;
-	      }
-	
-	      /* update pos to point to new location */
-	      free(pos->link);
-	      pos = &mlsnew[mlsroot->mls_size];
-	      /* end joining 2 mls segments */
-	    } else {
-	      /* EXTEND existing mls segment by one entry! */
-	      mlsnew = MALLOC(sizeof(STNode) * (mlsroot->mls_size + 1));	
-	      memcpy(mlsnew,
-		     mlsroot,
-		     sizeof(STNode) * (mlsroot->mls_size));
-	      mlsnew[mlsroot->mls_size].clength = 1;	
-
-	      /* adjust data in copy */
-	      mlsnew[0].mls_size = mlsroot->mls_size+1;	
-	      for (mls=1;mls<mlsnew->mls_size;mls++) {
-		mlsnew[mls].mls_size = mlsnew->mls_size - mls;
-		mlsnew[mls].parent = &mlsnew[mls-1];
-		mlsnew[mls-1].link = &mlsnew[mls];
-	      }
-	      for (mls=0;mls<mlsnew->mls_size;mls++)
-		if (mlsnew[mls].child != NULL)
-		  mlsnew[mls].child->parent = &mlsnew[mls];	
-	
-	      /* update link to next entry */
-	      mlsnew[mlsnew->mls_size-1].link = pos->link;
-	      mlsnew[mlsnew->mls_size-1].link_off = pos->link_off;
-	      if (pos->link != NULL)
-		pos->link->parent = &mlsnew[mlsnew->mls_size-1];
-	
-	      /* update data in new entry */
-	      mlsnew[mlsroot->mls_size].c 
-		= 1 + &CIS[(unsigned char) mlsnew[mlsroot->mls_size-1].c[0]];
-#if ASSERTS	
-	      if (mlsnew[mlsroot->mls_size].c[0] != cisp0[0]) {
-		tree->log(tree->context,
-			  DOODLE_LOG_CRITICAL,
-			  _("Assertion failed at %s:%d!\n"),
-			  __FILE__, __LINE__);
-		return 1;
-	      }
-#endif
-	      /* update link from parent */
-	      if (mlsroot->parent != NULL) {
-		mlsnew[0].parent = mlsroot->parent;
-		if (mlsroot->parent->link == mlsroot) {
-		  mlsroot->parent->link = mlsnew;
-		} else {
-#if ASSERTS
-		  if (mlsroot->parent->child != mlsroot) {
-		    tree->log(tree->context,
-			      DOODLE_LOG_CRITICAL,
-			      _("Assertion failed at %s:%d!\n"),
-			      __FILE__, __LINE__);
-		    free(mlsnew);
-		    return 1;
-		  }
-#endif
-		  mlsroot->parent->child = mlsnew;
-		}
-	      } else {
-#if ASSERTS
-		if (tree->root != mlsroot) {
-		  tree->log(tree->context,
-			    DOODLE_LOG_CRITICAL,
-			    _("Assertion failed at %s:%d!\n"),
-			    __FILE__, __LINE__);
-		  free(mlsnew);
-		  return 1;
-		}
-#endif
-		tree->root = mlsnew;
-	      }
-	      /* update pos to point to new location */
-	      pos = &mlsnew[mlsroot->mls_size];
-	    }
-	    free(mlsroot);	
-	    tree->used_memory += sizeof(STNode);
-	    tree->modified = 1;	  	
+	  fill = mlsGap(pos->c[0],
+			cisp0[0]);
+	  if ( (fill >= 0) &&
+	       (fill <= MLS_MAX_FILL) ) {
+	    /* extend the mls to the new character (and join
+	       it with the entries that follow if they are
+	       close) */
+	    pos = mlsExtend(tree,
+			    pos,
+			    fill);
 	    CHECK(tree);
-	    for (mls=0;mls<mlsnew->mls_size;mls++)
-	      markModified(&mlsnew[mls]);
-
-#if ASSERTS	
-	    if (*pos->c != cisp0[0]) {
-	      tree->log(tree->context,
-			DOODLE_LOG_CRITICAL,
-			_("Assertion failed at %s:%d!\n"),
-			__FILE__, __LINE__);
-	      return 1;
-	    }
-#endif
 	    continue;
 	  } else {
 	    STNode * insert;
@@ -2759,6 +4384,16 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
 	    pos->clength = 1;
 	    CHECK(tree);	
 	    markModified(pos);
+	    gap = mlsGap(cisp0[0],
+			 pos->link->c[0]);
+	    if ( (gap >= 0) &&
+		 (gap <= MLS_MAX_FILL) ) {
+	      /* join with the entries that follow */
+	      pos = mlsJoinFollowing(tree,
+				     pos);
+	      CHECK(tree);
+	      continue;
+	    }
 	    break; /* strlen(cisp0) > 0! */
 	  }
 	} else {
@@ -2803,28 +4438,360 @@ int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
   markModified(pos);
 
 CLEANUP_SUCCESS:
-  if (tree->used_memory > tree->memory_limit)
-    shrinkMemoryFootprint(tree, tree->root);
-
+  tree->hint = start;
+  tree->hintCix = cix;
   return 0; 	
 }
 
-static int truncate_internal(SuffixTree * tree,
-			     STNode * node,
-			     unsigned int fileNameIndex[],
-			     int max) {
-  STNode * next;
-  STNode * parent;
+/**
+ * Find the index of the given file, adding it to the list
+ * of files (with the given modification time) if it is
+ * not yet in the tree.
+ */
+static unsigned int fileIndexFor(SuffixTree * tree,
+				 const char * fileName,
+				 unsigned int mod_time) {
   int i;
-  int j;
-  int k;
 
-  if (node == NULL)
-    return 0;
-  parent = node->parent;
-  while (node != NULL) {
-    for (k=0;k<max;k++) {
-      j = -1;
+  if ( (tree->fnc > 0) &&
+       (0 == strcmp(fileName,
+		    tree->filenames[tree->fnc-1].filename)))
+    return tree->fnc-1;
+  i = DOODLE_tree_lookup_file(tree,
+			      fileName);
+  if (i != -1)
+    return i;
+  tree->modified = 1;
+  if (tree->fnc == tree->fns) {
+    GROW(tree->filenames,
+	 tree->fns,
+	 tree->fns * 2 + 1);
+  }
+  tree->filenames[tree->fnc].mod_time = mod_time;
+  tree->filenames[tree->fnc].filename = STRDUP(fileName);
+  tree->fnc++;
+  fileHashAdd(tree);
+  return tree->fnc-1;
+}
+
+/**
+ * Where is the given string stored if it is the string that was
+ * last inserted into tree->root without its first character?
+ * (The grams of the string are then in the filter already.)
+ *
+ * @return pointer into tree->cis, NULL if unknown
+ */
+static char * suffixStored(SuffixTree * tree,
+			   const char * searchString) {
+  if ( (tree->hint == NULL) ||
+       (0 != strncmp(&tree->hint[1],
+		     searchString,
+		     strlen(searchString))) )
+    return NULL;
+  return &tree->hint[1];
+}
+
+/**
+ * Insert a keyword for the file with the given index into
+ * the tree and into the flat and case-folded indices (or
+ * into the buffer of a bulk build).
+ *
+ * @param isSuffix 1 if the keyword is the previous keyword
+ *        without its first character
+ * @return 0 on success, 1 on error
+ */
+static int insertKeyword(SuffixTree * tree,
+			 const char * searchString,
+			 unsigned int sharedNameIndex,
+			 int isSuffix) {
+  char * folded;
+  char * stored;
+  int ret;
+
+  if (tree->bulk != NULL)
+    return bulkAdd(tree,
+		   searchString,
+		   sharedNameIndex,
+		   isSuffix);
+  tree->mutationCount++;
+  stored = NULL;
+  if (isSuffix != 0)
+    stored = suffixStored(tree,
+			  searchString);
+  ret = tree_insert_internal(tree,
+			     searchString,
+			     sharedNameIndex,
+			     stored,
+			     tree->hintCix);
+  if ( (ret == 0) &&
+       (tree->flatIndex != 0) )
+    flatAdd(tree,
+	    searchString,
+	    sharedNameIndex);
+  if ( (ret == 0) &&
+       (tree->fold != 0) ) {
+    folded = foldCase(searchString);
+    if (0 != strcmp(folded,
+		    searchString)) {
+      swapRoots(tree);
+      stored = NULL;
+      if (isSuffix != 0)
+	stored = suffixStored(tree,
+			      folded);
+      ret = tree_insert_internal(tree,
+				 folded,
+				 sharedNameIndex,
+				 stored,
+				 tree->hintCix);
+      swapRoots(tree);
+    } else {
+      /* the next folded keyword does not follow this one */
+      tree->fhint = NULL;
+    }
+    free(folded);
+  }
+  return ret;
+}
+
+/**
+ * Add keyword to suffix tree.
+ *
+ * @return 0 on success, 1 on error
+ */
+int DOODLE_tree_expand(struct DOODLE_SuffixTree * tree,
+		       const char * searchString,
+		       const char * fileName) {
+  struct stat sbuf;
+  int ret;
+
+  if ( (searchString == NULL) ||
+       (strlen(searchString) == 0) )
+    return 1; /* not legal! */
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "expand");
+    return 1;
+  }
+
+  CHECK(tree);
+  if (0 != stat(fileName,
+		&sbuf)) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Call to '%s' for file '%s' failed: %s\n"),
+	      "stat",
+	      fileName,
+	      strerror(errno));
+    return 1;
+  }
+  tree->generation++;
+  tree->log(tree->context,
+	    DOODLE_LOG_INSANELY_VERBOSE,
+	    _("Adding keyword '%s' for file '%s'.\n"),
+	    searchString, fileName);
+  ret = insertKeyword(tree,
+		      searchString,
+		      fileIndexFor(tree,
+				   fileName,
+				   (unsigned int) sbuf.st_mtime),
+		      0);
+  if (tree->used_memory > tree->memory_limit)
+    shrinkMemoryFootprint(tree, tree->root);
+  return ret;
+}
+
+/**
+ * Is the character part of a word (for DOODLE_tree_expand_words)?
+ * All bytes of multi-byte UTF-8 characters count as letters.
+ */
+static int isWordChar(char c) {
+  return ( ( (c >= 'a') && (c <= 'z') ) ||
+	   ( (c >= 'A') && (c <= 'Z') ) ||
+	   ( (c >= '0') && (c <= '9') ) ||
+	   ((unsigned char) c >= 128) );
+}
+
+/**
+ * Add each word of a keyword to the tree (without suffixes).
+ *
+ * @return 0 on success, 1 on error
+ */
+int DOODLE_tree_expand_words(struct DOODLE_SuffixTree * tree,
+			     const char * keyword,
+			     const char * fileName) {
+  char * word;
+  unsigned int len;
+  int ret;
+
+  word = MALLOC(strlen(keyword) + 1);
+  ret = 0;
+  while (keyword[0] != '\0') {
+    len = 0;
+    while (isWordChar(keyword[len]))
+      len++;
+    if (len > 0) {
+      memcpy(word,
+	     keyword,
+	     len);
+      word[len] = '\0';
+      ret = DOODLE_tree_expand(tree,
+			       word,
+			       fileName);
+      if (ret != 0)
+	break;
+      keyword += len;
+    } else {
+      keyword++;
+    }
+  }
+  free(word);
+  return ret;
+}
+
+/**
+ * Add a string to a set of strings (an open-addressing hash
+ * table with size slots, at most half of them used).
+ *
+ * @return 1 if the string was added, 0 if it was already in the set
+ */
+static int stringSetAdd(const char ** set,
+			unsigned int size,
+			const char * s) {
+  unsigned int slot;
+
+  slot = hashString(s) & (size - 1);
+  while (set[slot] != NULL) {
+    if (0 == strcmp(set[slot],
+		    s))
+      return 0;
+    slot = (slot + 1) & (size - 1);
+  }
+  set[slot] = s;
+  return 1;
+}
+
+/**
+ * Add all keywords of a file to the tree, each together with
+ * all of its suffixes (or, for a word index, each of its words).
+ * The file is looked up only once and keywords and suffixes
+ * that occur more than once are only inserted once.
+ *
+ * @return 0 on success, 1 on error
+ */
+int DOODLE_tree_expand_file(struct DOODLE_SuffixTree * tree,
+			    const char * fileName,
+			    unsigned int mod_time,
+			    const char * keywords[]) {
+  const char ** seen;
+  const char * pos;
+  char * words;
+  unsigned int seenSize;
+  unsigned int total;
+  unsigned int sharedNameIndex;
+  unsigned int j;
+  int i;
+  int ret;
+
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "expand");
+    return 1;
+  }
+  total = 0;
+  for (i=0;keywords[i] != NULL;i++)
+    total += strlen(keywords[i]) + 1;
+  if (total == (unsigned int) i)
+    return 0; /* no (non-empty) keywords */
+
+  CHECK(tree);
+  tree->generation++;
+  tree->log(tree->context,
+	    DOODLE_LOG_INSANELY_VERBOSE,
+	    _("Adding %d keywords for file '%s'.\n"),
+	    i, fileName);
+  words = NULL;
+  if (tree->words != 0) {
+    /* copy the keywords and terminate each word */
+    words = MALLOC(total);
+    j = 0;
+    for (i=0;keywords[i] != NULL;i++) {
+      strcpy(&words[j],
+	     keywords[i]);
+      j += strlen(keywords[i]) + 1;
+    }
+    for (j=0;j<total;j++)
+      if (! isWordChar(words[j]))
+	words[j] = '\0';
+  }
+  seenSize = 64;
+  while (seenSize < 2 * total)
+    seenSize *= 2;
+  seen = MALLOC(seenSize * sizeof(const char*));
+  sharedNameIndex = fileIndexFor(tree,
+				 fileName,
+				 mod_time);
+  ret = 0;
+  if (words != NULL) {
+    for (j=0;j<total;j++) {
+      if ( (words[j] == '\0') ||
+	   ( (j > 0) &&
+	     (words[j-1] != '\0') ) )
+	continue; /* not the start of a word */
+      if (0 == stringSetAdd(seen,
+			    seenSize,
+			    &words[j]))
+	continue;
+      ret = insertKeyword(tree,
+			  &words[j],
+			  sharedNameIndex,
+			  0);
+      if (ret != 0)
+	break;
+      if (tree->used_memory > tree->memory_limit)
+	shrinkMemoryFootprint(tree, tree->root);
+    }
+    free(words);
+  } else {
+    for (i=0;(ret == 0) && (keywords[i] != NULL);i++) {
+      /* longest suffix first: each suffix is stored right
+	 behind the previous one (see tree_insert_internal);
+	 swapping is deferred until the keyword is done */
+      for (pos=keywords[i];pos[0] != '\0';pos++) {
+	if (0 == stringSetAdd(seen,
+			      seenSize,
+			      pos))
+	  break; /* and so were all of its suffixes */
+	ret = insertKeyword(tree,
+			    pos,
+			    sharedNameIndex,
+			    (pos != keywords[i]) ? 1 : 0);
+	if (ret != 0)
+	  break;
+      }
+      if (tree->used_memory > tree->memory_limit)
+	shrinkMemoryFootprint(tree, tree->root);
+    }
+  }
+  free(seen);
+  return ret;
+}
+
+static int truncate_internal(SuffixTree * tree,
+			     STNode * node,
+			     unsigned int fileNameIndex[],
+			     int max) {
+  STNode * next;
+  STNode * parent;
+  int i;
+  int j;
+  int k;
+
+  if (node == NULL)
+    return 0;
+  parent = node->parent;
+  while (node != NULL) {
+    for (k=0;k<max;k++) {
+      j = -1;
       for (i=node->matchCount-1;i>=0;i--) {
 	if (node->matches[i] == fileNameIndex[k])
 	  j = i;
@@ -2908,7 +4875,15 @@ int DOODLE_tree_truncate_multiple(SuffixTree * tree,
   int i;
   int pos;
 
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "truncate");
+    return -1;
+  }
   CHECK(tree);
+  if ( (tree->bulk != NULL) &&
+       (0 != bulkFlush(tree)) )
+    return -1;
   max = 0;
   while (fileNames[max] != NULL) {
     tree->log(tree->context,
@@ -2918,31 +4893,80 @@ int DOODLE_tree_truncate_multiple(SuffixTree * tree,
   }
   if (max == 0)
     return 0;
+  tree->generation++;
+  tree->gramsStale = 1;
   delOff = MALLOC(sizeof(int) * max);
   rep = tree->fnc;
   err = 0;
   pos = 0;
-  for (off = rep-1;off>=0;off--) {
-    for (i=0;i<max;i++) {
-      if (0 == strcmp(tree->filenames[off].filename,
-		      fileNames[i])) {
-	tree->modified = 1;
-	delOff[pos++] = off; /* delOff is sorted largest to smallest! */
-      }
-    }
+  for (i=0;i<max;i++) {
+    off = DOODLE_tree_lookup_file(tree,
+				  fileNames[i]);
+    if (off != -1)
+      delOff[pos++] = off;
   }
-  max = pos;
-  if (max == 0) {
+  if (pos == 0) {
     free(delOff);
     return 0;
   }
+  /* delOff must be sorted largest to smallest (without
+     duplicates)! */
+  qsort(delOff,
+	pos,
+	sizeof(unsigned int),
+	&compareFileIndex);
+  max = 0;
+  for (i=0;i<pos;i++)
+    if ( (max == 0) ||
+	 (delOff[max-1] != delOff[i]) )
+      delOff[max++] = delOff[i];
+  for (i=0;i<max/2;i++) {
+    off = delOff[i];
+    delOff[i] = delOff[max-1-i];
+    delOff[max-1-i] = off;
+  }
+  tree->modified = 1;
+  if (tree->flatIndex != 0)
+    flatLoad(tree);
   err = truncate_internal(tree,
 			  tree->root,
 			  delOff,
 			  max);
+  if ( (err == 0) &&
+       (tree->froot != NULL) ) {
+    swapRoots(tree);
+    err = truncate_internal(tree,
+			    tree->root,
+			    delOff,
+			    max);
+    swapRoots(tree);
+  }
   for (i=0;i<max;i++) {
+    rep--;
+    if (tree->fileHash != NULL) {
+      /* the last file takes the place of the removed one, only
+	 these two entries of the hash table change */
+      fileHashRemove(tree,
+		     delOff[i]);
+      if (rep != delOff[i])
+	tree->fileHash[fileHashFind(tree, rep)] = delOff[i];
+    }
     free(tree->filenames[delOff[i]].filename);
-    tree->filenames[delOff[i]] = tree->filenames[--rep];
+    tree->filenames[delOff[i]] = tree->filenames[rep];
+    if (delOff[i] < tree->flatSize) {
+      /* move the keywords along with the filename */
+      if (tree->flat[delOff[i]].data != NULL)
+	free(tree->flat[delOff[i]].data);
+      memset(&tree->flat[delOff[i]],
+	     0,
+	     sizeof(FlatKeywords));
+      if (rep < tree->flatSize) {
+	tree->flat[delOff[i]] = tree->flat[rep];
+	memset(&tree->flat[rep],
+	       0,
+	       sizeof(FlatKeywords));
+      }
+    }
   }
   free(delOff);
   /* DOODLE_tree_dump(stdout, tree); */
@@ -2952,6 +4976,10 @@ int DOODLE_tree_truncate_multiple(SuffixTree * tree,
     GROW(tree->filenames,
 	 tree->fns,
 	 tree->fnc);
+    if (tree->flatSize > tree->fnc)
+      GROW(tree->flat,
+	   tree->flatSize,
+	   tree->fnc);
   }
   return err;
 }
@@ -3092,7 +5120,55 @@ void DOODLE_tree_truncate_modified(SuffixTree * tree,
        0);
 }
 
+/**
+ * How many nodes do we visit between two checks of the
+ * deadline of a search?
+ */
+#define LIMIT_CLOCK_INTERVAL 256
+
+/**
+ * @brief limits for a search (see DOODLE_tree_search_limited)
+ */
+typedef struct SearchLimit {
+  /* absolute deadline (0 for none) */
+  struct timeval deadline;
+  unsigned long long maxNodes;
+  unsigned int maxResults;
+  unsigned long long nodes;
+  unsigned int results;
+  /* 1 if the search was stopped before it was complete */
+  int truncated;
+  DOODLE_LimitedResultCallback callback;
+  void * arg;
+} SearchLimit;
+
+/**
+ * Account for visiting another node during a search.
+ * @return 1 if the search must stop (a limit was hit), 0 if not
+ */
+static int limitReached(SuffixTree * tree) {
+  SearchLimit * limit;
+  struct timeval now;
 
+  limit = tree->limit;
+  if (limit == NULL)
+    return 0;
+  if (limit->truncated)
+    return 1;
+  limit->nodes++;
+  if ( (limit->maxNodes != 0) &&
+       (limit->nodes > limit->maxNodes) )
+    limit->truncated = 1;
+  if ( (limit->deadline.tv_sec != 0) &&
+       ((limit->nodes % LIMIT_CLOCK_INTERVAL) == 1) ) {
+    gettimeofday(&now, NULL);
+    if ( (now.tv_sec > limit->deadline.tv_sec) ||
+	 ( (now.tv_sec == limit->deadline.tv_sec) &&
+	   (now.tv_usec >= limit->deadline.tv_usec) ) )
+      limit->truncated = 1;
+  }
+  return limit->truncated;
+}
 
 /**
  * @param do_links do we traverse the link list, too?
@@ -3111,6 +5187,8 @@ static int tree_iterate_internal(int do_links,
 
   ret = 0;
   while (node != NULL) {
+    if (limitReached(tree))
+      break;
     for (i=node->matchCount-1;i>=0;i--) {
       if (callback != NULL)
 	callback(&tree->filenames[node->matches[i]],
@@ -3143,177 +5221,5928 @@ static int tree_iterate_internal(int do_links,
 }
 
 
+/* ******************** bulk build ********************** */
+
 /**
- * Search the suffix tree for matching strings.
- * @return 0 for not found, >0 number of results found
+ * @brief a string to add to the tree at the end of a bulk build
  */
-int DOODLE_tree_search(SuffixTree * tree,
-		       const char * substring,
-		       DOODLE_ResultCallback callback,
-		       void * arg) {
-  STNode * pos;
+typedef struct {
+  /* the string, &tree->cis[cix][off] */
+  char * str;
+  unsigned int cix;
+  unsigned int off;
+  /* index into tree->filenames */
+  unsigned int file;
+  /* 1 if the string goes into the case-folded tree */
+  unsigned int fold;
+} BulkEntry;
 
-  pos = tree_search_internal(tree,
-			     substring);
-  return tree_iterate_internal(0,
-			       tree,
-			       pos,
-			       callback,
-			       arg);
+/**
+ * Number of buckets of the entries (see bulkBucket).
+ */
+#define BULK_BUCKETS 512
+
+/**
+ * @brief a sorted run of entries in a temporary file
+ */
+typedef struct {
+  BIO * fd;
+  /* offset of the first entry of each bucket, start[BULK_BUCKETS]
+     is the end of the run */
+  unsigned long long start[BULK_BUCKETS + 1];
+} BulkRun;
+
+/**
+ * @brief a sorted sequence of entries that is merged with others
+ */
+typedef struct {
+  /* handle of the run, NULL for the buffer */
+  BIO * fd;
+  /* end of the part of the run */
+  unsigned long long end;
+  /* next entry and end of the part of the buffer */
+  unsigned int pos;
+  unsigned int last;
+} BulkSource;
+
+/**
+ * @brief state of a bulk build (see DOODLE_tree_bulk_open)
+ */
+typedef struct BulkBuild {
+  /* entries that were not yet written to a run */
+  BulkEntry * entries;
+  /* number of entries used */
+  unsigned int count;
+  /* number of entries allocated */
+  unsigned int size;
+  /* index of the first entry of each bucket in the sorted
+     buffer (if there are no runs) */
+  unsigned int start[BULK_BUCKETS + 1];
+  /* sorted runs of entries */
+  BulkRun * runs;
+  /* number of runs */
+  unsigned int runCount;
+  /* number of temporary files opened so far (for their names) */
+  unsigned int tempCount;
+  /* hash table of the indices into tree->cis of the strings
+     added during the build (FILE_HASH_EMPTY for unused slots) */
+  unsigned int * strings;
+  /* number of slots in strings (a power of two) */
+  unsigned int stringsSize;
+  /* number of slots used in strings */
+  unsigned int stringsCount;
+  /* the last entry for the main and the case-folded tree */
+  BulkEntry last[2];
+  /* are the entries in last valid? */
+  int lastValid[2];
+} BulkBuild;
+
+/**
+ * Compare two strings in the order of the nodes in the tree
+ * (which compares the characters as char).
+ */
+static int bulkCompareStrings(const char * s,
+			      const char * t) {
+  while ( (s[0] == t[0]) &&
+	  (s[0] != '\0') ) {
+    s++;
+    t++;
+  }
+  if (s[0] == t[0])
+    return 0;
+  return (s[0] < t[0]) ? -1 : 1;
 }
 
 /**
- * Search the suffix tree for matching strings.
- *
- * @param pos current position in the tree
- * @param ignore_case for case-insensitive analysis
- * @param approx how many letters may we be off?
- * @param result pass address of pointer to NULL, will be set
- * @param resultSize pass address of integer of value 0, will be set
- * @return -1 on error, 0 for no results, >0 for number of results
+ * Order of the entries: the main tree before the case-folded
+ * tree, then by string and file.
  */
-static int tree_search_approx_internal(STNode * pos,
-				       const unsigned int approx,
-				       const int ignore_case,
-				       SuffixTree * tree,
-				       const char * ss,
-				       DOODLE_ResultCallback callback,
-				       void * arg) {
+static int bulkCompare(const void * a,
+		       const void * b) {
+  const BulkEntry * x = a;
+  const BulkEntry * y = b;
   int ret;
-  int iret;
 
-  ret = 0;
-  CHECK(tree);
-  if (ss[0] == '\0') {
-    /* search string empty!? */
+  if (x->fold != y->fold)
+    return (x->fold < y->fold) ? -1 : 1;
+  ret = bulkCompareStrings(x->str,
+			   y->str);
+  if (ret != 0)
+    return ret;
+  if (x->file != y->file)
+    return (x->file < y->file) ? -1 : 1;
+  return 0;
+}
+
+static void bulkStringsInsert(SuffixTree * tree,
+			      unsigned int cix) {
+  BulkBuild * b = tree->bulk;
+  unsigned int slot;
+
+  slot = hashString(tree->cis[cix]) & (b->stringsSize - 1);
+  while (b->strings[slot] != FILE_HASH_EMPTY)
+    slot = (slot + 1) & (b->stringsSize - 1);
+  b->strings[slot] = cix;
+  b->stringsCount++;
+}
+
+/**
+ * Find the string in tree->cis or add it (and its grams).  Each
+ * string is only added once during a bulk build.
+ *
+ * @return the index of the string in tree->cis
+ */
+static unsigned int bulkIntern(SuffixTree * tree,
+			       const char * str) {
+  BulkBuild * b = tree->bulk;
+  unsigned int * old;
+  unsigned int oldSize;
+  unsigned int slot;
+  unsigned int i;
+
+  slot = hashString(str) & (b->stringsSize - 1);
+  while (b->strings[slot] != FILE_HASH_EMPTY) {
+    if (0 == strcmp(tree->cis[b->strings[slot]],
+		    str))
+      return b->strings[slot];
+    slot = (slot + 1) & (b->stringsSize - 1);
+  }
+  gramsAdd(tree,
+	   str);
+  if (tree->cisLen == tree->cisPos) {
+    GROW(tree->cis,
+	 tree->cisLen,
+	 2 + tree->cisLen*2);
+  }
+  tree->cis[tree->cisPos] = STRDUP(str);
+  tree->cisPos++;
+  if (2 * (b->stringsCount + 1) > b->stringsSize) {
+    /* keep the table at most half full */
+    old = b->strings;
+    oldSize = b->stringsSize;
+    b->stringsSize *= 2;
+    b->strings = MALLOC(sizeof(unsigned int) * b->stringsSize);
+    memset(b->strings,
+	   0xFF,
+	   sizeof(unsigned int) * b->stringsSize);
+    b->stringsCount = 0;
+    for (i=0;i<oldSize;i++)
+      if (old[i] != FILE_HASH_EMPTY)
+	bulkStringsInsert(tree,
+			  old[i]);
+    free(old);
+  }
+  bulkStringsInsert(tree,
+		    tree->cisPos - 1);
+  return tree->cisPos - 1;
+}
+
+/**
+ * Index of the bucket of an entry: the entries of the main
+ * tree before those of the case-folded tree, each ordered by
+ * the first character (in the order of the nodes in the tree).
+ * The entries of different buckets go into different subtrees
+ * below the root.
+ */
+static unsigned int bulkBucket(const BulkEntry * entry) {
+  return entry->fold * 256 + ((int) entry->str[0] - CHAR_MIN);
+}
+
+/**
+ * Open a temporary file next to the database (it is
+ * unlinked right away, so it is removed when it is closed).
+ *
+ * @return NULL on error
+ */
+static BIO * bulkTempFile(SuffixTree * tree) {
+  BulkBuild * b = tree->bulk;
+  char * tname;
+  int fdt;
+
+  tname = MALLOC(strlen(tree->database) + 32);
+  strcpy(tname,
+	 tree->database);
+  sprintf(&tname[strlen(tname)],
+	  "~%u",
+	  b->tempCount++);
+#ifdef O_LARGEFILE
+  fdt = open(tname,
+	     O_CREAT | O_TRUNC | O_RDWR | O_LARGEFILE,
+	     S_IRUSR | S_IWUSR);
+#else
+  fdt = open(tname,
+	     O_CREAT | O_TRUNC | O_RDWR,
+	     S_IRUSR | S_IWUSR);
+#endif
+  if (fdt == -1) {
     tree->log(tree->context,
 	      DOODLE_LOG_CRITICAL,
-	      _("Assertion failed at %s:%d!\n"),
-	      __FILE__, __LINE__);
-    return -1;
+	      _("Could not open temporary file '%s': %s\n"),
+	      tname,
+	      strerror(errno));
+    free(tname);
+    return NULL;
   }
-  if (pos == NULL)
-    return 0; /* huh? */
-  if (pos->clength > 1)
-    tree_normalize(tree,
-		   pos); /* normalize! */
+  unlink(tname);
+  free(tname);
+  return IO_WRAP(tree->log,
+		 tree->context,
+		 fdt);
+}
 
-  while (pos != NULL) {
-    if ( (pos->c[0] == ss[0]) ||
-	 ( (ignore_case == 1) &&
-	   (tolower(pos->c[0]) == tolower(ss[0])) ) ) {
-      tree_normalize(tree, pos);
-      if (ss[1] == '\0') {
-	iret = tree_iterate_internal(0,
-				     tree,
-				     pos,
-				     callback,
-				     arg);	
-	if (iret == -1)
-	  return -1;
-	ret += iret;
-      } else {
-	if ( (pos->child == NULL) &&
-	     (pos->next_off != 0) )
-	  if (-1 == loadChild(tree,
-			      pos))
+/**
+ * Sort the buffered entries and write them to a new run.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int bulkWriteRun(SuffixTree * tree) {
+  BulkBuild * b = tree->bulk;
+  BulkRun * run;
+  BIO * fd;
+  unsigned int bucket;
+  unsigned int i;
+
+  qsort(b->entries,
+	b->count,
+	sizeof(BulkEntry),
+	&bulkCompare);
+  fd = bulkTempFile(tree);
+  if (fd == NULL)
+    return -1;
+  GROW(b->runs,
+       b->runCount,
+       b->runCount + 1);
+  run = &b->runs[b->runCount - 1];
+  run->fd = fd;
+  bucket = 0;
+  for (i=0;i<b->count;i++) {
+    if ( (i > 0) &&
+	 (0 == bulkCompare(&b->entries[i-1],
+			   &b->entries[i])) )
+      continue;
+    while (bucket <= bulkBucket(&b->entries[i]))
+      run->start[bucket++] = LSEEK(fd, 0, SEEK_CUR);
+    WRITEUINT(fd,
+	      b->entries[i].cix);
+    WRITEUINT(fd,
+	      b->entries[i].off);
+    WRITEUINT(fd,
+	      b->entries[i].file);
+    WRITEUINT(fd,
+	      b->entries[i].fold);
+  }
+  while (bucket <= BULK_BUCKETS)
+    run->start[bucket++] = LSEEK(fd, 0, SEEK_CUR);
+  flush_buffer(fd);
+  b->count = 0;
+  return 0;
+}
+
+/**
+ * Read the next entry of a part of the bulk build.
+ *
+ * @return 1 if an entry was read, 0 at the end, -1 on error
+ */
+static int bulkNext(SuffixTree * tree,
+		    BulkBuild * b,
+		    BulkSource * src,
+		    BulkEntry * entry) {
+  BIO * fd = src->fd;
+
+  if (fd == NULL) {
+    if (src->pos == src->last)
+      return 0;
+    *entry = b->entries[src->pos++];
+    return 1;
+  }
+  if (LSEEK(fd, 0, SEEK_CUR) >= src->end)
+    return 0;
+  if ( (-1 == READUINT(fd, &entry->cix)) ||
+       (-1 == READUINT(fd, &entry->off)) ||
+       (-1 == READUINT(fd, &entry->file)) ||
+       (-1 == READUINT(fd, &entry->fold)) ||
+       (entry->cix >= tree->cisPos) ||
+       (entry->off >= strlen(tree->cis[entry->cix])) )
+    return -1;
+  entry->str = &tree->cis[entry->cix][entry->off];
+  return 1;
+}
+
+/**
+ * Add a string from the bulk build to the tree.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int bulkInsert(SuffixTree * tree,
+		      const BulkEntry * entry) {
+  int ret;
+
+  if (entry->fold != 0)
+    swapRoots(tree);
+  tree->mutationCount++;
+  ret = tree_insert_internal(tree,
+			     entry->str,
+			     entry->file,
+			     entry->str,
+			     entry->cix);
+  if (entry->fold != 0)
+    swapRoots(tree);
+  if (tree->used_memory > tree->memory_limit)
+    shrinkMemoryFootprint(tree, tree->root);
+  return ret;
+}
+
+/**
+ * Restore the heap property of the sources below position i
+ * (heap holds the indices of the sources, ordered by their
+ * current entries in heads).
+ */
+static void bulkSiftDown(unsigned int * heap,
+			 unsigned int size,
+			 const BulkEntry * heads,
+			 unsigned int i) {
+  unsigned int min;
+  unsigned int tmp;
+
+  while (2 * i + 1 < size) {
+    min = 2 * i + 1;
+    if ( (min + 1 < size) &&
+	 (bulkCompare(&heads[heap[min + 1]],
+		      &heads[heap[min]]) < 0) )
+      min++;
+    if (bulkCompare(&heads[heap[min]],
+		    &heads[heap[i]]) >= 0)
+      return;
+    tmp = heap[i];
+    heap[i] = heap[min];
+    heap[min] = tmp;
+    i = min;
+  }
+}
+
+/**
+ * Insert the entries of the buckets lo to hi-1 into the given
+ * tree, in sorted order: the parts of the sorted runs (or of
+ * the sorted buffer if there are no runs) are merged and each
+ * string is inserted right after the strings that precede it
+ * in the tree.  The runs are read with separate handles, so
+ * several threads can merge different buckets at the same time.
+ *
+ * @param tree the tree to insert into (not necessarily the
+ *        tree of the bulk build)
+ * @return 0 on success, -1 on error
+ */
+static int bulkMerge(SuffixTree * tree,
+		     BulkBuild * b,
+		     unsigned int lo,
+		     unsigned int hi) {
+  BulkSource * sources;
+  BulkEntry * heads;
+  BulkEntry prev;
+  unsigned int * heap;
+  unsigned int count;
+  unsigned int size;
+  unsigned int i;
+  int have;
+  int ret;
+  int r;
+
+  ret = 0;
+  count = (b->runCount == 0) ? 1 : b->runCount;
+  sources = MALLOC(sizeof(BulkSource) * count);
+  heads = MALLOC(sizeof(BulkEntry) * count);
+  heap = MALLOC(sizeof(unsigned int) * count);
+  if (b->runCount == 0) {
+    sources[0].pos = b->start[lo];
+    sources[0].last = b->start[hi];
+  }
+  for (i=0;i<b->runCount;i++) {
+    /* shares the descriptor of the run (reads use pread) */
+    sources[i].fd = IO_WRAP(tree->log,
+			    tree->context,
+			    b->runs[i].fd->fd);
+    LSEEK(sources[i].fd,
+	  b->runs[i].start[lo],
+	  SEEK_SET);
+    sources[i].end = b->runs[i].start[hi];
+  }
+  size = 0;
+  for (i=0;(ret == 0) && (i<count);i++) {
+    r = bulkNext(tree,
+		 b,
+		 &sources[i],
+		 &heads[i]);
+    if (r == -1)
+      ret = -1;
+    else if (r == 1)
+      heap[size++] = i;
+  }
+  for (i=size;i>0;i--)
+    bulkSiftDown(heap,
+		 size,
+		 heads,
+		 i - 1);
+  have = 0;
+  while ( (ret == 0) &&
+	  (size > 0) ) {
+    i = heap[0];
+    if ( (have == 0) ||
+	 (0 != bulkCompare(&prev,
+			   &heads[i])) ) {
+      if (0 != bulkInsert(tree,
+			  &heads[i])) {
+	ret = -1;
+	break;
+      }
+    }
+    prev = heads[i];
+    have = 1;
+    r = bulkNext(tree,
+		 b,
+		 &sources[i],
+		 &heads[i]);
+    if (r == -1) {
+      ret = -1;
+      break;
+    }
+    if (r == 0)
+      heap[0] = heap[--size];
+    bulkSiftDown(heap,
+		 size,
+		 heads,
+		 0);
+  }
+  for (i=0;i<b->runCount;i++) {
+    free(sources[i].fd->buffer);
+    free(sources[i].fd);
+  }
+  free(heap);
+  free(heads);
+  free(sources);
+  return ret;
+}
+
+/**
+ * @brief a thread of a parallel bulk build
+ */
+typedef struct {
+  BulkBuild * bulk;
+  /* private tree of the thread (sharing the keywords, the
+     filenames and the database file with the tree of the
+     bulk build) */
+  SuffixTree * tree;
+  /* the buckets of the thread */
+  unsigned int lo;
+  unsigned int hi;
+  /* offsets of the subtrees built by the thread (0 for none) */
+  unsigned long long root;
+  unsigned long long froot;
+  int ret;
+} BulkWorker;
+
+/**
+ * Main method of the threads of a parallel bulk build: build
+ * the subtrees for the buckets of the thread and write them
+ * to the database file.
+ */
+static void * bulkWorkerMain(void * cls) {
+  BulkWorker * worker = cls;
+  SuffixTree * tree = worker->tree;
+
+  worker->ret = bulkMerge(tree,
+			  worker->bulk,
+			  worker->lo,
+			  worker->hi);
+  if (worker->ret == 0) {
+    pthread_mutex_lock(&tree->shared->lock);
+    tree->fd->fsize = tree->shared->end;
+    worker->root = writeNode(tree->fd,
+			     tree,
+			     tree->root,
+			     NULL);
+    worker->froot = writeNode(tree->fd,
+			      tree,
+			      tree->froot,
+			      NULL);
+    flush_buffer(tree->fd);
+    tree->shared->end = tree->fd->fsize;
+    pthread_mutex_unlock(&tree->shared->lock);
+  }
+  freeNode(tree,
+	   tree->root);
+  freeNode(tree,
+	   tree->froot);
+  tree->root = NULL;
+  tree->froot = NULL;
+  return NULL;
+}
+
+/**
+ * Append the (sub)tree at the given offset to the entries of
+ * the first level of the tree.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int bulkAppendRoot(SuffixTree * tree,
+			  unsigned long long off) {
+  STNode * pos;
+  STNode * last;
+  STNode * node;
+
+  if (off == 0)
+    return 0;
+  last = NULL;
+  pos = tree->root;
+  while (pos != NULL) {
+    last = &pos[pos->mls_size - 1];
+    if ( (last->link == NULL) &&
+	 (last->link_off != 0) &&
+	 (-1 == loadLink(tree,
+			 last)) )
+      return -1;
+    pos = last->link;
+  }
+  node = lazyReadNode(tree,
+		      off);
+  if (node == NULL)
+    return -1;
+  node->parent = last;
+  if (last == NULL)
+    tree->root = node;
+  else
+    last->link = node;
+  markModified(node);
+  tree->modified = 1;
+  return 0;
+}
+
+/**
+ * Insert the buffered entries with several threads.  The
+ * buckets are split into one range for each thread (with about
+ * the same number of entries, a bucket is never split); each
+ * thread builds the subtrees for its range in a private tree
+ * that swaps out to the database file like the tree itself
+ * (appending under a lock, reading with its own handle).  The
+ * subtrees are then linked into the (empty) first level of the
+ * tree.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int bulkParallel(SuffixTree * tree,
+			unsigned int threads) {
+  BulkBuild * b = tree->bulk;
+  BulkWorker * workers;
+  SuffixTree * wt;
+  SharedFile shared;
+  pthread_t * handles;
+  unsigned long long weight[BULK_BUCKETS];
+  unsigned long long total;
+  unsigned long long sum;
+  unsigned int bucket;
+  unsigned int i;
+  int * started;
+  int ret;
+
+  total = 0;
+  for (bucket=0;bucket<BULK_BUCKETS;bucket++) {
+    if (b->runCount == 0)
+      weight[bucket] = b->start[bucket + 1] - b->start[bucket];
+    else
+      weight[bucket] = 0;
+    for (i=0;i<b->runCount;i++)
+      weight[bucket] += b->runs[i].start[bucket + 1] - b->runs[i].start[bucket];
+    total += weight[bucket];
+  }
+  workers = MALLOC(sizeof(BulkWorker) * threads);
+  handles = MALLOC(sizeof(pthread_t) * threads);
+  started = MALLOC(sizeof(int) * threads);
+  i = 0;
+  sum = 0;
+  for (bucket=0;bucket<BULK_BUCKETS;bucket++) {
+    sum += weight[bucket];
+    if ( (sum * threads >= total * (i + 1)) &&
+	 (i + 1 < threads) ) {
+      workers[i].hi = bucket + 1;
+      workers[i + 1].lo = bucket + 1;
+      i++;
+    }
+  }
+  workers[i].hi = BULK_BUCKETS;
+  threads = i + 1;
+  flush_buffer(tree->fd);
+  pthread_mutex_init(&shared.lock, NULL);
+  shared.end = tree->fd->fsize;
+  for (i=0;i<threads;i++) {
+    wt = MALLOC(sizeof(SuffixTree));
+    wt->log = tree->log;
+    wt->context = tree->context;
+    wt->database = tree->database;
+    /* shares the descriptor of the database (reads use pread) */
+    wt->fd = IO_WRAP(tree->log,
+		     tree->context,
+		     tree->fd->fd);
+    wt->shared = &shared;
+    wt->fns = tree->fns;
+    wt->fnc = tree->fnc;
+    wt->filenames = tree->filenames;
+    wt->cis = tree->cis;
+    wt->cisPos = tree->cisPos;
+    wt->cisLen = tree->cisLen;
+    wt->fold = tree->fold;
+    wt->words = tree->words;
+    wt->aggregatesStart = tree->aggregatesStart;
+    wt->memory_limit = tree->memory_limit / threads;
+    workers[i].bulk = b;
+    workers[i].tree = wt;
+    started[i] = (0 == pthread_create(&handles[i],
+				      NULL,
+				      &bulkWorkerMain,
+				      &workers[i]));
+  }
+  ret = 0;
+  for (i=0;i<threads;i++) {
+    if (started[i])
+      pthread_join(handles[i], NULL);
+    else
+      bulkWorkerMain(&workers[i]); /* continue with fewer threads */
+    if (workers[i].ret != 0)
+      ret = -1;
+  }
+  pthread_mutex_destroy(&shared.lock);
+  tree->fd->fsize = shared.end;
+  for (i=0;i<threads;i++) {
+    if ( (ret == 0) &&
+	 (0 != bulkAppendRoot(tree,
+			      workers[i].root)) )
+      ret = -1;
+    if (ret == 0) {
+      swapRoots(tree);
+      if (0 != bulkAppendRoot(tree,
+			      workers[i].froot))
+	ret = -1;
+      swapRoots(tree);
+    }
+    wt = workers[i].tree;
+    free(wt->fd->buffer);
+    free(wt->fd);
+    free(wt);
+  }
+  free(started);
+  free(handles);
+  free(workers);
+  return ret;
+}
+
+/**
+ * Add all buffered entries to the tree (see bulkMerge), with
+ * several threads if the tree is still empty.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int bulkFlush(SuffixTree * tree) {
+  BulkBuild * b = tree->bulk;
+  unsigned int bucket;
+  unsigned int i;
+  int ret;
+
+  ret = 0;
+  b->lastValid[0] = 0;
+  b->lastValid[1] = 0;
+  if ( (b->count == 0) &&
+       (b->runCount == 0) )
+    return 0;
+  tree->generation++;
+  tree->log(tree->context,
+	    DOODLE_LOG_VERBOSE,
+	    _("Adding the keywords of the bulk build to the tree.\n"));
+  if (b->runCount == 0) {
+    /* everything fits into memory */
+    qsort(b->entries,
+	  b->count,
+	  sizeof(BulkEntry),
+	  &bulkCompare);
+    bucket = 0;
+    for (i=0;i<b->count;i++)
+      while (bucket <= bulkBucket(&b->entries[i]))
+	b->start[bucket++] = i;
+    while (bucket <= BULK_BUCKETS)
+      b->start[bucket++] = b->count;
+  } else if ( (b->count > 0) &&
+	      (0 != bulkWriteRun(tree)) ) {
+    ret = -1;
+  }
+  if (ret == 0) {
+    if ( (tree->bulkThreads > 1) &&
+	 (tree->root == NULL) &&
+	 (tree->froot == NULL) )
+      ret = bulkParallel(tree,
+			 tree->bulkThreads);
+    else
+      ret = bulkMerge(tree,
+		      b,
+		      0,
+		      BULK_BUCKETS);
+  }
+  if (ret != 0)
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Could not add the keywords of the bulk build to the tree.\n"));
+  b->count = 0;
+  for (i=0;i<b->runCount;i++)
+    IO_FREE(b->runs[i].fd);
+  GROW(b->runs,
+       b->runCount,
+       0);
+  return ret;
+}
+
+/**
+ * Add a string (and its case-folded version) to the buffer of
+ * the bulk build.
+ *
+ * @param fold 1 for the case-folded tree, 0 for the main tree
+ * @param isSuffix 1 if the string is the last string added for
+ *        the same tree without its first character
+ * @return 0 on success, 1 on error
+ */
+static int bulkAddTo(SuffixTree * tree,
+		     const char * str,
+		     unsigned int file,
+		     unsigned int fold,
+		     int isSuffix) {
+  BulkBuild * b = tree->bulk;
+  BulkEntry entry;
+
+  if ( (isSuffix != 0) &&
+       (b->lastValid[fold] != 0) &&
+       (0 == strcmp(&b->last[fold].str[1],
+		    str)) ) {
+    /* stored right behind the last string */
+    entry = b->last[fold];
+    entry.str++;
+    entry.off++;
+  } else {
+    entry.cix = bulkIntern(tree,
+			   str);
+    entry.off = 0;
+    entry.str = tree->cis[entry.cix];
+  }
+  entry.file = file;
+  entry.fold = fold;
+  b->last[fold] = entry;
+  b->lastValid[fold] = 1;
+  if ( (b->count == b->size) &&
+       (0 != bulkWriteRun(tree)) )
+    return 1;
+  b->entries[b->count++] = entry;
+  return 0;
+}
+
+static int bulkAdd(SuffixTree * tree,
+		   const char * searchString,
+		   unsigned int sharedNameIndex,
+		   int isSuffix) {
+  char * folded;
+  int ret;
+
+  if (tree->flatIndex != 0)
+    flatAdd(tree,
+	    searchString,
+	    sharedNameIndex);
+  ret = bulkAddTo(tree,
+		  searchString,
+		  sharedNameIndex,
+		  0,
+		  isSuffix);
+  if ( (ret == 0) &&
+       (tree->fold != 0) ) {
+    folded = foldCase(searchString);
+    if (0 != strcmp(folded,
+		    searchString))
+      ret = bulkAddTo(tree,
+		      folded,
+		      sharedNameIndex,
+		      1,
+		      isSuffix);
+    else
+      tree->bulk->lastValid[1] = 0;
+    free(folded);
+  }
+  return ret;
+}
+
+/**
+ * Start a bulk build.
+ *
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_bulk_open(struct DOODLE_SuffixTree * tree) {
+  BulkBuild * b;
+
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "bulk build");
+    return -1;
+  }
+  if (tree->read_only)
+    return -1;
+  if (tree->bulk != NULL)
+    return 0;
+  b = MALLOC(sizeof(BulkBuild));
+  b->size = tree->memory_limit / sizeof(BulkEntry);
+  if (b->size < 1024)
+    b->size = 1024;
+  b->entries = MALLOC(sizeof(BulkEntry) * b->size);
+  b->stringsSize = 1024;
+  b->strings = MALLOC(sizeof(unsigned int) * b->stringsSize);
+  memset(b->strings,
+	 0xFF,
+	 sizeof(unsigned int) * b->stringsSize);
+  tree->bulk = b;
+  return 0;
+}
+
+/**
+ * Change the number of threads that insert the keywords
+ * of a bulk build.
+ *
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_build_threads(struct DOODLE_SuffixTree * tree,
+				  unsigned int threads) {
+  if (tree->read_only)
+    return -1;
+  tree->bulkThreads = threads;
+  return 0;
+}
+
+/**
+ * Finish a bulk build.
+ *
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_bulk_close(struct DOODLE_SuffixTree * tree) {
+  BulkBuild * b = tree->bulk;
+  int ret;
+
+  if (b == NULL)
+    return 0;
+  ret = bulkFlush(tree);
+  tree->bulk = NULL;
+  free(b->entries);
+  free(b->strings);
+  free(b);
+  return ret;
+}
+
+
+/* ******************** frozen databases ********************** */
+
+/**
+ * A frozen database is a compact copy of a database that can only
+ * be searched (see DOODLE_tree_freeze).  The nodes of both trees
+ * (with each entry of a multi-link group as a node of its own)
+ * are numbered in level order and the shape of the trees is
+ * stored as a LOUDS bit vector: for each node, a 1-bit for each
+ * child followed by a 0-bit.  Nodes 0 and 1 are virtual roots
+ * whose children are the first levels of the main and of the
+ * case-folded tree.  The children of a node have consecutive
+ * numbers, so a child is found with a binary search over the
+ * first characters of the labels.  The other characters of
+ * longer labels, the matches and the aggregates are stored in
+ * arrays that are indexed by the rank of the node in a bit vector
+ * marking the nodes that have them.  The arrays are used directly
+ * from a read-only mapping of the database file.
+ */
+
+/**
+ * Number of bits per entry of the rank directory of a bit vector
+ * (the rank of a position is the directory entry plus the number
+ * of 1-bits in at most this many bits).
+ */
+#define FROZEN_RANK_BLOCK 512
+
+/**
+ * Number of virtual roots of a frozen tree (main tree and
+ * case-folded tree).
+ */
+#define FROZEN_ROOTS 2
+
+/**
+ * Marker for the byte order of the arrays of a frozen database
+ * (they are written in the byte order of the machine that froze
+ * the database and used without conversion).
+ */
+#define FROZEN_BYTE_ORDER 0x01020304
+
+/**
+ * Number of entries in the header that precedes the arrays.
+ */
+#define FROZEN_HEADER_SIZE 8
+
+/**
+ * Node number that stands for "no node".
+ */
+#define FROZEN_NONE 0xFFFFFFFF
+
+/**
+ * @brief bit vector with a rank directory (part of a frozen tree)
+ */
+typedef struct {
+  /* the bits, least significant bit first */
+  const unsigned long long * bits;
+  /* number of 1-bits before each block of FROZEN_RANK_BLOCK bits */
+  const unsigned int * rank;
+  /* number of bits */
+  unsigned int size;
+} FrozenBits;
+
+/**
+ * @brief the arrays of a frozen database
+ */
+typedef struct FrozenTree {
+  /* mapping of the database file */
+  void * map;
+  /* size of map */
+  size_t mapSize;
+  /* number of nodes (including the virtual roots) */
+  unsigned int nodes;
+  /* shape of the trees (LOUDS) */
+  FrozenBits louds;
+  /* marks the nodes with labels of more than one character */
+  FrozenBits longLabels;
+  /* marks the nodes with matches */
+  FrozenBits hasMatches;
+  /* marks the nodes with a stored aggregate */
+  FrozenBits hasAggregate;
+  /* first character of the label of each node */
+  const unsigned char * first;
+  /* offset into labels for each long label */
+  const unsigned int * labelOff;
+  /* for each long label: the length minus one (one byte),
+     followed by the characters after the first */
+  const unsigned char * labels;
+  /* offset into matches for each node with matches */
+  const unsigned int * matchOff;
+  /* for each node with matches: the number of matches, followed
+     by the differences between the sorted indices into
+     tree->filenames (all as varints) */
+  const unsigned char * matches;
+  /* end of matches */
+  const unsigned char * matchesEnd;
+  /* number of distinct files in the subtree of each node with
+     a stored aggregate */
+  const unsigned int * aggCount;
+  /* the arrays of an FM index, NULL if the database is a
+     frozen tree (then the arrays above are not used) */
+  struct FMIndex * fm;
+} FrozenTree;
+
+/**
+ * Count the 1-bits in a word.
+ */
+static unsigned int bitCount(unsigned long long x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (unsigned int) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+static int bitGet(const FrozenBits * fb,
+		  unsigned int pos) {
+  return (int) ((fb->bits[pos / 64] >> (pos % 64)) & 1);
+}
+
+/**
+ * @return number of 1-bits before pos
+ */
+static unsigned int bitRank(const FrozenBits * fb,
+			    unsigned int pos) {
+  unsigned int ret;
+  unsigned int w;
+
+  ret = fb->rank[pos / FROZEN_RANK_BLOCK];
+  for (w = (pos / FROZEN_RANK_BLOCK) * (FROZEN_RANK_BLOCK / 64);
+       w < pos / 64;
+       w++)
+    ret += bitCount(fb->bits[w]);
+  if ((pos % 64) != 0)
+    ret += bitCount(fb->bits[pos / 64] & ((1ULL << (pos % 64)) - 1));
+  return ret;
+}
+
+/**
+ * @param n number of the 0-bit (starting at 1)
+ * @return position of the n-th 0-bit, size if there are fewer
+ */
+static unsigned int bitSelect0(const FrozenBits * fb,
+			       unsigned int n) {
+  unsigned long long word;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+  unsigned int w;
+  unsigned int zeros;
+  unsigned int pos;
+
+  /* find the last block with fewer than n 0-bits before it */
+  lo = 0;
+  hi = fb->size / FROZEN_RANK_BLOCK + 1;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (mid * FROZEN_RANK_BLOCK - fb->rank[mid] < n)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  n -= lo * FROZEN_RANK_BLOCK - fb->rank[lo];
+  for (w = lo * (FROZEN_RANK_BLOCK / 64); w * 64 < fb->size; w++) {
+    word = ~fb->bits[w];
+    zeros = bitCount(word);
+    if (zeros < n) {
+      n -= zeros;
+      continue;
+    }
+    while (--n > 0)
+      word &= word - 1;
+    pos = w * 64;
+    while ((word & 1) == 0) {
+      word >>= 1;
+      pos++;
+    }
+    return (pos < fb->size) ? pos : fb->size;
+  }
+  return fb->size;
+}
+
+/**
+ * @return position of the bits for the children of a node of
+ *   a frozen tree in the LOUDS bit vector
+ */
+static unsigned int frozenChildPos(const FrozenTree * ft,
+				   unsigned int node) {
+  return (node == 0) ? 0 : bitSelect0(&ft->louds, node) + 1;
+}
+
+/**
+ * Find the children of a node of a frozen tree.
+ *
+ * @param count set to the number of children
+ * @return number of the first child
+ */
+static unsigned int frozenChildren(const FrozenTree * ft,
+				   unsigned int node,
+				   unsigned int * count) {
+  unsigned int pos;
+  unsigned int end;
+
+  pos = frozenChildPos(ft, node);
+  end = pos;
+  while ( (end < ft->louds.size) &&
+	  (bitGet(&ft->louds, end)) )
+    end++;
+  *count = end - pos;
+  return FROZEN_ROOTS + bitRank(&ft->louds, pos);
+}
+
+/**
+ * Get the label of a node of a frozen tree.
+ *
+ * @param rest set to the characters after the first
+ *   (see ft->first), NULL for labels of length 1
+ * @return length of the label
+ */
+static unsigned int frozenLabel(const FrozenTree * ft,
+				unsigned int node,
+				const unsigned char ** rest) {
+  const unsigned char * label;
+
+  if (! bitGet(&ft->longLabels, node)) {
+    *rest = NULL;
+    return 1;
+  }
+  label = &ft->labels[ft->labelOff[bitRank(&ft->longLabels, node)]];
+  *rest = &label[1];
+  return 1 + label[0];
+}
+
+static unsigned int frozenVarint(const unsigned char ** pos,
+				 const unsigned char * end) {
+  unsigned int ret;
+  unsigned int shift;
+  unsigned char b;
+
+  ret = 0;
+  shift = 0;
+  do {
+    if (*pos >= end)
+      return ret;
+    b = *(*pos)++;
+    ret |= (unsigned int) (b & 127) << shift;
+    shift += 7;
+  } while ( ((b & 128) != 0) &&
+	    (shift < 32) );
+  return ret;
+}
+
+/**
+ * Report the matches of a node of a frozen tree.
+ *
+ * @param entry rank of the node in ft->hasMatches
+ * @return -1 on error, otherwise the number of matches
+ */
+static int frozenMatches(SuffixTree * tree,
+			 unsigned int entry,
+			 DOODLE_ResultCallback callback,
+			 void * arg) {
+  const FrozenTree * ft;
+  const unsigned char * pos;
+  unsigned int count;
+  unsigned int idx;
+  unsigned int i;
+
+  ft = tree->frozen;
+  pos = &ft->matches[ft->matchOff[entry]];
+  count = frozenVarint(&pos, ft->matchesEnd);
+  idx = 0;
+  for (i=0;i<count;i++) {
+    if (pos < ft->matchesEnd)
+      idx += frozenVarint(&pos, ft->matchesEnd);
+    else
+      idx = tree->fnc;
+    if (idx >= tree->fnc) {
+      tree->log(tree->context,
+		DOODLE_LOG_CRITICAL,
+		_("Assertion failed at %s:%d.\nDatabase format error!\n"),
+		__FILE__, __LINE__);
+      return -1;
+    }
+    if (callback != NULL)
+      callback(&tree->filenames[idx],
+	       arg);
+  }
+  return (int) count;
+}
+
+/**
+ * Report the matches of a node of a frozen tree and of
+ * everything below it (tree_iterate_internal for frozen
+ * trees).  The subtree is visited level by level: the
+ * children of a range of nodes are again a range of nodes.
+ *
+ * @return -1 on error, otherwise the number of results
+ */
+static int frozenIterate(SuffixTree * tree,
+			 unsigned int node,
+			 DOODLE_ResultCallback callback,
+			 void * arg) {
+  const FrozenTree * ft;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int entry;
+  int ret;
+  int iret;
+
+  ft = tree->frozen;
+  ret = 0;
+  lo = node;
+  hi = node + 1;
+  while (lo < hi) {
+    entry = bitRank(&ft->hasMatches, lo);
+    for (node=lo;node<hi;node++) {
+      if (limitReached(tree))
+	return ret;
+      if (! bitGet(&ft->hasMatches, node))
+	continue;
+      iret = frozenMatches(tree,
+			   entry++,
+			   callback,
+			   arg);
+      if (iret == -1)
+	return -1;
+      ret += iret;
+    }
+    lo = FROZEN_ROOTS + bitRank(&ft->louds,
+				frozenChildPos(ft, lo));
+    hi = FROZEN_ROOTS + bitRank(&ft->louds,
+				frozenChildPos(ft, hi));
+  }
+  return ret;
+}
+
+/**
+ * Find the node of a frozen tree below which all strings
+ * start with the given string (tree_search_internal for
+ * frozen trees).
+ *
+ * @param root virtual root of the tree to search
+ * @return FROZEN_NONE if the string is not in the tree
+ */
+static unsigned int frozenFind(const FrozenTree * ft,
+			       unsigned int root,
+			       const char * ss) {
+  const unsigned char * rest;
+  unsigned int node;
+  unsigned int child;
+  unsigned int count;
+  unsigned int len;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+  unsigned int i;
+
+  if (ss[0] == '\0')
+    return FROZEN_NONE;
+  node = root;
+  while (ss[0] != '\0') {
+    child = frozenChildren(ft,
+			   node,
+			   &count);
+    /* siblings are sorted like in the tree */
+    lo = 0;
+    hi = count;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if ((char) ft->first[child + mid] < ss[0])
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+    if ( (lo == count) ||
+	 ((char) ft->first[child + lo] != ss[0]) )
+      return FROZEN_NONE;
+    node = child + lo;
+    len = frozenLabel(ft,
+		      node,
+		      &rest);
+    ss++;
+    for (i=1;(i<len) && (ss[0] != '\0');i++) {
+      if ((char) rest[i-1] != ss[0])
+	return FROZEN_NONE;
+      ss++;
+    }
+  }
+  return node;
+}
+
+/**
+ * Exact search in a frozen tree.
+ *
+ * @param root virtual root of the tree to search
+ * @return -1 on error, otherwise the number of results
+ */
+static int frozenSearch(SuffixTree * tree,
+			unsigned int root,
+			const char * substring,
+			DOODLE_ResultCallback callback,
+			void * arg) {
+  unsigned int node;
+
+  if (tree->frozen->fm != NULL)
+    return fmSearch(tree,
+		    substring,
+		    callback,
+		    arg);
+  node = frozenFind(tree->frozen,
+		    root,
+		    substring);
+  if (node == FROZEN_NONE)
+    return 0;
+  return frozenIterate(tree,
+		       node,
+		       callback,
+		       arg);
+}
+
+static int frozenApproxList(SuffixTree * tree,
+			    unsigned int node,
+			    unsigned int off,
+			    unsigned int end,
+			    unsigned int approx,
+			    int ignore_case,
+			    const char * ss,
+			    DOODLE_ResultCallback callback,
+			    void * arg);
+
+/**
+ * Approximate search starting at the given character of the
+ * label of a node of a frozen tree (tree_search_approx_node for
+ * frozen trees; node and off take the place of the normalized
+ * node).
+ *
+ * @param off index of the character in the label of node
+ * @param end number of the node after the last sibling of node
+ * @param stop set to 1 if the siblings must not be searched
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+static int frozenApproxNode(SuffixTree * tree,
+			    unsigned int node,
+			    unsigned int off,
+			    unsigned int end,
+			    unsigned int approx,
+			    int ignore_case,
+			    const char * ss,
+			    DOODLE_ResultCallback callback,
+			    void * arg,
+			    int * stop) {
+  const unsigned char * rest;
+  unsigned int len;
+  unsigned int next;
+  unsigned int nextOff;
+  unsigned int nextEnd;
+  char c;
+  int match;
+  int ret;
+  int iret;
+
+  if (off == 0) {
+    c = (char) tree->frozen->first[node];
+    len = 0; /* not yet known */
+  } else {
+    len = frozenLabel(tree->frozen,
+		      node,
+		      &rest);
+    c = (char) rest[off-1];
+  }
+  match = ( (c == ss[0]) ||
+	    ( (ignore_case == 1) &&
+	      (tolower(c) == tolower(ss[0])) ) );
+  if ( (! match) &&
+       (approx == 0) )
+    return 0;
+  if (ss[1] == '\0') {
+    if (! match)
+      *stop = 1;
+    return frozenIterate(tree,
+			 node,
+			 callback,
+			 arg);
+  }
+  /* position after c */
+  if (len == 0)
+    len = frozenLabel(tree->frozen,
+		      node,
+		      &rest);
+  if (off + 1 < len) {
+    next = node;
+    nextOff = off + 1;
+    nextEnd = node + 1;
+  } else {
+    next = frozenChildren(tree->frozen,
+			  node,
+			  &nextEnd);
+    nextOff = 0;
+    nextEnd += next;
+  }
+  if (match)
+    return frozenApproxList(tree,
+			    next,
+			    nextOff,
+			    nextEnd,
+			    approx,
+			    ignore_case,
+			    ss+1,
+			    callback,
+			    arg);
+  /* extra character in suffix-tree */
+  ret = frozenApproxList(tree,
+			 next,
+			 nextOff,
+			 nextEnd,
+			 approx-1,
+			 ignore_case,
+			 ss,
+			 callback,
+			 arg);
+  if (ret == -1)
+    return -1;
+  /* character mismatch */
+  iret = frozenApproxList(tree,
+			  next,
+			  nextOff,
+			  nextEnd,
+			  approx-1,
+			  ignore_case,
+			  ss+1,
+			  callback,
+			  arg);
+  if (iret == -1)
+    return -1;
+  ret += iret;
+  /* extra character in ss */
+  iret = frozenApproxList(tree,
+			  node,
+			  off,
+			  end,
+			  approx-1,
+			  ignore_case,
+			  ss+1,
+			  callback,
+			  arg);
+  if (iret == -1)
+    return -1;
+  return ret + iret;
+}
+
+/**
+ * Approximate search starting at the given character of the
+ * label of a node of a frozen tree and, if that is the first
+ * character, the siblings after the node (the equivalent of
+ * tree_search_approx_internal).
+ *
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+static int frozenApproxList(SuffixTree * tree,
+			    unsigned int node,
+			    unsigned int off,
+			    unsigned int end,
+			    unsigned int approx,
+			    int ignore_case,
+			    const char * ss,
+			    DOODLE_ResultCallback callback,
+			    void * arg) {
+  int ret;
+  int iret;
+  int stop;
+
+  if (ss[0] == '\0') {
+    /* search string empty!? */
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Assertion failed at %s:%d!\n"),
+	      __FILE__, __LINE__);
+    return -1;
+  }
+  ret = 0;
+  while (node < end) {
+    if (limitReached(tree))
+      break;
+    stop = 0;
+    iret = frozenApproxNode(tree,
+			    node,
+			    off,
+			    end,
+			    approx,
+			    ignore_case,
+			    ss,
+			    callback,
+			    arg,
+			    &stop);
+    if (iret == -1)
+      return -1;
+    ret += iret;
+    if (stop)
+      break;
+    node++;
+  }
+  return ret;
+}
+
+/**
+ * Approximate or case-insensitive search in a frozen tree.
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+static int frozenSearchApprox(SuffixTree * tree,
+			      const char * ss,
+			      unsigned int approx,
+			      int ignore_case,
+			      DOODLE_ResultCallback callback,
+			      void * arg) {
+  char * folded;
+  unsigned int child;
+  unsigned int count;
+  int ret;
+  int iret;
+
+  if (tree->frozen->fm != NULL) {
+    frozenRefuse(tree,
+		 "search_approx");
+    return -1;
+  }
+  if ( (approx == 0) &&
+       (ignore_case != 0) &&
+       (tree->fold != 0) ) {
+    /* see search_approx */
+    folded = foldCase(ss);
+    ret = frozenSearch(tree,
+		       0,
+		       folded,
+		       callback,
+		       arg);
+    if (ret != -1) {
+      iret = frozenSearch(tree,
+			  1,
+			  folded,
+			  callback,
+			  arg);
+      ret = (iret == -1) ? -1 : ret + iret;
+    }
+    free(folded);
+    return ret;
+  }
+  child = frozenChildren(tree->frozen,
+			 0,
+			 &count);
+  return frozenApproxList(tree,
+			  child,
+			  0,
+			  child + count,
+			  approx,
+			  ignore_case,
+			  ss,
+			  callback,
+			  arg);
+}
+
+/**
+ * @brief closure for counting the distinct files in a frozen tree
+ */
+typedef struct {
+  SuffixTree * tree;
+  unsigned char * seen;
+  int count;
+} FrozenCount;
+
+static void frozenCountFile(const DOODLE_FileInfo * fileinfo,
+			    void * cls) {
+  FrozenCount * fc = cls;
+  unsigned int idx;
+
+  idx = fileinfo - fc->tree->filenames;
+  if ((fc->seen[idx / 8] & (1 << (idx % 8))) != 0)
+    return;
+  fc->seen[idx / 8] |= (1 << (idx % 8));
+  fc->count++;
+}
+
+/**
+ * DOODLE_tree_count for frozen trees.
+ * @return -1 on error, otherwise the number of files
+ */
+static int frozenCount(SuffixTree * tree,
+		       const char * substring) {
+  const FrozenTree * ft;
+  FrozenCount fc;
+  unsigned int node;
+
+  ft = tree->frozen;
+  if (ft->fm != NULL)
+    return fmSearch(tree,
+		    substring,
+		    NULL,
+		    NULL);
+  node = frozenFind(ft,
+		    0,
+		    substring);
+  if ( (node == FROZEN_NONE) ||
+       (tree->fnc == 0) )
+    return 0;
+  if (bitGet(&ft->hasAggregate, node))
+    return ft->aggCount[bitRank(&ft->hasAggregate, node)];
+  fc.tree = tree;
+  fc.seen = MALLOC((tree->fnc + 7) / 8);
+  fc.count = 0;
+  if (-1 == frozenIterate(tree,
+			  node,
+			  &frozenCountFile,
+			  &fc))
+    fc.count = -1;
+  free(fc.seen);
+  return fc.count;
+}
+
+/**
+ * Log that an operation is not possible for a frozen database.
+ */
+static void frozenRefuse(SuffixTree * tree,
+			 const char * operation) {
+  tree->log(tree->context,
+	    DOODLE_LOG_CRITICAL,
+	    _("Operation '%s' is not supported for frozen database '%s'.\n"),
+	    operation,
+	    tree->database);
+}
+
+/**
+ * Set up a bit vector of a frozen tree.
+ *
+ * @param off offset of the bits in the mapping, set to the
+ *   offset after the rank directory
+ * @return 0 on success, -1 if the mapping is too small
+ */
+static int frozenBits(FrozenTree * ft,
+		      FrozenBits * fb,
+		      size_t * off,
+		      unsigned int size) {
+  size_t len;
+
+  fb->size = size;
+  len = sizeof(unsigned long long) * (((size_t) size + 63) / 64);
+  if (len > ft->mapSize - *off)
+    return -1;
+  fb->bits = (const unsigned long long *) ((const char *) ft->map + *off);
+  *off += len;
+  len = sizeof(unsigned int) * (size / FROZEN_RANK_BLOCK + 1);
+  if (len > ft->mapSize - *off)
+    return -1;
+  fb->rank = (const unsigned int *) ((const char *) ft->map + *off);
+  *off = (*off + len + 7) & ~((size_t) 7);
+  return 0;
+}
+
+/**
+ * Get an array of a frozen tree from the mapping.
+ *
+ * @param off offset of the array, set to the offset after it
+ * @return NULL if the mapping is too small
+ */
+static const void * frozenArray(FrozenTree * ft,
+				size_t * off,
+				size_t len) {
+  const void * ret;
+
+  if ( (*off > ft->mapSize) ||
+       (len > ft->mapSize - *off) )
+    return NULL;
+  ret = (const char *) ft->map + *off;
+  *off = (*off + len + 7) & ~((size_t) 7);
+  return ret;
+}
+
+static void frozenFree(SuffixTree * tree) {
+  if (tree->frozen == NULL)
+    return;
+  munmap(tree->frozen->map,
+	 tree->frozen->mapSize);
+  if (tree->frozen->fm != NULL)
+    free(tree->frozen->fm);
+  free(tree->frozen);
+  tree->frozen = NULL;
+}
+
+/**
+ * Read a frozen database (after the magic code).
+ *
+ * @param fm is the database an FM index (see fmLoad)?
+ * @return 0 on success, -1 on error (nothing allocated)
+ */
+static int frozenLoad(SuffixTree * tree,
+		      BIO * fd,
+		      int fm) {
+  FrozenTree * ft;
+  const unsigned int * header;
+  unsigned int dbflags;
+  unsigned int i;
+  size_t off;
+
+  if (-1 == READUINT(fd,
+		     &tree->fnc))
+    return -1;
+  if (tree->fnc != 0)
+    GROW(tree->filenames,
+	 tree->fns,
+	 tree->fnc);
+  for (i=0;i<tree->fnc;i++) {
+    tree->filenames[i].filename = readZT(fd);
+    if ( (tree->filenames[i].filename == NULL) ||
+	 (-1 == READUINT(fd,
+			 &tree->filenames[i].mod_time)) )
+      goto ERROR_ABORT;
+  }
+  if (-1 == READUINT(fd,
+		     &dbflags))
+    goto ERROR_ABORT;
+  tree->fold = ((dbflags & DB_FLAG_CASE_FOLDED) != 0) ? 1 : 0;
+  ft = MALLOC(sizeof(FrozenTree));
+  tree->frozen = ft;
+  ft->mapSize = fd->fsize;
+  ft->map = mmap(NULL,
+		 ft->mapSize,
+		 PROT_READ,
+		 MAP_SHARED,
+		 fd->fd,
+		 0);
+  if (ft->map == MAP_FAILED) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Call to '%s' for file '%s' failed: %s\n"),
+	      "mmap",
+	      tree->database,
+	      strerror(errno));
+    free(ft);
+    tree->frozen = NULL;
+    goto ERROR_ABORT;
+  }
+  off = (LSEEK(fd, 0, SEEK_CUR) + 7) & ~((unsigned long long) 7);
+  if (fm) {
+    if (-1 == fmLoad(tree,
+		     &off))
+      goto FORMAT_ERROR;
+    return 0;
+  }
+  header = frozenArray(ft,
+		       &off,
+		       sizeof(unsigned int) * FROZEN_HEADER_SIZE);
+  if ( (header == NULL) ||
+       (header[0] != FROZEN_BYTE_ORDER) ) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Frozen database '%s' was created on a different kind of machine.\n"),
+	      tree->database);
+    goto FORMAT_ERROR;
+  }
+  ft->nodes = header[1];
+  if ( (ft->nodes < FROZEN_ROOTS) ||
+       (ft->nodes > 0x7FFFFFFF) ||
+       (header[2] != 2 * ft->nodes - FROZEN_ROOTS) ||
+       (-1 == frozenBits(ft, &ft->louds, &off, header[2])) ||
+       (NULL == (ft->first = frozenArray(ft, &off, ft->nodes))) ||
+       (-1 == frozenBits(ft, &ft->longLabels, &off, ft->nodes)) ||
+       (NULL == (ft->labelOff = frozenArray(ft, &off, sizeof(unsigned int) * (size_t) header[3]))) ||
+       (-1 == frozenBits(ft, &ft->hasMatches, &off, ft->nodes)) ||
+       (NULL == (ft->matchOff = frozenArray(ft, &off, sizeof(unsigned int) * (size_t) header[5]))) ||
+       (-1 == frozenBits(ft, &ft->hasAggregate, &off, ft->nodes)) ||
+       (NULL == (ft->aggCount = frozenArray(ft, &off, sizeof(unsigned int) * (size_t) header[7]))) ||
+       (NULL == (ft->labels = frozenArray(ft, &off, header[4]))) ||
+       (NULL == (ft->matches = frozenArray(ft, &off, header[6]))) )
+    goto FORMAT_ERROR;
+  ft->matchesEnd = &ft->matches[header[6]];
+  /* the ranks index the arrays; check that they match */
+  if ( (bitRank(&ft->louds, ft->louds.size) != ft->nodes - FROZEN_ROOTS) ||
+       (bitRank(&ft->longLabels, ft->nodes) != header[3]) ||
+       (bitRank(&ft->hasMatches, ft->nodes) != header[5]) ||
+       (bitRank(&ft->hasAggregate, ft->nodes) != header[7]) )
+    goto FORMAT_ERROR;
+  for (i=0;i<header[3];i++)
+    if ( (ft->labelOff[i] >= header[4]) ||
+	 (ft->labels[ft->labelOff[i]] >= header[4] - ft->labelOff[i]) )
+      goto FORMAT_ERROR;
+  for (i=0;i<header[5];i++)
+    if (ft->matchOff[i] >= header[6])
+      goto FORMAT_ERROR;
+  return 0;
+ FORMAT_ERROR:
+  tree->log(tree->context,
+	    DOODLE_LOG_CRITICAL,
+	    _("Assertion failed at %s:%d.\nDatabase format error!\n"),
+	    __FILE__, __LINE__);
+  frozenFree(tree);
+ ERROR_ABORT:
+  for (i=0;i<tree->fnc;i++)
+    if (tree->filenames[i].filename != NULL)
+      free(tree->filenames[i].filename);
+  GROW(tree->filenames,
+       tree->fns,
+       0);
+  tree->fnc = 0;
+  return -1;
+}
+
+/**
+ * @brief the arrays of a frozen tree while it is built
+ */
+typedef struct {
+  /* offset of the first child group of each node in the
+     database (0 for none) */
+  unsigned long long * childOff;
+  /* first character of the label of each node */
+  unsigned char * first;
+  /* number of entries used in childOff and first */
+  unsigned int nodes;
+  /* number of entries allocated in childOff */
+  unsigned int childOffSize;
+  /* number of entries allocated in first */
+  unsigned int firstSize;
+  /* the bit vectors (see FrozenTree) */
+  unsigned long long * louds;
+  unsigned int loudsSize;
+  unsigned int loudsBits;
+  unsigned long long * longLabels;
+  unsigned int longLabelsSize;
+  unsigned long long * hasMatches;
+  unsigned int hasMatchesSize;
+  unsigned long long * hasAggregate;
+  unsigned int hasAggregateSize;
+  /* the arrays indexed by rank (see FrozenTree) */
+  unsigned int * labelOff;
+  unsigned int labelOffSize;
+  unsigned int labelCount;
+  unsigned int * matchOff;
+  unsigned int matchOffSize;
+  unsigned int matchCount;
+  unsigned int * aggCount;
+  unsigned int aggCountSize;
+  unsigned int aggCountCount;
+  unsigned char * labels;
+  unsigned int labelsSize;
+  unsigned int labelsLen;
+  unsigned char * matches;
+  unsigned int matchesSize;
+  unsigned int matchesLen;
+} FreezeState;
+
+static void freezeSetBit(unsigned long long ** bits,
+			 unsigned int * size,
+			 unsigned int pos) {
+  if (pos / 64 >= *size)
+    GROW(*bits,
+	 *size,
+	 pos / 64 + 1 + *size);
+  (*bits)[pos / 64] |= 1ULL << (pos % 64);
+}
+
+static void freezeAppend(unsigned int ** arr,
+			 unsigned int * size,
+			 unsigned int * count,
+			 unsigned int value) {
+  if (*count == *size)
+    GROW(*arr,
+	 *size,
+	 *size * 2 + 64);
+  (*arr)[(*count)++] = value;
+}
+
+/**
+ * Append to a byte array of a frozen tree.
+ * @return 0 on success, -1 if the array would be too large
+ */
+static int freezeBytes(unsigned char ** arr,
+		       unsigned int * size,
+		       unsigned int * len,
+		       const void * data,
+		       unsigned int count) {
+  unsigned int nsize;
+
+  if (*len > 0x7FFFFFFF - count)
+    return -1;
+  if (*len + count > *size) {
+    nsize = *size * 2 + 1024;
+    if (nsize < *len + count)
+      nsize = *len + count;
+    GROW(*arr,
+	 *size,
+	 nsize);
+  }
+  memcpy(&(*arr)[*len],
+	 data,
+	 count);
+  *len += count;
+  return 0;
+}
+
+static int freezeVarint(FreezeState * fs,
+			unsigned int value) {
+  unsigned char buf[5];
+  unsigned int n;
+
+  n = 0;
+  while (value >= 128) {
+    buf[n++] = (unsigned char) (128 | (value & 127));
+    value >>= 7;
+  }
+  buf[n++] = (unsigned char) value;
+  return freezeBytes(&fs->matches,
+		     &fs->matchesSize,
+		     &fs->matchesLen,
+		     buf,
+		     n);
+}
+
+/**
+ * Add a node of the tree to the frozen tree.
+ * @return 0 on success, -1 if the frozen tree would be too large
+ */
+static int freezeNode(FreezeState * fs,
+		      const STNode * node) {
+  unsigned int * ids;
+  unsigned int id;
+  unsigned int i;
+  unsigned char len;
+
+  if (fs->nodes == 0x7FFFFFFF)
+    return -1;
+  if (fs->nodes == fs->childOffSize) {
+    GROW(fs->childOff,
+	 fs->childOffSize,
+	 fs->nodes * 2 + 1024);
+    GROW(fs->first,
+	 fs->firstSize,
+	 fs->nodes * 2 + 1024);
+  }
+  id = fs->nodes++;
+  fs->childOff[id] = node->next_off;
+  fs->first[id] = (unsigned char) node->c[0];
+  if (node->clength > 1) {
+    freezeSetBit(&fs->longLabels,
+		 &fs->longLabelsSize,
+		 id);
+    freezeAppend(&fs->labelOff,
+		 &fs->labelOffSize,
+		 &fs->labelCount,
+		 fs->labelsLen);
+    len = node->clength - 1;
+    if ( (-1 == freezeBytes(&fs->labels,
+			    &fs->labelsSize,
+			    &fs->labelsLen,
+			    &len,
+			    1)) ||
+	 (-1 == freezeBytes(&fs->labels,
+			    &fs->labelsSize,
+			    &fs->labelsLen,
+			    &node->c[1],
+			    len)) )
+      return -1;
+  }
+  if (node->matchCount > 0) {
+    freezeSetBit(&fs->hasMatches,
+		 &fs->hasMatchesSize,
+		 id);
+    freezeAppend(&fs->matchOff,
+		 &fs->matchOffSize,
+		 &fs->matchCount,
+		 fs->matchesLen);
+    ids = MALLOC(sizeof(unsigned int) * node->matchCount);
+    memcpy(ids,
+	   node->matches,
+	   sizeof(unsigned int) * node->matchCount);
+    qsort(ids,
+	  node->matchCount,
+	  sizeof(unsigned int),
+	  &compareFileIndex);
+    if (-1 == freezeVarint(fs,
+			   node->matchCount)) {
+      free(ids);
+      return -1;
+    }
+    for (i=0;i<node->matchCount;i++)
+      if (-1 == freezeVarint(fs,
+			     ids[i] - ((i == 0) ? 0 : ids[i-1]))) {
+	free(ids);
+	return -1;
+      }
+    free(ids);
+  }
+  if (node->aggCount >= AGGREGATE_THRESHOLD) {
+    freezeSetBit(&fs->hasAggregate,
+		 &fs->hasAggregateSize,
+		 id);
+    freezeAppend(&fs->aggCount,
+		 &fs->aggCountSize,
+		 &fs->aggCountCount,
+		 node->aggCount);
+  }
+  return 0;
+}
+
+/**
+ * Add the children of a node (the chain of groups starting at
+ * the given offset in the database) to the frozen tree.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int freezeChildren(SuffixTree * tree,
+			  FreezeState * fs,
+			  unsigned long long off) {
+  STNode * group;
+  int mls;
+  int prev;
+
+  prev = -1;
+  while (off != 0) {
+    group = lazyReadNode(tree,
+			 off);
+    if (group == NULL)
+      return -1;
+    for (mls=0;mls<group->mls_size;mls++) {
+      /* the binary search in frozenFind needs sorted siblings */
+      if ( (prev != -1) &&
+	   ((char) prev >= group[mls].c[0]) ) {
+	tree->log(tree->context,
+		  DOODLE_LOG_CRITICAL,
+		  _("Assertion failed at %s:%d.\nDatabase format error!\n"),
+		  __FILE__, __LINE__);
+	freeNode(tree, group);
+	return -1;
+      }
+      prev = (unsigned char) group[mls].c[0];
+      freezeSetBit(&fs->louds,
+		   &fs->loudsSize,
+		   fs->loudsBits++);
+      if (-1 == freezeNode(fs,
+			   &group[mls])) {
+	tree->log(tree->context,
+		  DOODLE_LOG_CRITICAL,
+		  _("Database '%s' is too large to be frozen.\n"),
+		  tree->database);
+	freeNode(tree, group);
+	return -1;
+      }
+    }
+    off = group[group->mls_size-1].link_off;
+    freeNode(tree, group);
+  }
+  /* the 0-bit that ends the children of the node */
+  fs->loudsBits++;
+  return 0;
+}
+
+static void freezePad(BIO * fd) {
+  static const char zeros[8];
+  unsigned long long off;
+
+  off = LSEEK(fd, 0, SEEK_CUR);
+  if ((off % 8) != 0)
+    WRITEALL(fd,
+	     zeros,
+	     8 - (off % 8));
+}
+
+/**
+ * Write a bit vector with its rank directory (see frozenBits).
+ */
+static void freezeWriteBits(BIO * fd,
+			    unsigned long long ** bits,
+			    unsigned int * words,
+			    unsigned int size) {
+  unsigned int * rank;
+  unsigned int count;
+  unsigned int ones;
+  unsigned int w;
+
+  if (*words < (size + 63) / 64)
+    GROW(*bits,
+	 *words,
+	 (size + 63) / 64);
+  WRITEALL(fd,
+	   *bits,
+	   sizeof(unsigned long long) * ((size + 63) / 64));
+  count = size / FROZEN_RANK_BLOCK + 1;
+  rank = MALLOC(sizeof(unsigned int) * count);
+  ones = 0;
+  for (w=0;w<(size + 63) / 64;w++) {
+    if ((w % (FROZEN_RANK_BLOCK / 64)) == 0)
+      rank[w / (FROZEN_RANK_BLOCK / 64)] = ones;
+    ones += bitCount((*bits)[w]);
+  }
+  if ((size % FROZEN_RANK_BLOCK) == 0)
+    rank[count-1] = ones;
+  WRITEALL(fd,
+	   rank,
+	   sizeof(unsigned int) * count);
+  free(rank);
+  freezePad(fd);
+}
+
+static void freezeWriteArray(BIO * fd,
+			     const void * data,
+			     unsigned long long len) {
+  if (len > 0)
+    WRITEALL(fd,
+	     data,
+	     len);
+  freezePad(fd);
+}
+
+static void freezeStateFree(FreezeState * fs) {
+  GROW(fs->childOff,
+       fs->childOffSize,
+       0);
+  GROW(fs->first,
+       fs->firstSize,
+       0);
+  if (fs->louds != NULL)
+    free(fs->louds);
+  if (fs->longLabels != NULL)
+    free(fs->longLabels);
+  if (fs->hasMatches != NULL)
+    free(fs->hasMatches);
+  if (fs->hasAggregate != NULL)
+    free(fs->hasAggregate);
+  if (fs->labelOff != NULL)
+    free(fs->labelOff);
+  if (fs->matchOff != NULL)
+    free(fs->matchOff);
+  if (fs->aggCount != NULL)
+    free(fs->aggCount);
+  if (fs->labels != NULL)
+    free(fs->labels);
+  if (fs->matches != NULL)
+    free(fs->matches);
+}
+
+/**
+ * Check that a frozen copy of the tree can be written.
+ * @return 0 if so, -1 if not
+ */
+static int freezeCheck(SuffixTree * tree,
+		       const char * operation) {
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 operation);
+    return -1;
+  }
+  if ( (tree->read_only == 0) ||
+       (tree->modified != 0) ||
+       (tree->fd == NULL) ) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Only unmodified databases opened read-only can be frozen.\n"));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Create the temporary file for a frozen copy of the tree and
+ * write everything up to the arrays (magic code, files and
+ * flags, see frozenLoad).
+ *
+ * @param tname set to the name of the temporary file
+ * @return NULL on error
+ */
+static BIO * freezeCreate(SuffixTree * tree,
+			  const char * filename,
+			  const char * magic,
+			  char ** tname) {
+  BIO * fd;
+  unsigned int i;
+  int fdt;
+
+  *tname = MALLOC(strlen(filename) + 2);
+  strcpy(*tname,
+	 filename);
+  strcat(*tname,
+	 "~");
+#ifdef O_LARGEFILE
+  fdt = open(*tname,
+	     O_CREAT | O_TRUNC | O_RDWR | O_LARGEFILE,
+	     S_IRUSR | S_IWUSR | S_IRGRP);
+#else
+  fdt = open(*tname,
+	     O_CREAT | O_TRUNC | O_RDWR,
+	     S_IRUSR | S_IWUSR | S_IRGRP);
+#endif
+  if (fdt == -1) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Could not open temporary file '%s': %s\n"),
+	      *tname,
+	      strerror(errno));
+    free(*tname);
+    *tname = NULL;
+    return NULL;
+  }
+  fd = IO_WRAP(tree->log,
+	       tree->context,
+	       fdt);
+  WRITEALL(fd,
+	   magic,
+	   8);
+  WRITEUINT(fd,
+	    tree->fnc);
+  for (i=0;i<tree->fnc;i++) {
+    writeZT(fd,
+	    tree->filenames[i].filename);
+    WRITEUINT(fd,
+	      tree->filenames[i].mod_time);
+  }
+  WRITEUINT(fd,
+	    (tree->fold != 0) ? DB_FLAG_CASE_FOLDED : 0);
+  freezePad(fd);
+  return fd;
+}
+
+/**
+ * Close the temporary file of a frozen copy of the tree and
+ * move it to its final name.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int freezeCommit(SuffixTree * tree,
+			BIO * fd,
+			char * tname,
+			const char * filename) {
+  IO_FREE(fd);
+  if (0 != rename(tname,
+		  filename)) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Could not rename temporary file '%s' to '%s: %s\n"),
+	      tname,
+	      filename,
+	      strerror(errno));
+    free(tname);
+    return -1;
+  }
+  free(tname);
+  return 0;
+}
+
+/**
+ * Write a frozen copy of the database: a compact, read-only
+ * representation that is searched directly from a mapping of
+ * the file (opened with DOODLE_tree_open_RDONLY).  Only
+ * possible for unmodified trees opened read-only.
+ *
+ * @param filename name of the frozen database
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_freeze(SuffixTree * tree,
+		       const char * filename) {
+  FreezeState fs;
+  STNode root;
+  BIO * fd;
+  char * tname;
+  unsigned int header[FROZEN_HEADER_SIZE];
+  unsigned int node;
+  unsigned int i;
+
+  if (-1 == freezeCheck(tree,
+			"freeze"))
+    return -1;
+  memset(&fs, 0, sizeof(FreezeState));
+  /* the virtual roots */
+  memset(&root, 0, sizeof(STNode));
+  root.c = "";
+  root.clength = 1;
+  for (i=0;i<FROZEN_ROOTS;i++)
+    freezeNode(&fs,
+	       &root);
+  fs.childOff[0] = (tree->root != NULL) ? tree->root->pos : 0;
+  fs.childOff[1] = (tree->froot != NULL) ? tree->froot->pos : 0;
+  /* level order: the children of each node are added
+     after all nodes that are already there */
+  for (node=0;node<fs.nodes;node++)
+    if (-1 == freezeChildren(tree,
+			     &fs,
+			     fs.childOff[node])) {
+      freezeStateFree(&fs);
+      return -1;
+    }
+
+  fd = freezeCreate(tree,
+		    filename,
+		    FROZEN_MAGIC,
+		    &tname);
+  if (fd == NULL) {
+    freezeStateFree(&fs);
+    return -1;
+  }
+  header[0] = FROZEN_BYTE_ORDER;
+  header[1] = fs.nodes;
+  header[2] = fs.loudsBits;
+  header[3] = fs.labelCount;
+  header[4] = fs.labelsLen;
+  header[5] = fs.matchCount;
+  header[6] = fs.matchesLen;
+  header[7] = fs.aggCountCount;
+  freezeWriteArray(fd,
+		   header,
+		   sizeof(header));
+  freezeWriteBits(fd,
+		  &fs.louds,
+		  &fs.loudsSize,
+		  fs.loudsBits);
+  freezeWriteArray(fd,
+		   fs.first,
+		   fs.nodes);
+  freezeWriteBits(fd,
+		  &fs.longLabels,
+		  &fs.longLabelsSize,
+		  fs.nodes);
+  freezeWriteArray(fd,
+		   fs.labelOff,
+		   sizeof(unsigned int) * (unsigned long long) fs.labelCount);
+  freezeWriteBits(fd,
+		  &fs.hasMatches,
+		  &fs.hasMatchesSize,
+		  fs.nodes);
+  freezeWriteArray(fd,
+		   fs.matchOff,
+		   sizeof(unsigned int) * (unsigned long long) fs.matchCount);
+  freezeWriteBits(fd,
+		  &fs.hasAggregate,
+		  &fs.hasAggregateSize,
+		  fs.nodes);
+  freezeWriteArray(fd,
+		   fs.aggCount,
+		   sizeof(unsigned int) * (unsigned long long) fs.aggCountCount);
+  freezeWriteArray(fd,
+		   fs.labels,
+		   fs.labelsLen);
+  freezeWriteArray(fd,
+		   fs.matches,
+		   fs.matchesLen);
+  freezeStateFree(&fs);
+  return freezeCommit(tree,
+		      fd,
+		      tname,
+		      filename);
+}
+
+/* ******************** FM index ********************** */
+
+/**
+ * An FM index is a second layout of a frozen database (see
+ * DOODLE_tree_build_fm_index).  Instead of the tree it stores
+ * the Burrows-Wheeler transform (BWT) of a text that contains
+ * the keywords of each file (each followed by a 0-byte), with
+ * the keywords of a file next to each other.  The rows of the
+ * BWT are the suffixes of the text in sorted order, preceded by
+ * the empty suffix.  A backward search finds the rows that start
+ * with a string in one step per character; the rows are mapped
+ * to positions in the text (and thus to files) by walking back
+ * in the text until a position is reached that is stored in the
+ * samples of the suffix array.  Since every suffix of a keyword
+ * is in the tree, a string is in the tree exactly if it occurs
+ * in the text of the file, so the searches find the same files
+ * as in the tree; each file is reported once.
+ */
+
+/**
+ * Number of entries in the header that precedes the arrays of
+ * an FM index.
+ */
+#define FM_HEADER_SIZE 8
+
+/**
+ * Code of the characters that do not occur in the text.
+ */
+#define FM_NO_CODE 0xFFFF
+
+/**
+ * Text position that stands for "not found".
+ */
+#define FM_NONE 0xFFFFFFFF
+
+/**
+ * @brief the arrays of an FM index
+ */
+typedef struct FMIndex {
+  /* length of the text (the number of rows is one more) */
+  unsigned int length;
+  /* row of the whole text (its BWT character is the virtual
+     end marker, stored as 0) */
+  unsigned int primary;
+  /* number of distinct characters in the text */
+  unsigned int sigma;
+  /* number of rows per block of occ (FM_OCC_BLOCK at the time
+     the index was built) */
+  unsigned int occBlock;
+  /* distance of the sampled text positions (FM_SAMPLE_RATE at
+     the time the index was built) */
+  unsigned int sampleRate;
+  /* dense code of each character (FM_NO_CODE if it does not
+     occur in the text) */
+  const unsigned short * code;
+  /* for each character, one (the end marker) plus the number of
+     characters in the text that are smaller (257 entries) */
+  const unsigned int * smaller;
+  /* for each block of rows and each code, the number of
+     occurrences of the character in the BWT before the block */
+  const unsigned int * occ;
+  /* the BWT, one character per row */
+  const unsigned char * bwt;
+  /* marks the rows whose text position is sampled */
+  FrozenBits sampled;
+  /* text position divided by sampleRate for each sampled row */
+  const unsigned int * samples;
+  /* offset of the keywords of each file in the text, followed
+     by the length of the text (fnc + 1 entries) */
+  const unsigned int * fileStart;
+} FMIndex;
+
+/**
+ * @return number of occurrences of c in the BWT before row
+ */
+static unsigned int fmOcc(const FMIndex * fm,
+			  unsigned char c,
+			  unsigned int row) {
+  unsigned int start;
+  unsigned int ret;
+  unsigned int i;
+
+  start = row - (row % fm->occBlock);
+  ret = fm->occ[(size_t) (row / fm->occBlock) * fm->sigma + fm->code[c]];
+  for (i=start;i<row;i++)
+    if (fm->bwt[i] == c)
+      ret++;
+  /* the end marker is stored as 0 but not counted */
+  if ( (c == 0) &&
+       (fm->primary >= start) &&
+       (fm->primary < row) )
+    ret--;
+  return ret;
+}
+
+/**
+ * Find the rows of the suffixes that start with a string.
+ *
+ * @param lo set to the first row
+ * @param hi set to the row after the last row
+ * @return 0 if the string does not occur, 1 if it does
+ */
+static int fmRange(const FMIndex * fm,
+		   const char * substring,
+		   unsigned int * lo,
+		   unsigned int * hi) {
+  unsigned int len;
+  unsigned char c;
+
+  *lo = 0;
+  *hi = fm->length + 1;
+  len = strlen(substring);
+  while (len > 0) {
+    c = (unsigned char) substring[--len];
+    if (fm->code[c] == FM_NO_CODE)
+      return 0;
+    *lo = fm->smaller[c] + fmOcc(fm, c, *lo);
+    *hi = fm->smaller[c] + fmOcc(fm, c, *hi);
+    if (*lo >= *hi)
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * @return text position of the suffix in a row, FM_NONE if the
+ *   index is corrupt
+ */
+static unsigned int fmLocate(const FMIndex * fm,
+			     unsigned int row) {
+  unsigned int steps;
+  unsigned char c;
+
+  steps = 0;
+  while (! bitGet(&fm->sampled, row)) {
+    c = fm->bwt[row];
+    if ( (fm->code[c] == FM_NO_CODE) ||
+	 (++steps >= fm->sampleRate) )
+      return FM_NONE;
+    row = fm->smaller[c] + fmOcc(fm, c, row);
+    if (row > fm->length)
+      return FM_NONE;
+  }
+  return fm->samples[bitRank(&fm->sampled, row)] * fm->sampleRate + steps;
+}
+
+/**
+ * @return index into tree->filenames of the file whose keywords
+ *   contain the given text position
+ */
+static unsigned int fmFile(const FMIndex * fm,
+			   unsigned int fnc,
+			   unsigned int pos) {
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+
+  /* last file that starts at or before pos (files without
+     keywords start where the next file starts) */
+  lo = 0;
+  hi = fnc;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (fm->fileStart[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Exact search in an FM index.  Each file is reported once.
+ *
+ * @param callback may be NULL to only count the files
+ * @return -1 on error, otherwise the number of files
+ */
+static int fmSearch(SuffixTree * tree,
+		    const char * substring,
+		    DOODLE_ResultCallback callback,
+		    void * arg) {
+  const FMIndex * fm;
+  unsigned char * seen;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int row;
+  unsigned int pos;
+  unsigned int idx;
+  int ret;
+
+  fm = tree->frozen->fm;
+  if ( (substring[0] == '\0') ||
+       (tree->fnc == 0) ||
+       (! fmRange(fm,
+		  substring,
+		  &lo,
+		  &hi)) )
+    return 0;
+  seen = MALLOC((tree->fnc + 7) / 8);
+  ret = 0;
+  for (row=lo;row<hi;row++) {
+    if (limitReached(tree))
+      break;
+    pos = fmLocate(fm,
+		   row);
+    if (pos >= fm->length) {
+      tree->log(tree->context,
+		DOODLE_LOG_CRITICAL,
+		_("Assertion failed at %s:%d.\nDatabase format error!\n"),
+		__FILE__, __LINE__);
+      ret = -1;
+      break;
+    }
+    idx = fmFile(fm,
+		 tree->fnc,
+		 pos);
+    if ((seen[idx / 8] & (1 << (idx % 8))) != 0)
+      continue;
+    seen[idx / 8] |= (1 << (idx % 8));
+    ret++;
+    if (callback != NULL)
+      callback(&tree->filenames[idx],
+	       arg);
+  }
+  free(seen);
+  return ret;
+}
+
+/**
+ * Read the arrays of an FM index from the mapping (see
+ * frozenLoad, which logs the errors).
+ *
+ * @param off offset of the header in the mapping
+ * @return 0 on success, -1 on error
+ */
+static int fmLoad(SuffixTree * tree,
+		  size_t * off) {
+  FrozenTree * ft;
+  FMIndex * fm;
+  const unsigned int * header;
+  unsigned int i;
+
+  ft = tree->frozen;
+  header = frozenArray(ft,
+		       off,
+		       sizeof(unsigned int) * FM_HEADER_SIZE);
+  if ( (header == NULL) ||
+       (header[0] != FROZEN_BYTE_ORDER) ) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Frozen database '%s' was created on a different kind of machine.\n"),
+	      tree->database);
+    return -1;
+  }
+  fm = MALLOC(sizeof(FMIndex));
+  ft->fm = fm;
+  fm->length = header[1];
+  fm->primary = header[2];
+  fm->sigma = header[3];
+  fm->occBlock = header[4];
+  fm->sampleRate = header[5];
+  if ( (fm->length > 0x7FFFFFF0) ||
+       (fm->primary > fm->length) ||
+       (fm->sigma > 256) ||
+       (fm->occBlock == 0) ||
+       (fm->sampleRate == 0) ||
+       (NULL == (fm->code = frozenArray(ft, off, sizeof(unsigned short) * 256))) ||
+       (NULL == (fm->smaller = frozenArray(ft, off, sizeof(unsigned int) * 257))) ||
+       (NULL == (fm->occ = frozenArray(ft, off, sizeof(unsigned int) * ((size_t) (fm->length + 1) / fm->occBlock + 1) * fm->sigma))) ||
+       (NULL == (fm->bwt = frozenArray(ft, off, (size_t) fm->length + 1))) ||
+       (-1 == frozenBits(ft, &fm->sampled, off, fm->length + 1)) ||
+       (NULL == (fm->samples = frozenArray(ft, off, sizeof(unsigned int) * (size_t) header[6]))) ||
+       (NULL == (fm->fileStart = frozenArray(ft, off, sizeof(unsigned int) * ((size_t) tree->fnc + 1)))) ||
+       (bitRank(&fm->sampled, fm->length + 1) != header[6]) ||
+       (fm->smaller[256] != fm->length + 1) ||
+       (fm->fileStart[tree->fnc] != fm->length) )
+    return -1;
+  for (i=0;i<256;i++)
+    if ( ( (fm->code[i] != FM_NO_CODE) &&
+	   (fm->code[i] >= fm->sigma) ) ||
+	 (fm->smaller[i] > fm->smaller[i+1]) )
+      return -1;
+  for (i=0;i<tree->fnc;i++)
+    if (fm->fileStart[i] > fm->fileStart[i+1])
+      return -1;
+  for (i=0;i<header[6];i++)
+    if (fm->samples[i] > fm->length / fm->sampleRate)
+      return -1;
+  return 0;
+}
+
+/**
+ * @brief a string of the tree and a file that it belongs to
+ *  (while an FM index is built)
+ */
+typedef struct {
+  /* the string (not 0-terminated) */
+  const char * str;
+  /* offset of the string in FMBuild.strings (until str is set) */
+  unsigned int off;
+  /* length of the string */
+  unsigned int len;
+  /* index into tree->filenames */
+  unsigned int file;
+} FMKey;
+
+/**
+ * @brief the strings of the tree while an FM index is built
+ */
+typedef struct {
+  FMKey * keys;
+  unsigned int keySize;
+  unsigned int keyCount;
+  /* the characters of all strings with matches */
+  unsigned char * strings;
+  unsigned int stringsSize;
+  unsigned int stringsLen;
+  /* the string of the current node */
+  char * path;
+  unsigned int pathSize;
+} FMBuild;
+
+/**
+ * Order the strings by file, and the strings of a file by their
+ * reversed characters (so that the strings that end with a
+ * string follow it directly).
+ */
+static int fmCompareKeys(const void * a,
+			 const void * b) {
+  const FMKey * ka = a;
+  const FMKey * kb = b;
+  unsigned int i;
+
+  if (ka->file != kb->file)
+    return (ka->file < kb->file) ? -1 : 1;
+  for (i=1;(i<=ka->len) && (i<=kb->len);i++)
+    if (ka->str[ka->len-i] != kb->str[kb->len-i])
+      return ((unsigned char) ka->str[ka->len-i] <
+	      (unsigned char) kb->str[kb->len-i]) ? -1 : 1;
+  if (ka->len == kb->len)
+    return 0;
+  return (ka->len < kb->len) ? -1 : 1;
+}
+
+/**
+ * Collect the strings with matches of the nodes in the chain
+ * of groups starting at the given offset in the database and
+ * of everything below them.
+ *
+ * @param depth length of the string of the parent node
+ * @return 0 on success, -1 on error
+ */
+static int fmCollect(SuffixTree * tree,
+		     FMBuild * fb,
+		     unsigned long long off,
+		     unsigned int depth) {
+  STNode * group;
+  STNode * node;
+  unsigned int len;
+  unsigned int i;
+  int mls;
+
+  while (off != 0) {
+    group = lazyReadNode(tree,
+			 off);
+    if (group == NULL)
+      return -1;
+    for (mls=0;mls<group->mls_size;mls++) {
+      node = &group[mls];
+      /* empty (mls) entries are not part of any keyword */
+      if ( (node->matchCount == 0) &&
+	   (node->next_off == 0) )
+	continue;
+      len = depth + node->clength;
+      if (len > fb->pathSize)
+	GROW(fb->path,
+	     fb->pathSize,
+	     len * 2);
+      memcpy(&fb->path[depth],
+	     node->c,
+	     node->clength);
+      if (node->matchCount > 0) {
+	if ( (fb->keyCount > 0xFFFFFFFF - node->matchCount) ||
+	     (-1 == freezeBytes(&fb->strings,
+				&fb->stringsSize,
+				&fb->stringsLen,
+				fb->path,
+				len)) ) {
+	  tree->log(tree->context,
+		    DOODLE_LOG_CRITICAL,
+		    _("Database '%s' is too large to be frozen.\n"),
+		    tree->database);
+	  freeNode(tree, group);
+	  return -1;
+	}
+	for (i=0;i<node->matchCount;i++) {
+	  if (node->matches[i] >= tree->fnc) {
+	    tree->log(tree->context,
+		      DOODLE_LOG_CRITICAL,
+		      _("Assertion failed at %s:%d.\nDatabase format error!\n"),
+		      __FILE__, __LINE__);
+	    freeNode(tree, group);
 	    return -1;
-	iret = tree_search_approx_internal(pos->child,
-					   approx,
-					   ignore_case,
-					   tree,
-					   ss+1,
-					   callback,
-					   arg);
-	if (iret == -1)
+	  }
+	  if (fb->keyCount == fb->keySize)
+	    GROW(fb->keys,
+		 fb->keySize,
+		 fb->keySize * 2 + 1024);
+	  fb->keys[fb->keyCount].off = fb->stringsLen - len;
+	  fb->keys[fb->keyCount].len = len;
+	  fb->keys[fb->keyCount].file = node->matches[i];
+	  fb->keyCount++;
+	}
+      }
+      if (-1 == fmCollect(tree,
+			  fb,
+			  node->next_off,
+			  len)) {
+	freeNode(tree, group);
+	return -1;
+      }
+    }
+    off = group[group->mls_size-1].link_off;
+    freeNode(tree, group);
+  }
+  return 0;
+}
+
+/**
+ * Sort the suffixes of a text (prefix doubling: the suffixes
+ * are sorted by their first k characters, then by the first 2k
+ * characters using the order of the first k characters of the
+ * suffix k positions further, until all are distinct).
+ *
+ * @param n length of the text
+ * @return the text positions in the order of the suffixes,
+ *   starting with n (the empty suffix)
+ */
+static unsigned int * fmSuffixArray(const unsigned char * text,
+				    unsigned int n) {
+  unsigned int * sa;
+  unsigned int * cls;
+  unsigned int * tmp;
+  unsigned int * count;
+  unsigned int * swap;
+  unsigned int classes;
+  unsigned int k;
+  unsigned int i;
+  unsigned int p;
+
+  sa = MALLOC(sizeof(unsigned int) * ((size_t) n + 1));
+  cls = MALLOC(sizeof(unsigned int) * ((size_t) n + 1));
+  tmp = MALLOC(sizeof(unsigned int) * ((size_t) n + 1));
+  count = MALLOC(sizeof(unsigned int) * ((size_t) n + 258));
+  /* sort by the first character, the empty suffix first */
+  for (i=0;i<n;i++)
+    count[text[i] + 1]++;
+  count[0] = 1;
+  for (i=1;i<257;i++)
+    count[i] += count[i-1];
+  sa[--count[0]] = n;
+  for (i=n;i>0;i--)
+    sa[--count[text[i-1] + 1]] = i - 1;
+  classes = 1;
+  cls[sa[0]] = 0;
+  for (i=1;i<=n;i++) {
+    if ( (sa[i-1] == n) ||
+	 (text[sa[i]] != text[sa[i-1]]) )
+      classes++;
+    cls[sa[i]] = classes - 1;
+  }
+  for (k=1;classes <= n;k*=2) {
+    /* order by the class of the suffix k positions further
+       (the suffixes that end before come first) */
+    p = 0;
+    for (i=(k <= n) ? n+1-k : 0;i<=n;i++)
+      tmp[p++] = i;
+    for (i=0;i<=n;i++)
+      if (sa[i] >= k)
+	tmp[p++] = sa[i] - k;
+    /* stable sort by the class of the suffix */
+    memset(count,
+	   0,
+	   sizeof(unsigned int) * classes);
+    for (i=0;i<=n;i++)
+      count[cls[i]]++;
+    for (i=1;i<classes;i++)
+      count[i] += count[i-1];
+    for (i=n+1;i>0;i--)
+      sa[--count[cls[tmp[i-1]]]] = tmp[i-1];
+    /* new classes: equal if both halves are equal */
+    tmp[sa[0]] = 0;
+    classes = 1;
+    for (i=1;i<=n;i++) {
+      if ( (cls[sa[i]] != cls[sa[i-1]]) ||
+	   (sa[i] + k > n) ||
+	   (sa[i-1] + k > n) ||
+	   (cls[sa[i] + k] != cls[sa[i-1] + k]) )
+	classes++;
+      tmp[sa[i]] = classes - 1;
+    }
+    swap = cls;
+    cls = tmp;
+    tmp = swap;
+  }
+  free(count);
+  free(tmp);
+  free(cls);
+  return sa;
+}
+
+/**
+ * Write an FM index of the database: a read-only copy that only
+ * supports exact searches, but needs little more space than the
+ * keywords themselves (opened with DOODLE_tree_open_RDONLY).
+ * Only possible for unmodified trees opened read-only to which
+ * each keyword was added together with all of its suffixes.
+ *
+ * @param filename name of the FM index
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_build_fm_index(SuffixTree * tree,
+			       const char * filename) {
+  FMBuild fb;
+  FMKey probe;
+  BIO * fd;
+  char * tname;
+  unsigned char * text;
+  unsigned char * bwt;
+  unsigned int * sa;
+  unsigned int * fileStart;
+  unsigned int * occ;
+  unsigned int * samples;
+  unsigned long long * sampled;
+  unsigned int header[FM_HEADER_SIZE];
+  unsigned int counts[256];
+  unsigned int smaller[257];
+  unsigned short code[256];
+  unsigned long long length;
+  unsigned int sampledWords;
+  unsigned int sampleCount;
+  unsigned int blocks;
+  unsigned int sigma;
+  unsigned int rows;
+  unsigned int pos;
+  unsigned int i;
+  unsigned int c;
+
+  if (-1 == freezeCheck(tree,
+			"build_fm_index"))
+    return -1;
+  memset(&fb, 0, sizeof(FMBuild));
+  if (-1 == fmCollect(tree,
+		      &fb,
+		      (tree->root != NULL) ? tree->root->pos : 0,
+		      0))
+    goto ERROR_ABORT;
+  for (i=0;i<fb.keyCount;i++)
+    fb.keys[i].str = (const char *) &fb.strings[fb.keys[i].off];
+  if (fb.keyCount > 0)
+    qsort(fb.keys,
+	  fb.keyCount,
+	  sizeof(FMKey),
+	  &fmCompareKeys);
+  /* the text only has the keywords; that is the same as the
+     tree only if the tree has all suffixes of the keywords */
+  for (i=0;i<fb.keyCount;i++) {
+    if (fb.keys[i].len < 2)
+      continue;
+    probe.str = fb.keys[i].str + 1;
+    probe.len = fb.keys[i].len - 1;
+    probe.file = fb.keys[i].file;
+    if (NULL == bsearch(&probe,
+			fb.keys,
+			fb.keyCount,
+			sizeof(FMKey),
+			&fmCompareKeys)) {
+      tree->log(tree->context,
+		DOODLE_LOG_CRITICAL,
+		_("Database '%s' does not contain all suffixes of its keywords, an FM index can not be built.\n"),
+		tree->database);
+      goto ERROR_ABORT;
+    }
+  }
+  /* a string is a keyword unless the next string of the
+     file ends with it */
+  length = 0;
+  for (i=0;i<fb.keyCount;i++) {
+    if ( (i + 1 < fb.keyCount) &&
+	 (fb.keys[i+1].file == fb.keys[i].file) &&
+	 (fb.keys[i+1].len >= fb.keys[i].len) &&
+	 (0 == memcmp(fb.keys[i+1].str + fb.keys[i+1].len - fb.keys[i].len,
+		      fb.keys[i].str,
+		      fb.keys[i].len)) ) {
+      fb.keys[i].len = 0;
+      continue;
+    }
+    length += fb.keys[i].len + 1;
+  }
+  if (length > 0x7FFFFFF0) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Database '%s' is too large to be frozen.\n"),
+	      tree->database);
+    goto ERROR_ABORT;
+  }
+  text = MALLOC(length + 1);
+  fileStart = MALLOC(sizeof(unsigned int) * ((size_t) tree->fnc + 1));
+  pos = 0;
+  c = 0;
+  for (i=0;i<fb.keyCount;i++) {
+    while (c <= fb.keys[i].file)
+      fileStart[c++] = pos;
+    if (fb.keys[i].len == 0)
+      continue;
+    memcpy(&text[pos],
+	   fb.keys[i].str,
+	   fb.keys[i].len);
+    pos += fb.keys[i].len + 1;
+  }
+  while (c <= tree->fnc)
+    fileStart[c++] = pos;
+  GROW(fb.keys,
+       fb.keySize,
+       0);
+  GROW(fb.strings,
+       fb.stringsSize,
+       0);
+  GROW(fb.path,
+       fb.pathSize,
+       0);
+
+  rows = pos + 1;
+  sa = fmSuffixArray(text,
+		     pos);
+  memset(counts, 0, sizeof(counts));
+  for (i=0;i<pos;i++)
+    counts[text[i]]++;
+  sigma = 0;
+  smaller[0] = 1;
+  for (c=0;c<256;c++) {
+    code[c] = (counts[c] > 0) ? sigma++ : FM_NO_CODE;
+    smaller[c+1] = smaller[c] + counts[c];
+  }
+  blocks = rows / FM_OCC_BLOCK + 1;
+  occ = MALLOC(sizeof(unsigned int) * (size_t) blocks * (sigma + 1));
+  bwt = MALLOC(rows);
+  sampledWords = (rows + 63) / 64;
+  sampled = MALLOC(sizeof(unsigned long long) * sampledWords);
+  samples = MALLOC(sizeof(unsigned int) * (rows / FM_SAMPLE_RATE + 2));
+  sampleCount = 0;
+  header[2] = 0;
+  memset(counts, 0, sizeof(counts));
+  for (i=0;i<rows;i++) {
+    if ((i % FM_OCC_BLOCK) == 0)
+      for (c=0;c<256;c++)
+	if (code[c] != FM_NO_CODE)
+	  occ[(size_t) (i / FM_OCC_BLOCK) * sigma + code[c]] = counts[c];
+    if (sa[i] == 0) {
+      header[2] = i;
+      bwt[i] = 0;
+    } else {
+      bwt[i] = text[sa[i] - 1];
+      counts[bwt[i]]++;
+    }
+    if ((sa[i] % FM_SAMPLE_RATE) == 0) {
+      sampled[i / 64] |= 1ULL << (i % 64);
+      samples[sampleCount++] = sa[i] / FM_SAMPLE_RATE;
+    }
+  }
+  if ((rows % FM_OCC_BLOCK) == 0)
+    for (c=0;c<256;c++)
+      if (code[c] != FM_NO_CODE)
+	occ[(size_t) (rows / FM_OCC_BLOCK) * sigma + code[c]] = counts[c];
+  free(sa);
+  free(text);
+
+  fd = freezeCreate(tree,
+		    filename,
+		    FM_MAGIC,
+		    &tname);
+  if (fd != NULL) {
+    header[0] = FROZEN_BYTE_ORDER;
+    header[1] = pos;
+    header[3] = sigma;
+    header[4] = FM_OCC_BLOCK;
+    header[5] = FM_SAMPLE_RATE;
+    header[6] = sampleCount;
+    header[7] = 0;
+    freezeWriteArray(fd,
+		     header,
+		     sizeof(header));
+    freezeWriteArray(fd,
+		     code,
+		     sizeof(code));
+    freezeWriteArray(fd,
+		     smaller,
+		     sizeof(smaller));
+    freezeWriteArray(fd,
+		     occ,
+		     sizeof(unsigned int) * (unsigned long long) blocks * sigma);
+    freezeWriteArray(fd,
+		     bwt,
+		     rows);
+    freezeWriteBits(fd,
+		    &sampled,
+		    &sampledWords,
+		    rows);
+    freezeWriteArray(fd,
+		     samples,
+		     sizeof(unsigned int) * (unsigned long long) sampleCount);
+    freezeWriteArray(fd,
+		     fileStart,
+		     sizeof(unsigned int) * ((unsigned long long) tree->fnc + 1));
+  }
+  free(occ);
+  free(bwt);
+  free(sampled);
+  free(samples);
+  free(fileStart);
+  if (fd == NULL)
+    return -1;
+  return freezeCommit(tree,
+		      fd,
+		      tname,
+		      filename);
+ ERROR_ABORT:
+  GROW(fb.keys,
+       fb.keySize,
+       0);
+  GROW(fb.strings,
+       fb.stringsSize,
+       0);
+  GROW(fb.path,
+       fb.pathSize,
+       0);
+  return -1;
+}
+
+/* ******************** result cache ********************** */
+
+/**
+ * Searches with more results than this are not cached (the
+ * time is then dominated by the client processing the results,
+ * and we do not want to keep huge lists in memory).
+ */
+#define RESULT_CACHE_MAX_RESULTS 65536
+
+/**
+ * @brief results of a recent search
+ */
+typedef struct CacheEntry {
+  /* normalized search string, NULL if the entry is unused */
+  char * query;
+  /* indices into tree->filenames, in the order in which
+     the search reported them (with repetitions) */
+  unsigned int * ids;
+  unsigned int count;
+  unsigned int approx;
+  int ignore_case;
+  /* tree->generation at the time of the search */
+  unsigned int generation;
+  /* tree->cacheClock at the time of the last use */
+  unsigned int lastUse;
+} CacheEntry;
+
+/**
+ * @brief collects the results of a search for the cache
+ */
+typedef struct {
+  SuffixTree * tree;
+  DOODLE_ResultCallback callback;
+  void * arg;
+  unsigned int * ids;
+  unsigned int count;
+  unsigned int size;
+  /* 1 if there were too many results to cache */
+  int overflow;
+} CacheRecorder;
+
+/**
+ * Release all entries of the result cache.
+ */
+static void cacheFlush(SuffixTree * tree) {
+  unsigned int i;
+
+  if (tree->cache == NULL)
+    return;
+  for (i=0;i<tree->cacheSize;i++) {
+    if (tree->cache[i].query == NULL)
+      continue;
+    free(tree->cache[i].query);
+    if (tree->cache[i].ids != NULL)
+      free(tree->cache[i].ids);
+  }
+  free(tree->cache);
+  tree->cache = NULL;
+}
+
+/**
+ * Normalize a search string for use as a key of the cache.
+ * Case-insensitive searches fold the query the way the search
+ * does: with foldCase if the exact search uses the case-folded
+ * tree (see search_approx), otherwise only ASCII characters
+ * are compared without case.
+ *
+ * @return normalized copy of the query (caller must free)
+ */
+static char * cacheKey(SuffixTree * tree,
+		       const char * query,
+		       unsigned int approx,
+		       int ignore_case) {
+  char * key;
+  int i;
+
+  if ( (approx == 0) &&
+       (ignore_case != 0) &&
+       (tree->fold != 0) )
+    return foldCase(query);
+  key = STRDUP(query);
+  if (ignore_case != 0)
+    for (i=0;key[i]!='\0';i++)
+      if ( (key[i] >= 'A') && (key[i] <= 'Z') )
+	key[i] = key[i] - 'A' + 'a';
+  return key;
+}
+
+/**
+ * Report the results of a search from the cache (if present).
+ *
+ * @return -1 if the results are not in the cache, otherwise
+ *   the number of results
+ */
+static int cacheLookup(SuffixTree * tree,
+		       const char * key,
+		       unsigned int approx,
+		       int ignore_case,
+		       DOODLE_ResultCallback callback,
+		       void * arg) {
+  CacheEntry * entry;
+  unsigned int i;
+  unsigned int j;
+
+  if (tree->cache == NULL)
+    return -1;
+  for (i=0;i<tree->cacheSize;i++) {
+    entry = &tree->cache[i];
+    if ( (entry->query == NULL) ||
+	 (entry->approx != approx) ||
+	 (entry->ignore_case != ignore_case) ||
+	 (0 != strcmp(entry->query, key)) )
+      continue;
+    if (entry->generation != tree->generation)
+      return -1; /* stale, will be replaced by cacheStore */
+    entry->lastUse = ++tree->cacheClock;
+    if (callback != NULL)
+      for (j=0;j<entry->count;j++)
+	callback(&tree->filenames[entry->ids[j]],
+		 arg);
+    return entry->count;
+  }
+  return -1;
+}
+
+/**
+ * Remember the results of a search, replacing the least
+ * recently used entry (or the stale entry for the same query).
+ *
+ * @param key normalized query, the cache takes ownership
+ */
+static void cacheStore(SuffixTree * tree,
+		       char * key,
+		       unsigned int approx,
+		       int ignore_case,
+		       CacheRecorder * rec) {
+  CacheEntry * entry;
+  unsigned int i;
+
+  if (tree->cache == NULL)
+    tree->cache = MALLOC(sizeof(CacheEntry) * tree->cacheSize);
+  entry = &tree->cache[0];
+  for (i=0;i<tree->cacheSize;i++) {
+    if ( (tree->cache[i].query != NULL) &&
+	 (tree->cache[i].approx == approx) &&
+	 (tree->cache[i].ignore_case == ignore_case) &&
+	 (0 == strcmp(tree->cache[i].query, key)) ) {
+      entry = &tree->cache[i];
+      break;
+    }
+    if ( (tree->cache[i].query == NULL) ||
+	 ( (entry->query != NULL) &&
+	   (tree->cache[i].lastUse < entry->lastUse) ) )
+      entry = &tree->cache[i];
+  }
+  if (entry->query != NULL) {
+    free(entry->query);
+    if (entry->ids != NULL)
+      free(entry->ids);
+  }
+  entry->query = key;
+  entry->ids = rec->ids;
+  entry->count = rec->count;
+  entry->approx = approx;
+  entry->ignore_case = ignore_case;
+  entry->generation = tree->generation;
+  entry->lastUse = ++tree->cacheClock;
+  rec->ids = NULL;
+}
+
+/**
+ * Pass a result on to the client and remember it for the cache.
+ */
+static void cacheRecord(const DOODLE_FileInfo * fileinfo,
+			void * cls) {
+  CacheRecorder * rec = cls;
+
+  if (rec->callback != NULL)
+    rec->callback(fileinfo,
+		  rec->arg);
+  if (rec->overflow)
+    return;
+  if (rec->count == RESULT_CACHE_MAX_RESULTS) {
+    rec->overflow = 1;
+    return;
+  }
+  if (rec->count == rec->size)
+    GROW(rec->ids,
+	 rec->size,
+	 rec->size * 2 + 16);
+  rec->ids[rec->count++] = fileinfo - rec->tree->filenames;
+}
+
+/**
+ * Search the tree (using the cache if possible).
+ */
+static int cachedSearch(SuffixTree * tree,
+			const char * substring,
+			unsigned int approx,
+			int ignore_case,
+			int (*search)(SuffixTree * tree,
+				      const char * substring,
+				      unsigned int approx,
+				      int ignore_case,
+				      DOODLE_ResultCallback callback,
+				      void * arg),
+			DOODLE_ResultCallback callback,
+			void * arg) {
+  CacheRecorder rec;
+  char * key;
+  int ret;
+
+  /* searches with limits may be stopped early, the results
+     are incomplete and can not be cached */
+  if ( (tree->cacheSize == 0) ||
+       (tree->limit != NULL) )
+    return search(tree, substring, approx, ignore_case, callback, arg);
+  key = cacheKey(tree, substring, approx, ignore_case);
+  ret = cacheLookup(tree, key, approx, ignore_case, callback, arg);
+  if (ret != -1) {
+    free(key);
+    return ret;
+  }
+  memset(&rec, 0, sizeof(CacheRecorder));
+  rec.tree = tree;
+  rec.callback = callback;
+  rec.arg = arg;
+  ret = search(tree, substring, approx, ignore_case, &cacheRecord, &rec);
+  if ( (ret != -1) &&
+       (rec.overflow == 0) )
+    cacheStore(tree, key, approx, ignore_case, &rec);
+  else
+    free(key);
+  if (rec.ids != NULL)
+    free(rec.ids);
+  return ret;
+}
+
+/**
+ * Change the number of searches for which the results are
+ * cached.
+ *
+ * @param entries new size of the cache, 0 to disable caching
+ */
+void DOODLE_tree_set_cache_size(SuffixTree * tree,
+				unsigned int entries) {
+  cacheFlush(tree);
+  tree->cacheSize = entries;
+}
+
+static int parallelSearch(SuffixTree * tree,
+			  const char * ss,
+			  int exact,
+			  unsigned int approx,
+			  int ignore_case,
+			  unsigned int tasks,
+			  DOODLE_ResultCallback callback,
+			  void * arg);
+
+/**
+ * Exact search (signature for cachedSearch).
+ */
+static int search_exact(SuffixTree * tree,
+			const char * substring,
+			unsigned int approx,
+			int ignore_case,
+			DOODLE_ResultCallback callback,
+			void * arg) {
+  STNode * pos;
+  STNode * node;
+  unsigned int tasks;
+
+  if (tree->frozen != NULL)
+    return frozenSearch(tree,
+			0,
+			substring,
+			callback,
+			arg);
+  pos = tree_search_internal(tree,
+			     substring);
+  if ( (pos != NULL) &&
+       (tree->limit == NULL) &&
+       (substring[0] != '\0') &&
+       ( (pos->aggCount != 0)
+	 ? (pos->aggCount * FLAT_SCAN_SELECTIVITY >= tree->fnc)
+	 : (strlen(substring) <= FLAT_SCAN_MAX_LENGTH) ) &&
+       (flatReady(tree)) )
+    return flatScan(tree,
+		    substring,
+		    callback,
+		    arg);
+  if ( (pos != NULL) &&
+       (tree->workerCount > 0) &&
+       (tree->limit == NULL) &&
+       ( (pos->aggCount == 0) ||
+	 (pos->aggCount >= PARALLEL_MIN_FILES) ) ) {
+    /* one task for the matches at pos, one for each
+       subtree below */
+    tasks = 1;
+    if ( (pos->child == NULL) &&
+	 (pos->next_off != 0) )
+      if (-1 == loadChild(tree,
+			  pos))
+	return -1;
+    node = pos->child;
+    while (node != NULL) {
+      tasks++;
+      if ( (node->link == NULL) &&
+	   (node->link_off != 0) )
+	if (-1 == loadLink(tree,
+			   node))
+	  return -1;
+      node = node->link;
+    }
+    if (tasks > 2)
+      return parallelSearch(tree,
+			    substring,
+			    1,
+			    0,
+			    0,
+			    tasks,
+			    callback,
+			    arg);
+  }
+  return tree_iterate_internal(0,
+			       tree,
+			       pos,
+			       callback,
+			       arg);
+}
+
+/**
+ * Search the suffix tree for matching strings.
+ * @return 0 for not found, >0 number of results found
+ */
+int DOODLE_tree_search(SuffixTree * tree,
+		       const char * substring,
+		       DOODLE_ResultCallback callback,
+		       void * arg) {
+  return cachedSearch(tree,
+		      substring,
+		      0,
+		      0,
+		      &search_exact,
+		      callback,
+		      arg);
+}
+
+/**
+ * Number of levels of the tree that are kept in memory while
+ * a batch of searches is processed.
+ */
+#define BATCH_PIN_DEPTH 3
+
+/**
+ * Position in the tree after matching a prefix of a query:
+ * the node and the number of characters of its label that
+ * were matched (0 if the next character must be looked up
+ * in the list starting at node).
+ */
+typedef struct {
+  STNode * node;
+  int off;
+} BatchState;
+
+/**
+ * A query of a batch (with its index in the caller's array).
+ */
+typedef struct {
+  const char * query;
+  unsigned int index;
+} BatchQuery;
+
+static int compareQueries(const void * a,
+			  const void * b) {
+  return strcmp(((const BatchQuery*) a)->query,
+		((const BatchQuery*) b)->query);
+}
+
+/**
+ * Closure for reporting the results of a query of a batch.
+ */
+typedef struct {
+  DOODLE_BatchCallback callback;
+  void * arg;
+  unsigned int index;
+} BatchResult;
+
+static void batch_result(const DOODLE_FileInfo * fileinfo,
+			 void * cls) {
+  BatchResult * br = cls;
+
+  if (br->callback != NULL)
+    br->callback(br->index,
+		 fileinfo,
+		 br->arg);
+}
+
+/**
+ * Advance the position in the tree by one character.
+ * @return 0 on success, 1 if the character does not match, -1 on error
+ */
+static int batch_step(SuffixTree * tree,
+		      BatchState * from,
+		      BatchState * to,
+		      char c) {
+  STNode * pos;
+
+  pos = from->node;
+  if ( (from->off > 0) &&
+       (from->off < pos->clength) ) {
+    if (pos->c[from->off] != c)
+      return 1;
+    to->node = pos;
+    to->off = from->off + 1;
+    return 0;
+  }
+  if (from->off > 0) {
+    if ( (pos->child == NULL) &&
+	 (pos->next_off != 0) )
+      if (-1 == loadChild(tree,
+			  pos))
+	return -1;
+    pos = pos->child;
+  }
+  while (pos != NULL) {
+    if (pos->c[0] > c)
+      return 1;
+    if (pos->c[0] == c) {
+      to->node = pos;
+      to->off = 1;
+      return 0;
+    }
+    if ( (pos->clength == 1) &&
+	 (pos->mls_size > c - pos->c[0]) ) {
+      pos = &pos[c - pos->c[0]];
+      continue;
+    }
+    if ( (pos->link == NULL) &&
+	 (pos->link_off != 0) )
+      if (-1 == loadLink(tree,
+			 pos))
+	return -1;
+    pos = pos->link;
+  }
+  return 1;
+}
+
+/**
+ * Search the suffix tree for a batch of strings.  The queries
+ * are sorted and evaluated in a single traversal of the tree
+ * where queries with a common prefix share the descent; the
+ * upper levels of the tree stay in memory for the whole batch.
+ *
+ * @param queries the strings to search for
+ * @param count number of queries
+ * @param callback function to call for each match; the results
+ *  are grouped by query, in the (strcmp) order of the queries
+ * @param arg extra argument to callback
+ * @param results set to the number of results for each query
+ *   (may be NULL)
+ * @return -1 on error, otherwise the total number of results
+ */
+int DOODLE_tree_search_batch(SuffixTree * tree,
+			     const char ** queries,
+			     unsigned int count,
+			     DOODLE_BatchCallback callback,
+			     void * arg,
+			     unsigned int * results) {
+  BatchQuery * batch;
+  BatchState * states;
+  BatchResult br;
+  unsigned int stateCount;
+  unsigned int matched;
+  unsigned int depth;
+  unsigned int pinDepth;
+  const char * q;
+  const char * prev;
+  unsigned int i;
+  int m;
+  int ret;
+  int iret;
+
+  if (count == 0)
+    return 0;
+  if (tree->frozen != NULL) {
+    /* nothing to gain from sharing the descents, searching
+       a frozen tree does not load any nodes */
+    br.callback = callback;
+    br.arg = arg;
+    ret = 0;
+    for (i=0;i<count;i++) {
+      br.index = i;
+      iret = frozenSearch(tree,
+			  0,
+			  queries[i],
+			  &batch_result,
+			  &br);
+      if (iret == -1)
+	return -1;
+      if (results != NULL)
+	results[i] = iret;
+      ret += iret;
+    }
+    return ret;
+  }
+  batch = MALLOC(sizeof(BatchQuery) * count);
+  stateCount = 1;
+  for (i=0;i<count;i++) {
+    batch[i].query = queries[i];
+    batch[i].index = i;
+    if (strlen(queries[i]) + 1 > stateCount)
+      stateCount = strlen(queries[i]) + 1;
+  }
+  qsort(batch,
+	count,
+	sizeof(BatchQuery),
+	&compareQueries);
+  states = MALLOC(sizeof(BatchState) * stateCount);
+  states[0].node = tree->root;
+  states[0].off = 0;
+  pinDepth = tree->pinDepth;
+  tree->pinDepth = BATCH_PIN_DEPTH;
+  br.callback = callback;
+  br.arg = arg;
+  ret = 0;
+  matched = 0;
+  prev = "";
+  for (i=0;i<count;i++) {
+    q = batch[i].query;
+    /* reuse the descent for the common prefix with the
+       previous query (as far as that one got) */
+    depth = 0;
+    while ( (depth < matched) &&
+	    (q[depth] != '\0') &&
+	    (q[depth] == prev[depth]) )
+      depth++;
+    m = 0;
+    while ( (q[depth] != '\0') &&
+	    (states[depth].node != NULL) ) {
+      m = batch_step(tree,
+		     &states[depth],
+		     &states[depth+1],
+		     q[depth]);
+      if (m != 0)
+	break;
+      depth++;
+    }
+    if (m == -1) {
+      ret = -1;
+      break;
+    }
+    matched = depth;
+    prev = q;
+    iret = 0;
+    if (q[depth] == '\0') {
+      br.index = batch[i].index;
+      iret = tree_iterate_internal(0,
+				   tree,
+				   states[depth].node,
+				   &batch_result,
+				   &br);
+      if (iret == -1) {
+	ret = -1;
+	break;
+      }
+    }
+    if (results != NULL)
+      results[batch[i].index] = iret;
+    ret += iret;
+  }
+  tree->pinDepth = pinDepth;
+  free(states);
+  free(batch);
+  return ret;
+}
+
+/**
+ * Mark the files matching in the given node and its subtree
+ * in the bitmap, using the stored aggregates where possible.
+ *
+ * @param do_links do we traverse the link list, too?
+ *   (0 for the search-result root, 1 for the children)
+ * @return -1 on error, 0 on success
+ */
+static int tree_collect_internal(int do_links,
+				 SuffixTree * tree,
+				 STNode * node,
+				 unsigned char * seen) {
+  unsigned int * ids;
+  int count;
+  int i;
+
+  while (node != NULL) {
+    if ( (node->aggCount != 0) &&
+	 (node->aggOff != 0) ) {
+      count = readAggregate(tree, node, &ids);
+      if (count == -1)
+	return -1;
+      for (i=0;i<count;i++)
+	seen[ids[i] / 8] |= (1 << (ids[i] % 8));
+      free(ids);
+    } else {
+      for (i=node->matchCount-1;i>=0;i--)
+	seen[node->matches[i] / 8] |= (1 << (node->matches[i] % 8));
+      if ( (node->child == NULL) &&
+	   (node->next_off != 0) ) {
+	if (-1 == loadChild(tree,
+			    node))
+	  return -1;
+      }
+      if (-1 == tree_collect_internal(1,
+				      tree,
+				      node->child,
+				      seen))
+	return -1;
+    }
+    if (do_links == 0)
+      return 0;
+    if ( (node->link == NULL) &&
+	 (node->link_off != 0) ) {
+      if (-1 == loadLink(tree,
+			 node))
+	return -1;
+    }
+    node = node->link;
+  }
+  return 0;
+}
+
+/**
+ * Count the number of distinct files matching the given string.
+ * If the tree was not modified below the matching node, this
+ * is answered from the aggregate stored with the node.
+ *
+ * @return -1 on error, otherwise the number of files
+ */
+int DOODLE_tree_count(SuffixTree * tree,
+		      const char * substring) {
+  STNode * pos;
+  unsigned char * seen;
+  unsigned int i;
+  int ret;
+
+  if (tree->frozen != NULL)
+    return frozenCount(tree,
+		       substring);
+  pos = tree_search_internal(tree,
+			     substring);
+  if (pos == NULL)
+    return 0;
+  if (pos->aggCount != 0)
+    return pos->aggCount;
+  if (tree->fnc == 0)
+    return 0;
+  seen = MALLOC((tree->fnc + 7) / 8);
+  if (-1 == tree_collect_internal(0,
+				  tree,
+				  pos,
+				  seen)) {
+    free(seen);
+    return -1;
+  }
+  ret = 0;
+  for (i=0;i<tree->fnc;i++)
+    if ((seen[i / 8] & (1 << (i % 8))) != 0)
+      ret++;
+  free(seen);
+  return ret;
+}
+
+/**
+ * @brief state of a paginated search.
+ *
+ * The cursor does not keep pointers into the tree between
+ * calls since the nodes may be swapped out in the meantime.
+ * Instead, we remember the labels on the path from the
+ * search-result root to the node where we stopped; since the
+ * tree is sorted, this is sufficient to find the place where
+ * we need to continue.
+ */
+struct DOODLE_SearchCursor {
+  /* the tree that we are searching */
+  SuffixTree * tree;
+  /* the string that we are searching for */
+  char * substring;
+  /* labels of the nodes from the search-result root
+     to the node where we stopped (working buffer) */
+  char * path;
+  /* size of the path buffer */
+  unsigned int pathSize;
+  /* length of the path to the node where we stopped */
+  unsigned int pathLen;
+  /* how many matches of that node were processed? */
+  unsigned int done;
+  /* how many distinct files do we still have to skip? */
+  unsigned int offset;
+  /* bitmap of files that were already produced (or skipped) */
+  unsigned char * seen;
+  /* size of the seen bitmap (in bytes) */
+  unsigned int seenSize;
+  /* list of matching files (from the aggregate of the
+     search-result root), NULL if we walk the tree */
+  unsigned int * ids;
+  /* number of entries in ids */
+  unsigned int idCount;
+  /* number of entries of ids that were processed */
+  unsigned int idPos;
+  /* have we visited the entire subtree? */
+  int finished;
+};
+
+/**
+ * @brief entry on the stack of the cursor traversal
+ */
+typedef struct {
+  /* node on the path to the current node */
+  STNode * node;
+  /* length of the path up to (and including) the label of node */
+  unsigned int plen;
+} CursorFrame;
+
+/**
+ * Start a paginated search for the given substring.
+ *
+ * @param offset number of distinct files to skip
+ * @return NULL on error
+ */
+struct DOODLE_SearchCursor * DOODLE_tree_search_open(SuffixTree * tree,
+						     const char * substring,
+						     unsigned int offset) {
+  struct DOODLE_SearchCursor * cursor;
+
+  if ( (tree == NULL) ||
+       (substring == NULL) )
+    return NULL;
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "search_open");
+    return NULL;
+  }
+  cursor = MALLOC(sizeof(struct DOODLE_SearchCursor));
+  cursor->tree = tree;
+  cursor->substring = STRDUP(substring);
+  cursor->offset = offset;
+  return cursor;
+}
+
+/**
+ * Copy the label of the given node into the path buffer
+ * of the cursor (at the given offset).
+ */
+static void cursor_set_label(struct DOODLE_SearchCursor * cursor,
+			     unsigned int plen,
+			     STNode * pos) {
+  if (cursor->pathSize < plen + pos->clength)
+    GROW(cursor->path,
+	 cursor->pathSize,
+	 2 * (plen + pos->clength));
+  memcpy(&cursor->path[plen],
+	 pos->c,
+	 pos->clength);
+}
+
+/**
+ * Obtain the next batch of results of a paginated search.
+ * Each file is reported at most once (over all calls
+ * for the same cursor).  The traversal of the tree stops
+ * as soon as the limit has been reached and continues
+ * from there on the next call.  The cursor must not be
+ * used after the tree has been modified.
+ *
+ * @param limit maximum number of files to report
+ * @return -1 on error, otherwise number of files reported,
+ *   0 if there are no more results
+ */
+int DOODLE_tree_search_next(struct DOODLE_SearchCursor * cursor,
+			    unsigned int limit,
+			    DOODLE_ResultCallback callback,
+			    void * arg) {
+  SuffixTree * tree;
+  STNode * root;
+  STNode * pos;
+  CursorFrame * stack;
+  unsigned int stackSize;
+  unsigned int depth;
+  unsigned int base;
+  unsigned int done;
+  unsigned int fid;
+  unsigned int i;
+  int ret;
+
+  if ( (cursor == NULL) ||
+       (cursor->finished) ||
+       (limit == 0) )
+    return 0;
+  tree = cursor->tree;
+  if (cursor->seenSize < (tree->fnc + 7) / 8)
+    GROW(cursor->seen,
+	 cursor->seenSize,
+	 (tree->fnc + 7) / 8);
+  if (cursor->ids == NULL) {
+    root = tree_search_internal(tree,
+				cursor->substring);
+    if (root == NULL) {
+      cursor->finished = 1;
+      return 0;
+    }
+    if ( (root->aggCount != 0) &&
+	 (root->aggOff != 0) &&
+	 (cursor->pathLen == 0) &&
+	 (cursor->done == 0) ) {
+      /* first call and the list of files is stored with the
+	 node, no need to walk the subtree */
+      if (-1 == readAggregate(tree,
+			      root,
+			      &cursor->ids))
+	return -1;
+      cursor->idCount = root->aggCount;
+      cursor->idPos = cursor->offset;
+      cursor->offset = 0;
+    }
+  }
+  if (cursor->ids != NULL) {
+    ret = 0;
+    while ( (cursor->idPos < cursor->idCount) &&
+	    ((unsigned int) ret < limit) ) {
+      if (callback != NULL)
+	callback(&tree->filenames[cursor->ids[cursor->idPos]],
+		 arg);
+      cursor->idPos++;
+      ret++;
+    }
+    if (cursor->idPos >= cursor->idCount)
+      cursor->finished = 1;
+    return ret;
+  }
+  ret = 0;
+  stack = NULL;
+  stackSize = 0;
+  depth = 0;
+  pos = root;
+  done = cursor->done;
+  /* find the node where we stopped last time; stack[depth-1] is
+     always the node whose child-list contains pos */
+  if (cursor->pathLen == 0)
+    goto EMIT; /* we stopped at the root */
+  while (1) {
+    if (depth == stackSize)
+      GROW(stack,
+	   stackSize,
+	   stackSize * 2 + 8);
+    stack[depth].node = pos;
+    stack[depth].plen = (depth == 0) ? 0 : stack[depth-1].plen + pos->clength;
+    depth++;
+    base = stack[depth-1].plen;
+    if ( (pos->child == NULL) &&
+	 (pos->next_off != 0) )
+      if (-1 == loadChild(tree,
+			  pos))
+	goto ERROR;
+    if (pos->child == NULL) {
+      /* the entire subtree is before the stop-position */
+      depth--;
+      goto ADVANCE;
+    }
+    pos = pos->child;
+    /* skip over the nodes that are smaller */
+    while (pos->c[0] < cursor->path[base]) {
+      if ( (pos->clength == 1) &&
+	   (pos->mls_size > cursor->path[base] - pos->c[0]) ) {
+	pos = &pos[cursor->path[base] - pos->c[0]];
+	continue;
+      }
+      if ( (pos->link == NULL) &&
+	   (pos->link_off != 0) )
+	if (-1 == loadLink(tree,
+			   pos))
+	  goto ERROR;
+      if (pos->link == NULL)
+	goto ADVANCE;
+      pos = pos->link;
+    }
+    cursor_set_label(cursor,
+		     base,
+		     pos);
+    done = 0;
+    if (pos->c[0] > cursor->path[base])
+      goto EMIT;
+    for (i=1;i<pos->clength;i++) {
+      if (base + i == cursor->pathLen)
+	goto EMIT; /* the node was split since the last call */
+      if (pos->c[i] > cursor->path[base + i])
+	goto EMIT;
+      if (pos->c[i] < cursor->path[base + i])
+	goto ADVANCE;
+    }
+    if (base + pos->clength == cursor->pathLen) {
+      done = cursor->done;
+      goto EMIT; /* found the node where we stopped */
+    }
+  }
+
+ EMIT:
+  /* report the matches at pos, then continue with the children */
+  for (i=done;i<pos->matchCount;i++) {
+    fid = pos->matches[i];
+    if (fid / 8 >= cursor->seenSize)
+      GROW(cursor->seen,
+	   cursor->seenSize,
+	   fid / 8 + 1);
+    if ((cursor->seen[fid / 8] & (1 << (fid % 8))) != 0)
+      continue;
+    cursor->seen[fid / 8] |= (1 << (fid % 8));
+    if (cursor->offset > 0) {
+      cursor->offset--;
+      continue;
+    }
+    if (callback != NULL)
+      callback(&tree->filenames[fid],
+	       arg);
+    ret++;
+    if ((unsigned int) ret == limit) {
+      cursor->pathLen = (depth == 0) ? 0 : stack[depth-1].plen + pos->clength;
+      cursor->done = i + 1;
+      GROW(stack,
+	   stackSize,
+	   0);
+      return ret;
+    }
+  }
+  if ( (pos->child == NULL) &&
+       (pos->next_off != 0) )
+    if (-1 == loadChild(tree,
+			pos))
+      goto ERROR;
+  if (pos->child != NULL) {
+    if (depth == stackSize)
+      GROW(stack,
+	   stackSize,
+	   stackSize * 2 + 8);
+    stack[depth].node = pos;
+    stack[depth].plen = (depth == 0) ? 0 : stack[depth-1].plen + pos->clength;
+    depth++;
+    pos = pos->child;
+    cursor_set_label(cursor,
+		     stack[depth-1].plen,
+		     pos);
+    done = 0;
+    goto EMIT;
+  }
+
+ ADVANCE:
+  /* the subtree of pos is finished, continue with the next node */
+  while (depth > 0) {
+    if ( (pos->link == NULL) &&
+	 (pos->link_off != 0) )
+      if (-1 == loadLink(tree,
+			 pos))
+	goto ERROR;
+    if (pos->link != NULL) {
+      pos = pos->link;
+      cursor_set_label(cursor,
+		       stack[depth-1].plen,
+		       pos);
+      done = 0;
+      goto EMIT;
+    }
+    depth--;
+    pos = stack[depth].node;
+  }
+  cursor->finished = 1;
+  GROW(stack,
+       stackSize,
+       0);
+  return ret;
+
+ ERROR:
+  GROW(stack,
+       stackSize,
+       0);
+  return -1;
+}
+
+/**
+ * Release the resources associated with a paginated search.
+ */
+void DOODLE_tree_search_close(struct DOODLE_SearchCursor * cursor) {
+  if (cursor == NULL)
+    return;
+  GROW(cursor->path,
+       cursor->pathSize,
+       0);
+  GROW(cursor->seen,
+       cursor->seenSize,
+       0);
+  if (cursor->ids != NULL)
+    free(cursor->ids);
+  free(cursor->substring);
+  free(cursor);
+}
+
+static int tree_search_approx_internal(STNode * pos,
+				       const unsigned int approx,
+				       const int ignore_case,
+				       SuffixTree * tree,
+				       const char * ss,
+				       DOODLE_ResultCallback callback,
+				       void * arg);
+
+/**
+ * Search a single node (and the subtree below it, but not the
+ * nodes linked from it) for matching strings.
+ *
+ * @param pos the node, must be normalized
+ * @param ignore_case for case-insensitive analysis
+ * @param approx how many letters may we be off?
+ * @param stop set to 1 if the nodes linked from pos must not
+ *   be searched
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+static int tree_search_approx_node(STNode * pos,
+				   const unsigned int approx,
+				   const int ignore_case,
+				   SuffixTree * tree,
+				   const char * ss,
+				   DOODLE_ResultCallback callback,
+				   void * arg,
+				   int * stop) {
+  int ret;
+  int iret;
+
+  ret = 0;
+  if ( (pos->c[0] == ss[0]) ||
+       ( (ignore_case == 1) &&
+	 (tolower(pos->c[0]) == tolower(ss[0])) ) ) {
+    tree_normalize(tree, pos);
+    if (ss[1] == '\0') {
+      iret = tree_iterate_internal(0,
+				   tree,
+				   pos,
+				   callback,
+				   arg);
+      if (iret == -1)
+	return -1;
+      ret += iret;
+    } else {
+      if ( (pos->child == NULL) &&
+	   (pos->next_off != 0) )
+	if (-1 == loadChild(tree,
+			    pos))
 	  return -1;
+      iret = tree_search_approx_internal(pos->child,
+					 approx,
+					 ignore_case,
+					 tree,
+					 ss+1,
+					 callback,
+					 arg);
+      if (iret == -1)
+	return -1;
+      ret += iret;
+    }
+  } /* end if exact match */ else if (approx > 0) {
+    /* we have approx room */
+    if (ss[1] == '\0') {
+      ret += tree_iterate_internal(0,
+				   tree,
+				   pos,
+				   callback,
+				   arg);
+      *stop = 1;
+      return ret;
+    }
+    tree_normalize(tree, pos);
+
+    if ( (pos->child == NULL) &&
+	 (pos->next_off != 0) )
+      if (-1 == loadChild(tree,
+			  pos))
+	return -1;
+    /* extra character in suffix-tree */
+    iret = tree_search_approx_internal(pos->child,
+				       approx-1,
+				       ignore_case,
+				       tree,
+				       ss,
+				       callback,
+				       arg);
+    if (iret == -1)
+      return -1;
+    ret += iret;
+    /* character mismatch */
+    iret = tree_search_approx_internal(pos->child,
+				       approx-1,
+				       ignore_case,
+				       tree,
+				       ss+1,
+				       callback,
+				       arg);
+    if (iret == -1)
+      return -1;
+    ret += iret;
+    /* extra character in ss */
+    iret = tree_search_approx_internal(pos,
+				       approx-1,
+				       ignore_case,
+				       tree,
+				       ss+1,
+				       callback,
+				       arg);
+    if (iret == -1)
+      return -1;
+    ret += iret;
+  }
+  return ret;
+}
+
+/**
+ * Search the suffix tree for matching strings.
+ *
+ * @param pos current position in the tree
+ * @param ignore_case for case-insensitive analysis
+ * @param approx how many letters may we be off?
+ * @param result pass address of pointer to NULL, will be set
+ * @param resultSize pass address of integer of value 0, will be set
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+static int tree_search_approx_internal(STNode * pos,
+				       const unsigned int approx,
+				       const int ignore_case,
+				       SuffixTree * tree,
+				       const char * ss,
+				       DOODLE_ResultCallback callback,
+				       void * arg) {
+  int ret;
+  int iret;
+  int stop;
+
+  ret = 0;
+  CHECK(tree);
+  if (ss[0] == '\0') {
+    /* search string empty!? */
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Assertion failed at %s:%d!\n"),
+	      __FILE__, __LINE__);
+    return -1;
+  }
+  if (pos == NULL)
+    return 0; /* huh? */
+  if (pos->clength > 1)
+    tree_normalize(tree,
+		   pos); /* normalize! */
+
+  while (pos != NULL) {
+    if (limitReached(tree))
+      break;
+    stop = 0;
+    iret = tree_search_approx_node(pos,
+				   approx,
+				   ignore_case,
+				   tree,
+				   ss,
+				   callback,
+				   arg,
+				   &stop);
+    if (iret == -1)
+      return -1;
+    ret += iret;
+    if (stop)
+      return ret;
+    if ( (pos->link == NULL) &&
+	 (pos->link_off != 0) )
+      if (-1 == loadLink(tree,
+			 pos))
+	return -1;
+    pos = pos->link;
+  }
+  CHECK(tree);
+  return ret;
+}
+
+
+/* ******************** parallel search ********************** */
+
+/**
+ * @brief results of one task of a parallel search
+ */
+typedef struct {
+  /* indices into tree->filenames, in the order in which
+     the task found them */
+  unsigned int * ids;
+  unsigned int count;
+  unsigned int size;
+  /* 1 if the results of the later tasks must be ignored
+     (see tree_search_approx_node) */
+  int stop;
+} TaskResult;
+
+/**
+ * @brief the logger of a tree during a parallel search
+ *  (see parallelLog)
+ */
+typedef struct {
+  DOODLE_Logger log;
+  void * context;
+  pthread_mutex_t lock;
+} ParallelLog;
+
+/**
+ * @brief a parallel search.
+ *
+ * The search is split into tasks (the subtrees below the
+ * matching node for an exact search, the nodes of the first
+ * level for an approximate search).  Since loading nodes
+ * modifies the tree, each thread works on its own handle of
+ * the database (see DOODLE_tree_set_threads).  The threads
+ * take the next task from a shared counter, so a thread that
+ * finishes early starts on the next subtree; a subtree is
+ * never split between threads, so one large subtree is still
+ * searched by a single thread.  The results of each task are
+ * buffered and reported in the order of the tasks, which is
+ * the order of the single-threaded search.
+ */
+typedef struct {
+  const char * ss;
+  /* 1 for an exact search, 0 for an approximate search */
+  int exact;
+  unsigned int approx;
+  int ignore_case;
+  unsigned int tasks;
+  TaskResult * results;
+  /* next task to process */
+  unsigned int next;
+  /* 1 if a task failed */
+  int error;
+  pthread_mutex_t lock;
+  /* logger used by all handles during the search */
+  ParallelLog log;
+} ParallelSearch;
+
+/**
+ * @brief a thread of a parallel search
+ */
+typedef struct {
+  ParallelSearch * ps;
+  /* handle of the database used by this thread */
+  SuffixTree * tree;
+  /* result of the task in progress */
+  TaskResult * result;
+} TaskWorker;
+
+/**
+ * Remember a result of a task.
+ */
+static void taskResult(const DOODLE_FileInfo * fileinfo,
+		       void * cls) {
+  TaskWorker * worker = cls;
+  TaskResult * result = worker->result;
+
+  if (result->count == result->size)
+    GROW(result->ids,
+	 result->size,
+	 result->size * 2 + 16);
+  result->ids[result->count++] = fileinfo - worker->tree->filenames;
+}
+
+/**
+ * Run the given task of a parallel search.
+ * @return -1 on error, 0 on success
+ */
+static int runTask(TaskWorker * worker,
+		   unsigned int task) {
+  ParallelSearch * ps = worker->ps;
+  SuffixTree * tree = worker->tree;
+  STNode * pos;
+  int i;
+
+  if (ps->exact) {
+    pos = tree_search_internal(tree,
+			       ps->ss);
+    if (pos == NULL)
+      return 0;
+    if (task == 0) {
+      for (i=pos->matchCount-1;i>=0;i--)
+	taskResult(&tree->filenames[pos->matches[i]],
+		   worker);
+      return 0;
+    }
+    if ( (pos->child == NULL) &&
+	 (pos->next_off != 0) )
+      if (-1 == loadChild(tree,
+			  pos))
+	return -1;
+    pos = pos->child;
+    task--;
+  } else {
+    pos = tree->root;
+    if (pos == NULL)
+      return 0;
+    if (pos->clength > 1)
+      tree_normalize(tree,
+		     pos);
+  }
+  while ( (pos != NULL) &&
+	  (task > 0) ) {
+    if ( (pos->link == NULL) &&
+	 (pos->link_off != 0) )
+      if (-1 == loadLink(tree,
+			 pos))
+	return -1;
+    pos = pos->link;
+    task--;
+  }
+  if (pos == NULL)
+    return 0;
+  if (ps->exact)
+    return (-1 == tree_iterate_internal(0,
+					tree,
+					pos,
+					&taskResult,
+					worker)) ? -1 : 0;
+  return (-1 == tree_search_approx_node(pos,
+					ps->approx,
+					ps->ignore_case,
+					tree,
+					ps->ss,
+					&taskResult,
+					worker,
+					&worker->result->stop)) ? -1 : 0;
+}
+
+/**
+ * Logger of the handles of a tree during a parallel search:
+ * passes the messages on to the logger of the tree, one
+ * at a time.
+ */
+static void parallelLog(void * cls,
+			unsigned int level,
+			const char * msg,
+			...) {
+  ParallelLog * pl = cls;
+  char buf[1024];
+  va_list args;
+
+  va_start(args, msg);
+  vsnprintf(buf,
+	    sizeof(buf),
+	    msg,
+	    args);
+  va_end(args);
+  pthread_mutex_lock(&pl->lock);
+  pl->log(pl->context,
+	  level,
+	  "%s",
+	  buf);
+  pthread_mutex_unlock(&pl->lock);
+}
+
+/**
+ * Change the logger of a handle (and of its file).
+ */
+static void setLogger(SuffixTree * handle,
+		      DOODLE_Logger log,
+		      void * context) {
+  handle->log = log;
+  handle->context = context;
+  handle->fd->log = log;
+  handle->fd->context = context;
+}
+
+/**
+ * Main method of the threads of a parallel search: process
+ * tasks until there are none left.
+ */
+static void * taskLoop(void * cls) {
+  TaskWorker * worker = cls;
+  ParallelSearch * ps = worker->ps;
+  unsigned int task;
+
+  while (1) {
+    pthread_mutex_lock(&ps->lock);
+    task = ps->next++;
+    pthread_mutex_unlock(&ps->lock);
+    if (task >= ps->tasks)
+      break;
+    worker->result = &ps->results[task];
+    if (-1 == runTask(worker,
+		      task)) {
+      pthread_mutex_lock(&ps->lock);
+      ps->error = 1;
+      ps->next = ps->tasks; /* abort */
+      pthread_mutex_unlock(&ps->lock);
+      break;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Search the tree using tree and all of its workers.
+ *
+ * @param exact 1 for an exact search, 0 for an approximate search
+ * @param tasks number of tasks (see runTask)
+ * @return -1 on error, otherwise the number of results
+ */
+static int parallelSearch(SuffixTree * tree,
+			  const char * ss,
+			  int exact,
+			  unsigned int approx,
+			  int ignore_case,
+			  unsigned int tasks,
+			  DOODLE_ResultCallback callback,
+			  void * arg) {
+  ParallelSearch ps;
+  TaskWorker * workers;
+  pthread_t * threads;
+  unsigned int i;
+  unsigned int j;
+  unsigned int started;
+  int stopped;
+  int ret;
+
+  memset(&ps, 0, sizeof(ParallelSearch));
+  ps.ss = ss;
+  ps.exact = exact;
+  ps.approx = approx;
+  ps.ignore_case = ignore_case;
+  ps.tasks = tasks;
+  ps.results = MALLOC(sizeof(TaskResult) * tasks);
+  pthread_mutex_init(&ps.lock, NULL);
+  ps.log.log = tree->log;
+  ps.log.context = tree->context;
+  pthread_mutex_init(&ps.log.lock, NULL);
+  workers = MALLOC(sizeof(TaskWorker) * (tree->workerCount + 1));
+  threads = MALLOC(sizeof(pthread_t) * tree->workerCount);
+  started = 0;
+  /* the handles share the logger of the tree */
+  setLogger(tree, &parallelLog, &ps.log);
+  for (i=0;i<tree->workerCount;i++)
+    setLogger(tree->workers[i], &parallelLog, &ps.log);
+  for (i=0;i<tree->workerCount;i++) {
+    workers[i+1].ps = &ps;
+    workers[i+1].tree = tree->workers[i];
+    if (0 != pthread_create(&threads[started],
+			    NULL,
+			    &taskLoop,
+			    &workers[i+1]))
+      break; /* continue with fewer threads */
+    started++;
+  }
+  /* the calling thread works on the tree itself */
+  workers[0].ps = &ps;
+  workers[0].tree = tree;
+  taskLoop(&workers[0]);
+  for (i=0;i<started;i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&ps.lock);
+  setLogger(tree, ps.log.log, ps.log.context);
+  for (i=0;i<tree->workerCount;i++)
+    setLogger(tree->workers[i], ps.log.log, ps.log.context);
+  pthread_mutex_destroy(&ps.log.lock);
+
+  ret = 0;
+  stopped = 0;
+  for (i=0;i<tasks;i++) {
+    if ( (ps.error == 0) &&
+	 (stopped == 0) ) {
+      for (j=0;j<ps.results[i].count;j++)
+	if (callback != NULL)
+	  callback(&tree->filenames[ps.results[i].ids[j]],
+		   arg);
+      ret += ps.results[i].count;
+      stopped = ps.results[i].stop;
+    }
+    if (ps.results[i].ids != NULL)
+      free(ps.results[i].ids);
+  }
+  free(ps.results);
+  free(workers);
+  free(threads);
+  if (ps.error != 0)
+    return -1;
+  return ret;
+}
+
+/**
+ * Create an additional handle of a read-only tree for a thread
+ * of a parallel search.  The handle has its own nodes (loaded
+ * on demand within its share of the memory limit) but shares
+ * the descriptor of the database (reads use pread), the
+ * filenames and the keywords with the tree.
+ *
+ * @param threads number of threads that share the memory limit
+ */
+static SuffixTree * searchWorkerCreate(SuffixTree * tree,
+				       unsigned int threads) {
+  SuffixTree * wt;
+
+  wt = MALLOC(sizeof(SuffixTree));
+  wt->log = tree->log;
+  wt->context = tree->context;
+  wt->database = tree->database;
+  wt->fd = IO_WRAP(tree->log,
+		   tree->context,
+		   tree->fd->fd);
+  wt->read_only = 1;
+  wt->fns = tree->fns;
+  wt->fnc = tree->fnc;
+  wt->filenames = tree->filenames;
+  wt->cis = tree->cis;
+  wt->cisPos = tree->cisPos;
+  wt->cisLen = tree->cisLen;
+  wt->fold = tree->fold;
+  wt->words = tree->words;
+  wt->aggregatesStart = tree->aggregatesStart;
+  wt->memory_limit = tree->memory_limit / threads;
+  if (tree->root != NULL)
+    wt->root = lazyReadNode(wt,
+			    tree->root->pos);
+  return wt;
+}
+
+/**
+ * Free a handle created with searchWorkerCreate.
+ */
+static void searchWorkerFree(SuffixTree * wt) {
+  STNode * tmp;
+
+  tmp = wt->root;
+  wt->root = NULL;
+  freeNode(wt, tmp);
+  free(wt->fd->buffer);
+  free(wt->fd);
+  free(wt);
+}
+
+/**
+ * Release the additional handles of a tree.
+ */
+static void closeWorkers(SuffixTree * tree) {
+  unsigned int i;
+
+  for (i=0;i<tree->workerCount;i++)
+    searchWorkerFree(tree->workers[i]);
+  if (tree->workers != NULL)
+    free(tree->workers);
+  tree->workers = NULL;
+  tree->workerCount = 0;
+}
+
+/**
+ * Change the number of threads used for approximate searches
+ * and exact searches with many results.  Each extra thread
+ * uses its own handle of the database (see searchWorkerCreate);
+ * together, these handles use at most the memory limit of the
+ * tree for their nodes.  Only possible for trees opened with
+ * DOODLE_tree_open_RDONLY.
+ *
+ * @param threads number of threads, 1 for single-threaded searches
+ * @return 0 on success, -1 on error
+ */
+int DOODLE_tree_set_threads(SuffixTree * tree,
+			    unsigned int threads) {
+  closeWorkers(tree);
+  if (threads <= 1)
+    return 0;
+  /* frozen trees are searched without extra threads */
+  if ( (tree->read_only == 0) ||
+       (tree->frozen != NULL) ||
+       (tree->fd == NULL) )
+    return -1;
+  tree->workers = MALLOC(sizeof(SuffixTree*) * (threads - 1));
+  while (tree->workerCount < threads - 1)
+    tree->workers[tree->workerCount++]
+      = searchWorkerCreate(tree,
+			   threads);
+  return 0;
+}
+
+/**
+ * Approximate or case-insensitive search (signature for
+ * cachedSearch).
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+static int search_approx(SuffixTree * tree,
+			 const char * ss,
+			 unsigned int approx,
+			 int ignore_case,
+			 DOODLE_ResultCallback callback,
+			 void * arg) {
+  STNode * pos;
+  char * folded;
+  unsigned int tasks;
+  int ret;
+  int iret;
+
+  if (tree->frozen != NULL)
+    return frozenSearchApprox(tree,
+			      ss,
+			      approx,
+			      ignore_case,
+			      callback,
+			      arg);
+  if ( (approx == 0) &&
+       (ignore_case != 0) &&
+       (tree->fold != 0) ) {
+    /* exact search for the folded string; strings that
+       are not in folded form are (also) in the case-folded
+       tree, all others only in the main tree */
+    folded = foldCase(ss);
+    pos = tree_search_internal(tree,
+			       folded);
+    ret = tree_iterate_internal(0,
+				tree,
+				pos,
+				callback,
+				arg);
+    if ( (ret != -1) &&
+	 (tree->froot != NULL) ) {
+      swapRoots(tree);
+      pos = tree_search_internal(tree,
+				 folded);
+      iret = tree_iterate_internal(0,
+				   tree,
+				   pos,
+				   callback,
+				   arg);
+      swapRoots(tree);
+      if (iret == -1)
+	ret = -1;
+      else
 	ret += iret;
+    }
+    free(folded);
+    return ret;
+  }
+  pos = tree->root;
+  if ( (pos != NULL) &&
+       (ss[0] != '\0') &&
+       (tree->workerCount > 0) &&
+       (tree->limit == NULL) ) {
+    /* one task for each node of the first level */
+    if (pos->clength > 1)
+      tree_normalize(tree,
+		     pos);
+    tasks = 0;
+    while (pos != NULL) {
+      tasks++;
+      if ( (pos->link == NULL) &&
+	   (pos->link_off != 0) )
+	if (-1 == loadLink(tree,
+			   pos))
+	  return -1;
+      pos = pos->link;
+    }
+    return parallelSearch(tree,
+			  ss,
+			  0,
+			  approx,
+			  ignore_case,
+			  tasks,
+			  callback,
+			  arg);
+  }
+  return tree_search_approx_internal(tree->root,
+				     approx,
+				     ignore_case,
+				     tree,
+				     ss,
+				     callback,
+				     arg);
+}
+
+/**
+ * Search the suffix tree for matching strings.
+ * @param ignore_case for case-insensitive analysis
+ * @param approx how many letters may we be off?
+ * @return -1 on error, 0 for no results, >0 for number of results
+ */
+int DOODLE_tree_search_approx(SuffixTree * tree,
+			      const unsigned int approx,
+			      const int ignore_case,
+			      const char * ss,
+			      DOODLE_ResultCallback callback,
+			      void * arg) {
+  return cachedSearch(tree,
+		      ss,
+		      approx,
+		      ignore_case,
+		      &search_approx,
+		      callback,
+		      arg);
+}
+
+
+/**
+ * Report a result of a search with limits to the client.
+ */
+static void limitedResult(const DOODLE_FileInfo * fileinfo,
+			  void * cls) {
+  SearchLimit * limit = cls;
+
+  if (limit->truncated)
+    return;
+  if ( (limit->maxResults != 0) &&
+       (limit->results >= limit->maxResults) ) {
+    /* only a result beyond the limit makes the results
+       incomplete */
+    limit->truncated = 1;
+    return;
+  }
+  limit->results++;
+  if ( (limit->callback != NULL) &&
+       (0 != limit->callback(fileinfo,
+			     limit->arg)) )
+    limit->truncated = 1;
+}
+
+/**
+ * Search the suffix tree for matching strings, giving up when
+ * the given limits are exceeded or when the callback asks us
+ * to stop.
+ *
+ * @param limits limits for the search, NULL for none
+ * @param truncated set to 1 if the search was stopped early,
+ *   0 if all results were reported (may be NULL)
+ * @return -1 on error, otherwise the number of results reported
+ */
+int DOODLE_tree_search_limited(SuffixTree * tree,
+			       const char * substring,
+			       unsigned int approx,
+			       int ignore_case,
+			       const DOODLE_SearchLimits * limits,
+			       DOODLE_LimitedResultCallback callback,
+			       void * arg,
+			       int * truncated) {
+  SearchLimit limit;
+  int ret;
+
+  memset(&limit, 0, sizeof(SearchLimit));
+  limit.callback = callback;
+  limit.arg = arg;
+  if (limits != NULL) {
+    limit.maxNodes = limits->max_nodes;
+    limit.maxResults = limits->max_results;
+    if (limits->max_time != 0) {
+      gettimeofday(&limit.deadline, NULL);
+      limit.deadline.tv_sec += limits->max_time / 1000;
+      limit.deadline.tv_usec += (limits->max_time % 1000) * 1000;
+      if (limit.deadline.tv_usec >= 1000000) {
+	limit.deadline.tv_sec++;
+	limit.deadline.tv_usec -= 1000000;
+      }
+    }
+  }
+  tree->limit = &limit;
+  if ( (approx == 0) &&
+       (ignore_case == 0) )
+    ret = DOODLE_tree_search(tree,
+			     substring,
+			     &limitedResult,
+			     &limit);
+  else
+    ret = DOODLE_tree_search_approx(tree,
+				    approx,
+				    ignore_case,
+				    substring,
+				    &limitedResult,
+				    &limit);
+  tree->limit = NULL;
+  if (truncated != NULL)
+    *truncated = limit.truncated;
+  if (ret == -1)
+    return -1;
+  return limit.results;
+}
+
+
+/* ******************** pattern search ********************** */
+
+/**
+ * Maximum number of NFA states for a pattern (this limits the
+ * size of repetitions like "a{1000}").
+ */
+#define PATTERN_MAX_NFA 8192
+
+/**
+ * Maximum number of DFA states that we construct (lazily) while
+ * matching a pattern.  Each state costs 1k of memory for the
+ * transition table.
+ */
+#define PATTERN_MAX_DFA 4096
+
+/**
+ * Size of the hash table for finding DFA states.
+ */
+#define PATTERN_HASH 1024
+
+/**
+ * @brief state of the NFA compiled from a pattern
+ */
+typedef struct {
+  /* bytes on which we move to out1 (bitmap) */
+  unsigned char set[32];
+  /* is this a state with a byte-transition (otherwise
+     out1 and out2 are epsilon-transitions)? */
+  int byte;
+  /* successors, -1 for none */
+  int out1;
+  int out2;
+} NFAState;
+
+/**
+ * @brief part of the NFA under construction; all states of
+ *  a fragment are stored consecutively, the out1 of the final
+ *  state is not yet set
+ */
+typedef struct {
+  int start;
+  int end;
+} NFAFragment;
+
+/**
+ * @brief pattern compiled to an NFA and the DFA that is
+ *  constructed (lazily) from it while we walk the tree
+ */
+typedef struct {
+  SuffixTree * tree;
+  /* the pattern and the position of the parser */
+  const char * pattern;
+  unsigned int ppos;
+  /* error message from the parser, NULL for none */
+  const char * error;
+  /* DOODLE_PATTERN_* flags */
+  int flags;
+  /* must the match extend to the end of the keyword? */
+  int anchored;
+  /* the NFA */
+  NFAState * nfa;
+  unsigned int nfaSize;
+  unsigned int nfaCount;
+  int start;
+  int accept;
+  /* the DFA states (sorted lists of NFA states) */
+  int ** dfaSets;
+  unsigned int * dfaSetSizes;
+  unsigned char * dfaAccept;
+  unsigned int dfaCount;
+  /* transitions of the DFA (256 per state), -1 if unknown */
+  int * trans;
+  unsigned int transSize;
+  /* hash table over the DFA states */
+  int hashHead[PATTERN_HASH];
+  int * hashNext;
+  /* work space for computing the epsilon-closure */
+  unsigned int * mark;
+  unsigned int generation;
+  int * stack;
+  int * members;
+} Automaton;
+
+static int nfa_new(Automaton * a) {
+  if (a->nfaCount == a->nfaSize)
+    GROW(a->nfa,
+	 a->nfaSize,
+	 a->nfaSize * 2 + 64);
+  memset(&a->nfa[a->nfaCount], 0, sizeof(NFAState));
+  a->nfa[a->nfaCount].out1 = -1;
+  a->nfa[a->nfaCount].out2 = -1;
+  return a->nfaCount++;
+}
+
+static NFAFragment frag_empty(Automaton * a) {
+  NFAFragment ret;
+
+  ret.start = nfa_new(a);
+  ret.end = ret.start;
+  return ret;
+}
+
+static NFAFragment frag_set(Automaton * a,
+			    const unsigned char * set) {
+  NFAFragment ret;
+
+  ret.start = nfa_new(a);
+  ret.end = nfa_new(a);
+  a->nfa[ret.start].byte = 1;
+  memcpy(a->nfa[ret.start].set,
+	 set,
+	 32);
+  a->nfa[ret.start].out1 = ret.end;
+  return ret;
+}
+
+static NFAFragment frag_range(Automaton * a,
+			      unsigned char lo,
+			      unsigned char hi) {
+  unsigned char set[32];
+  unsigned int i;
+
+  memset(set, 0, sizeof(set));
+  for (i=lo;i<=hi;i++)
+    set[i / 8] |= (1 << (i % 8));
+  return frag_set(a, set);
+}
+
+static NFAFragment frag_concat(Automaton * a,
+			       NFAFragment f1,
+			       NFAFragment f2) {
+  NFAFragment ret;
+
+  a->nfa[f1.end].out1 = f2.start;
+  ret.start = f1.start;
+  ret.end = f2.end;
+  return ret;
+}
+
+static NFAFragment frag_alt(Automaton * a,
+			    NFAFragment f1,
+			    NFAFragment f2) {
+  NFAFragment ret;
+
+  ret.start = nfa_new(a);
+  ret.end = nfa_new(a);
+  a->nfa[ret.start].out1 = f1.start;
+  a->nfa[ret.start].out2 = f2.start;
+  a->nfa[f1.end].out1 = ret.end;
+  a->nfa[f2.end].out1 = ret.end;
+  return ret;
+}
+
+static NFAFragment frag_star(Automaton * a,
+			     NFAFragment f) {
+  NFAFragment ret;
+
+  ret.start = nfa_new(a);
+  ret.end = nfa_new(a);
+  a->nfa[ret.start].out1 = f.start;
+  a->nfa[ret.start].out2 = ret.end;
+  a->nfa[f.end].out1 = ret.start;
+  return ret;
+}
+
+static NFAFragment frag_plus(Automaton * a,
+			     NFAFragment f) {
+  NFAFragment ret;
+
+  ret.start = f.start;
+  ret.end = nfa_new(a);
+  a->nfa[f.end].out1 = f.start;
+  a->nfa[f.end].out2 = ret.end;
+  return ret;
+}
+
+static NFAFragment frag_opt(Automaton * a,
+			    NFAFragment f) {
+  NFAFragment ret;
+
+  ret.start = nfa_new(a);
+  ret.end = nfa_new(a);
+  a->nfa[ret.start].out1 = f.start;
+  a->nfa[ret.start].out2 = ret.end;
+  a->nfa[f.end].out1 = ret.end;
+  return ret;
+}
+
+/**
+ * Copy the fragment f which consists of the states lo to hi-1.
+ */
+static NFAFragment frag_copy(Automaton * a,
+			     NFAFragment f,
+			     int lo,
+			     int hi) {
+  NFAFragment ret;
+  int shift;
+  int i;
+  int n;
+
+  shift = a->nfaCount - lo;
+  for (i=lo;i<hi;i++) {
+    n = nfa_new(a);
+    a->nfa[n] = a->nfa[i];
+    if (a->nfa[n].out1 != -1)
+      a->nfa[n].out1 += shift;
+    if (a->nfa[n].out2 != -1)
+      a->nfa[n].out2 += shift;
+  }
+  ret.start = f.start + shift;
+  ret.end = f.end + shift;
+  return ret;
+}
+
+/**
+ * @return number of bytes of the UTF-8 character starting at str
+ *   (1 for invalid sequences)
+ */
+static unsigned int utf8_length(const char * str) {
+  unsigned char c;
+  unsigned int len;
+  unsigned int i;
+
+  c = (unsigned char) str[0];
+  if ((c & 0xE0) == 0xC0)
+    len = 2;
+  else if ((c & 0xF0) == 0xE0)
+    len = 3;
+  else if ((c & 0xF8) == 0xF0)
+    len = 4;
+  else
+    return 1;
+  for (i=1;i<len;i++)
+    if (((unsigned char) str[i] & 0xC0) != 0x80)
+      return 1;
+  return len;
+}
+
+/**
+ * Fragment matching the given (UTF-8) character.
+ */
+static NFAFragment frag_char(Automaton * a,
+			     const char * chr,
+			     unsigned int len) {
+  unsigned char set[32];
+  NFAFragment ret;
+  NFAFragment f;
+  unsigned int cp;
+  unsigned int other;
+  unsigned int i;
+
+  if (len == 1) {
+    memset(set, 0, sizeof(set));
+    i = (unsigned char) chr[0];
+    set[i / 8] |= (1 << (i % 8));
+    if ( ((a->flags & DOODLE_PATTERN_IGNORE_CASE) != 0) &&
+	 (i < 128) &&
+	 (isalpha(i)) ) {
+      set[tolower(i) / 8] |= (1 << (tolower(i) % 8));
+      set[toupper(i) / 8] |= (1 << (toupper(i) % 8));
+    }
+    return frag_set(a, set);
+  }
+  if ( (len == 2) &&
+       ((a->flags & DOODLE_PATTERN_IGNORE_CASE) != 0) ) {
+    /* all characters with the same case-folded version */
+    cp = foldCodePoint((((unsigned char) chr[0] & 0x1F) << 6) |
+		       ((unsigned char) chr[1] & 0x3F));
+    ret.start = -1;
+    for (other=0x80;other<0x800;other++) {
+      if (foldCodePoint(other) != cp)
+	continue;
+      f = frag_concat(a,
+		      frag_range(a, 0xC0 | (other >> 6), 0xC0 | (other >> 6)),
+		      frag_range(a, 0x80 | (other & 0x3F), 0x80 | (other & 0x3F)));
+      if (ret.start == -1)
+	ret = f;
+      else
+	ret = frag_alt(a, ret, f);
+    }
+    return ret;
+  }
+  ret = frag_range(a, (unsigned char) chr[0], (unsigned char) chr[0]);
+  for (i=1;i<len;i++)
+    ret = frag_concat(a,
+		      ret,
+		      frag_range(a, (unsigned char) chr[i], (unsigned char) chr[i]));
+  return ret;
+}
+
+/**
+ * Fragment matching any UTF-8 character that is not ASCII.
+ */
+static NFAFragment frag_any_multibyte(Automaton * a) {
+  NFAFragment two;
+  NFAFragment three;
+  NFAFragment four;
+  int i;
+
+  two = frag_concat(a,
+		    frag_range(a, 0xC0, 0xDF),
+		    frag_range(a, 0x80, 0xBF));
+  three = frag_range(a, 0xE0, 0xEF);
+  for (i=0;i<2;i++)
+    three = frag_concat(a,
+			three,
+			frag_range(a, 0x80, 0xBF));
+  four = frag_range(a, 0xF0, 0xF7);
+  for (i=0;i<3;i++)
+    four = frag_concat(a,
+		       four,
+		       frag_range(a, 0x80, 0xBF));
+  return frag_alt(a,
+		  frag_alt(a, two, three),
+		  four);
+}
+
+/**
+ * Fragment matching any (UTF-8) character.
+ */
+static NFAFragment frag_any(Automaton * a) {
+  return frag_alt(a,
+		  frag_range(a, 0x01, 0x7F),
+		  frag_any_multibyte(a));
+}
+
+/**
+ * Add the ASCII characters of a class like "[:alpha:]" or
+ * "\d" to the set.
+ */
+static void set_add_ctype(unsigned char * set,
+			  int (*pred)(int)) {
+  int i;
+
+  for (i=1;i<128;i++)
+    if (pred(i))
+      set[i / 8] |= (1 << (i % 8));
+}
+
+static int isword(int c) {
+  return isalnum(c) || (c == '_');
+}
+
+/**
+ * Parse a character class (the parser is positioned after the '[').
+ */
+static NFAFragment parse_class(Automaton * a) {
+  static struct {
+    const char * name;
+    int (*pred)(int);
+  } classes[] = {
+    { "[:alpha:]", &isalpha },
+    { "[:digit:]", &isdigit },
+    { "[:alnum:]", &isalnum },
+    { "[:space:]", &isspace },
+    { "[:upper:]", &isupper },
+    { "[:lower:]", &islower },
+    { "[:punct:]", &ispunct },
+    { NULL, NULL },
+  };
+  unsigned char set[32];
+  NFAFragment ret;
+  NFAFragment f;
+  const char * p;
+  unsigned int len;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int i;
+  int negate;
+  int first;
+  int empty;
+  int multibyte;
+
+  p = a->pattern;
+  memset(set, 0, sizeof(set));
+  ret.start = -1;
+  ret.end = -1;
+  empty = 1;
+  multibyte = 0;
+  negate = 0;
+  if ( (p[a->ppos] == '^') ||
+       ( ((a->flags & DOODLE_PATTERN_GLOB) != 0) &&
+	 (p[a->ppos] == '!') ) ) {
+    negate = 1;
+    a->ppos++;
+  }
+  first = 1;
+  while ( (p[a->ppos] != ']') || (first == 1) ) {
+    first = 0;
+    if (p[a->ppos] == '\0') {
+      a->error = _("unterminated character class");
+      return ret;
+    }
+    if (p[a->ppos] == '[') {
+      for (i=0;classes[i].name != NULL;i++)
+	if (0 == strncmp(&p[a->ppos],
+			 classes[i].name,
+			 strlen(classes[i].name)))
+	  break;
+      if (classes[i].name != NULL) {
+	set_add_ctype(set, classes[i].pred);
+	a->ppos += strlen(classes[i].name);
+	empty = 0;
+	continue;
       }
-    } /* end if exact match */ else if (approx > 0) {
-      /* we have approx room */
-      if (ss[1] == '\0') {
-	ret += tree_iterate_internal(0,
-				     tree,
-				     pos,
-				     callback,
-				     arg);
- 	return ret;
+    }
+    if ( (p[a->ppos] == '\\') &&
+	 (p[a->ppos+1] != '\0') )
+      a->ppos++;
+    len = utf8_length(&p[a->ppos]);
+    if ( (p[a->ppos + len] == '-') &&
+	 (p[a->ppos + len + 1] != ']') &&
+	 (p[a->ppos + len + 1] != '\0') ) {
+      /* range */
+      if ( (len != 1) ||
+	   (utf8_length(&p[a->ppos + len + 1]) != 1) ) {
+	a->error = _("ranges of non-ASCII characters are not supported");
+	return ret;
+      }
+      lo = (unsigned char) p[a->ppos];
+      hi = (unsigned char) p[a->ppos + 2];
+      if ( (lo > hi) || (hi >= 128) ) {
+	a->error = _("invalid range in character class");
+	return ret;
+      }
+      for (i=lo;i<=hi;i++) {
+	set[i / 8] |= (1 << (i % 8));
+	if ( ((a->flags & DOODLE_PATTERN_IGNORE_CASE) != 0) &&
+	     (isalpha(i)) ) {
+	  set[tolower(i) / 8] |= (1 << (tolower(i) % 8));
+	  set[toupper(i) / 8] |= (1 << (toupper(i) % 8));
+	}
+      }
+      a->ppos += 3;
+      empty = 0;
+      continue;
+    }
+    if (len == 1) {
+      i = (unsigned char) p[a->ppos];
+      if (i >= 128) {
+	a->error = _("invalid UTF-8 in character class");
+	return ret;
       }
-      tree_normalize(tree, pos);
+      set[i / 8] |= (1 << (i % 8));
+      if ( ((a->flags & DOODLE_PATTERN_IGNORE_CASE) != 0) &&
+	   (isalpha(i)) ) {
+	set[tolower(i) / 8] |= (1 << (tolower(i) % 8));
+	set[toupper(i) / 8] |= (1 << (toupper(i) % 8));
+      }
+    } else {
+      if (negate) {
+	a->error = _("negated classes with non-ASCII characters are not supported");
+	return ret;
+      }
+      f = frag_char(a, &p[a->ppos], len);
+      if (ret.start == -1)
+	ret = f;
+      else
+	ret = frag_alt(a, ret, f);
+      multibyte = 1;
+    }
+    a->ppos += len;
+    empty = 0;
+  }
+  a->ppos++; /* skip ']' */
+  if (empty) {
+    a->error = _("empty character class");
+    return ret;
+  }
+  if (negate) {
+    for (i=0;i<32;i++)
+      set[i] = ~set[i];
+    for (i=128;i<256;i++)
+      set[i / 8] &= ~(1 << (i % 8));
+    set[0] &= ~1; /* never '\0' */
+    return frag_alt(a,
+		    frag_set(a, set),
+		    frag_any_multibyte(a));
+  }
+  for (i=0;i<32;i++)
+    if (set[i] != 0)
+      break;
+  if (i == 32)
+    return ret; /* only non-ASCII characters */
+  f = frag_set(a, set);
+  if (multibyte)
+    return frag_alt(a, ret, f);
+  return f;
+}
 
-      if ( (pos->child == NULL) &&
-	   (pos->next_off != 0) )
-	if (-1 == loadChild(tree,
-			    pos))
-	  return -1;
-      /* extra character in suffix-tree */
-      iret = tree_search_approx_internal(pos->child,
-					 approx-1,
-					 ignore_case,
-					 tree,
-					 ss,
-					 callback,
-					 arg);
-      if (iret == -1)
+static NFAFragment parse_alternative(Automaton * a,
+				     unsigned int depth);
+
+/**
+ * Parse an atom of a regular expression (character, class
+ * or group).
+ */
+static NFAFragment parse_atom(Automaton * a,
+			      unsigned int depth) {
+  unsigned char set[32];
+  NFAFragment ret;
+  const char * p;
+  unsigned int len;
+
+  p = a->pattern;
+  ret.start = -1;
+  ret.end = -1;
+  switch (p[a->ppos]) {
+  case '(':
+    a->ppos++;
+    ret = parse_alternative(a, depth + 1);
+    if (a->error != NULL)
+      return ret;
+    if (p[a->ppos] != ')') {
+      a->error = _("missing ')'");
+      return ret;
+    }
+    a->ppos++;
+    return ret;
+  case '[':
+    a->ppos++;
+    return parse_class(a);
+  case '.':
+    a->ppos++;
+    return frag_any(a);
+  case '^':
+    a->error = _("'^' is not supported (matches may start anywhere in a keyword)");
+    return ret;
+  case '*':
+  case '+':
+  case '?':
+  case '{':
+    a->error = _("nothing to repeat");
+    return ret;
+  case '\\':
+    a->ppos++;
+    memset(set, 0, sizeof(set));
+    switch (p[a->ppos]) {
+    case '\0':
+      a->error = _("trailing backslash");
+      return ret;
+    case 'd':
+      set_add_ctype(set, &isdigit);
+      break;
+    case 'w':
+      set_add_ctype(set, &isword);
+      break;
+    case 's':
+      set_add_ctype(set, &isspace);
+      break;
+    default:
+      len = utf8_length(&p[a->ppos]);
+      a->ppos += len;
+      return frag_char(a, &p[a->ppos - len], len);
+    }
+    a->ppos++;
+    return frag_set(a, set);
+  default:
+    len = utf8_length(&p[a->ppos]);
+    a->ppos += len;
+    return frag_char(a, &p[a->ppos - len], len);
+  }
+}
+
+/**
+ * Parse a number in a "{m,n}" repetition.
+ * @return -1 if there is no number
+ */
+static int parse_number(Automaton * a) {
+  int ret;
+
+  if (! isdigit((unsigned char) a->pattern[a->ppos]))
+    return -1;
+  ret = 0;
+  while (isdigit((unsigned char) a->pattern[a->ppos])) {
+    ret = ret * 10 + (a->pattern[a->ppos] - '0');
+    if (ret > 255)
+      ret = 256; /* too large, caught by the caller */
+    a->ppos++;
+  }
+  return ret;
+}
+
+/**
+ * Apply a "{min,max}" repetition (max -1 for no limit) to the
+ * fragment f consisting of the states lo to hi-1.
+ */
+static NFAFragment repeat_fragment(Automaton * a,
+				   NFAFragment f,
+				   int lo,
+				   int hi,
+				   int min,
+				   int max) {
+  NFAFragment * copies;
+  NFAFragment ret;
+  int count;
+  int i;
+
+  ret.start = -1;
+  ret.end = -1;
+  if (max == 0)
+    return frag_empty(a);
+  count = (max == -1) ? min + 1 : max;
+  if ((count - 1) * (hi - lo) + a->nfaCount > PATTERN_MAX_NFA) {
+    a->error = _("pattern too complex");
+    return ret;
+  }
+  copies = MALLOC(sizeof(NFAFragment) * count);
+  copies[0] = f;
+  for (i=1;i<count;i++)
+    copies[i] = frag_copy(a, f, lo, hi);
+  for (i=0;i<min;i++)
+    ret = (i == 0) ? copies[0] : frag_concat(a, ret, copies[i]);
+  if (max == -1) {
+    f = frag_star(a, copies[min]);
+    ret = (min == 0) ? f : frag_concat(a, ret, f);
+  } else {
+    for (i=min;i<max;i++) {
+      f = frag_opt(a, copies[i]);
+      ret = (i == 0) ? f : frag_concat(a, ret, f);
+    }
+  }
+  free(copies);
+  return ret;
+}
+
+/**
+ * Parse an atom and the repetition operators following it.
+ */
+static NFAFragment parse_repetition(Automaton * a,
+				    unsigned int depth) {
+  NFAFragment ret;
+  const char * p;
+  int lo;
+  int min;
+  int max;
+
+  p = a->pattern;
+  lo = a->nfaCount;
+  ret = parse_atom(a, depth);
+  while (a->error == NULL) {
+    switch (p[a->ppos]) {
+    case '*':
+      ret = frag_star(a, ret);
+      break;
+    case '+':
+      ret = frag_plus(a, ret);
+      break;
+    case '?':
+      ret = frag_opt(a, ret);
+      break;
+    case '{':
+      a->ppos++;
+      min = parse_number(a);
+      max = min;
+      if (p[a->ppos] == ',') {
+	a->ppos++;
+	max = parse_number(a);
+      }
+      if ( (min == -1) ||
+	   (p[a->ppos] != '}') ||
+	   (min > 255) ||
+	   (max > 255) ||
+	   ( (max != -1) && (max < min) ) ) {
+	a->error = _("invalid repetition");
+	return ret;
+      }
+      ret = repeat_fragment(a, ret, lo, a->nfaCount, min, max);
+      break;
+    default:
+      return ret;
+    }
+    a->ppos++;
+  }
+  return ret;
+}
+
+/**
+ * Parse a sequence of atoms (with repetitions).
+ */
+static NFAFragment parse_sequence(Automaton * a,
+				  unsigned int depth) {
+  NFAFragment ret;
+  NFAFragment f;
+  const char * p;
+
+  p = a->pattern;
+  ret = frag_empty(a);
+  while ( (p[a->ppos] != '\0') &&
+	  (p[a->ppos] != '|') &&
+	  (p[a->ppos] != ')') ) {
+    if (p[a->ppos] == '$') {
+      if ( (depth > 0) ||
+	   (p[a->ppos+1] != '\0') ) {
+	a->error = _("'$' is only supported at the end of the pattern");
+	return ret;
+      }
+      a->anchored = 1;
+      a->ppos++;
+      break;
+    }
+    f = parse_repetition(a, depth);
+    if (a->error != NULL)
+      return ret;
+    ret = frag_concat(a, ret, f);
+  }
+  return ret;
+}
+
+/**
+ * Parse alternatives ("a|b").
+ */
+static NFAFragment parse_alternative(Automaton * a,
+				     unsigned int depth) {
+  NFAFragment ret;
+  NFAFragment f;
+
+  ret = parse_sequence(a, depth);
+  while ( (a->error == NULL) &&
+	  (a->pattern[a->ppos] == '|') ) {
+    a->ppos++;
+    f = parse_sequence(a, depth);
+    if (a->error != NULL)
+      return ret;
+    ret = frag_alt(a, ret, f);
+  }
+  return ret;
+}
+
+/**
+ * Parse a glob pattern ("*", "?" and classes).  Globs
+ * always extend to the end of the keyword.
+ */
+static NFAFragment parse_glob(Automaton * a) {
+  unsigned char set[32];
+  NFAFragment ret;
+  NFAFragment f;
+  const char * p;
+  unsigned int len;
+
+  p = a->pattern;
+  a->anchored = 1;
+  ret = frag_empty(a);
+  while (p[a->ppos] != '\0') {
+    switch (p[a->ppos]) {
+    case '*':
+      memset(set, 255, sizeof(set));
+      set[0] &= ~1; /* never '\0' */
+      f = frag_star(a, frag_set(a, set));
+      a->ppos++;
+      break;
+    case '?':
+      f = frag_any(a);
+      a->ppos++;
+      break;
+    case '[':
+      a->ppos++;
+      f = parse_class(a);
+      if (a->error != NULL)
+	return ret;
+      break;
+    case '\\':
+      if (p[a->ppos+1] != '\0')
+	a->ppos++;
+      /* fall through */
+    default:
+      len = utf8_length(&p[a->ppos]);
+      f = frag_char(a, &p[a->ppos], len);
+      a->ppos += len;
+      break;
+    }
+    ret = frag_concat(a, ret, f);
+  }
+  return ret;
+}
+
+/**
+ * Compile the pattern to an NFA.
+ * @return 0 on success, -1 on error (a->error is set)
+ */
+static int pattern_compile(Automaton * a) {
+  NFAFragment f;
+
+  if ((a->flags & DOODLE_PATTERN_GLOB) != 0) {
+    f = parse_glob(a);
+  } else {
+    f = parse_alternative(a, 0);
+    if ( (a->error == NULL) &&
+	 (a->pattern[a->ppos] != '\0') )
+      a->error = _("unmatched ')'");
+  }
+  if ( (a->error == NULL) &&
+       (a->nfaCount > PATTERN_MAX_NFA) )
+    a->error = _("pattern too complex");
+  if (a->error != NULL)
+    return -1;
+  a->start = f.start;
+  a->accept = nfa_new(a);
+  a->nfa[f.end].out1 = a->accept;
+  return 0;
+}
+
+/**
+ * Find (or create) the DFA state for the epsilon-closure
+ * of the given NFA states.
+ *
+ * @param seeds NFA states (will be modified)
+ * @return DFA state, -1 if there are too many DFA states
+ */
+static int dfa_state(Automaton * a,
+		     int * seeds,
+		     unsigned int seedCount) {
+  unsigned int count;
+  unsigned int top;
+  unsigned int hash;
+  unsigned int i;
+  int ret;
+  int s;
+
+  /* epsilon closure; keep only the states that matter
+     for the transitions (and the accepting state) */
+  a->generation++;
+  count = 0;
+  top = 0;
+  for (i=0;i<seedCount;i++)
+    a->stack[top++] = seeds[i];
+  while (top > 0) {
+    s = a->stack[--top];
+    if (a->mark[s] == a->generation)
+      continue;
+    a->mark[s] = a->generation;
+    if ( (a->nfa[s].byte) ||
+	 (s == a->accept) )
+      a->members[count++] = s;
+    if (a->nfa[s].byte)
+      continue;
+    if (a->nfa[s].out1 != -1)
+      a->stack[top++] = a->nfa[s].out1;
+    if (a->nfa[s].out2 != -1)
+      a->stack[top++] = a->nfa[s].out2;
+  }
+  qsort(a->members,
+	count,
+	sizeof(int),
+	&compareFileIndex);
+  hash = count;
+  for (i=0;i<count;i++)
+    hash = hash * 31 + a->members[i];
+  hash %= PATTERN_HASH;
+  for (ret = a->hashHead[hash]; ret != -1; ret = a->hashNext[ret])
+    if ( (a->dfaSetSizes[ret] == count) &&
+	 (0 == memcmp(a->dfaSets[ret],
+		      a->members,
+		      sizeof(int) * count)) )
+      return ret;
+  if (a->dfaCount == PATTERN_MAX_DFA)
+    return -1;
+  ret = a->dfaCount++;
+  a->dfaSetSizes[ret] = count;
+  if (count > 0) {
+    a->dfaSets[ret] = MALLOC(sizeof(int) * count);
+    memcpy(a->dfaSets[ret],
+	   a->members,
+	   sizeof(int) * count);
+  }
+  a->dfaAccept[ret] = (a->mark[a->accept] == a->generation) ? 1 : 0;
+  a->hashNext[ret] = a->hashHead[hash];
+  a->hashHead[hash] = ret;
+  GROW(a->trans,
+       a->transSize,
+       a->dfaCount * 256);
+  for (i=0;i<256;i++)
+    a->trans[ret * 256 + i] = -1;
+  return ret;
+}
+
+/**
+ * Compute the transition of the DFA from the given state
+ * for the given byte.
+ *
+ * @return the new state, -1 if there are too many DFA states
+ */
+static int dfa_step(Automaton * a,
+		    int state,
+		    unsigned char c) {
+  unsigned int count;
+  unsigned int i;
+  int * seeds;
+  int s;
+  int ret;
+
+  ret = a->trans[state * 256 + c];
+  if (ret != -1)
+    return ret;
+  count = 0;
+  seeds = NULL;
+  if (a->dfaSetSizes[state] > 0)
+    seeds = MALLOC(sizeof(int) * a->dfaSetSizes[state]);
+  for (i=0;i<a->dfaSetSizes[state];i++) {
+    s = a->dfaSets[state][i];
+    if ( (a->nfa[s].byte) &&
+	 ((a->nfa[s].set[c / 8] & (1 << (c % 8))) != 0) )
+      seeds[count++] = a->nfa[s].out1;
+  }
+  ret = dfa_state(a, seeds, count);
+  if (seeds != NULL)
+    free(seeds);
+  if (ret != -1)
+    a->trans[state * 256 + c] = ret;
+  return ret;
+}
+
+static void automaton_free(Automaton * a) {
+  unsigned int i;
+
+  for (i=0;i<a->dfaCount;i++)
+    if (a->dfaSets[i] != NULL)
+      free(a->dfaSets[i]);
+  if (a->dfaSets != NULL) {
+    free(a->dfaSets);
+    free(a->dfaSetSizes);
+    free(a->dfaAccept);
+    free(a->hashNext);
+  }
+  if (a->mark != NULL) {
+    free(a->mark);
+    free(a->stack);
+    free(a->members);
+  }
+  GROW(a->trans,
+       a->transSize,
+       0);
+  GROW(a->nfa,
+       a->nfaSize,
+       0);
+}
+
+/**
+ * Run the DFA over the labels of the given node (and the
+ * nodes linked from it) and report the matches.  Subtrees
+ * for which the DFA is in the dead state are skipped.
+ *
+ * @param state state of the DFA before the label of node
+ * @return -1 on error, otherwise the number of results
+ */
+static int pattern_walk(Automaton * a,
+			STNode * node,
+			int state,
+			DOODLE_ResultCallback callback,
+			void * arg) {
+  SuffixTree * tree;
+  int ret;
+  int iret;
+  int s;
+  int i;
+
+  tree = a->tree;
+  ret = 0;
+  while (node != NULL) {
+    s = state;
+    for (i=0;i<node->clength;i++) {
+      s = dfa_step(a, s, (unsigned char) node->c[i]);
+      if (s == -1) {
+	tree->log(tree->context,
+		  DOODLE_LOG_CRITICAL,
+		  _("Pattern '%s' is too complex.\n"),
+		  a->pattern);
 	return -1;
-      ret += iret;
-      /* character mismatch */
-      iret = tree_search_approx_internal(pos->child,
-					 approx-1,
-					 ignore_case,
-					 tree,
-					 ss+1,
-					 callback,
-					 arg);
+      }
+      if ( (a->dfaSetSizes[s] == 0) ||
+	   ( (a->anchored == 0) &&
+	     (a->dfaAccept[s]) ) )
+	break;
+    }
+    if (a->dfaSetSizes[s] == 0) {
+      /* dead state, nothing below can match */
+    } else if ( (a->anchored == 0) &&
+		(a->dfaAccept[s]) ) {
+      /* every keyword in the subtree matches */
+      iret = tree_iterate_internal(0,
+				   tree,
+				   node,
+				   callback,
+				   arg);
       if (iret == -1)
 	return -1;
       ret += iret;
-      /* extra character in ss */
-      iret = tree_search_approx_internal(pos,
-					 approx-1,
-					 ignore_case,
-					 tree,
-					 ss+1,
-					 callback,
-					 arg);
+    } else {
+      if (a->dfaAccept[s]) {
+	for (i=node->matchCount-1;i>=0;i--) {
+	  if (callback != NULL)
+	    callback(&tree->filenames[node->matches[i]],
+		     arg);
+	  ret++;
+	}
+      }
+      if ( (node->child == NULL) &&
+	   (node->next_off != 0) )
+	if (-1 == loadChild(tree,
+			    node))
+	  return -1;
+      iret = pattern_walk(a,
+			  node->child,
+			  s,
+			  callback,
+			  arg);
       if (iret == -1)
 	return -1;
       ret += iret;
     }
-    if ( (pos->link == NULL) &&
-	 (pos->link_off != 0) )
+    if ( (node->link == NULL) &&
+	 (node->link_off != 0) )
       if (-1 == loadLink(tree,
-			 pos))
+			 node))
 	return -1;
-    pos = pos->link;
+    node = node->link;
   }
-  CHECK(tree);
   return ret;
 }
 
-
 /**
- * Search the suffix tree for matching strings.
- * @param pos tree->root at the beginning
- * @param ignore_case for case-insensitive analysis
- * @param approx how many letters may we be off?
- * @param result pass address of pointer to NULL, will be set
- * @param resultSize pass address of integer of value 0, will be set
- * @return -1 on error, 0 for no results, >0 for number of results
+ * Search the suffix tree for keywords matching a glob or a
+ * (POSIX extended) regular expression.  The pattern is compiled
+ * to an automaton that is run over the tree; subtrees where the
+ * automaton can no longer accept are not visited.
+ *
+ * @param flags DOODLE_PATTERN_* flags
+ * @return -1 on error (i.e. invalid pattern), otherwise the
+ *   number of results
  */
-int DOODLE_tree_search_approx(SuffixTree * tree,
-			      const unsigned int approx,
-			      const int ignore_case,
-			      const char * ss,
-			      DOODLE_ResultCallback callback,
-			      void * arg) {
-  return tree_search_approx_internal(tree->root,
-				     approx,
-				     ignore_case,
-				     tree,
-				     ss,
-				     callback,
-				     arg);
+int DOODLE_tree_search_pattern(SuffixTree * tree,
+			       const char * pattern,
+			       int flags,
+			       DOODLE_ResultCallback callback,
+			       void * arg) {
+  Automaton a;
+  int start;
+  int ret;
+
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "search_pattern");
+    return -1;
+  }
+  memset(&a, 0, sizeof(Automaton));
+  a.tree = tree;
+  a.pattern = pattern;
+  a.flags = flags;
+  if (-1 == pattern_compile(&a)) {
+    tree->log(tree->context,
+	      DOODLE_LOG_CRITICAL,
+	      _("Invalid pattern '%s' at position %u: %s.\n"),
+	      pattern,
+	      a.ppos,
+	      a.error);
+    automaton_free(&a);
+    return -1;
+  }
+  a.dfaSets = MALLOC(sizeof(int*) * PATTERN_MAX_DFA);
+  a.dfaSetSizes = MALLOC(sizeof(unsigned int) * PATTERN_MAX_DFA);
+  a.dfaAccept = MALLOC(PATTERN_MAX_DFA);
+  a.hashNext = MALLOC(sizeof(int) * PATTERN_MAX_DFA);
+  memset(a.hashHead, -1, sizeof(a.hashHead));
+  a.mark = MALLOC(sizeof(unsigned int) * a.nfaCount);
+  a.stack = MALLOC(sizeof(int) * 2 * a.nfaCount);
+  a.members = MALLOC(sizeof(int) * a.nfaCount);
+  start = dfa_state(&a, &a.start, 1);
+  if ( (a.anchored == 0) &&
+       (a.dfaAccept[start]) ) {
+    /* the pattern matches the empty string */
+    ret = tree_iterate_internal(1,
+				tree,
+				tree->root,
+				callback,
+				arg);
+  } else {
+    ret = pattern_walk(&a,
+		       tree->root,
+		       start,
+		       callback,
+		       arg);
+  }
+  automaton_free(&a);
+  return ret;
 }
 
 
@@ -3365,6 +11194,11 @@ int DOODLE_tree_dump(FILE * stream,
   if ( (tree == NULL) ||
        (stream == NULL) )
     return 1;
+  if (tree->frozen != NULL) {
+    frozenRefuse(tree,
+		 "dump");
+    return 1;
+  }
   return print_internal(tree,
 			tree->root,
 			stream,
@@ -3551,25 +11385,19 @@ JNIEXPORT jlong JNICALL Java_org_gnunet_doodle_Doodle_lastModified
   JNICTX * ret = (JNICTX*) (long) handle;
   int i;
   const char * fn;
-  const DOODLE_FileInfo * f;
   jboolean isCopy;
 
   fn = (*env)->GetStringUTFChars(env,
 				 filename,
 				 &isCopy);	
-  for (i=DOODLE_getFileCount(ret->dst)-1;i>=0;i--) {
-    f = DOODLE_getFileAt(ret->dst, i);
-    if (0 == strcmp(fn, f->filename)) {
-      (*env)->ReleaseStringUTFChars(env,
-				    filename,
-				    fn);
-      return f->mod_time;
-    }
-  }
+  i = DOODLE_tree_lookup_file(ret->dst,
+			      fn);
   (*env)->ReleaseStringUTFChars(env,
 				filename,
 				fn);
-  return -1;
+  if (i == -1)
+    return -1;
+  return DOODLE_getFileAt(ret->dst, i)->mod_time;
 }
 
 typedef struct {